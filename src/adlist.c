@@ -1,12 +1,13 @@
 #include <stdlib.h>
 #include "adlist.h"
+#include "zmalloc.h"
 
 /*
  *  新建一个空的链表列表
  */
 list *listCreate(void){
     list *list;
-    list = malloc(sizeof(*list));
+    list = zmalloc(sizeof(*list));
     if(list == NULL){
         return NULL;
     }
@@ -17,6 +18,7 @@ list *listCreate(void){
     list->dup = NULL;
     list->free = NULL;
     list->match = NULL;
+    slabPoolInit(&list->nodepool, sizeof(listNode));
     return list;
 }
 
@@ -24,26 +26,29 @@ list *listCreate(void){
  *  释放指定的链表列表
  */
 void listRelease(list *list){
+    listEmpty(list);
+    //最后还要释放链表列表
+    zfree(list);
+}
+
+/*
+ *  清空链表中的所有节点，但保留链表本身
+ *  只有绑定了free函数时才需要遍历节点，节点本身随slab一次释放
+ */
+void listEmpty(list *list){
     listNode *current = list->head;
     listNode *next;
     size_t len = list->len;
 
-    while(len--){
+    while(list->free && len--){
         //先把下一个拿出来备用
         next = current->next;
-        //如果list绑定了free函数，则要逐一对节点进行free处理
-        if(list->free){
-            list->free(current->value);
-        }
-
-        //释放节点
-        free(current);
-        //把下一个给当前
+        list->free(current->value);
         current = next;
     }
-
-    //最后还要释放链表列表
-    free(list);
+    slabPoolRelease(&list->nodepool);
+    list->head = list->tail = NULL;
+    list->len = 0;
 }
 
 /*
@@ -53,10 +58,7 @@ list *listAddNodeHead(list *list, void *value){
     
     //新建listNode节点并分配内存
     listNode *node;
-    node = malloc(sizeof(*node));
-    if(node == NULL){
-        return NULL;
-    }
+    node = slabAlloc(&list->nodepool);
     //赋值value
     node->value = value;
 
@@ -84,10 +86,7 @@ list *listAddNodeTail(list *list, void *value){
     
     //新建listNode节点并分配内存
     listNode *node;
-    node = malloc(sizeof(*node));
-    if(node == NULL){
-        return NULL;
-    }
+    node = slabAlloc(&list->nodepool);
     //赋值value
     node->value = value;
 
@@ -117,10 +116,7 @@ list *listInsertNode(list *list, listNode *oldNode, void *value, int after){
 
     //新建listNode节点并分配内存
     listNode *node;
-    node = malloc(sizeof(*node));
-    if(node == NULL){
-        return NULL;
-    }
+    node = slabAlloc(&list->nodepool);
     //赋值value
     node->value = value;
 
@@ -175,10 +171,10 @@ void listDeleteNode(list *list, listNode *node){
     }
 
     if(list->free){
-        list->free(node);
+        list->free(node->value);
     }
 
-    free(node);
+    slabFree(&list->nodepool, node);
 
     list->len = list->len - 1;
 }
@@ -189,7 +185,7 @@ void listDeleteNode(list *list, listNode *node){
 listIterator *listGetIterator(list *list, int direction){
     //新建listNode节点并分配内存
     listIterator *iter;
-    iter = malloc(sizeof(*iter));
+    iter = zmalloc(sizeof(*iter));
     if(iter == NULL){
         return NULL;
     }
@@ -209,7 +205,7 @@ listIterator *listGetIterator(list *list, int direction){
  *  释放迭代器，啥也不干就一步free
  */
 void listReleaseIterator(listIterator *iter){
-    free(iter);
+    zfree(iter);
 }
 
 /*
@@ -330,7 +326,7 @@ listNode *listIndex(list *list, long index){
         }else{
             //假定head就是默认元素，然后index递减并向前移动node指向，如果index为0了说明就是当前节点
             node = list->head;
-            while(index--){
+            while(index-- && node){
                 node = node->next;
             }
         }
@@ -342,7 +338,7 @@ listNode *listIndex(list *list, long index){
         }else{
             //和上面是一样的逻辑，只是倒着遍历
             node = list->tail;
-            while(index--){
+            while(index-- && node){
                 node = node->prev;
             }
         }
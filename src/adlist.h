@@ -1,6 +1,8 @@
 #ifndef __ADLIST_H__
 #define __ADLIST_H__
 
+#include "slab.h"
+
 //双端链表节点
 typedef struct listNode{
     //前置
@@ -33,11 +35,21 @@ typedef struct list{
     void (*free)(void *ptr);
     //节点对比函数
     int (*match)(void *ptr, void *key);
+
+    //节点的slab池，链表释放时一次归还
+    slabPool nodepool;
 } list;
 
 /**
  * 定义函数宏
  */ 
+#define listLength(l) ((l)->len)
+#define listFirst(l) ((l)->head)
+#define listLast(l) ((l)->tail)
+#define listPrevNode(n) ((n)->prev)
+#define listNextNode(n) ((n)->next)
+#define listNodeValue(n) ((n)->value)
+
 #define listSetDupMethod(l,m) ((l)->dup = (m))
 #define listSetFreeMethod(l,m) ((l)->free = (m))
 #define listSetMatchMethod(l,m) ((l)->match = (m))
@@ -47,6 +59,7 @@ typedef struct list{
 
 list *listCreate(void);
 void listRelease(list *list);
+void listEmpty(list *list);
 list *listAddNodeHead(list *list, void *value);
 list *listAddNodeTail(list *list, void *value);
 list *listInsertNode(list *list, listNode *oldNode, void *value, int after);
@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include "ae.h"
+#include "zmalloc.h"
+#include "config.h"
+
+/**
+ * 根据平台选择多路复用库，默认使用epoll，
+ * 支持io_uring的平台可以在创建事件处理器之后通过aeUseIoUring切换
+ */
+#ifdef HAVE_EPOLL
+#include "ae_epoll.c"
+#else
+#error "ae: no multiplexing backend available on this platform"
+#endif
+#ifdef HAVE_IO_URING
+#include "ae_iouring.c"
+#endif
+
+/**
+ * 根据eventLoop->api分派到具体的多路复用库
+ */
+static int aeBackendAddEvent(aeEventLoop *eventLoop, int fd, int mask){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        return aeUringAddEvent(eventLoop, fd, mask);
+    }
+#endif
+    return aeApiAddEvent(eventLoop, fd, mask);
+}
+
+static void aeBackendDelEvent(aeEventLoop *eventLoop, int fd, int mask){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        aeUringDelEvent(eventLoop, fd, mask);
+        return;
+    }
+#endif
+    aeApiDelEvent(eventLoop, fd, mask);
+}
+
+static int aeBackendPoll(aeEventLoop *eventLoop, struct timeval *tvp){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        return aeUringPoll(eventLoop, tvp);
+    }
+#endif
+    return aeApiPoll(eventLoop, tvp);
+}
+
+static void aeBackendFree(aeEventLoop *eventLoop){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        aeUringFree(eventLoop);
+        return;
+    }
+#endif
+    aeApiFree(eventLoop);
+}
+
+/**
+ * 创建并初始化事件处理器
+ * setsize为最多可以追踪的描述符数量
+ */
+aeEventLoop *aeCreateEventLoop(int setsize){
+    aeEventLoop *eventLoop = zmalloc(sizeof(*eventLoop));
+    if(eventLoop == NULL){
+        goto err;
+    }
+    eventLoop->events = zmalloc(sizeof(aeFileEvent) * setsize);
+    eventLoop->fired = zmalloc(sizeof(aeFiredEvent) * setsize);
+    if(eventLoop->events == NULL || eventLoop->fired == NULL){
+        goto err;
+    }
+    eventLoop->setsize = setsize;
+    eventLoop->lastTime = time(NULL);
+    eventLoop->timeEventHead = NULL;
+    eventLoop->timeEventNextId = 0;
+    eventLoop->stop = 0;
+    eventLoop->maxfd = -1;
+    eventLoop->beforesleep = NULL;
+    eventLoop->api = AE_API_EPOLL;
+    if(aeApiCreate(eventLoop) == -1){
+        goto err;
+    }
+    //所有的文件事件都初始化为未设置
+    for(int i = 0; i < setsize; i++){
+        eventLoop->events[i].mask = AE_NONE;
+    }
+    return eventLoop;
+
+    err : {
+        if(eventLoop){
+            zfree(eventLoop->events);
+            zfree(eventLoop->fired);
+            zfree(eventLoop);
+        }
+        return NULL;
+    }
+}
+
+/**
+ * 删除事件处理器
+ */
+void aeDeleteEventLoop(aeEventLoop *eventLoop){
+    aeBackendFree(eventLoop);
+    zfree(eventLoop->events);
+    zfree(eventLoop->fired);
+    zfree(eventLoop);
+}
+
+/**
+ * 停止事件处理器，aeMain会在本轮处理完成后退出
+ */
+void aeStop(aeEventLoop *eventLoop){
+    eventLoop->stop = 1;
+}
+
+/**
+ * 根据mask的值，监听fd的状态，当fd可用时，执行proc函数
+ */
+int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc, void *clientData){
+    if(fd >= eventLoop->setsize){
+        errno = ERANGE;
+        return AE_ERR;
+    }
+    aeFileEvent *fe = &eventLoop->events[fd];
+    //注册到多路复用库
+    if(aeBackendAddEvent(eventLoop, fd, mask) == -1){
+        return AE_ERR;
+    }
+    //设置文件事件类型，以及事件的处理器
+    fe->mask |= mask;
+    if(mask & AE_READABLE){
+        fe->rfileProc = proc;
+    }
+    if(mask & AE_WRITABLE){
+        fe->wfileProc = proc;
+    }
+    fe->clientData = clientData;
+    //如果有需要，更新事件处理器的最大fd
+    if(fd > eventLoop->maxfd){
+        eventLoop->maxfd = fd;
+    }
+    return AE_OK;
+}
+
+/**
+ * 将fd从mask指定的监听队列中删除
+ */
+void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask){
+    if(fd >= eventLoop->setsize){
+        return;
+    }
+    aeFileEvent *fe = &eventLoop->events[fd];
+    //未设置监听的事件类型，直接返回
+    if(fe->mask == AE_NONE){
+        return;
+    }
+    aeBackendDelEvent(eventLoop, fd, mask);
+    fe->mask = fe->mask & (~mask);
+    //只剩下AE_EDGE标志也说明没有监听了，一并清除
+    if(!(fe->mask & (AE_READABLE|AE_WRITABLE))){
+        fe->mask = AE_NONE;
+    }
+    if(fd == eventLoop->maxfd && fe->mask == AE_NONE){
+        //更新最大fd
+        int j;
+        for(j = eventLoop->maxfd-1; j >= 0; j--){
+            if(eventLoop->events[j].mask != AE_NONE){
+                break;
+            }
+        }
+        eventLoop->maxfd = j;
+    }
+}
+
+/**
+ * 返回fd正在监听的事件类型
+ */
+int aeGetFileEvents(aeEventLoop *eventLoop, int fd){
+    if(fd >= eventLoop->setsize){
+        return 0;
+    }
+    aeFileEvent *fe = &eventLoop->events[fd];
+    return fe->mask;
+}
+
+/**
+ * 取出当前时间的秒和毫秒，并分别将它们保存到seconds和milliseconds参数中
+ */
+static void aeGetTime(long *seconds, long *milliseconds){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    *seconds = tv.tv_sec;
+    *milliseconds = tv.tv_usec/1000;
+}
+
+/**
+ * 在当前时间上加上milliseconds毫秒，并且将加上之后的秒数和毫秒数分别保存在sec和ms指针中
+ */
+static void aeAddMillisecondsToNow(long long milliseconds, long *sec, long *ms){
+    long cur_sec, cur_ms, when_sec, when_ms;
+    aeGetTime(&cur_sec, &cur_ms);
+    when_sec = cur_sec + milliseconds/1000;
+    when_ms = cur_ms + milliseconds%1000;
+    //进位
+    if(when_ms >= 1000){
+        when_sec++;
+        when_ms -= 1000;
+    }
+    *sec = when_sec;
+    *ms = when_ms;
+}
+
+/**
+ * 创建时间事件，milliseconds毫秒之后执行proc
+ * 返回时间事件的id
+ */
+long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
+        aeTimeProc *proc, void *clientData, aeEventFinalizerProc *finalizerProc){
+    long long id = eventLoop->timeEventNextId++;
+    aeTimeEvent *te = zmalloc(sizeof(*te));
+    if(te == NULL){
+        return AE_ERR;
+    }
+    te->id = id;
+    aeAddMillisecondsToNow(milliseconds, &te->when_sec, &te->when_ms);
+    te->timeProc = proc;
+    te->finalizerProc = finalizerProc;
+    te->clientData = clientData;
+    //放到链表头部
+    te->next = eventLoop->timeEventHead;
+    eventLoop->timeEventHead = te;
+    return id;
+}
+
+/**
+ * 删除给定id的时间事件
+ */
+int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id){
+    aeTimeEvent *te = eventLoop->timeEventHead;
+    aeTimeEvent *prev = NULL;
+    while(te){
+        if(te->id == id){
+            if(prev == NULL){
+                eventLoop->timeEventHead = te->next;
+            }else{
+                prev->next = te->next;
+            }
+            //执行清理处理器
+            if(te->finalizerProc){
+                te->finalizerProc(eventLoop, te->clientData);
+            }
+            zfree(te);
+            return AE_OK;
+        }
+        prev = te;
+        te = te->next;
+    }
+    return AE_ERR;
+}
+
+/**
+ * 寻找里目前时间最近的时间事件
+ * 因为链表是乱序的，所以查找复杂度为O(N)，服务器里只有serverCron这一个时间事件，所以不是问题
+ */
+static aeTimeEvent *aeSearchNearestTimer(aeEventLoop *eventLoop){
+    aeTimeEvent *te = eventLoop->timeEventHead;
+    aeTimeEvent *nearest = NULL;
+    while(te){
+        if(!nearest || te->when_sec < nearest->when_sec ||
+                (te->when_sec == nearest->when_sec && te->when_ms < nearest->when_ms)){
+            nearest = te;
+        }
+        te = te->next;
+    }
+    return nearest;
+}
+
+/**
+ * 处理所有已到达的时间事件
+ */
+static int processTimeEvents(aeEventLoop *eventLoop){
+    int processed = 0;
+    time_t now = time(NULL);
+
+    /**
+     * 如果系统时间被调到了过去，那就尽快执行所有的时间事件
+     * 提前执行比延后执行要安全
+     */
+    if(now < eventLoop->lastTime){
+        aeTimeEvent *te = eventLoop->timeEventHead;
+        while(te){
+            te->when_sec = 0;
+            te = te->next;
+        }
+    }
+    eventLoop->lastTime = now;
+
+    aeTimeEvent *te = eventLoop->timeEventHead;
+    //本轮执行中新建的时间事件，留到下一轮再执行
+    long long maxId = eventLoop->timeEventNextId-1;
+    while(te){
+        long now_sec, now_ms;
+        if(te->id > maxId){
+            te = te->next;
+            continue;
+        }
+        aeGetTime(&now_sec, &now_ms);
+        //事件已到达，执行
+        if(now_sec > te->when_sec || (now_sec == te->when_sec && now_ms >= te->when_ms)){
+            long long id = te->id;
+            int retval = te->timeProc(eventLoop, id, te->clientData);
+            processed++;
+            if(retval != AE_NOMORE){
+                //返回值是下一次执行的间隔毫秒数
+                aeAddMillisecondsToNow(retval, &te->when_sec, &te->when_ms);
+            }else{
+                aeDeleteTimeEvent(eventLoop, id);
+            }
+            //执行时事件链表可能被修改过，只能从头开始再次遍历
+            te = eventLoop->timeEventHead;
+        }else{
+            te = te->next;
+        }
+    }
+    return processed;
+}
+
+/**
+ * 处理所有已到达的时间事件，以及所有已就绪的文件事件
+ * 如果flags为0，则函数不作动作，直接返回
+ * 如果flags包含AE_DONT_WAIT，则不阻塞，处理完不需要等待的事件就返回
+ * 返回值为已处理事件的数量
+ */
+int aeProcessEvents(aeEventLoop *eventLoop, int flags){
+    int processed = 0;
+
+    //既没有时间事件也没有文件事件，直接返回
+    if(!(flags & AE_TIME_EVENTS) && !(flags & AE_FILE_EVENTS)){
+        return 0;
+    }
+
+    /**
+     * 即使没有文件事件，也要调用一次多路复用库，用来阻塞到下一个时间事件到达
+     */
+    if(eventLoop->maxfd != -1 || ((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT))){
+        aeTimeEvent *shortest = NULL;
+        struct timeval tv, *tvp;
+
+        if((flags & AE_TIME_EVENTS) && !(flags & AE_DONT_WAIT)){
+            shortest = aeSearchNearestTimer(eventLoop);
+        }
+        if(shortest){
+            //计算距离最近的时间事件还有多久，作为阻塞的超时时间
+            long now_sec, now_ms;
+            aeGetTime(&now_sec, &now_ms);
+            tvp = &tv;
+            long long ms = (shortest->when_sec - now_sec)*1000 + shortest->when_ms - now_ms;
+            if(ms > 0){
+                tvp->tv_sec = ms/1000;
+                tvp->tv_usec = (ms % 1000)*1000;
+            }else{
+                tvp->tv_sec = 0;
+                tvp->tv_usec = 0;
+            }
+        }else{
+            if(flags & AE_DONT_WAIT){
+                //不阻塞
+                tv.tv_sec = tv.tv_usec = 0;
+                tvp = &tv;
+            }else{
+                //一直阻塞直到有文件事件
+                tvp = NULL;
+            }
+        }
+
+        int numevents = aeBackendPoll(eventLoop, tvp);
+        for(int j = 0; j < numevents; j++){
+            aeFileEvent *fe = &eventLoop->events[eventLoop->fired[j].fd];
+            int mask = eventLoop->fired[j].mask;
+            int fd = eventLoop->fired[j].fd;
+            int rfired = 0;
+
+            /**
+             * 读事件先处理，而且读处理函数可能删除了事件，所以要判断fe->mask
+             */
+            if(fe->mask & mask & AE_READABLE){
+                rfired = 1;
+                fe->rfileProc(eventLoop, fd, fe->clientData, mask);
+            }
+            //读写处理函数是同一个时，不要重复调用
+            if(fe->mask & mask & AE_WRITABLE){
+                if(!rfired || fe->wfileProc != fe->rfileProc){
+                    fe->wfileProc(eventLoop, fd, fe->clientData, mask);
+                }
+            }
+            processed++;
+        }
+    }
+
+    //执行时间事件
+    if(flags & AE_TIME_EVENTS){
+        processed += processTimeEvents(eventLoop);
+    }
+    return processed;
+}
+
+/**
+ * 事件处理器的主循环
+ */
+void aeMain(aeEventLoop *eventLoop){
+    eventLoop->stop = 0;
+    while(!eventLoop->stop){
+        if(eventLoop->beforesleep != NULL){
+            eventLoop->beforesleep(eventLoop);
+        }
+        aeProcessEvents(eventLoop, AE_ALL_EVENTS);
+    }
+}
+
+/**
+ * 返回所使用的多路复用库的名称
+ */
+char *aeGetApiName(aeEventLoop *eventLoop){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        return aeUringName();
+    }
+#endif
+    AE_NOTUSED(eventLoop);
+    return aeApiName();
+}
+
+/**
+ * 把事件处理器切换到io_uring，只能在还没有注册任何文件事件时调用
+ * 编译时没有io_uring或者内核不支持时返回AE_ERR，事件处理器继续使用epoll
+ */
+int aeUseIoUring(aeEventLoop *eventLoop){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING){
+        return AE_OK;
+    }
+    if(eventLoop->maxfd != -1){
+        return AE_ERR;
+    }
+    void *epolldata = eventLoop->apidata;
+    if(aeUringCreate(eventLoop) == -1){
+        eventLoop->apidata = epolldata;
+        return AE_ERR;
+    }
+    void *uringdata = eventLoop->apidata;
+    eventLoop->apidata = epolldata;
+    aeApiFree(eventLoop);
+    eventLoop->apidata = uringdata;
+    eventLoop->api = AE_API_IO_URING;
+    return AE_OK;
+#else
+    AE_NOTUSED(eventLoop);
+    return AE_ERR;
+#endif
+}
+
+/**
+ * 从fd读取数据，用法和read一样
+ * 以AE_COMPLETION注册的套接字在io_uring下已经由内核收好，这里只是从接收缓冲区中复制出来
+ */
+ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING && aeUringIsCompletion(eventLoop, fd)){
+        return aeUringRead(eventLoop, fd, buf, len);
+    }
+#endif
+    AE_NOTUSED(eventLoop);
+    return read(fd, buf, len);
+}
+
+/**
+ * 向fd写入数据，用法和writev一样
+ * 以AE_COMPLETION注册的套接字在io_uring下只是复制进发送缓冲区，在下一次io_uring_enter时和其他请求一起提交，
+ * 上一次的send还没有完成时返回-1并设置errno为EAGAIN，完成后会通知写事件
+ */
+ssize_t aeWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt){
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING && aeUringIsCompletion(eventLoop, fd)){
+        return aeUringWritev(eventLoop, fd, iov, iovcnt);
+    }
+#endif
+    AE_NOTUSED(eventLoop);
+    return writev(fd, iov, iovcnt);
+}
+
+/**
+ * 在监听套接字上接受一个连接，没有新连接时返回-1并设置errno为EAGAIN
+ * 以AE_COMPLETION注册的监听套接字在io_uring下由multishot accept接受好，这里只是取出一个
+ */
+int aeAccept(aeEventLoop *eventLoop, int fd){
+    int cfd;
+#ifdef HAVE_IO_URING
+    if(eventLoop->api == AE_API_IO_URING && aeUringIsCompletion(eventLoop, fd)){
+        return aeUringAccept(eventLoop, fd);
+    }
+#endif
+    AE_NOTUSED(eventLoop);
+    do{
+        cfd = accept(fd, NULL, NULL);
+    }while(cfd == -1 && errno == EINTR);
+    return cfd;
+}
+
+/**
+ * 设置处理事件前要执行的函数
+ */
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep){
+    eventLoop->beforesleep = beforesleep;
+}
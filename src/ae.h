@@ -0,0 +1,142 @@
+#ifndef __AE_H__
+#define __AE_H__
+
+#include <time.h>
+#include <sys/types.h>
+
+/**
+ * 事件处理操作结果代码
+ */
+#define AE_OK 0
+#define AE_ERR -1
+
+/**
+ * 文件事件状态
+ */
+#define AE_NONE 0       //未设置
+#define AE_READABLE 1   //可读
+#define AE_WRITABLE 2   //可写
+#define AE_EDGE 4       //边缘触发，只在状态变化时通知一次，调用方必须一直读到EAGAIN
+#define AE_COMPLETION 8 //套接字的读写和accept交给多路复用库完成（io_uring），处理函数通过aeRead、aeWritev、aeAccept取得结果
+
+/**
+ * 事件处理器的执行flags
+ */
+#define AE_FILE_EVENTS 1    //文件事件
+#define AE_TIME_EVENTS 2    //时间事件
+#define AE_ALL_EVENTS (AE_FILE_EVENTS|AE_TIME_EVENTS)   //所有事件
+#define AE_DONT_WAIT 4  //不阻塞，也不进行等待
+
+/**
+ * 多路复用库
+ */
+#define AE_API_EPOLL 0
+#define AE_API_IO_URING 1
+
+//时间事件的处理函数返回这个值，说明不再需要执行，会被删除
+#define AE_NOMORE -1
+
+//什么也不做，只是为了消除未使用参数的警告
+#define AE_NOTUSED(V) ((void) V)
+
+struct aeEventLoop;
+struct iovec;
+
+/**
+ * 事件处理函数的原型
+ */
+typedef void aeFileProc(struct aeEventLoop *eventLoop, int fd, void *clientData, int mask);
+typedef int aeTimeProc(struct aeEventLoop *eventLoop, long long id, void *clientData);
+typedef void aeEventFinalizerProc(struct aeEventLoop *eventLoop, void *clientData);
+typedef void aeBeforeSleepProc(struct aeEventLoop *eventLoop);
+
+/**
+ * 文件事件结构
+ */
+typedef struct aeFileEvent{
+    //监听事件类型掩码，值可以是AE_READABLE或AE_WRITABLE，或者两者的或
+    int mask;
+    //读事件处理器
+    aeFileProc *rfileProc;
+    //写事件处理器
+    aeFileProc *wfileProc;
+    //多路复用库的私有数据
+    void *clientData;
+} aeFileEvent;
+
+/**
+ * 时间事件结构
+ */
+typedef struct aeTimeEvent{
+    //时间事件的唯一标识符
+    long long id;
+    //事件的到达时间（秒和毫秒两部分）
+    long when_sec;
+    long when_ms;
+    //事件处理函数
+    aeTimeProc *timeProc;
+    //事件释放函数
+    aeEventFinalizerProc *finalizerProc;
+    //多路复用库的私有数据
+    void *clientData;
+    //指向下一个时间事件结构，形成链表
+    struct aeTimeEvent *next;
+} aeTimeEvent;
+
+/**
+ * 已就绪事件
+ */
+typedef struct aeFiredEvent{
+    //已就绪的文件描述符
+    int fd;
+    //事件类型掩码
+    int mask;
+} aeFiredEvent;
+
+/**
+ * 事件处理器的状态
+ */
+typedef struct aeEventLoop{
+    //目前已注册的最大描述符
+    int maxfd;
+    //目前已追踪的最大描述符数量
+    int setsize;
+    //用于生成时间事件id
+    long long timeEventNextId;
+    //最后一次执行时间事件的时间
+    time_t lastTime;
+    //已注册的文件事件，按fd直接索引
+    aeFileEvent *events;
+    //已就绪的文件事件
+    aeFiredEvent *fired;
+    //时间事件链表
+    aeTimeEvent *timeEventHead;
+    //事件处理器的开关
+    int stop;
+    //使用的多路复用库，AE_API_EPOLL或AE_API_IO_URING
+    int api;
+    //多路复用库的私有数据
+    void *apidata;
+    //每次进入多路复用库等待之前要执行的函数
+    aeBeforeSleepProc *beforesleep;
+} aeEventLoop;
+
+aeEventLoop *aeCreateEventLoop(int setsize);
+void aeDeleteEventLoop(aeEventLoop *eventLoop);
+void aeStop(aeEventLoop *eventLoop);
+int aeCreateFileEvent(aeEventLoop *eventLoop, int fd, int mask, aeFileProc *proc, void *clientData);
+void aeDeleteFileEvent(aeEventLoop *eventLoop, int fd, int mask);
+int aeGetFileEvents(aeEventLoop *eventLoop, int fd);
+long long aeCreateTimeEvent(aeEventLoop *eventLoop, long long milliseconds,
+        aeTimeProc *proc, void *clientData, aeEventFinalizerProc *finalizerProc);
+int aeDeleteTimeEvent(aeEventLoop *eventLoop, long long id);
+int aeProcessEvents(aeEventLoop *eventLoop, int flags);
+void aeMain(aeEventLoop *eventLoop);
+char *aeGetApiName(aeEventLoop *eventLoop);
+int aeUseIoUring(aeEventLoop *eventLoop);
+ssize_t aeRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len);
+ssize_t aeWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt);
+int aeAccept(aeEventLoop *eventLoop, int fd);
+void aeSetBeforeSleepProc(aeEventLoop *eventLoop, aeBeforeSleepProc *beforesleep);
+
+#endif // !__AE_H__
@@ -0,0 +1,135 @@
+#include <sys/epoll.h>
+
+/**
+ * epoll多路复用库的实现，由ae.c直接include进来，所有函数都是static的
+ */
+
+/**
+ * epoll的私有数据
+ */
+typedef struct aeApiState{
+    //epoll实例的描述符
+    int epfd;
+    //事件槽，接收epoll_wait的结果
+    struct epoll_event *events;
+} aeApiState;
+
+/**
+ * 创建一个新的epoll实例，并绑定到eventLoop上
+ */
+static int aeApiCreate(aeEventLoop *eventLoop){
+    aeApiState *state = zmalloc(sizeof(aeApiState));
+    if(!state){
+        return -1;
+    }
+    state->events = zmalloc(sizeof(struct epoll_event) * eventLoop->setsize);
+    if(!state->events){
+        zfree(state);
+        return -1;
+    }
+    //参数只是给内核的提示，新内核已经忽略这个值
+    state->epfd = epoll_create(1024);
+    if(state->epfd == -1){
+        zfree(state->events);
+        zfree(state);
+        return -1;
+    }
+    eventLoop->apidata = state;
+    return 0;
+}
+
+static void aeApiFree(aeEventLoop *eventLoop){
+    aeApiState *state = eventLoop->apidata;
+    close(state->epfd);
+    zfree(state->events);
+    zfree(state);
+}
+
+/**
+ * 将fd的事件加入到epoll中，如果fd已在监听，则合并旧的事件
+ */
+static int aeApiAddEvent(aeEventLoop *eventLoop, int fd, int mask){
+    aeApiState *state = eventLoop->apidata;
+    struct epoll_event ee = {0};
+    //如果fd已经关联了事件，就是MOD操作，否则是ADD操作
+    int op = eventLoop->events[fd].mask == AE_NONE ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+
+    //合并旧的事件
+    mask |= eventLoop->events[fd].mask;
+    if(mask & AE_READABLE){
+        ee.events |= EPOLLIN;
+    }
+    if(mask & AE_WRITABLE){
+        ee.events |= EPOLLOUT;
+    }
+    if(mask & AE_EDGE){
+        ee.events |= EPOLLET;
+    }
+    ee.data.fd = fd;
+    if(epoll_ctl(state->epfd, op, fd, &ee) == -1){
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * 从fd中删除指定的事件，如果没有剩余事件了，则从epoll中移除这个fd
+ */
+static void aeApiDelEvent(aeEventLoop *eventLoop, int fd, int delmask){
+    aeApiState *state = eventLoop->apidata;
+    struct epoll_event ee = {0};
+    int mask = eventLoop->events[fd].mask & (~delmask);
+
+    if(mask & AE_READABLE){
+        ee.events |= EPOLLIN;
+    }
+    if(mask & AE_WRITABLE){
+        ee.events |= EPOLLOUT;
+    }
+    if(mask & AE_EDGE){
+        ee.events |= EPOLLET;
+    }
+    ee.data.fd = fd;
+    if((mask & (AE_READABLE|AE_WRITABLE)) != AE_NONE){
+        epoll_ctl(state->epfd, EPOLL_CTL_MOD, fd, &ee);
+    }else{
+        //注意内核2.6.9之前的版本，EPOLL_CTL_DEL也要求传入非NULL的event
+        epoll_ctl(state->epfd, EPOLL_CTL_DEL, fd, &ee);
+    }
+}
+
+/**
+ * 获取可执行事件，tvp为NULL时会一直阻塞
+ * 返回已就绪事件的数量，就绪的事件会写入eventLoop的fired数组
+ */
+static int aeApiPoll(aeEventLoop *eventLoop, struct timeval *tvp){
+    aeApiState *state = eventLoop->apidata;
+    int numevents = 0;
+
+    int retval = epoll_wait(state->epfd, state->events, eventLoop->setsize,
+            tvp ? (tvp->tv_sec * 1000 + tvp->tv_usec / 1000) : -1);
+    if(retval > 0){
+        numevents = retval;
+        for(int j = 0; j < numevents; j++){
+            int mask = 0;
+            struct epoll_event *e = state->events + j;
+            //出错和挂断也当做可读可写，让处理函数去read/write时发现错误
+            if(e->events & EPOLLIN){
+                mask |= AE_READABLE;
+            }
+            if(e->events & EPOLLOUT){
+                mask |= AE_WRITABLE;
+            }
+            if(e->events & (EPOLLERR|EPOLLHUP)){
+                mask |= AE_READABLE|AE_WRITABLE;
+            }
+            eventLoop->fired[j].fd = e->data.fd;
+            eventLoop->fired[j].mask = mask;
+        }
+    }
+    return numevents;
+}
+
+static char *aeApiName(void){
+    return "epoll";
+}
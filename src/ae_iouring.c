@@ -0,0 +1,974 @@
+#include <stdint.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/**
+ * io_uring多路复用库的实现，由ae.c直接include进来，所有函数都是static的
+ * 普通的fd用IORING_OP_POLL_ADD代替epoll_ctl，处理函数自己去read/write：
+ * 边缘触发的事件使用multishot poll，只需要提交一次；水平触发的事件使用单次poll，触发后在下一轮重新提交
+ * 以AE_COMPLETION注册的套接字不再poll，读写和accept都交给内核完成：
+ * 监听套接字提交一次multishot accept，连接提交一次multishot recv，数据直接收进注册给内核的接收缓冲区环，
+ * 回复复制进每个连接的发送缓冲区后提交send，处理函数通过aeAccept、aeRead、aeWritev取得结果
+ * 一轮循环里所有的提交和等待合并成一次io_uring_enter
+ * 不依赖liburing，直接使用系统调用，内核不支持时aeUseIoUring返回AE_ERR，事件处理器继续使用epoll；
+ * 内核不支持接收缓冲区环和multishot recv时，AE_COMPLETION的fd退回到poll
+ */
+
+//提交队列的大小，满了会先提交一次
+#define AE_URING_ENTRIES 1024
+//接收缓冲区的数量和每个缓冲区的大小，数量必须是2的幂
+#define AE_URING_RECV_BUFS 256
+#define AE_URING_RECV_BUFSIZE (1024*16)
+//接收缓冲区组的编号
+#define AE_URING_BGID 0
+//一次aeWritev最多复制进发送缓冲区的字节数
+#define AE_URING_SEND_MAX (1024*512)
+//发送完成后，超过这个大小的发送缓冲区直接释放，不留给下一次使用
+#define AE_URING_SEND_KEEP (1024*64)
+
+//multishot recv（6.0）和接收缓冲区环之后才有的特性位，头文件太旧时自己定义
+#ifndef IORING_FEAT_REG_REG_RING
+#define IORING_FEAT_REG_REG_RING (1U << 13)
+#endif
+
+/**
+ * user_data的低29位是fd，29到31位是请求类型，高32位是代数
+ * 代数变化之后收到的旧请求的完成事件都会被丢弃，这样fd被关闭后复用也不会出错
+ * user_data为0的完成事件直接丢弃
+ */
+#define AE_URING_FD_MASK 0x1fffffff
+#define AE_URING_OP_POLL_READ 0     //读方向的poll
+#define AE_URING_OP_POLL_WRITE 1    //写方向的poll
+#define AE_URING_OP_RECV 2          //multishot recv
+#define AE_URING_OP_ACCEPT 3        //multishot accept
+#define AE_URING_OP_SEND 4          //send
+
+/**
+ * 等待重新提交的请求，值是fd*3加上类型
+ */
+#define AE_URING_REARM_POLL_READ 0
+#define AE_URING_REARM_POLL_WRITE 1
+#define AE_URING_REARM_CONN 2
+
+/**
+ * AE_COMPLETION的fd的类型
+ */
+#define AE_URING_CONN_NONE 0    //没有使用完成模式
+#define AE_URING_CONN_RECV 1    //已连接的套接字
+#define AE_URING_CONN_ACCEPT 2  //监听套接字
+
+/**
+ * 每个fd的每个方向（读、写）各有一个poll请求，按fd*2+方向索引
+ * 删除事件时代数加1
+ */
+typedef struct aeUringSlot{
+    uint32_t gen;   //当前请求的代数
+    unsigned armed:1;   //是否有poll请求在内核中
+    unsigned queued:1;  //是否已经在等待重新提交的队列中
+} aeUringSlot;
+
+/**
+ * 连接的发送缓冲区，send请求在内核中时内容不能修改，
+ * 所以连接注销之后也要等完成事件回来才能释放
+ */
+typedef struct aeUringSend{
+    uint32_t gen;   //提交时连接的代数
+    size_t len;     //要发送的字节数
+    size_t off;     //已经发送的字节数
+    size_t cap;     //buf的大小
+    char buf[];
+} aeUringSend;
+
+/**
+ * AE_COMPLETION的fd的状态，按fd索引
+ */
+typedef struct aeUringConn{
+    uint32_t gen;       //代数，注销时加1，旧请求的完成事件只回收资源
+    uint32_t round;     //最后一次通知可读的轮次，同一轮里只通知一次
+    unsigned mode:2;    //AE_URING_CONN_*
+    unsigned armed:1;   //multishot recv或accept是否在内核中
+    unsigned queued:1;  //是否已经在等待重新提交的队列中
+    unsigned ready:1;   //是否已经在ready队列中
+    unsigned sending:1; //send请求是否在内核中
+    unsigned eof:1;     //对端已经关闭了连接
+    int rerr;           //接收出错时的错误码
+    int serr;           //发送出错时的错误码
+    //已经收到但还没有被aeRead取走的接收缓冲区，通过bufnext按编号链接，-1为空
+    int head;
+    int tail;
+    unsigned off;       //head缓冲区里已经取走的字节数
+    aeUringSend *send;
+    //已经接受但还没有被aeAccept取走的连接
+    int *accepted;
+    int acceptedlen;
+    int acceptedcap;
+} aeUringConn;
+
+/**
+ * io_uring的私有数据
+ */
+typedef struct aeUringState{
+    int ringfd;
+    //提交队列
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local_tail; //已经写入但可能还没提交的位置
+    struct io_uring_sqe *sqes;
+    //完成队列
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    //mmap出来的区域，释放时使用
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    size_t sqes_size;
+    //按fd*2+方向索引
+    aeUringSlot *polls;
+    //需要重新提交的请求，值是fd*3+AE_URING_REARM_*
+    int *rearm;
+    int rearmlen;
+    //按fd索引，为NULL说明内核不支持完成模式，AE_COMPLETION的fd也使用poll
+    aeUringConn *conns;
+    //注册给内核的接收缓冲区环，以及缓冲区本身
+    struct io_uring_buf_ring *br;
+    size_t br_size;
+    unsigned short br_tail;
+    char *bufs;
+    size_t bufs_size;
+    //每个接收缓冲区收到的字节数，和链表中的下一个缓冲区
+    unsigned *buflen;
+    int *bufnext;
+    //每一轮开始时要检查的fd：可写（没有send在内核中）或者还有没取走的连接
+    int *ready;
+    int readylen;
+    uint32_t round;
+} aeUringState;
+
+static int aeUringSetup(unsigned entries, struct io_uring_params *p){
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int aeUringEnter(int ringfd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz){
+    return (int)syscall(__NR_io_uring_enter, ringfd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int aeUringRegister(int ringfd, unsigned opcode, void *arg, unsigned nr_args){
+    return (int)syscall(__NR_io_uring_register, ringfd, opcode, arg, nr_args);
+}
+
+static void aeUringFree(aeEventLoop *eventLoop){
+    aeUringState *state = eventLoop->apidata;
+    if(state->sqes){
+        munmap(state->sqes, state->sqes_size);
+    }
+    if(state->cq_ring && state->cq_ring != state->sq_ring){
+        munmap(state->cq_ring, state->cq_ring_size);
+    }
+    if(state->sq_ring){
+        munmap(state->sq_ring, state->sq_ring_size);
+    }
+    //先关闭io_uring，内核中的请求都结束之后才能释放缓冲区
+    if(state->ringfd != -1){
+        close(state->ringfd);
+    }
+    if(state->conns){
+        for(int j = 0; j < eventLoop->setsize; j++){
+            aeUringConn *c = &state->conns[j];
+            for(int k = 0; k < c->acceptedlen; k++){
+                close(c->accepted[k]);
+            }
+            zfree(c->accepted);
+            zfree(c->send);
+        }
+    }
+    if(state->br){
+        munmap(state->br, state->br_size);
+    }
+    if(state->bufs){
+        munmap(state->bufs, state->bufs_size);
+    }
+    zfree(state->conns);
+    zfree(state->buflen);
+    zfree(state->bufnext);
+    zfree(state->ready);
+    zfree(state->polls);
+    zfree(state->rearm);
+    zfree(state);
+}
+
+/**
+ * 把编号为bid的接收缓冲区还给内核
+ */
+static void aeUringRecycleBuf(aeUringState *state, int bid){
+    struct io_uring_buf *b = &state->br->bufs[state->br_tail & (AE_URING_RECV_BUFS-1)];
+    b->addr = (uint64_t)(uintptr_t)(state->bufs + (size_t)bid * AE_URING_RECV_BUFSIZE);
+    b->len = AE_URING_RECV_BUFSIZE;
+    b->bid = bid;
+    state->br_tail++;
+    __atomic_store_n(&state->br->tail, state->br_tail, __ATOMIC_RELEASE);
+}
+
+/**
+ * 创建接收缓冲区环并注册给内核，这些缓冲区不计入zmalloc的内存统计，和内核的套接字缓冲区一样
+ * 内核不支持时返回-1，之后AE_COMPLETION的fd也使用poll
+ */
+static int aeUringCreateBufRing(aeEventLoop *eventLoop){
+    aeUringState *state = eventLoop->apidata;
+    struct io_uring_buf_reg reg;
+
+    state->br_size = AE_URING_RECV_BUFS * sizeof(struct io_uring_buf);
+    state->br = mmap(NULL, state->br_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(state->br == MAP_FAILED){
+        state->br = NULL;
+        return -1;
+    }
+    state->bufs_size = (size_t)AE_URING_RECV_BUFS * AE_URING_RECV_BUFSIZE;
+    state->bufs = mmap(NULL, state->bufs_size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(state->bufs == MAP_FAILED){
+        state->bufs = NULL;
+        return -1;
+    }
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)state->br;
+    reg.ring_entries = AE_URING_RECV_BUFS;
+    reg.bgid = AE_URING_BGID;
+    if(aeUringRegister(state->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1){
+        return -1;
+    }
+    state->conns = zcalloc(sizeof(aeUringConn) * eventLoop->setsize);
+    state->buflen = zmalloc(sizeof(unsigned) * AE_URING_RECV_BUFS);
+    state->bufnext = zmalloc(sizeof(int) * AE_URING_RECV_BUFS);
+    state->ready = zmalloc(sizeof(int) * eventLoop->setsize);
+    state->br_tail = 0;
+    for(int j = 0; j < AE_URING_RECV_BUFS; j++){
+        aeUringRecycleBuf(state, j);
+    }
+    return 0;
+}
+
+/**
+ * 创建io_uring实例，并映射提交队列和完成队列
+ * 需要内核支持multishot poll（5.13）和带超时的io_uring_enter，否则返回-1
+ * 内核支持multishot recv时，再注册接收缓冲区环，打开AE_COMPLETION的完成模式
+ */
+static int aeUringCreate(aeEventLoop *eventLoop){
+    struct io_uring_params p;
+    aeUringState *state = zcalloc(sizeof(aeUringState));
+    if(!state){
+        return -1;
+    }
+    state->ringfd = -1;
+    eventLoop->apidata = state;
+    if(eventLoop->setsize > AE_URING_FD_MASK){
+        goto err;
+    }
+    state->polls = zcalloc(eventLoop->setsize * 2 * sizeof(aeUringSlot));
+    state->rearm = zmalloc(sizeof(int) * eventLoop->setsize * 3);
+    if(!state->polls || !state->rearm){
+        goto err;
+    }
+    memset(&p, 0, sizeof(p));
+    state->ringfd = aeUringSetup(AE_URING_ENTRIES, &p);
+    if(state->ringfd == -1){
+        goto err;
+    }
+    //RSRC_TAGS和multishot poll是同一个版本加入的，没有单独的特性位，只能这样判断
+    if(!(p.features & IORING_FEAT_EXT_ARG) || !(p.features & IORING_FEAT_NODROP) ||
+        !(p.features & IORING_FEAT_RSRC_TAGS)){
+        goto err;
+    }
+
+    state->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    state->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    //新内核两个队列可以一次映射
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        if(state->cq_ring_size > state->sq_ring_size){
+            state->sq_ring_size = state->cq_ring_size;
+        }
+        state->cq_ring_size = state->sq_ring_size;
+    }
+    state->sq_ring = mmap(NULL, state->sq_ring_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQ_RING);
+    if(state->sq_ring == MAP_FAILED){
+        state->sq_ring = NULL;
+        goto err;
+    }
+    if(p.features & IORING_FEAT_SINGLE_MMAP){
+        state->cq_ring = state->sq_ring;
+    }else{
+        state->cq_ring = mmap(NULL, state->cq_ring_size, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_CQ_RING);
+        if(state->cq_ring == MAP_FAILED){
+            state->cq_ring = NULL;
+            goto err;
+        }
+    }
+    state->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    state->sqes = mmap(NULL, state->sqes_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, state->ringfd, IORING_OFF_SQES);
+    if(state->sqes == MAP_FAILED){
+        state->sqes = NULL;
+        goto err;
+    }
+
+    char *sq = state->sq_ring;
+    char *cq = state->cq_ring;
+    state->sq_head = (unsigned*)(sq + p.sq_off.head);
+    state->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    state->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    state->sq_entries = p.sq_entries;
+    state->sq_local_tail = *state->sq_tail;
+    state->cq_head = (unsigned*)(cq + p.cq_off.head);
+    state->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    state->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    state->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    //提交队列的下标数组固定为一一对应，之后只需要移动tail
+    unsigned *array = (unsigned*)(sq + p.sq_off.array);
+    for(unsigned j = 0; j < p.sq_entries; j++){
+        array[j] = j;
+    }
+    if(!(p.features & IORING_FEAT_REG_REG_RING) || aeUringCreateBufRing(eventLoop) == -1){
+        if(state->br){
+            munmap(state->br, state->br_size);
+            state->br = NULL;
+        }
+        if(state->bufs){
+            munmap(state->bufs, state->bufs_size);
+            state->bufs = NULL;
+        }
+    }
+    return 0;
+
+    err : {
+        aeUringFree(eventLoop);
+        eventLoop->apidata = NULL;
+        return -1;
+    }
+}
+
+/**
+ * 已经写入提交队列但内核还没有取走的SQE数量
+ */
+static unsigned aeUringToSubmit(aeUringState *state){
+    return state->sq_local_tail - __atomic_load_n(state->sq_head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * 取得一个空闲的SQE，提交队列满了就先提交一次
+ */
+static struct io_uring_sqe *aeUringGetSqe(aeUringState *state){
+    if(aeUringToSubmit(state) >= state->sq_entries){
+        aeUringEnter(state->ringfd, aeUringToSubmit(state), 0, 0, NULL, 0);
+        if(aeUringToSubmit(state) >= state->sq_entries){
+            return NULL;
+        }
+    }
+    struct io_uring_sqe *sqe = &state->sqes[state->sq_local_tail & state->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void aeUringCommitSqe(aeUringState *state){
+    state->sq_local_tail++;
+    __atomic_store_n(state->sq_tail, state->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t aeUringUserData(int fd, int op, uint32_t gen){
+    return ((uint64_t)gen << 32) | ((uint64_t)op << 29) | (uint64_t)fd;
+}
+
+/**
+ * 为fd的一个方向提交poll请求，dir为0是读，1是写
+ */
+static int aeUringArm(aeUringState *state, int fd, int dir, int edge){
+    aeUringSlot *up = &state->polls[fd*2+dir];
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    if(!sqe){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = fd;
+    sqe->poll32_events = dir ? POLLOUT : POLLIN;
+    sqe->len = edge ? IORING_POLL_ADD_MULTI : 0;
+    sqe->user_data = aeUringUserData(fd, dir, up->gen);
+    aeUringCommitSqe(state);
+    up->armed = 1;
+    return 0;
+}
+
+/**
+ * 撤销fd一个方向上的poll请求，代数加1后，旧请求之后产生的完成事件都会被忽略
+ */
+static void aeUringDisarm(aeUringState *state, int fd, int dir){
+    aeUringSlot *up = &state->polls[fd*2+dir];
+    if(up->armed){
+        struct io_uring_sqe *sqe = aeUringGetSqe(state);
+        if(sqe){
+            sqe->opcode = IORING_OP_POLL_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = aeUringUserData(fd, dir, up->gen);
+            sqe->user_data = 0;
+            aeUringCommitSqe(state);
+        }
+        up->armed = 0;
+    }
+    up->gen++;
+}
+
+/**
+ * 为AE_COMPLETION的fd提交multishot accept或者multishot recv
+ * recv不指定缓冲区，由内核从接收缓冲区环中选一个，每收到一次数据产生一个完成事件
+ */
+static int aeUringArmConn(aeUringState *state, int fd){
+    aeUringConn *c = &state->conns[fd];
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    if(!sqe){
+        return -1;
+    }
+    sqe->fd = fd;
+    if(c->mode == AE_URING_CONN_ACCEPT){
+        sqe->opcode = IORING_OP_ACCEPT;
+        sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+        sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+        sqe->user_data = aeUringUserData(fd, AE_URING_OP_ACCEPT, c->gen);
+    }else{
+        sqe->opcode = IORING_OP_RECV;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = AE_URING_BGID;
+        sqe->user_data = aeUringUserData(fd, AE_URING_OP_RECV, c->gen);
+    }
+    aeUringCommitSqe(state);
+    c->armed = 1;
+    return 0;
+}
+
+/**
+ * 提交发送缓冲区中还没有发送的部分
+ * MSG_WAITALL让内核在一个请求里把数据发完，只有出错时才会返回更少的字节数
+ */
+static int aeUringSubmitSend(aeUringState *state, int fd){
+    aeUringConn *c = &state->conns[fd];
+    aeUringSend *s = c->send;
+    struct io_uring_sqe *sqe = aeUringGetSqe(state);
+    if(!sqe){
+        return -1;
+    }
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)(s->buf + s->off);
+    sqe->len = s->len - s->off;
+    sqe->msg_flags = MSG_WAITALL|MSG_NOSIGNAL;
+    sqe->user_data = aeUringUserData(fd, AE_URING_OP_SEND, s->gen);
+    aeUringCommitSqe(state);
+    c->sending = 1;
+    return 0;
+}
+
+/**
+ * 放进ready队列，下一轮开始时检查是否需要通知
+ */
+static void aeUringAddReady(aeUringState *state, int fd){
+    aeUringConn *c = &state->conns[fd];
+    if(!c->ready){
+        c->ready = 1;
+        state->ready[state->readylen++] = fd;
+    }
+}
+
+static void aeUringQueueRearm(aeUringState *state, int fd, int kind){
+    state->rearm[state->rearmlen++] = fd*3+kind;
+}
+
+/**
+ * 注销AE_COMPLETION的fd：撤销内核中的accept或recv，代数加1，
+ * 还没有被取走的接收缓冲区还给内核，还没有被取走的连接直接关闭
+ * 发送缓冲区如果还在内核中，要等完成事件回来再释放
+ */
+static void aeUringDetach(aeUringState *state, int fd){
+    aeUringConn *c = &state->conns[fd];
+    if(c->armed){
+        struct io_uring_sqe *sqe = aeUringGetSqe(state);
+        if(sqe){
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = aeUringUserData(fd,
+                    c->mode == AE_URING_CONN_ACCEPT ? AE_URING_OP_ACCEPT : AE_URING_OP_RECV, c->gen);
+            sqe->user_data = 0;
+            aeUringCommitSqe(state);
+        }
+        c->armed = 0;
+    }
+    c->gen++;
+    while(c->head != -1){
+        int bid = c->head;
+        c->head = state->bufnext[bid];
+        aeUringRecycleBuf(state, bid);
+    }
+    c->tail = -1;
+    c->off = 0;
+    c->eof = 0;
+    c->rerr = 0;
+    c->serr = 0;
+    for(int j = 0; j < c->acceptedlen; j++){
+        close(c->accepted[j]);
+    }
+    c->acceptedlen = 0;
+    if(!c->sending){
+        zfree(c->send);
+        c->send = NULL;
+    }else if(aeUringToSubmit(state)){
+        /**
+         * 内核在提交时才根据fd取得套接字，调用方注销之后马上就会close，
+         * 所以还在提交队列里的send要现在提交，例如QUIT的回复
+         */
+        aeUringEnter(state->ringfd, aeUringToSubmit(state), 0, 0, NULL, 0);
+    }
+    c->mode = AE_URING_CONN_NONE;
+}
+
+static int aeUringAddEvent(aeEventLoop *eventLoop, int fd, int mask){
+    aeUringState *state = eventLoop->apidata;
+    int allmask = mask | eventLoop->events[fd].mask;
+    int edge = allmask & AE_EDGE;
+
+    /**
+     * AE_COMPLETION的读事件根据套接字是否在监听，提交accept或者recv，不是套接字时退回到poll
+     * 写事件不需要提交请求，没有send在内核中就是可写的，在下一轮开始时通知
+     */
+    if(state->conns && (allmask & AE_COMPLETION)){
+        aeUringConn *c = &state->conns[fd];
+        if((mask & AE_READABLE) && c->mode == AE_URING_CONN_NONE){
+            int listening = 0;
+            socklen_t len = sizeof(listening);
+            if(getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) == 0){
+                c->mode = listening ? AE_URING_CONN_ACCEPT : AE_URING_CONN_RECV;
+                c->head = c->tail = -1;
+                if(aeUringArmConn(state, fd) == -1){
+                    c->mode = AE_URING_CONN_NONE;
+                    return -1;
+                }
+            }
+        }
+        if(c->mode != AE_URING_CONN_NONE){
+            if(mask & AE_WRITABLE){
+                aeUringAddReady(state, fd);
+            }
+            return 0;
+        }
+    }
+
+    if((mask & AE_READABLE) && !state->polls[fd*2].armed){
+        if(aeUringArm(state, fd, 0, edge) == -1){
+            return -1;
+        }
+    }
+    if((mask & AE_WRITABLE) && !state->polls[fd*2+1].armed){
+        if(aeUringArm(state, fd, 1, edge) == -1){
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void aeUringDelEvent(aeEventLoop *eventLoop, int fd, int delmask){
+    aeUringState *state = eventLoop->apidata;
+    if(state->conns && state->conns[fd].mode != AE_URING_CONN_NONE){
+        if(delmask & AE_READABLE){
+            aeUringDetach(state, fd);
+        }
+        return;
+    }
+    if(delmask & AE_READABLE){
+        aeUringDisarm(state, fd, 0);
+    }
+    if(delmask & AE_WRITABLE){
+        aeUringDisarm(state, fd, 1);
+    }
+}
+
+/**
+ * fd是否使用完成模式，是的话aeRead、aeWritev、aeAccept要调用下面的函数
+ */
+static int aeUringIsCompletion(aeEventLoop *eventLoop, int fd){
+    aeUringState *state = eventLoop->apidata;
+    return state->conns && fd >= 0 && fd < eventLoop->setsize &&
+        state->conns[fd].mode != AE_URING_CONN_NONE;
+}
+
+/**
+ * 从已经收到的接收缓冲区中复制数据，取完的缓冲区马上还给内核
+ * 没有数据时，对端已经关闭返回0，出过错返回-1并设置errno，否则返回-1并设置errno为EAGAIN
+ */
+static ssize_t aeUringRead(aeEventLoop *eventLoop, int fd, void *buf, size_t len){
+    aeUringState *state = eventLoop->apidata;
+    aeUringConn *c = &state->conns[fd];
+    size_t nread = 0;
+
+    while(nread < len && c->head != -1){
+        int bid = c->head;
+        size_t avail = state->buflen[bid] - c->off;
+        size_t n = len - nread < avail ? len - nread : avail;
+        memcpy((char*)buf + nread, state->bufs + (size_t)bid * AE_URING_RECV_BUFSIZE + c->off, n);
+        nread += n;
+        c->off += n;
+        if(c->off == state->buflen[bid]){
+            c->head = state->bufnext[bid];
+            if(c->head == -1){
+                c->tail = -1;
+            }
+            c->off = 0;
+            aeUringRecycleBuf(state, bid);
+        }
+    }
+    if(nread){
+        return nread;
+    }
+    if(c->rerr){
+        errno = c->rerr;
+        return -1;
+    }
+    if(c->eof){
+        return 0;
+    }
+    errno = EAGAIN;
+    return -1;
+}
+
+/**
+ * 把数据复制进连接的发送缓冲区并提交send，返回复制的字节数，提交要等到下一次io_uring_enter
+ * 每个连接同时只有一个send在内核中，否则数据的顺序没法保证，这时返回-1并设置errno为EAGAIN，
+ * send完成后会通知写事件
+ */
+static ssize_t aeUringWritev(aeEventLoop *eventLoop, int fd, const struct iovec *iov, int iovcnt){
+    aeUringState *state = eventLoop->apidata;
+    aeUringConn *c = &state->conns[fd];
+    aeUringSend *s = c->send;
+    size_t total = 0;
+
+    if(c->serr){
+        errno = c->serr;
+        return -1;
+    }
+    if(c->sending || (s && s->off < s->len)){
+        //上一次没能提交的剩余部分
+        if(!c->sending){
+            aeUringSubmitSend(state, fd);
+        }
+        errno = EAGAIN;
+        return -1;
+    }
+    for(int j = 0; j < iovcnt; j++){
+        total += iov[j].iov_len;
+    }
+    if(total > AE_URING_SEND_MAX){
+        total = AE_URING_SEND_MAX;
+    }
+    if(total == 0){
+        return 0;
+    }
+    if(!s || s->cap < total){
+        size_t cap = total < 512 ? 512 : total;
+        zfree(s);
+        s = zmalloc(sizeof(aeUringSend) + cap);
+        s->cap = cap;
+        c->send = s;
+    }
+    size_t copied = 0;
+    for(int j = 0; j < iovcnt && copied < total; j++){
+        size_t n = iov[j].iov_len < total - copied ? iov[j].iov_len : total - copied;
+        memcpy(s->buf + copied, iov[j].iov_base, n);
+        copied += n;
+    }
+    s->gen = c->gen;
+    s->len = total;
+    s->off = 0;
+    if(aeUringSubmitSend(state, fd) == -1){
+        s->len = 0;
+        errno = EAGAIN;
+        return -1;
+    }
+    return total;
+}
+
+/**
+ * 取出一个multishot accept已经接受的连接，没有时返回-1并设置errno为EAGAIN
+ */
+static int aeUringAccept(aeEventLoop *eventLoop, int fd){
+    aeUringState *state = eventLoop->apidata;
+    aeUringConn *c = &state->conns[fd];
+    if(c->acceptedlen == 0){
+        errno = EAGAIN;
+        return -1;
+    }
+    return c->accepted[--c->acceptedlen];
+}
+
+/**
+ * 把fd的可读事件放进fired，同一轮里只放一次
+ */
+static int aeUringFireReadable(aeEventLoop *eventLoop, aeUringState *state, int fd, int numevents){
+    aeUringConn *c = &state->conns[fd];
+    if(c->round == state->round){
+        return numevents;
+    }
+    c->round = state->round;
+    eventLoop->fired[numevents].fd = fd;
+    eventLoop->fired[numevents].mask = AE_READABLE;
+    return numevents + 1;
+}
+
+/**
+ * 处理recv、accept和send的完成事件，返回新的numevents
+ */
+static int aeUringComplete(aeEventLoop *eventLoop, struct io_uring_cqe *cqe, int fd, int op, uint32_t gen, int numevents){
+    aeUringState *state = eventLoop->apidata;
+    aeUringConn *c = &state->conns[fd];
+    int more = cqe->flags & IORING_CQE_F_MORE;
+
+    if(op == AE_URING_OP_RECV){
+        int bid = (cqe->flags & IORING_CQE_F_BUFFER) ? (int)(cqe->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+        //已经注销的连接，只把缓冲区还给内核
+        if(gen != c->gen || c->mode != AE_URING_CONN_RECV){
+            if(bid != -1){
+                aeUringRecycleBuf(state, bid);
+            }
+            return numevents;
+        }
+        if(!more){
+            c->armed = 0;
+        }
+        if(cqe->res > 0 && bid != -1){
+            state->buflen[bid] = cqe->res;
+            state->bufnext[bid] = -1;
+            if(c->tail == -1){
+                c->head = bid;
+            }else{
+                state->bufnext[c->tail] = bid;
+            }
+            c->tail = bid;
+            //内核可能因为完成队列溢出等原因结束multishot，下一轮重新提交
+            if(!more && !c->queued){
+                c->queued = 1;
+                aeUringQueueRearm(state, fd, AE_URING_REARM_CONN);
+            }
+        }else{
+            if(bid != -1){
+                aeUringRecycleBuf(state, bid);
+            }
+            //接收缓冲区用完了，这一轮的处理函数会把缓冲区还回来，下一轮再重新提交
+            if(cqe->res == -ENOBUFS){
+                if(!c->queued){
+                    c->queued = 1;
+                    aeUringQueueRearm(state, fd, AE_URING_REARM_CONN);
+                }
+                return numevents;
+            }
+            if(cqe->res == 0){
+                c->eof = 1;
+            }else{
+                c->rerr = -cqe->res;
+            }
+        }
+        return aeUringFireReadable(eventLoop, state, fd, numevents);
+    }else if(op == AE_URING_OP_ACCEPT){
+        if(gen != c->gen || c->mode != AE_URING_CONN_ACCEPT){
+            if(cqe->res >= 0){
+                close(cqe->res);
+            }
+            return numevents;
+        }
+        if(!more){
+            c->armed = 0;
+            //文件描述符或内存暂时不够是可以恢复的，监听套接字本身出错（例如EBADF）就不再重新提交
+            int res = cqe->res;
+            if((res >= 0 || res == -EMFILE || res == -ENFILE || res == -ENOBUFS || res == -ENOMEM ||
+                res == -ECONNABORTED || res == -EINTR || res == -EAGAIN) && !c->queued){
+                c->queued = 1;
+                aeUringQueueRearm(state, fd, AE_URING_REARM_CONN);
+            }
+        }
+        if(cqe->res < 0){
+            return numevents;
+        }
+        if(c->acceptedlen == c->acceptedcap){
+            c->acceptedcap = c->acceptedcap ? c->acceptedcap * 2 : 16;
+            c->accepted = zrealloc(c->accepted, sizeof(int) * c->acceptedcap);
+        }
+        c->accepted[c->acceptedlen++] = cqe->res;
+        //处理函数每次只接受一部分连接，剩下的在下一轮开始时再通知
+        aeUringAddReady(state, fd);
+        return aeUringFireReadable(eventLoop, state, fd, numevents);
+    }
+
+    //send
+    aeUringSend *s = c->send;
+    c->sending = 0;
+    if(s->gen != c->gen){
+        //连接已经注销，缓冲区这时才能释放
+        zfree(s);
+        c->send = NULL;
+    }else if(cqe->res < 0){
+        c->serr = -cqe->res;
+        s->len = s->off = 0;
+    }else{
+        s->off += cqe->res;
+        if(s->off < s->len){
+            if(aeUringSubmitSend(state, fd) == 0){
+                return numevents;
+            }
+        }else{
+            s->len = s->off = 0;
+            if(s->cap > AE_URING_SEND_KEEP){
+                zfree(s);
+                c->send = NULL;
+            }
+        }
+    }
+    //没有send在内核中了，通知写事件
+    if(c->mode != AE_URING_CONN_NONE && (eventLoop->events[fd].mask & AE_WRITABLE)){
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = AE_WRITABLE;
+        numevents++;
+    }
+    return numevents;
+}
+
+/**
+ * 先重新提交上一轮结束了的请求，检查ready队列，
+ * 然后把这一轮所有的SQE连同等待合并成一次io_uring_enter，最后收割完成队列
+ */
+static int aeUringPoll(aeEventLoop *eventLoop, struct timeval *tvp){
+    aeUringState *state = eventLoop->apidata;
+    int numevents = 0;
+
+    state->round++;
+    for(int j = 0; j < state->rearmlen; j++){
+        int fd = state->rearm[j] / 3, kind = state->rearm[j] % 3;
+        if(kind == AE_URING_REARM_CONN){
+            aeUringConn *c = &state->conns[fd];
+            c->queued = 0;
+            if(!c->armed && c->mode != AE_URING_CONN_NONE){
+                aeUringArmConn(state, fd);
+            }
+            continue;
+        }
+        int dir = kind;
+        aeUringSlot *up = &state->polls[fd*2+dir];
+        up->queued = 0;
+        int mask = eventLoop->events[fd].mask;
+        if(!up->armed && (mask & (dir ? AE_WRITABLE : AE_READABLE))){
+            aeUringArm(state, fd, dir, mask & AE_EDGE);
+        }
+    }
+    state->rearmlen = 0;
+
+    /**
+     * ready队列里的fd：没有send在内核中并且注册了写事件的，通知可写；还有连接没取走的监听套接字，通知可读
+     * 通知过的留在队列里，下一轮再检查一次，这样和水平触发的语义一致
+     */
+    if(state->conns){
+        int readylen = state->readylen;
+        state->readylen = 0;
+        for(int j = 0; j < readylen; j++){
+            int fd = state->ready[j];
+            aeUringConn *c = &state->conns[fd];
+            int fmask = eventLoop->events[fd].mask, mask = 0;
+            if(c->mode != AE_URING_CONN_NONE){
+                if((fmask & AE_WRITABLE) && !c->sending){
+                    mask |= AE_WRITABLE;
+                }
+                if((fmask & AE_READABLE) && c->acceptedlen){
+                    mask |= AE_READABLE;
+                    c->round = state->round;
+                }
+            }
+            if(!mask){
+                c->ready = 0;
+                continue;
+            }
+            state->ready[state->readylen++] = fd;
+            eventLoop->fired[numevents].fd = fd;
+            eventLoop->fired[numevents].mask = mask;
+            numevents++;
+        }
+    }
+
+    //完成队列里已经有事件，或者ready队列里有需要通知的，都不需要等待
+    unsigned min_complete = 1;
+    if(numevents || (tvp && tvp->tv_sec == 0 && tvp->tv_usec == 0) ||
+        *state->cq_head != __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE)){
+        min_complete = 0;
+    }
+    unsigned to_submit = aeUringToSubmit(state);
+    if(to_submit || min_complete){
+        struct __kernel_timespec ts;
+        struct io_uring_getevents_arg arg;
+        memset(&arg, 0, sizeof(arg));
+        arg.sigmask_sz = _NSIG / 8;
+        if(tvp){
+            ts.tv_sec = tvp->tv_sec;
+            ts.tv_nsec = tvp->tv_usec * 1000;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+        //超时（ETIME）和被信号打断都是正常的，其他错误也只是这一轮没有事件
+        aeUringEnter(state->ringfd, to_submit, min_complete,
+                IORING_ENTER_GETEVENTS|IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    }
+
+    unsigned head = *state->cq_head;
+    unsigned tail = __atomic_load_n(state->cq_tail, __ATOMIC_ACQUIRE);
+    while(head != tail && numevents < eventLoop->setsize){
+        struct io_uring_cqe *cqe = &state->cqes[head & state->cq_mask];
+        uint64_t ud = cqe->user_data;
+        head++;
+        if(ud == 0){
+            continue;
+        }
+        int fd = (int)(ud & AE_URING_FD_MASK);
+        int op = (int)((ud >> 29) & 7);
+        uint32_t gen = (uint32_t)(ud >> 32);
+        if(op != AE_URING_OP_POLL_READ && op != AE_URING_OP_POLL_WRITE){
+            numevents = aeUringComplete(eventLoop, cqe, fd, op, gen, numevents);
+            continue;
+        }
+        int dir = op;
+        aeUringSlot *up = &state->polls[fd*2+dir];
+        //已经删除的旧请求
+        if(up->gen != gen){
+            continue;
+        }
+        /**
+         * 没有IORING_CQE_F_MORE说明这个poll请求已经结束，正常结束的下一轮重新提交
+         * 出错结束的（例如fd已经被关闭的EBADF）直接丢弃，否则每一轮都会重新提交再失败一次
+         */
+        if(!(cqe->flags & IORING_CQE_F_MORE)){
+            up->armed = 0;
+            if(cqe->res >= 0 && !up->queued){
+                up->queued = 1;
+                aeUringQueueRearm(state, fd, dir);
+            }
+        }
+        if(cqe->res < 0){
+            continue;
+        }
+        eventLoop->fired[numevents].fd = fd;
+        eventLoop->fired[numevents].mask = dir ? AE_WRITABLE : AE_READABLE;
+        numevents++;
+    }
+    __atomic_store_n(state->cq_head, head, __ATOMIC_RELEASE);
+    return numevents;
+}
+
+static char *aeUringName(void){
+    return "io_uring";
+}
@@ -0,0 +1,243 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <netdb.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include "anet.h"
+
+/**
+ * 将错误信息格式化到err中，err为NULL时不处理
+ */
+static void anetSetError(char *err, const char *fmt, ...){
+    va_list ap;
+    if(!err){
+        return;
+    }
+    va_start(ap, fmt);
+    vsnprintf(err, ANET_ERR_LEN, fmt, ap);
+    va_end(ap);
+}
+
+/**
+ * 将fd设置为非阻塞模式
+ */
+int anetNonBlock(char *err, int fd){
+    int flags;
+    //获取原有的flags，再加入O_NONBLOCK
+    if((flags = fcntl(fd, F_GETFL)) == -1){
+        anetSetError(err, "fcntl(F_GETFL): %s", strerror(errno));
+        return ANET_ERR;
+    }
+    if(fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1){
+        anetSetError(err, "fcntl(F_SETFL,O_NONBLOCK): %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
+/**
+ * 关闭Nagle算法，小包立即发送
+ */
+int anetEnableTcpNoDelay(char *err, int fd){
+    int yes = 1;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes)) == -1){
+        anetSetError(err, "setsockopt TCP_NODELAY: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
+/**
+ * 开启TCP keepalive，interval为探测的间隔秒数
+ */
+int anetKeepAlive(char *err, int fd, int interval){
+    int val = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &val, sizeof(val)) == -1){
+        anetSetError(err, "setsockopt SO_KEEPALIVE: %s", strerror(errno));
+        return ANET_ERR;
+    }
+#ifdef __linux__
+    //空闲interval秒后开始发送探测包
+    val = interval;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &val, sizeof(val)) < 0){
+        anetSetError(err, "setsockopt TCP_KEEPIDLE: %s\n", strerror(errno));
+        return ANET_ERR;
+    }
+    //探测包的间隔，总共探测3次
+    val = interval/3;
+    if(val == 0){
+        val = 1;
+    }
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &val, sizeof(val)) < 0){
+        anetSetError(err, "setsockopt TCP_KEEPINTVL: %s\n", strerror(errno));
+        return ANET_ERR;
+    }
+    val = 3;
+    if(setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &val, sizeof(val)) < 0){
+        anetSetError(err, "setsockopt TCP_KEEPCNT: %s\n", strerror(errno));
+        return ANET_ERR;
+    }
+#endif
+    return ANET_OK;
+}
+
+/**
+ * 开启SO_REUSEADDR，服务器重启时可以立即重新绑定端口
+ */
+static int anetSetReuseAddr(char *err, int fd){
+    int yes = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes)) == -1){
+        anetSetError(err, "setsockopt SO_REUSEADDR: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
+/**
+ * 开启SO_REUSEPORT，多个套接字可以绑定同一个端口，由内核把新连接分散到这些套接字上
+ */
+static int anetSetReusePort(char *err, int fd){
+    int yes = 1;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) == -1){
+        anetSetError(err, "setsockopt SO_REUSEPORT: %s", strerror(errno));
+        return ANET_ERR;
+    }
+    return ANET_OK;
+}
+
+/**
+ * 创建一个TCP的监听套接字，bindaddr为NULL则绑定所有地址
+ * 成功返回套接字描述符，失败返回ANET_ERR
+ */
+static int _anetTcpServer(char *err, int port, char *bindaddr, int backlog, int reuseport){
+    int s = -1, rv;
+    char _port[6];
+    struct addrinfo hints, *servinfo, *p;
+
+    snprintf(_port, 6, "%d", port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;    //没有指定bindaddr时绑定INADDR_ANY
+
+    if((rv = getaddrinfo(bindaddr, _port, &hints, &servinfo)) != 0){
+        anetSetError(err, "%s", gai_strerror(rv));
+        return ANET_ERR;
+    }
+    for(p = servinfo; p != NULL; p = p->ai_next){
+        if((s = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1){
+            continue;
+        }
+        if(anetSetReuseAddr(err, s) == ANET_ERR){
+            goto error;
+        }
+        if(reuseport && anetSetReusePort(err, s) == ANET_ERR){
+            goto error;
+        }
+        if(bind(s, p->ai_addr, p->ai_addrlen) == -1){
+            anetSetError(err, "bind: %s", strerror(errno));
+            goto error;
+        }
+        if(listen(s, backlog) == -1){
+            anetSetError(err, "listen: %s", strerror(errno));
+            goto error;
+        }
+        goto end;
+    }
+    if(p == NULL){
+        anetSetError(err, "unable to bind socket");
+        goto error;
+    }
+
+    error : {
+        if(s != -1){
+            close(s);
+        }
+        s = ANET_ERR;
+    }
+    end : {
+        freeaddrinfo(servinfo);
+        return s;
+    }
+}
+
+int anetTcpServer(char *err, int port, char *bindaddr, int backlog){
+    return _anetTcpServer(err, port, bindaddr, backlog, 0);
+}
+
+/**
+ * 和anetTcpServer相同，但是开启了SO_REUSEPORT，每个分片各自调用一次，绑定同一个端口
+ */
+int anetTcpServerReusePort(char *err, int port, char *bindaddr, int backlog){
+    return _anetTcpServer(err, port, bindaddr, backlog, 1);
+}
+
+/**
+ * 以阻塞方式连接到addr:port，成功返回套接字描述符，失败返回ANET_ERR
+ */
+int anetTcpConnect(char *err, char *addr, int port){
+    int s = ANET_ERR, rv;
+    char portstr[6];
+    struct addrinfo hints, *servinfo, *p;
+
+    snprintf(portstr, sizeof(portstr), "%d", port);
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    if((rv = getaddrinfo(addr, portstr, &hints, &servinfo)) != 0){
+        anetSetError(err, "%s", gai_strerror(rv));
+        return ANET_ERR;
+    }
+    for(p = servinfo; p != NULL; p = p->ai_next){
+        if((s = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1){
+            continue;
+        }
+        if(connect(s, p->ai_addr, p->ai_addrlen) == -1){
+            close(s);
+            s = ANET_ERR;
+            continue;
+        }
+        break;
+    }
+    if(s == ANET_ERR){
+        anetSetError(err, "connect: %s", strerror(errno));
+    }
+    freeaddrinfo(servinfo);
+    return s;
+}
+
+/**
+ * 接受一个TCP连接，并将客户端的地址和端口写入ip和port中（可以为NULL）
+ * 被信号打断时会自动重试
+ */
+int anetTcpAccept(char *err, int serversock, char *ip, size_t ip_len, int *port){
+    int fd;
+    struct sockaddr_in sa;
+    socklen_t salen = sizeof(sa);
+    while(1){
+        fd = accept(serversock, (struct sockaddr*)&sa, &salen);
+        if(fd == -1){
+            if(errno == EINTR){
+                continue;
+            }
+            anetSetError(err, "accept: %s", strerror(errno));
+            return ANET_ERR;
+        }
+        break;
+    }
+    if(ip){
+        inet_ntop(AF_INET, (void*)&(sa.sin_addr), ip, ip_len);
+    }
+    if(port){
+        *port = ntohs(sa.sin_port);
+    }
+    return fd;
+}
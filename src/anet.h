@@ -0,0 +1,20 @@
+#ifndef __ANET_H__
+#define __ANET_H__
+
+/**
+ * 网络操作结果代码
+ */
+#define ANET_OK 0
+#define ANET_ERR -1
+//错误信息的最大长度
+#define ANET_ERR_LEN 256
+
+int anetTcpServer(char *err, int port, char *bindaddr, int backlog);
+int anetTcpServerReusePort(char *err, int port, char *bindaddr, int backlog);
+int anetTcpConnect(char *err, char *addr, int port);
+int anetTcpAccept(char *err, int serversock, char *ip, size_t ip_len, int *port);
+int anetNonBlock(char *err, int fd);
+int anetEnableTcpNoDelay(char *err, int fd);
+int anetKeepAlive(char *err, int fd, int interval);
+
+#endif // !__ANET_H__
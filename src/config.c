@@ -17,12 +17,32 @@ void loadServerConfig(char *filename, char *option){
     char buf[REDIS_CONFIGLINE_MAX + 1];
 
     if(filename){
-
+        FILE *fp;
+        //文件名为"-"则从标准输入读取
+        if(filename[0] == '-' && filename[1] == '\0'){
+            fp = stdin;
+        }else{
+            if((fp = fopen(filename, "r")) == NULL){
+                redisLog("Fatal error, can't open config file '%s'", filename);
+                exit(1);
+            }
+        }
+        //逐行读入，拼接成一个完整的配置字符串
+        while(fgets(buf, REDIS_CONFIGLINE_MAX + 1, fp) != NULL){
+            config = sdscat(config, buf);
+        }
+        if(fp != stdin){
+            fclose(fp);
+        }
     }
 
+    //命令行中的参数追加在最后，可以覆盖文件中的配置
     if(option){
-        
+        config = sdscat(config, "\n");
+        config = sdscat(config, option);
     }
+    loadServerConfigFromString(config);
+    sdsfree(config);
 }
 
 void loadServerConfigFromString(char *config){
@@ -60,33 +80,63 @@ void loadServerConfigFromString(char *config){
 
         //开始检查参数值是否合理，并开始处理配置参数，每次只会满足1个条件
         if(!strcasecmp(argv[0], "timeout") && argc == 2){
-            server.maxidletime = atoi(argv[0]);
+            server.maxidletime = atoi(argv[1]);
             if(server.maxidletime < 0){
                 err = "Invalid timeout value";
                 goto loaderr;
             }
         }else if(!strcasecmp(argv[0], "tcp-keepalive") && argc == 2){
-            server.tcpkeepalive = atoi(argv[0]);
+            server.tcpkeepalive = atoi(argv[1]);
             if(server.tcpkeepalive < 0){
                 err = "Invalid tcp-keepalive value";
                 goto loaderr;
             }
         }else if(!strcasecmp(argv[0], "port") && argc == 2){
-            server.port = atoi(argv[0]);
+            server.port = atoi(argv[1]);
             if(server.port < 0 || server.port > 65535){
                 err = "Invalid port value";
                 goto loaderr;
             }
         }else if(!strcasecmp(argv[0], "tcp-backlog") && argc == 2){
-            server.tcp_backlog = atoi(argv[0]);
+            server.tcp_backlog = atoi(argv[1]);
             if(server.tcp_backlog < 0){
                 err = "Invalid tcp-backlog value";
                 goto loaderr;
             }
+        }else if(!strcasecmp(argv[0], "bind") && argc == 2){
+            zfree(server.bindaddr);
+            server.bindaddr = zstrdup(argv[1]);
+        }else if(!strcasecmp(argv[0], "maxclients") && argc == 2){
+            server.maxclients = atoi(argv[1]);
+            if(server.maxclients < 1){
+                err = "Invalid max clients limit";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "io-threads") && argc == 2){
+            server.io_threads_num = atoi(argv[1]);
+            if(server.io_threads_num < 1 || server.io_threads_num > REDIS_IO_THREADS_MAX_NUM){
+                err = "Invalid number of I/O threads";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "shards") && argc == 2){
+            server.shards_num = atoi(argv[1]);
+            if(server.shards_num < 1 || server.shards_num > REDIS_SHARDS_MAX_NUM){
+                err = "Invalid number of shards";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "event-backend") && argc == 2){
+            if(!strcasecmp(argv[1], "epoll")){
+                server.event_backend = AE_API_EPOLL;
+            }else if(!strcasecmp(argv[1], "io_uring")){
+                server.event_backend = AE_API_IO_URING;
+            }else{
+                err = "event-backend must be 'epoll' or 'io_uring'";
+                goto loaderr;
+            }
         }else if(!strcasecmp(argv[0], "logfile") && argc == 2){
             //要先free默认值
-            free(server.logfile);
-            server.logfile = strdup(argv[1]);
+            zfree(server.logfile);
+            server.logfile = zstrdup(argv[1]);
             //如果文件名不为空，则尝试打开一次，检查文件本身是否存在
             if(server.logfile[0] != '\0'){
                 FILE *fp = fopen(server.logfile, "a");
@@ -97,13 +147,67 @@ void loadServerConfigFromString(char *config){
                 fclose(fp);
             }
         }else if(!strcasecmp(argv[0], "databases") && argc == 2){
-            server.dbnum = atoi(argv[0]);
+            server.dbnum = atoi(argv[1]);
             if(server.dbnum < 1){
                 err = "Invalid number of databases";
                 goto loaderr;
             }
+        }else if(!strcasecmp(argv[0], "latency-tracking") && argc == 2){
+            if((server.latency_tracking = yesnotoi(argv[1])) == -1){
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "activerehashing") && argc == 2){
+            if((server.activerehashing = yesnotoi(argv[1])) == -1){
+                err = "argument must be 'yes' or 'no'";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "set-max-intset-entries") && argc == 2){
+            server.set_max_intset_entries = memtoll(argv[1], NULL);
+        }else if(!strcasecmp(argv[0], "sds-max-prealloc") && argc == 2){
+            //sds扩容时最多预分配的长度，追加很多的场景调小可以减少浪费，0表示不预分配
+            sdsSetMaxPrealloc(memtoll(argv[1], NULL));
         }else if(!strcasecmp(argv[0], "maxmemory") && argc == 2){
             server.maxmemory = memtoll(argv[1], NULL);
+        }else if(!strcasecmp(argv[0], "maxmemory-policy") && argc == 2){
+            if(!strcasecmp(argv[1], "volatile-lru")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_LRU;
+            }else if(!strcasecmp(argv[1], "volatile-lfu")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_LFU;
+            }else if(!strcasecmp(argv[1], "volatile-ttl")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_TTL;
+            }else if(!strcasecmp(argv[1], "volatile-random")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_VOLATILE_RANDOM;
+            }else if(!strcasecmp(argv[1], "allkeys-lru")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_ALLKEYS_LRU;
+            }else if(!strcasecmp(argv[1], "allkeys-lfu")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_ALLKEYS_LFU;
+            }else if(!strcasecmp(argv[1], "allkeys-random")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_ALLKEYS_RANDOM;
+            }else if(!strcasecmp(argv[1], "noeviction")){
+                server.maxmemory_policy = REDIS_MAXMEMORY_NO_EVICTION;
+            }else{
+                err = "Invalid maxmemory policy";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "maxmemory-samples") && argc == 2){
+            server.maxmemory_samples = atoi(argv[1]);
+            if(server.maxmemory_samples <= 0){
+                err = "maxmemory-samples must be 1 or greater";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "lfu-log-factor") && argc == 2){
+            server.lfu_log_factor = atoi(argv[1]);
+            if(server.lfu_log_factor < 0){
+                err = "lfu-log-factor must be 0 or greater";
+                goto loaderr;
+            }
+        }else if(!strcasecmp(argv[0], "lfu-decay-time") && argc == 2){
+            server.lfu_decay_time = atoi(argv[1]);
+            if(server.lfu_decay_time < 0){
+                err = "lfu-decay-time must be 0 or greater";
+                goto loaderr;
+            }
         }else if(!strcasecmp(argv[0], "daemonize") && argc == 2){
             if((server.daemonize = yesnotoi(argv[1]))==-1){
                 err = "argument must be 'yes' or 'no'";
@@ -118,8 +222,8 @@ void loadServerConfigFromString(char *config){
             }
         }else if(!strcasecmp(argv[0], "pidfile") && argc == 2){
             //先释放后复制新值
-            free(server.pidfile);
-            server.pidfile = strdup(argv[1]);
+            zfree(server.pidfile);
+            server.pidfile = zstrdup(argv[1]);
         }else{
             err = "Bad directive or Wrong number of arguments";
             goto loaderr;
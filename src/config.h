@@ -0,0 +1,20 @@
+#ifndef __CONFIG_H__
+#define __CONFIG_H__
+
+/**
+ * 根据编译平台，检测可用的系统特性
+ */
+
+//linux下使用epoll作为事件多路复用的实现
+#ifdef __linux__
+#define HAVE_EPOLL 1
+#endif
+
+//有io_uring头文件的linux可以选择io_uring，运行时内核不支持则退回epoll
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#endif // !__CONFIG_H__
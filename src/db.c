@@ -0,0 +1,731 @@
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include "redis.h"
+#include "util.h"
+
+/**
+ * 数据库键空间的底层操作，以及键相关的命令
+ * 键在dict中保存为sds，值是redisObject；设置了过期时间的键在expires中还有一份，
+ * expires直接引用dict中的那个sds，不再复制
+ */
+
+/**
+ * 值被访问时更新它的LRU时间，LFU模式下更新访问计数器
+ * 共享对象被所有分片只读地使用，不写它的LRU时间
+ */
+static void touchValue(robj *val){
+    if(val->refcount != REDIS_SHARED_REFCOUNT){
+        if(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU){
+            updateLFU(val);
+        }else{
+            val->lru = LRU_CLOCK();
+        }
+    }
+}
+
+/**
+ * 查找键对应的值，找到时更新访问信息
+ */
+robj *lookupKey(redisDb *db, robj *key){
+    dictEntry *de = dictFind(db->dict, key->ptr);
+    if(de){
+        robj *val = dictGetVal(de);
+        touchValue(val);
+        return val;
+    }
+    return NULL;
+}
+
+/**
+ * 读操作使用的查找，先删除已经过期的键
+ */
+robj *lookupKeyRead(redisDb *db, robj *key){
+    expireIfNeeded(db, key);
+    return lookupKey(db, key);
+}
+
+/**
+ * 写操作使用的查找，和lookupKeyRead相同，单独分开是为了以后区分读写的统计
+ */
+robj *lookupKeyWrite(redisDb *db, robj *key){
+    expireIfNeeded(db, key);
+    return lookupKey(db, key);
+}
+
+/**
+ * lookupKeyRead的批量版本，keys中每隔step个取一个键，共count个，值按顺序放到vals中，
+ * 不存在或者已经过期的为NULL
+ * 每DICT_BATCH_SIZE个键一批，先批量查expires删掉过期的键，再批量查dict，访存互相重叠
+ * vals中的对象在下一次修改数据库之前有效
+ */
+void lookupKeysBatch(redisDb *db, robj **keys, int count, int step, robj **vals){
+    void *ptrs[DICT_BATCH_SIZE];
+    dictEntry *des[DICT_BATCH_SIZE];
+
+    for(int base = 0; base < count; base += DICT_BATCH_SIZE){
+        int n = count - base < DICT_BATCH_SIZE ? count - base : DICT_BATCH_SIZE;
+        for(int j = 0; j < n; j++){
+            ptrs[j] = keys[(base+j)*step]->ptr;
+        }
+
+        //删除会让开放寻址表做单步rehash而移动节点，所以先把过期时间都读出来再删除
+        if(dictSize(db->expires) > 0){
+            int expired[DICT_BATCH_SIZE];
+            long long now = mstime();
+            dictFindBatch(db->expires, ptrs, n, des);
+            for(int j = 0; j < n; j++){
+                expired[j] = des[j] != NULL && now > dictGetSignedIntegerVal(des[j]);
+            }
+            for(int j = 0; j < n; j++){
+                if(expired[j]){
+                    dbDelete(db, keys[(base+j)*step]);
+                }
+            }
+        }
+
+        dictFindBatch(db->dict, ptrs, n, des);
+        for(int j = 0; j < n; j++){
+            robj *val = NULL;
+            if(des[j]){
+                val = dictGetVal(des[j]);
+                touchValue(val);
+            }
+            vals[base+j] = val;
+        }
+    }
+}
+
+/**
+ * 预取count个键在键空间中的位置，最多DICT_BATCH_SIZE个
+ * 键还没有创建成对象，直接对字节计算hash，和dbDictType的hash函数一致
+ */
+void dbPrefetchKeys(redisDb *db, const char **keys, const size_t *lens, int count){
+    uint64_t hashes[DICT_BATCH_SIZE];
+    for(int j = 0; j < count; j++){
+        hashes[j] = dictGenHashFunction(keys[j], lens[j]);
+    }
+    dictPrefetchHashes(db->dict, hashes, count);
+}
+
+/**
+ * 查找键，找不到时回复reply
+ */
+robj *lookupKeyReadOrReply(redisClient *c, robj *key, robj *reply){
+    robj *o = lookupKeyRead(c->db, key);
+    if(!o){
+        addReply(c, reply);
+    }
+    return o;
+}
+
+robj *lookupKeyWriteOrReply(redisClient *c, robj *key, robj *reply){
+    robj *o = lookupKeyWrite(c->db, key);
+    if(!o){
+        addReply(c, reply);
+    }
+    return o;
+}
+
+/**
+ * 添加一个新的键，键必须不存在，值的引用计数由调用方负责
+ */
+void dbAdd(redisDb *db, robj *key, robj *val){
+    sds copy = sdsdup(key->ptr);
+    int retval = dictAdd(db->dict, copy, val);
+    redisAssert(retval == DICT_OK);
+}
+
+/**
+ * 覆盖已经存在的键的值，旧值会被释放
+ * LFU模式下新值继承旧值的访问计数器，热点键不会因为被改写而变冷
+ */
+void dbOverwrite(redisDb *db, robj *key, robj *val){
+    dictEntry *de = dictFind(db->dict, key->ptr);
+    redisAssert(de != NULL);
+    if(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU){
+        robj *old = dictGetVal(de);
+        if(old->refcount != REDIS_SHARED_REFCOUNT && val->refcount != REDIS_SHARED_REFCOUNT){
+            val->lru = old->lru;
+        }
+    }
+    dictReplace(db->dict, key->ptr, val);
+}
+
+/**
+ * 高层的设置键值接口，不管键是否存在，都会设置成功，并且清除原来的过期时间
+ * 值的引用计数会加1
+ */
+void setKey(redisDb *db, robj *key, robj *val){
+    if(lookupKeyWrite(db, key) == NULL){
+        dbAdd(db, key, val);
+    }else{
+        dbOverwrite(db, key, val);
+    }
+    incrRefCount(val);
+    removeExpire(db, key);
+}
+
+int dbExists(redisDb *db, robj *key){
+    return dictFind(db->dict, key->ptr) != NULL;
+}
+
+/**
+ * 删除键和它的过期时间，键存在返回1
+ */
+int dbDelete(redisDb *db, robj *key){
+    //先删除过期时间，因为expires和dict共用同一个sds
+    if(dictSize(db->expires) > 0){
+        dictDelete(db->expires, key->ptr);
+    }
+    return dictDelete(db->dict, key->ptr) == DICT_OK;
+}
+
+/**
+ * 清空当前分片的所有数据库，返回删除的键数量
+ */
+long long emptyDb(void){
+    long long removed = 0;
+    for(int j = 0; j < server.dbnum; j++){
+        redisDb *db = &shard->db[j];
+        removed += dictSize(db->dict);
+        dictRelease(db->dict);
+        dictRelease(db->expires);
+        db->dict = dictCreateWithEngine(&dbDictType, NULL, DICT_ENGINE_SWISS);
+        db->expires = dictCreateWithEngine(&keyptrDictType, NULL, DICT_ENGINE_SWISS);
+    }
+    return removed;
+}
+
+/**
+ * 切换客户端使用的数据库
+ */
+int selectDb(redisClient *c, int id){
+    if(id < 0 || id >= server.dbnum){
+        return REDIS_ERR;
+    }
+    c->db = &shard->db[id];
+    c->dictid = id;
+    return REDIS_OK;
+}
+
+/**
+ * 过期时间相关
+ */
+int removeExpire(redisDb *db, robj *key){
+    return dictDelete(db->expires, key->ptr) == DICT_OK;
+}
+
+/**
+ * 设置键的过期时间，when为毫秒级的时间戳，键必须存在
+ */
+void setExpire(redisDb *db, robj *key, long long when){
+    dictEntry *kde = dictFind(db->dict, key->ptr);
+    redisAssert(kde != NULL);
+    dictEntry *de = dictAddRaw(db->expires, dictGetKey(kde));
+    if(de == NULL){
+        de = dictFind(db->expires, key->ptr);
+    }
+    dictSetSignedIntegerVal(de, when);
+}
+
+/**
+ * 返回键的过期时间，没有设置过期时间返回-1
+ */
+long long getExpire(redisDb *db, robj *key){
+    dictEntry *de;
+    if(dictSize(db->expires) == 0 || (de = dictFind(db->expires, key->ptr)) == NULL){
+        return -1;
+    }
+    return dictGetSignedIntegerVal(de);
+}
+
+/**
+ * 如果键已经过期就删除它，返回1说明键已经被删除
+ */
+int expireIfNeeded(redisDb *db, robj *key){
+    long long when = getExpire(db, key);
+    if(when < 0){
+        return 0;
+    }
+    if(mstime() <= when){
+        return 0;
+    }
+    return dbDelete(db, key);
+}
+
+/**
+ * 随机返回一个没有过期的键，数据库为空时返回NULL，返回的对象由调用方释放
+ * 随机到已经过期的键就顺便删掉，再随机一次
+ */
+robj *dbRandomKey(redisDb *db){
+    while(1){
+        dictEntry *de = dictGetRandomKey(db->dict);
+        if(de == NULL){
+            return NULL;
+        }
+        sds key = dictGetKey(de);
+        robj *keyobj = createStringObject(key, sdslen(key));
+        if(expireIfNeeded(db, keyobj)){
+            decrRefCount(keyobj);
+            continue;
+        }
+        return keyobj;
+    }
+}
+
+/**
+ * 键相关的命令
+ */
+/**
+ * DEL和EXISTS都按批查找，见lookupKeysBatch
+ */
+void delCommand(redisClient *c){
+    robj *vals[DICT_BATCH_SIZE];
+    int deleted = 0;
+    for(int base = 1; base < c->argc; base += DICT_BATCH_SIZE){
+        int n = c->argc - base < DICT_BATCH_SIZE ? c->argc - base : DICT_BATCH_SIZE;
+        lookupKeysBatch(c->db, c->argv + base, n, 1, vals);
+        for(int j = 0; j < n; j++){
+            //同一个键出现多次时，后面的dbDelete会返回0
+            if(vals[j] && dbDelete(c->db, c->argv[base+j])){
+                deleted++;
+            }
+        }
+    }
+    addReplyLongLong(c, deleted);
+}
+
+void existsCommand(redisClient *c){
+    robj *vals[DICT_BATCH_SIZE];
+    long long count = 0;
+    for(int base = 1; base < c->argc; base += DICT_BATCH_SIZE){
+        int n = c->argc - base < DICT_BATCH_SIZE ? c->argc - base : DICT_BATCH_SIZE;
+        lookupKeysBatch(c->db, c->argv + base, n, 1, vals);
+        for(int j = 0; j < n; j++){
+            if(vals[j]){
+                count++;
+            }
+        }
+    }
+    addReplyLongLong(c, count);
+}
+
+void selectCommand(redisClient *c){
+    long id;
+    if(getLongFromObjectOrReply(c, c->argv[1], &id, "invalid DB index") != REDIS_OK){
+        return;
+    }
+    if(id > INT_MAX || selectDb(c, (int)id) == REDIS_ERR){
+        addReplyError(c, "invalid DB index");
+    }else{
+        addReply(c, shared.ok);
+    }
+}
+
+/**
+ * KEYS pattern，多个分片时只返回当前分片的键
+ */
+void keysCommand(redisClient *c){
+    sds pattern = c->argv[1]->ptr;
+    int plen = sdslen(pattern), allkeys;
+    unsigned long numkeys = 0;
+    dictIterator *di = dictGetSafeIterator(c->db->dict);
+    dictEntry *de;
+
+    robj *keyobj;
+    list *keys = listCreate();
+    allkeys = (pattern[0] == '*' && pattern[1] == '\0');
+    while((de = dictNext(di)) != NULL){
+        sds key = dictGetKey(de);
+        if(allkeys || stringmatchlen(pattern, plen, key, sdslen(key), 0)){
+            keyobj = createStringObject(key, sdslen(key));
+            if(expireIfNeeded(c->db, keyobj) == 0){
+                listAddNodeTail(keys, keyobj);
+                numkeys++;
+            }else{
+                decrRefCount(keyobj);
+            }
+        }
+    }
+    dictReleaseIterator(di);
+
+    addReplyMultiBulkLen(c, numkeys);
+    while(listLength(keys)){
+        listNode *ln = listFirst(keys);
+        keyobj = listNodeValue(ln);
+        addReplyBulk(c, keyobj);
+        decrRefCount(keyobj);
+        listDeleteNode(keys, ln);
+    }
+    listRelease(keys);
+}
+
+/**
+ * RANDOMKEY，多个分片时只在当前分片的键中选
+ */
+void randomkeyCommand(redisClient *c){
+    robj *key;
+    if((key = dbRandomKey(c->db)) == NULL){
+        addReply(c, shared.nullbulk);
+        return;
+    }
+    addReplyBulk(c, key);
+    decrRefCount(key);
+}
+
+/**
+ * SCAN、SSCAN、HSCAN共用的部分
+ */
+
+/**
+ * 解析游标，游标必须是一个完整的无符号十进制数
+ */
+int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor){
+    char *eptr;
+    errno = 0;
+    *cursor = strtoul(o->ptr, &eptr, 10);
+    if(isspace(((char*)o->ptr)[0]) || eptr[0] != '\0' || errno == ERANGE){
+        addReplyError(c, "invalid cursor");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+/**
+ * dictScan的回调，把节点复制到privdata[0]的链表里，privdata[1]是被遍历的对象，SCAN时为NULL
+ * 哈希的字段和值依次放进链表
+ */
+static void scanCallback(void *privdata, const dictEntry *de){
+    void **pd = (void**)privdata;
+    list *keys = pd[0];
+    robj *o = pd[1];
+    robj *key, *val = NULL;
+
+    if(o == NULL){
+        sds sdskey = dictGetKey(de);
+        key = createStringObject(sdskey, sdslen(sdskey));
+    }else if(o->type == REDIS_SET){
+        key = dictGetKey(de);
+        incrRefCount(key);
+    }else if(o->type == REDIS_HASH){
+        key = dictGetKey(de);
+        incrRefCount(key);
+        val = dictGetVal(de);
+        incrRefCount(val);
+    }else{
+        redisPanic("Type not handled in SCAN callback.");
+    }
+
+    listAddNodeTail(keys, key);
+    if(val){
+        listAddNodeTail(keys, val);
+    }
+}
+
+/**
+ * SCAN cursor [MATCH pattern] [COUNT count]
+ * o为NULL时遍历当前数据库，否则遍历集合或者哈希对象
+ * COUNT只是每次遍历的桶数量的提示，返回的元素可能比它多也可能少；
+ * 一次最多访问count*10个桶，数据库很稀疏时也不会长时间阻塞
+ * MATCH在遍历之后过滤，所以匹配的元素很少时可能返回空的结果和一个非0的游标
+ */
+void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor){
+    int i, j;
+    list *keys = listCreate();
+    listNode *node, *nextnode;
+    long count = 10;
+    sds pat = NULL;
+    int patlen = 0, use_pattern = 0;
+    dict *ht;
+
+    redisAssert(o == NULL || o->type == REDIS_SET || o->type == REDIS_HASH);
+
+    //第一个选项的位置，前面是游标，SSCAN和HSCAN还有一个键
+    i = (o == NULL) ? 2 : 3;
+
+    //第一步：解析选项
+    while(i < c->argc){
+        j = c->argc - i;
+        if(!strcasecmp(c->argv[i]->ptr, "count") && j >= 2){
+            if(getLongFromObjectOrReply(c, c->argv[i+1], &count, NULL) != REDIS_OK){
+                goto cleanup;
+            }
+            if(count < 1){
+                addReply(c, shared.syntaxerr);
+                goto cleanup;
+            }
+            i += 2;
+        }else if(!strcasecmp(c->argv[i]->ptr, "match") && j >= 2){
+            pat = c->argv[i+1]->ptr;
+            patlen = sdslen(pat);
+            //"*"能匹配所有元素，不需要过滤
+            use_pattern = !(pat[0] == '*' && patlen == 1);
+            i += 2;
+        }else{
+            addReply(c, shared.syntaxerr);
+            goto cleanup;
+        }
+    }
+
+    //第二步：遍历
+    ht = NULL;
+    if(o == NULL){
+        ht = c->db->dict;
+    }else if(o->type == REDIS_SET && o->encoding == REDIS_ENCODING_HT){
+        ht = o->ptr;
+    }else if(o->type == REDIS_HASH && o->encoding == REDIS_ENCODING_HT){
+        ht = o->ptr;
+        //每个字段返回字段和值两项
+        count *= 2;
+    }
+
+    if(ht){
+        void *privdata[2];
+        long maxiterations = count * 10;
+        privdata[0] = keys;
+        privdata[1] = o;
+        do{
+            cursor = dictScan(ht, cursor, scanCallback, privdata);
+        }while(cursor && maxiterations-- && listLength(keys) < (unsigned long)count);
+    }else if(o->type == REDIS_SET){
+        //整数集合很小，一次全部返回
+        int pos = 0;
+        int64_t ll;
+        while(intsetGet(o->ptr, pos++, &ll)){
+            listAddNodeTail(keys, createStringObjectFromLongLong(ll));
+        }
+        cursor = 0;
+    }else{
+        redisPanic("Not handled encoding in SCAN.");
+    }
+
+    //第三步：按MATCH过滤，SCAN还要过滤掉已经过期的键
+    node = listFirst(keys);
+    while(node){
+        robj *kobj = listNodeValue(node);
+        nextnode = listNextNode(node);
+        int filter = 0;
+
+        if(use_pattern){
+            if(sdsEncodedObject(kobj)){
+                if(!stringmatchlen(pat, patlen, kobj->ptr, sdslen(kobj->ptr), 0)){
+                    filter = 1;
+                }
+            }else{
+                char buf[LONG_STR_SIZE];
+                int len;
+                redisAssert(kobj->encoding == REDIS_ENCODING_INT);
+                len = ll2string(buf, sizeof(buf), (long)kobj->ptr);
+                if(!stringmatchlen(pat, patlen, buf, len, 0)){
+                    filter = 1;
+                }
+            }
+        }
+        if(!filter && o == NULL && expireIfNeeded(c->db, kobj)){
+            filter = 1;
+        }
+        if(filter){
+            decrRefCount(kobj);
+            listDeleteNode(keys, node);
+        }
+
+        //哈希的链表是字段和值交替的，只匹配字段，字段被过滤时值也要删掉
+        if(o && o->type == REDIS_HASH){
+            node = nextnode;
+            nextnode = listNextNode(node);
+            if(filter){
+                kobj = listNodeValue(node);
+                decrRefCount(kobj);
+                listDeleteNode(keys, node);
+            }
+        }
+        node = nextnode;
+    }
+
+    //第四步：回复新的游标和元素
+    char buf[LONG_STR_SIZE];
+    int len = ull2string(buf, sizeof(buf), cursor);
+    addReplyMultiBulkLen(c, 2);
+    addReplyBulkCBuffer(c, buf, len);
+    addReplyMultiBulkLen(c, listLength(keys));
+    while((node = listFirst(keys)) != NULL){
+        robj *kobj = listNodeValue(node);
+        addReplyBulk(c, kobj);
+        decrRefCount(kobj);
+        listDeleteNode(keys, node);
+    }
+
+cleanup:
+    listSetFreeMethod(keys, decrRefCountVoid);
+    listRelease(keys);
+}
+
+/**
+ * SCAN cursor [MATCH pattern] [COUNT count]，多个分片时只遍历当前分片的键
+ */
+void scanCommand(redisClient *c){
+    unsigned long cursor;
+    if(parseScanCursorOrReply(c, c->argv[1], &cursor) == REDIS_ERR){
+        return;
+    }
+    scanGenericCommand(c, NULL, cursor);
+}
+
+/**
+ * DBSIZE、FLUSHDB、FLUSHALL带A标志，多个分片时在每个分片上各执行一次，broadcast_hops为0时是最后一个分片，由它回复
+ */
+void dbsizeCommand(redisClient *c){
+    c->broadcast_acc += dictSize(c->db->dict);
+    if(c->broadcast_hops == 0){
+        addReplyLongLong(c, c->broadcast_acc);
+    }
+}
+
+void flushdbCommand(redisClient *c){
+    dictRelease(c->db->dict);
+    dictRelease(c->db->expires);
+    c->db->dict = dictCreateWithEngine(&dbDictType, NULL, DICT_ENGINE_SWISS);
+    c->db->expires = dictCreateWithEngine(&keyptrDictType, NULL, DICT_ENGINE_SWISS);
+    if(c->broadcast_hops == 0){
+        addReply(c, shared.ok);
+    }
+}
+
+void flushallCommand(redisClient *c){
+    emptyDb();
+    if(c->broadcast_hops == 0){
+        addReply(c, shared.ok);
+    }
+}
+
+void typeCommand(redisClient *c){
+    robj *o = lookupKeyRead(c->db, c->argv[1]);
+    addReplyStatus(c, o == NULL ? "none" : strObjectType(o->type));
+}
+
+/**
+ * RENAME和RENAMENX的通用实现，过期时间会跟着键一起转移
+ */
+static void renameGenericCommand(redisClient *c, int nx){
+    robj *o;
+    long long expire;
+
+    //新旧名字相同时直接返回错误
+    if(sdscmp(c->argv[1]->ptr, c->argv[2]->ptr) == 0){
+        addReply(c, shared.sameobjecterr);
+        return;
+    }
+    if((o = lookupKeyWriteOrReply(c, c->argv[1], shared.nokeyerr)) == NULL){
+        return;
+    }
+    incrRefCount(o);
+    expire = getExpire(c->db, c->argv[1]);
+    if(lookupKeyWrite(c->db, c->argv[2]) != NULL){
+        if(nx){
+            decrRefCount(o);
+            addReply(c, shared.czero);
+            return;
+        }
+        dbDelete(c->db, c->argv[2]);
+    }
+    dbAdd(c->db, c->argv[2], o);
+    if(expire != -1){
+        setExpire(c->db, c->argv[2], expire);
+    }
+    dbDelete(c->db, c->argv[1]);
+    addReply(c, nx ? shared.cone : shared.ok);
+}
+
+void renameCommand(redisClient *c){
+    renameGenericCommand(c, 0);
+}
+
+void renamenxCommand(redisClient *c){
+    renameGenericCommand(c, 1);
+}
+
+/**
+ * EXPIRE、PEXPIRE、EXPIREAT、PEXPIREAT的通用实现
+ * basetime为相对时间的基准（绝对时间时为0），unit为秒或者毫秒
+ */
+static void expireGenericCommand(redisClient *c, long long basetime, int unit){
+    robj *key = c->argv[1], *param = c->argv[2];
+    long long when;
+
+    if(getLongLongFromObjectOrReply(c, param, &when, NULL) != REDIS_OK){
+        return;
+    }
+    if(unit == UNIT_SECONDS){
+        when *= 1000;
+    }
+    when += basetime;
+
+    if(lookupKeyWrite(c->db, key) == NULL){
+        addReply(c, shared.czero);
+        return;
+    }
+    //过期时间已经到了，直接删除
+    if(when <= mstime()){
+        dbDelete(c->db, key);
+    }else{
+        setExpire(c->db, key, when);
+    }
+    addReply(c, shared.cone);
+}
+
+void expireCommand(redisClient *c){
+    expireGenericCommand(c, mstime(), UNIT_SECONDS);
+}
+
+void pexpireCommand(redisClient *c){
+    expireGenericCommand(c, mstime(), UNIT_MILLISECONDS);
+}
+
+void expireatCommand(redisClient *c){
+    expireGenericCommand(c, 0, UNIT_SECONDS);
+}
+
+void pexpireatCommand(redisClient *c){
+    expireGenericCommand(c, 0, UNIT_MILLISECONDS);
+}
+
+/**
+ * 键不存在返回-2，没有过期时间返回-1
+ */
+static void ttlGenericCommand(redisClient *c, int output_ms){
+    long long expire, ttl = -1;
+
+    if(lookupKeyRead(c->db, c->argv[1]) == NULL){
+        addReplyLongLong(c, -2);
+        return;
+    }
+    expire = getExpire(c->db, c->argv[1]);
+    if(expire != -1){
+        ttl = expire - mstime();
+        if(ttl < 0){
+            ttl = 0;
+        }
+    }
+    if(ttl == -1){
+        addReplyLongLong(c, -1);
+    }else{
+        addReplyLongLong(c, output_ms ? ttl : ((ttl+500)/1000));
+    }
+}
+
+void ttlCommand(redisClient *c){
+    ttlGenericCommand(c, 0);
+}
+
+void pttlCommand(redisClient *c){
+    ttlGenericCommand(c, 1);
+}
+
+void persistCommand(redisClient *c){
+    if(lookupKeyWrite(c->db, c->argv[1]) && removeExpire(c->db, c->argv[1])){
+        addReply(c, shared.cone);
+    }else{
+        addReply(c, shared.czero);
+    }
+}
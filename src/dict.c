@@ -2,8 +2,14 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <sys/time.h>
+#include <limits.h>
 #include "dict.h"
+#include "monotonic.h"
+#include "zmalloc.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 //控制字典是否可以自动rehash
 static int dict_can_resize = 1;
@@ -15,86 +21,126 @@ static unsigned int dict_force_resize_radio = 5;
  * 
  */
 static void _dictReset(dictht *ht);
-static int _dictInit(dict *d, dictType *type, void *privdata);
-static int _dictKeyIndex(dict *d, const void *key);
+static int _dictInit(dict *d, dictType *type, void *privdata, int engine);
+static long _dictKeyIndex(dict *d, const void *key, uint64_t hash);
 static int _dictExpandIfNeeded(dict *d);
 static size_t _dictNextPower(size_t size);
 static void _dictRehashStep(dict *d);
 static int _dictClear(dict *d, dictht *ht, void(callback)(void *));
 static int dictGenericDelete(dict *d, const void *key, int nofree);
+long long dictFingerprint(dict *d);
 
 /**
  * hash生成相关的函数
+ * 默认用SipHash-1-2，密钥在启动时随机生成，键来自客户端的字典都用它，防止hash flooding；
+ * 键不受客户端控制、或者只需要分散而不怕碰撞的场合可以用更快的dictGenFastHashFunction
  */
-static uint32_t dict_hash_function_seed = 5381;
-void dictSetHashFunctionSeed(unsigned int initval){
-    dict_hash_function_seed = initval;
-}
-unsigned int dictGetHashFunctionSeed(void){
+static uint8_t dict_hash_function_seed[16];
+//dictGenFastHashFunction使用的种子，由密钥的前8个字节混合得到
+static uint64_t dict_fast_hash_seed;
+static const uint64_t dict_wyhash_secret[4] = {0xa0761d6478bd642fULL, 0xe7037ed1a0b428dbULL,
+    0x8ebc6af09c88c6e3ULL, 0x589965cc75374cc3ULL};
+
+uint8_t *dictGetHashFunctionSeed(void){
     return dict_hash_function_seed;
 }
 
-/* MurmurHash2, by Austin Appleby
- * Note - This code makes a few assumptions about how your machine behaves -
- * 1. We can read a 4-byte value from any address without crashing
- * 2. sizeof(int) == 4
- *
- * And it has a few limitations -
- *
- * 1. It will not work incrementally.
- * 2. It will not produce the same results on little-endian and big-endian
- *    machines.
- */
-unsigned int dictGenHashFunction(const void *key, int len){
-    /* 'm' and 'r' are mixing constants generated offline.
-     They're not really 'magic', they just happen to work well.  */
-    uint32_t seed = dict_hash_function_seed;
-    const uint32_t m = 0x5bd1e995;
-    const int r = 24;
-
-    /* Initialize the hash to a 'random' value */
-    uint32_t h = seed ^ len;
-
-    /* Mix 4 bytes at a time into the hash */
-    const unsigned char *data = (const unsigned char *)key;
-
-    while(len >= 4) {
-        uint32_t k = *(uint32_t*)data;
-
-        k *= m;
-        k ^= k >> r;
-        k *= m;
+uint64_t dictGenHashFunction(const void *key, int len){
+    return siphash(key, len, dict_hash_function_seed);
+}
 
-        h *= m;
-        h ^= k;
+/**
+ * 不区分大小写的版本
+ */
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len){
+    return siphash_nocase(buf, len, dict_hash_function_seed);
+}
 
-        data += 4;
-        len -= 4;
-    }
+/**
+ * 快速hash，算法来自wyhash：每16字节只做一次64位乘法得到128位结果再折叠
+ * 种子取自同一个随机密钥，但这个算法没有抗碰撞攻击的保证，不能用在键来自客户端的字典上
+ */
+static inline uint64_t _wymix(uint64_t a, uint64_t b){
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, hb = b >> 32, la = (uint32_t)a, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    uint64_t hi = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+    return lo ^ hi;
+#endif
+}
 
-    /* Handle the last few bytes of the input array  */
-    switch(len) {
-    case 3: h ^= data[2] << 16;
-    case 2: h ^= data[1] << 8;
-    case 1: h ^= data[0]; h *= m;
-    };
+static inline uint64_t _wyr8(const uint8_t *p){
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
 
-    /* Do a few final mixes of the hash to ensure the last few
-     * bytes are well-incorporated. */
-    h ^= h >> 13;
-    h *= m;
-    h ^= h >> 15;
+static inline uint64_t _wyr4(const uint8_t *p){
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
 
-    return (unsigned int)h;
+//1到3个字节，首、中、尾各取一个
+static inline uint64_t _wyr3(const uint8_t *p, size_t k){
+    return (((uint64_t)p[0]) << 16) | (((uint64_t)p[k >> 1]) << 8) | p[k - 1];
 }
 
-/* And a case insensitive hash function (based on djb hash) */
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len){
-    unsigned int hash = (unsigned int)dict_hash_function_seed;
+/**
+ * 设置hash密钥，16个字节
+ */
+void dictSetHashFunctionSeed(uint8_t *seed){
+    memcpy(dict_hash_function_seed, seed, sizeof(dict_hash_function_seed));
+    memcpy(&dict_fast_hash_seed, seed, sizeof(dict_fast_hash_seed));
+    dict_fast_hash_seed ^= _wymix(dict_fast_hash_seed ^ dict_wyhash_secret[0], dict_wyhash_secret[1]);
+}
 
-    while (len--)
-        hash = ((hash << 5) + hash) + (tolower(*buf++)); /* hash * 33 + c */
-    return hash;
+uint64_t dictGenFastHashFunction(const void *key, int len){
+    const uint64_t *secret = dict_wyhash_secret;
+    const uint8_t *p = key;
+    size_t n = len;
+    uint64_t seed = dict_fast_hash_seed, a, b;
+
+    if(n <= 16){
+        if(n >= 4){
+            //4到16字节：头尾各取两个可能重叠的4字节
+            a = (_wyr4(p) << 32) | _wyr4(p + ((n >> 3) << 2));
+            b = (_wyr4(p + n - 4) << 32) | _wyr4(p + n - 4 - ((n >> 3) << 2));
+        }else if(n > 0){
+            a = _wyr3(p, n);
+            b = 0;
+        }else{
+            a = b = 0;
+        }
+    }else{
+        size_t i = n;
+        if(i > 48){
+            //三条独立的乘法链并行，充分利用流水线
+            uint64_t see1 = seed, see2 = seed;
+            do{
+                seed = _wymix(_wyr8(p) ^ secret[1], _wyr8(p + 8) ^ seed);
+                see1 = _wymix(_wyr8(p + 16) ^ secret[2], _wyr8(p + 24) ^ see1);
+                see2 = _wymix(_wyr8(p + 32) ^ secret[3], _wyr8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16){
+            seed = _wymix(_wyr8(p) ^ secret[1], _wyr8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = _wyr8(p + i - 16);
+        b = _wyr8(p + i - 8);
+    }
+    return _wymix(secret[1] ^ n, _wymix(a ^ secret[1], b ^ seed));
 }
 
 /**
@@ -104,22 +150,27 @@ static void _dictReset(dictht *ht){
     ht->size = 0;
     ht->sizemask = 0;
     ht->table = NULL;
+    ht->ctrl = NULL;
+    ht->slots = NULL;
     ht->used = 0;
+    ht->deleted = 0;
 }
 
 /**
  * 将给定的dict初始化
  */ 
-static int _dictInit(dict *d, dictType *type, void *privdata){
+static int _dictInit(dict *d, dictType *type, void *privdata, int engine){
     //注意要加&，因为ht数组定义的时候并不是指针而是真值
     _dictReset(&d->ht[0]);
     _dictReset(&d->ht[1]);
     //暂不对里面的hash表进行分配内存
 
+    d->engine = engine;
     d->type = type;
     d->rehashindex = -1;
     d->privdata = privdata;
     d->iterators = 0;
+    slabPoolInit(&d->nodepool, sizeof(dictNode));
     return DICT_OK;
 }
 
@@ -129,27 +180,25 @@ static int _dictInit(dict *d, dictType *type, void *privdata){
  * 如果字典正在rehash，则要去1号表查索引，而不是0号
  * rehash过程中所有的新key都会放到1号表
  */ 
-static int _dictKeyIndex(dict *d, const void *key){
+static long _dictKeyIndex(dict *d, const void *key, uint64_t hash){
 
     //在这里检查hash表是否需要扩展（注意只有在这里才会检查）
     if(_dictExpandIfNeeded(d) == DICT_ERR){
         return -1;
     }
 
-    //计算hash值
-    unsigned int hash = dictHashKey(d, key);
-    unsigned int index;
-    dictEntry *entry;
+    size_t index;
+    dictNode *node;
     //遍历2个hash表,从0号表开始
     for(unsigned int i = 0; i <= 1; i++){
         index = hash & d->ht[i].sizemask;
-        entry = d->ht[i].table[index];
+        node = d->ht[i].table[index];
         //遍历这个桶，把每个entry的key都比较，看是否和新key重复
-        while(entry){
-            if(dictCompareKeys(d, entry->key, key)){
+        while(node){
+            if(node->hash == hash && dictCompareKeys(d, node->entry.key, key)){
                 return -1;
             }
-            entry = entry->next;
+            node = node->next;
         }
         //已经遍历完了0号表，如果没有rehash，则不会再遍历1号表，当做没找到重复从而返回桶索引值
         if(!dictIsRehashing(d)){
@@ -217,42 +266,574 @@ static size_t _dictNextPower(size_t size){
     }
 }
 
+/*-------------------------------- 开放寻址引擎 --------------------------------*/
+
+/**
+ * 槽数组按16个槽分组，每个槽有一个控制字节：
+ * 空槽是0x80，墓碑是0xFE，已使用的槽是0到127，保存hash的低7位（h2）；
+ * hash的其余位（h1）决定从哪一组开始探测，查找时一条指令比较一组的16个控制字节，
+ * 只有h2相同的槽才需要比较key，绝大多数不命中的比较都在控制字节上完成
+ *
+ * 探测序列：组下标按二进制反转之后加1，和dictScan的游标顺序一样，
+ * 这样一组满了之后溢出的节点，在扫描到它的起始组时可以沿着探测序列顺带访问到
+ *
+ * 删除时如果所在的组里还有空槽，说明这一组从来没有满过，没有探测序列经过它，直接置为空槽；
+ * 否则置为墓碑，让经过这里的查找继续往后探测。所以一组里有空槽时查找就可以停下了
+ */
+#define DICT_CTRL_EMPTY ((int8_t)-128)
+#define DICT_CTRL_DELETED ((int8_t)-2)
+//h2在控制字节里，h1决定起始组
+#define DICT_SWISS_H2(hash) ((int8_t)((hash) & 0x7f))
+#define DICT_SWISS_H1(hash) ((hash) >> 7)
+//负载（包括墓碑）达到7/8时扩容或者重建
+#define DICT_SWISS_MAX_LOAD(size) ((size) - (size) / 8)
+
+#if defined(__SSE2__)
+/**
+ * 返回一组中控制字节等于c的槽的位图
+ */
+static inline unsigned int _dictGroupMatch(const int8_t *ctrl, int8_t c){
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+}
+
+/**
+ * 返回一组中空槽和墓碑的位图，两者的最高位都是1
+ */
+static inline unsigned int _dictGroupMatchFree(const int8_t *ctrl){
+    return (unsigned int)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl));
+}
+#else
+static inline unsigned int _dictGroupMatch(const int8_t *ctrl, int8_t c){
+    unsigned int mask = 0;
+    for(int i = 0; i < DICT_SWISS_GROUP_SIZE; i++){
+        mask |= (unsigned int)(ctrl[i] == c) << i;
+    }
+    return mask;
+}
+
+static inline unsigned int _dictGroupMatchFree(const int8_t *ctrl){
+    unsigned int mask = 0;
+    for(int i = 0; i < DICT_SWISS_GROUP_SIZE; i++){
+        mask |= (unsigned int)(ctrl[i] < 0) << i;
+    }
+    return mask;
+}
+#endif
+
+static inline unsigned int _dictGroupMatchEmpty(const int8_t *ctrl){
+    return _dictGroupMatch(ctrl, DICT_CTRL_EMPTY);
+}
+
+static inline unsigned int _dictGroupMatchFull(const int8_t *ctrl){
+    return ~_dictGroupMatchFree(ctrl) & 0xffff;
+}
+
+/**
+ * 把v的二进制位反转，dictScan和开放寻址的探测序列用它让下标从高位开始加1
+ */
+static unsigned long rev(unsigned long v){
+    unsigned long s = 8 * sizeof(v);    //位数，必须是2的幂
+    unsigned long mask = ~0UL;
+    while((s >>= 1) > 0){
+        mask ^= (mask << s);
+        v = ((v >> s) & mask) | ((v << s) & ~mask);
+    }
+    return v;
+}
+
+/**
+ * 探测序列中的下一组，mask是组数-1，连续调用组数次正好访问每一组一次
+ */
+static inline size_t _dictSwissNextGroup(size_t g, size_t mask){
+    g |= ~mask;
+    g = rev(g);
+    g++;
+    g = rev(g);
+    return g & mask;
+}
+
+/**
+ * 容纳size个节点而不超过负载上限的最小槽数，至少一组
+ */
+static size_t _dictSwissSlotsFor(size_t size){
+    size_t slots = DICT_SWISS_GROUP_SIZE;
+    while(DICT_SWISS_MAX_LOAD(slots) < size && slots < LONG_MAX / 2){
+        slots *= 2;
+    }
+    return slots;
+}
+
+/**
+ * 分配一个有size个槽的表，槽数组和控制字节数组在同一块内存中
+ */
+static void _dictSwissInitTable(dictht *ht, size_t size){
+    _dictReset(ht);
+    ht->size = size;
+    ht->sizemask = size / DICT_SWISS_GROUP_SIZE - 1;
+    ht->slots = zmalloc(size * (sizeof(dictEntry) + 1));
+    ht->ctrl = (int8_t*)(ht->slots + size);
+    memset(ht->ctrl, DICT_CTRL_EMPTY, size);
+}
+
+/**
+ * 在一个表中查找key，返回槽下标，找不到返回-1
+ */
+static long _dictSwissLookup(dict *d, dictht *ht, const void *key, uint64_t hash){
+    if(ht->used == 0){
+        return -1;
+    }
+    int8_t h2 = DICT_SWISS_H2(hash);
+    size_t g = DICT_SWISS_H1(hash) & ht->sizemask;
+    for(size_t probes = 0; probes <= ht->sizemask; probes++){
+        const int8_t *ctrl = ht->ctrl + g * DICT_SWISS_GROUP_SIZE;
+        unsigned int match = _dictGroupMatch(ctrl, h2);
+        while(match){
+            size_t idx = g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(match);
+            if(dictCompareKeys(d, ht->slots[idx].key, key)){
+                return idx;
+            }
+            match &= match - 1;
+        }
+        //有空槽说明这一组没有满过，key不会在后面的组里
+        if(_dictGroupMatchEmpty(ctrl)){
+            return -1;
+        }
+        g = _dictSwissNextGroup(g, ht->sizemask);
+    }
+    return -1;
+}
+
+/**
+ * 沿着探测序列找到第一个空槽或者墓碑，占用它并返回槽下标
+ * 调用方保证key不在表中并且表没有满
+ */
+static size_t _dictSwissInsertSlot(dictht *ht, uint64_t hash){
+    size_t g = DICT_SWISS_H1(hash) & ht->sizemask;
+    for(size_t probes = 0; probes <= ht->sizemask; probes++){
+        unsigned int free = _dictGroupMatchFree(ht->ctrl + g * DICT_SWISS_GROUP_SIZE);
+        if(free){
+            size_t idx = g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(free);
+            if(ht->ctrl[idx] == DICT_CTRL_DELETED){
+                ht->deleted--;
+            }
+            ht->ctrl[idx] = DICT_SWISS_H2(hash);
+            ht->used++;
+            return idx;
+        }
+        g = _dictSwissNextGroup(g, ht->sizemask);
+    }
+    assert(0);
+    return 0;
+}
+
+/**
+ * 释放一个槽，规则见本节开头
+ */
+static void _dictSwissEraseSlot(dictht *ht, size_t idx){
+    const int8_t *group = ht->ctrl + (idx & ~(size_t)(DICT_SWISS_GROUP_SIZE - 1));
+    if(_dictGroupMatchEmpty(group)){
+        ht->ctrl[idx] = DICT_CTRL_EMPTY;
+    }else{
+        ht->ctrl[idx] = DICT_CTRL_DELETED;
+        ht->deleted++;
+    }
+    ht->used--;
+}
+
+/**
+ * 开放寻址法的dictExpand，size是要容纳的节点数
+ * 新表的大小不一定比原来大：墓碑太多时用同样大小（甚至更小）的表重建，同样走渐进式rehash
+ * 每次插入都先迁移至少一个组，迁移完成前最多再插入0号表组数个节点，1号表按这个数量留出余量，迁移期间不会装满
+ */
+static int _dictSwissExpand(dict *d, size_t size){
+    if(dictIsRehashing(d) || size < d->ht[0].used){
+        return DICT_ERR;
+    }
+    if(d->ht[0].size != 0 && size < d->ht[0].used + d->ht[0].size / DICT_SWISS_GROUP_SIZE){
+        size = d->ht[0].used + d->ht[0].size / DICT_SWISS_GROUP_SIZE;
+    }
+    dictht n;
+    _dictSwissInitTable(&n, _dictSwissSlotsFor(size));
+    if(d->ht[0].size == 0){
+        d->ht[0] = n;
+    }else{
+        d->ht[1] = n;
+        d->rehashindex = 0;
+    }
+    return DICT_OK;
+}
+
+/**
+ * 插入前检查负载，开放寻址的表不能超载，所以不受dict_can_resize控制
+ * rehash中1号表留了余量，只有安全迭代器暂停了迁移时才会到达负载上限：
+ * 这时没有安全迭代器就多迁移一批，但不一次做完，避免卡住；还没迁移完就继续往1号表里插入，直到真的放不下
+ */
+static int _dictSwissExpandIfNeeded(dict *d){
+    if(dictIsRehashing(d)){
+        if(d->ht[1].used + d->ht[1].deleted < DICT_SWISS_MAX_LOAD(d->ht[1].size)){
+            return DICT_OK;
+        }
+        if(d->iterators == 0){
+            dictRehash(d, 100);
+        }
+        if(dictIsRehashing(d)){
+            return d->ht[1].used < d->ht[1].size ? DICT_OK : DICT_ERR;
+        }
+    }
+    if(d->ht[0].size == 0){
+        return _dictSwissExpand(d, DICT_HT_INITIAL_SIZE);
+    }
+    //按节点数的两倍分配：墓碑不多时表扩大一倍，墓碑占了一半以上的负载时原样大小重建
+    if(d->ht[0].used + d->ht[0].deleted >= DICT_SWISS_MAX_LOAD(d->ht[0].size)){
+        return _dictSwissExpand(d, d->ht[0].used * 2);
+    }
+    return DICT_OK;
+}
+
+static dictEntry *_dictSwissAddRaw(dict *d, void *key){
+    if(dictIsRehashing(d)){
+        _dictRehashStep(d);
+    }
+    if(_dictSwissExpandIfNeeded(d) == DICT_ERR){
+        return NULL;
+    }
+
+    uint64_t hash = dictHashKey(d, key);
+    if(_dictSwissLookup(d, &d->ht[0], key, hash) != -1){
+        return NULL;
+    }
+    if(dictIsRehashing(d) && _dictSwissLookup(d, &d->ht[1], key, hash) != -1){
+        return NULL;
+    }
+
+    //rehash中新节点都放到1号表
+    dictht *ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    dictEntry *entry = &ht->slots[_dictSwissInsertSlot(ht, hash)];
+    dictSetKey(d, entry, key);
+    return entry;
+}
+
+/**
+ * 查找不做单步rehash，这样只读的操作不会移动节点，之前返回的节点指针仍然有效
+ */
+static dictEntry *_dictSwissFindWithHash(dict *d, const void *key, uint64_t hash){
+    for(int i = 0; i <= 1; i++){
+        long idx = _dictSwissLookup(d, &d->ht[i], key, hash);
+        if(idx != -1){
+            return &d->ht[i].slots[idx];
+        }
+        if(!dictIsRehashing(d)){
+            break;
+        }
+    }
+    return NULL;
+}
+
+static int _dictSwissDelete(dict *d, const void *key, int nofree){
+    if(dictSize(d) == 0){
+        return DICT_ERR;
+    }
+    if(dictIsRehashing(d)){
+        _dictRehashStep(d);
+    }
+    uint64_t hash = dictHashKey(d, key);
+    for(int i = 0; i <= 1; i++){
+        dictht *ht = &d->ht[i];
+        long idx = _dictSwissLookup(d, ht, key, hash);
+        if(idx != -1){
+            if(!nofree){
+                dictFreeKey(d, (&ht->slots[idx]));
+                dictFreeVal(d, (&ht->slots[idx]));
+            }
+            _dictSwissEraseSlot(ht, idx);
+            return DICT_OK;
+        }
+        if(!dictIsRehashing(d)){
+            break;
+        }
+    }
+    return DICT_ERR;
+}
+
+/**
+ * 迁移N个非空的组，最多访问N*10个空组，返回值和dictRehash相同
+ * 迁移走的槽留下墓碑：0号表里还没迁移的节点，探测序列可能经过已经迁移的组
+ */
+static int _dictSwissRehash(dict *d, int n){
+    int empty_visits = n * 10;
+    dictht *from = &d->ht[0], *to = &d->ht[1];
+
+    while(n-- && from->used != 0){
+        unsigned int full;
+        assert(from->size > (size_t)d->rehashindex);
+        while((full = _dictGroupMatchFull(from->ctrl + d->rehashindex)) == 0){
+            d->rehashindex += DICT_SWISS_GROUP_SIZE;
+            if(--empty_visits == 0){
+                return 1;
+            }
+        }
+        //槽里没有缓存hash值，迁移要重新计算，先把这一组的key都预取进cache，让访存互相重叠
+        for(unsigned int m = full; m; m &= m - 1){
+            __builtin_prefetch(from->slots[d->rehashindex + __builtin_ctz(m)].key);
+        }
+        while(full){
+            size_t idx = d->rehashindex + __builtin_ctz(full);
+            dictEntry *entry = &from->slots[idx];
+            to->slots[_dictSwissInsertSlot(to, dictHashKey(d, entry->key))] = *entry;
+            from->ctrl[idx] = DICT_CTRL_DELETED;
+            from->used--;
+            full &= full - 1;
+        }
+        d->rehashindex += DICT_SWISS_GROUP_SIZE;
+    }
+
+    if(from->used == 0){
+        zfree(from->slots);
+        d->ht[0] = d->ht[1];
+        _dictReset(&d->ht[1]);
+        d->rehashindex = -1;
+        return 0;
+    }
+    return 1;
+}
+
+static void _dictSwissClear(dict *d, dictht *ht, void(callback)(void *)){
+    //没有析构函数时不用逐个访问节点
+    if(d->type->keyDestructor || d->type->valDestructor || callback){
+        for(size_t i = 0; i < ht->size && ht->used > 0; i++){
+            if(callback && (i & 65535) == 0){
+                callback(d->privdata);
+            }
+            if(ht->ctrl[i] < 0){
+                continue;
+            }
+            dictFreeKey(d, (&ht->slots[i]));
+            dictFreeVal(d, (&ht->slots[i]));
+            ht->used--;
+        }
+    }
+    zfree(ht->slots);
+    _dictReset(ht);
+}
+
+static dictEntry *_dictSwissNext(dictIterator *iter){
+    dict *d = iter->d;
+    if(iter->index == -1 && iter->table == 0){
+        if(iter->safe){
+            d->iterators++;
+        }else{
+            iter->fingerprint = dictFingerprint(d);
+        }
+    }
+    while(1){
+        dictht *ht = &d->ht[iter->table];
+        iter->index++;
+        if((size_t)iter->index >= ht->size){
+            if(dictIsRehashing(d) && iter->table == 0){
+                iter->table++;
+                iter->index = -1;
+                continue;
+            }
+            return NULL;
+        }
+        if(ht->ctrl[iter->index] >= 0){
+            return &ht->slots[iter->index];
+        }
+    }
+}
+
+/**
+ * 先随机选一个有节点的组，再在组里随机选一个节点，负载不低于7/16，很快就能选到
+ * 和查找一样不做单步rehash
+ */
+static dictEntry *_dictSwissGetRandomKey(dict *d){
+    if(dictSize(d) == 0){
+        return NULL;
+    }
+    while(1){
+        dictht *ht = &d->ht[0];
+        size_t g;
+        if(dictIsRehashing(d)){
+            //0号表中rehashindex之前的组已经空了
+            size_t groups0 = d->ht[0].size / DICT_SWISS_GROUP_SIZE;
+            size_t start = d->rehashindex / DICT_SWISS_GROUP_SIZE;
+            g = start + random() % (groups0 + d->ht[1].size / DICT_SWISS_GROUP_SIZE - start);
+            if(g >= groups0){
+                ht = &d->ht[1];
+                g -= groups0;
+            }
+        }else{
+            g = random() & ht->sizemask;
+        }
+        unsigned int full = _dictGroupMatchFull(ht->ctrl + g * DICT_SWISS_GROUP_SIZE);
+        if(full == 0){
+            continue;
+        }
+        int k = random() % __builtin_popcount(full);
+        while(k--){
+            full &= full - 1;
+        }
+        return &ht->slots[g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(full)];
+    }
+}
+
+/**
+ * 和拉链法的dictGetSomeKeys一样，从随机的一组开始连续扫描，空组太多时换一个位置
+ */
+static unsigned int _dictSwissGetSomeKeys(dict *d, dictEntry **des, unsigned int count){
+    unsigned long stored = 0, maxsteps, emptylen = 0;
+    int tables = dictIsRehashing(d) ? 2 : 1;
+
+    if(dictSize(d) < count){
+        count = dictSize(d);
+    }
+    maxsteps = count * 10;
+
+    size_t maxsizemask = d->ht[0].sizemask;
+    if(tables > 1 && maxsizemask < d->ht[1].sizemask){
+        maxsizemask = d->ht[1].sizemask;
+    }
+
+    size_t g = random() & maxsizemask;
+    while(stored < count && maxsteps--){
+        for(int j = 0; j < tables; j++){
+            dictht *ht = &d->ht[j];
+            if(g > ht->sizemask){
+                continue;
+            }
+            if(tables == 2 && j == 0 && g * DICT_SWISS_GROUP_SIZE < (size_t)d->rehashindex){
+                continue;
+            }
+            unsigned int full = _dictGroupMatchFull(ht->ctrl + g * DICT_SWISS_GROUP_SIZE);
+            if(full == 0){
+                emptylen++;
+                if(emptylen >= 5 && emptylen > count){
+                    g = random() & maxsizemask;
+                    emptylen = 0;
+                }
+                continue;
+            }
+            emptylen = 0;
+            while(full){
+                *des++ = &ht->slots[g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(full)];
+                full &= full - 1;
+                if(++stored == count){
+                    return stored;
+                }
+            }
+        }
+        g = (g + 1) & maxsizemask;
+    }
+    return stored;
+}
+
+/**
+ * 扫描第g组，如果这一组满过（没有空槽），从它溢出的节点在探测序列后面的组里，一直扫到有空槽的组为止
+ * 这样起始组是g的节点都会在这次调用中返回，扩容缩容时dictScan的保证仍然成立，代价是可能重复返回
+ */
+static void _dictSwissScanGroup(dictht *ht, size_t g, dictScanFunction *fn, void *privdata){
+    for(size_t probes = 0; probes <= ht->sizemask; probes++){
+        const int8_t *ctrl = ht->ctrl + g * DICT_SWISS_GROUP_SIZE;
+        unsigned int full = _dictGroupMatchFull(ctrl);
+        while(full){
+            fn(privdata, &ht->slots[g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(full)]);
+            full &= full - 1;
+        }
+        if(_dictGroupMatchEmpty(ctrl)){
+            return;
+        }
+        g = _dictSwissNextGroup(g, ht->sizemask);
+    }
+}
+
+/**
+ * 游标是组下标，其余和拉链法的dictScan相同
+ */
+static unsigned long _dictSwissScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata){
+    dictht *t0, *t1;
+    unsigned long m0, m1;
+
+    if(!dictIsRehashing(d)){
+        t0 = &d->ht[0];
+        m0 = t0->sizemask;
+        _dictSwissScanGroup(t0, v & m0, fn, privdata);
+        v |= ~m0;
+        v = rev(v);
+        v++;
+        v = rev(v);
+    }else{
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+        if(t0->size > t1->size){
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        _dictSwissScanGroup(t0, v & m0, fn, privdata);
+        do{
+            _dictSwissScanGroup(t1, v & m1, fn, privdata);
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+        }while(v & (m0 ^ m1));
+    }
+    return v;
+}
+
 /**
  * 清空给定的hash表：
  * 1.遍历table，获取每个桶的首位entry
- * 2.清理entry的key和val，最后才能free，并且继续清理后面的entry
- * 
+ * 2.清理entry的key和val，并且继续清理后面的entry
+ * 节点本身不在这里释放，由调用方通过slabPoolRelease一次归还
  */ 
 static int _dictClear(dict *d, dictht *ht, void(callback)(void *)){
+    if(d->engine == DICT_ENGINE_SWISS){
+        _dictSwissClear(d, ht, callback);
+        return DICT_OK;
+    }
+
+    //没有销毁函数时节点中没有需要处理的东西，直接跳过遍历
+    int destruct = d->type->keyDestructor != NULL || d->type->valDestructor != NULL;
 
     //遍历hash表中的每一个entry，直到遍历size次，或者used为0了
-    for (size_t i = 0; i < ht->size && ht->used > 0; i++){
+    for (size_t i = 0; destruct && i < ht->size && ht->used > 0; i++){
 
         //这步看不懂，应该是要传入一个回调函数来执行
         if (callback && (i & 65535) == 0){
             callback(d->privdata);
         }
 
-        dictEntry *entry, *nextEntry;
+        //按桶的顺序访问节点是随机访存，提前预取后面桶的节点和节点的key
+        if(i + 16 < ht->size){
+            __builtin_prefetch(ht->table[i+16]);
+        }
+        if(i + 8 < ht->size && ht->table[i+8]){
+            __builtin_prefetch(ht->table[i+8]->entry.key);
+        }
+
+        dictNode *node, *nextNode;
         //如果table为NULL桶，则跳过
-        if((entry = ht->table[i]) == NULL){
+        if((node = ht->table[i]) == NULL){
             continue;
         }
         //开始遍历单个桶
-        while(entry){
+        while(node){
             //尝试将下一个entry暂存
-            nextEntry = entry->next;
-            //删除key和val，并释放entry指向的内容，还要used减1
-            dictFreeKey(d, entry);
-            dictFreeVal(d, entry);
-            free(entry);
+            nextNode = node->next;
+            //删除key和val，还要used减1
+            dictFreeKey(d, (&node->entry));
+            dictFreeVal(d, (&node->entry));
             ht->used--;
-            entry = nextEntry;
+            node = nextNode;
         }
     }
 
     //全部table里面的entry清理完毕，table这个数组本身也要清理
-    free(ht->table);
+    zfree(ht->table);
     //最后重置这个hash表的其他字段值
     _dictReset(ht);
     return DICT_OK;
@@ -263,7 +844,10 @@ static int _dictClear(dict *d, dictht *ht, void(callback)(void *)){
  * nofree为0表示调用key和value的free函数，否则就不调用
  */ 
 static int dictGenericDelete(dict *d, const void *key, int nofree){
-    
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissDelete(d, key, nofree);
+    }
+
     //hash表如果为空，直接返回ERR
     if(d->ht[0].size == 0){
         return DICT_ERR;
@@ -275,33 +859,34 @@ static int dictGenericDelete(dict *d, const void *key, int nofree){
     }
 
     //计算hash值
-    unsigned int hash = dictHashKey(d, key);
-    dictEntry *entry, *prevEntry;
+    uint64_t hash = dictHashKey(d, key);
+    dictNode *node, *prevNode;
     for (int i = 0; i <= 1; i++){
+        prevNode = NULL;
         //返回桶索引值
-        unsigned int index = hash & d->ht[i].sizemask;
-        entry = d->ht[i].table[index];
-        while(entry){
-            if(dictCompareKeys(d, entry->key, key)){
-                if(prevEntry){  //如果prevEntry不为NULL，说明是中间或最后一个元素
+        size_t index = hash & d->ht[i].sizemask;
+        node = d->ht[i].table[index];
+        while(node){
+            if(node->hash == hash && dictCompareKeys(d, node->entry.key, key)){
+                if(prevNode){  //如果prevNode不为NULL，说明是中间或最后一个元素
                     //直接修改前一个元素next，指向本元素的next，相当于去掉自身元素
-                    prevEntry->next = entry->next;
-                }else{  //如果prevEntry为NULL，说明这次是首元素
+                    prevNode->next = node->next;
+                }else{  //如果prevNode为NULL，说明这次是首元素
                     //直接修改桶的第一个指向，直接指向本元素的next
-                    d->ht[i].table[index] = entry->next;
+                    d->ht[i].table[index] = node->next;
                 }
                 if(!nofree){    //释放key和value
-                    dictFreeKey(d, entry);
-                    dictFreeVal(d, entry);
+                    dictFreeKey(d, (&node->entry));
+                    dictFreeVal(d, (&node->entry));
                 }
                 //释放当前entry，used减一
-                free(entry);
+                slabFree(&d->nodepool, node);
                 d->ht[i].used--;
                 return DICT_OK;
             }
             //没找到还要暂存前一个节点和当前节点
-            prevEntry = entry;
-            entry = entry->next;
+            prevNode = node;
+            node = node->next;
         }
         if(!dictIsRehashing(d)){    //如果没有在rehash，也就不用再扫描1号表了
             break;
@@ -326,6 +911,9 @@ int dictNoFreeDelete(dict *d, const void *key){
  * 等于是对2个hash表做类似的操作，但是调用时机不同（一个是最初存储，一个是准备扩展）
  */ 
 int dictExpand(dict *d, size_t size){
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissExpand(d, size);
+    }
     //如果正在rehash，或者新的size比used还要小（相等于收缩过度了），直接返回1
     if(dictIsRehashing(d) || size < d->ht[0].used){
         return DICT_ERR;
@@ -340,7 +928,7 @@ int dictExpand(dict *d, size_t size){
     n.sizemask = newSize - 1;
     n.used = 0;
     //为entry数组分配空间，大小为newSize*单个dictEntry指针大小
-    n.table = calloc(1, newSize*(sizeof(dictEntry*)));
+    n.table = zcalloc(newSize*sizeof(dictNode*));
 
     if(d->ht[0].table == NULL){ //说明是初始化字典本身
         d->ht[0] = n;
@@ -353,14 +941,21 @@ int dictExpand(dict *d, size_t size){
 }
 
 /**
- * 创建一个新的dict
+ * 创建一个新的dict，使用拉链法
  */ 
 dict *dictCreate(dictType *type, void *privdata){
-    dict *d = malloc(sizeof(*d));
+    return dictCreateWithEngine(type, privdata, DICT_ENGINE_CHAINED);
+}
+
+/**
+ * 创建一个使用指定存储引擎的dict
+ */
+dict *dictCreateWithEngine(dictType *type, void *privdata, int engine){
+    dict *d = zmalloc(sizeof(*d));
     if(d == NULL){
         return NULL;
     }
-    _dictInit(d, type, privdata);
+    _dictInit(d, type, privdata, engine);
     return d;
 }
 
@@ -368,10 +963,11 @@ dict *dictCreate(dictType *type, void *privdata){
  * 删除并释放整个字典
  */ 
 void dictRelease(dict *d){
-    //先删除2个hash表
+    //先删除2个hash表，再一次释放所有节点
     _dictClear(d, &(d->ht[0]), NULL);
     _dictClear(d, &(d->ht[1]), NULL);
-    free(d);
+    slabPoolRelease(&d->nodepool);
+    zfree(d);
 }
 
 /**
@@ -436,58 +1032,56 @@ int dictReplace(dict *d, void *key, void *val){
  * 如果key已经存在，则返回NULL
  */ 
 dictEntry *dictAddRaw(dict *d, void *key){
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissAddRaw(d, key);
+    }
     //只要尝试新增key，就尝试执行单步rehash
     if(dictIsRehashing(d)){
         _dictRehashStep(d);
     }
 
-    //开始根据key找到是否已存在
-    int index = _dictKeyIndex(d, key);
+    //开始根据key找到是否已存在，hash值保存在节点里
+    uint64_t hash = dictHashKey(d, key);
+    long index = _dictKeyIndex(d, key, hash);
     if(index == -1){    //已存在则返回NULL
         return NULL;
     }
 
     dictht *ht;
     //如果正在rehash，则往1号表增加，否则往0号表增加
-    ht = dictIsRehashing(d) ? &d->ht[0] : &d->ht[1];
-    //给entry分配空间
-    dictEntry *entry;
-    entry = malloc(sizeof(*entry));
+    ht = dictIsRehashing(d) ? &d->ht[1] : &d->ht[0];
+    //从字典的slab池中给entry分配空间
+    dictNode *node = slabAlloc(&d->nodepool);
+    node->hash = hash;
     //将新的entry插入hash桶的头部
-    entry->next = ht->table[index];
-    ht->table[index] = entry;
+    node->next = ht->table[index];
+    ht->table[index] = node;
     ht->used++;
-    dictSetKey(d, entry, key);
+    dictSetKey(d, (&node->entry), key);
 
-    return entry;
+    return &node->entry;
 }
 
 /**
- * 根据key寻找entry，实现类似_dictKeyIndex函数
- * 
- */ 
-dictEntry *dictFind(dict *d, void *key){
-
-    if(d->ht[0].size == 0){ //hash表为空直接返回NULL
-        return NULL;
-    }
-
-    if(dictIsRehashing(d)){ //尝试单步rehash
-        _dictRehashStep(d);
+ * 用已经算好的hash查找key，实现类似_dictKeyIndex函数，不做单步rehash
+ * 沿着链表比较时顺便预取下一个节点
+ */
+static dictEntry *_dictFindWithHash(dict *d, const void *key, uint64_t hash){
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissFindWithHash(d, key, hash);
     }
 
-    //算出hash值
-    unsigned int hash = dictHashKey(d, key);
-    dictEntry *entry;
+    dictNode *node;
     //遍历2个hash表
     for (int i = 0; i <= 1; i++){
-        unsigned int index = hash & d->ht[i].sizemask;
-        entry = d->ht[i].table[index];
-        while(entry){
-            if(dictCompareKeys(d, entry->key, key)){
-                return entry;
+        size_t index = hash & d->ht[i].sizemask;
+        node = d->ht[i].table[index];
+        while(node){
+            __builtin_prefetch(node->next);
+            if(node->hash == hash && dictCompareKeys(d, node->entry.key, key)){
+                return &node->entry;
             }
-            entry = entry->next;
+            node = node->next;
         }
         if(!dictIsRehashing(d)){    //如果没有rehash中，找一遍就到了，到这里说明已经找不到了
             return NULL;
@@ -498,6 +1092,20 @@ dictEntry *dictFind(dict *d, void *key){
     return NULL;
 }
 
+/**
+ * 根据key寻找entry
+ * 拉链法会顺便做单步rehash；开放寻址法的查找不移动节点，之前返回的节点指针仍然有效
+ */ 
+dictEntry *dictFind(dict *d, void *key){
+    if(dictSize(d) == 0){ //hash表为空直接返回NULL
+        return NULL;
+    }
+    if(d->engine == DICT_ENGINE_CHAINED && dictIsRehashing(d)){ //尝试单步rehash
+        _dictRehashStep(d);
+    }
+    return _dictFindWithHash(d, key, dictHashKey(d, key));
+}
+
 /**
  * 根据给定的key，从字典中查找相应的value并返回，否则返回NULL
  */ 
@@ -511,75 +1119,191 @@ void *dictFetchValue(dict *d, void *key){
 }
 
 /**
- *  执行N步渐进式rehash
- *  返回1表示只移动了一部分hash内容过去
+ * 预取hash值对应的桶（拉链法）或者控制字节组（开放寻址法），rehash时两个表都预取
+ */
+static void _dictPrefetchBucket(dict *d, uint64_t hash){
+    for(int i = 0; i <= 1; i++){
+        dictht *ht = &d->ht[i];
+        if(ht->size == 0){
+            return;
+        }
+        if(d->engine == DICT_ENGINE_SWISS){
+            __builtin_prefetch(ht->ctrl + (DICT_SWISS_H1(hash) & ht->sizemask) * DICT_SWISS_GROUP_SIZE);
+        }else{
+            __builtin_prefetch(&ht->table[hash & ht->sizemask]);
+        }
+        if(!dictIsRehashing(d)){
+            return;
+        }
+    }
+}
+
+/**
+ * 按提前算好的hash值预取查找时要访问的内存，不比较key，也不修改字典
+ * 逐个查找时每个key都要依次等待 桶/控制字节 -> 节点 -> key 几次cache miss，
+ * 这里分几遍处理，每一遍只为所有hash走一步并预取下一步要访问的内存，不同key的访存互相重叠
+ * count最多DICT_BATCH_SIZE个，调用方之后的查找需要的数据基本都已经在cache中了
+ */
+void dictPrefetchHashes(dict *d, const uint64_t *hashes, unsigned int count){
+    dictEntry *cand[DICT_BATCH_SIZE];
+    dictht *ht = &d->ht[0];
+
+    if(dictSize(d) == 0){
+        return;
+    }
+    //第一遍：预取桶或者控制字节组
+    for(unsigned int j = 0; j < count; j++){
+        _dictPrefetchBucket(d, hashes[j]);
+    }
+    //rehash时节点可能在任意一个表里，只预取到第一步
+    if(dictIsRehashing(d)){
+        return;
+    }
+
+    //第二遍：找出第一个候选节点并预取，开放寻址法是控制字节匹配的第一个槽，拉链法是桶里的第一个节点
+    for(unsigned int j = 0; j < count; j++){
+        cand[j] = NULL;
+        if(d->engine == DICT_ENGINE_SWISS){
+            size_t g = DICT_SWISS_H1(hashes[j]) & ht->sizemask;
+            unsigned int match = _dictGroupMatch(ht->ctrl + g * DICT_SWISS_GROUP_SIZE, DICT_SWISS_H2(hashes[j]));
+            if(match){
+                cand[j] = &ht->slots[g * DICT_SWISS_GROUP_SIZE + __builtin_ctz(match)];
+            }
+        }else{
+            dictNode *node = ht->table[hashes[j] & ht->sizemask];
+            if(node){
+                cand[j] = &node->entry;
+            }
+        }
+        if(cand[j]){
+            __builtin_prefetch(cand[j]);
+        }
+    }
+
+    //第三遍：预取候选节点的key；拉链法中hash不同的节点不可能匹配，改为预取链表的下一个节点
+    for(unsigned int j = 0; j < count; j++){
+        if(cand[j] == NULL){
+            continue;
+        }
+        if(d->engine == DICT_ENGINE_CHAINED && ((dictNode*)cand[j])->hash != hashes[j]){
+            __builtin_prefetch(((dictNode*)cand[j])->next);
+        }else{
+            __builtin_prefetch(cand[j]->key);
+        }
+    }
+}
+
+/**
+ * 批量查找count个key，结果按顺序放到des中，找不到的为NULL
+ * 每DICT_BATCH_SIZE个key先用dictPrefetchHashes把访存发出去，再逐个完整地查找
+ * 返回的节点指针和dictFind一样，在下一次修改字典之前有效
+ */
+void dictFindBatch(dict *d, void **keys, unsigned int count, dictEntry **des){
+    uint64_t hashes[DICT_BATCH_SIZE];
+
+    if(dictSize(d) == 0){
+        memset(des, 0, sizeof(dictEntry*) * count);
+        return;
+    }
+    if(d->engine == DICT_ENGINE_CHAINED && dictIsRehashing(d)){
+        _dictRehashStep(d);
+    }
+
+    for(unsigned int base = 0; base < count; base += DICT_BATCH_SIZE){
+        unsigned int n = count - base < DICT_BATCH_SIZE ? count - base : DICT_BATCH_SIZE;
+        for(unsigned int j = 0; j < n; j++){
+            hashes[j] = dictHashKey(d, keys[base+j]);
+        }
+        dictPrefetchHashes(d, hashes, n);
+        for(unsigned int j = 0; j < n; j++){
+            des[base+j] = _dictFindWithHash(d, keys[base+j], hashes[j]);
+        }
+    }
+}
+
+/**
+ *  执行N步渐进式rehash，每一步迁移0号表中的一个非空桶
+ *  为了不在大量空桶上花太多时间，最多只访问N*10个空桶
+ *  返回1表示还有节点没有迁移过去
  *  返回0表示全部移动完毕
  */ 
 int dictRehash(dict *d, int n){
+    int empty_visits = n * 10;  //最多访问的空桶数量
     //只能在rehash进行中才能执行
     if(!dictIsRehashing(d)){
         return 0;
     }
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissRehash(d, n);
+    }
 
-    while(n--){ //只重复N次操作
-        if(d->ht[0].used == 0){ //0号hash表used为0，说明已经全部移动完毕，只剩交换hash表本身了
-            //直接释放0号表的节点数组
-            free(d->ht[0].table);
-            //1号表直接给0号表
-            d->ht[0] = d->ht[1];
-            //1号表直接重置
-            _dictReset(&d->ht[1]);
-            //关闭dict的rehash标识
-            d->rehashindex = -1;
-            return 0;
-        }
-
-        //确保rehashidx没有越界，idx最多只会比size小1，永远不可能相等
-        assert(d->ht[0].size >(unsigned)d->rehashindex);
+    while(n-- && d->ht[0].used != 0){ //只重复N次操作
+        //确保rehashidx没有越界，0号表还有节点，所以后面一定还有非空的桶
+        assert(d->ht[0].size > (unsigned long)d->rehashindex);
 
-        //寻找下一个非空的桶，如果是空桶，则继续寻找
+        //寻找下一个非空的桶，空桶太多时先返回，下次再继续
         while(d->ht[0].table[d->rehashindex] == NULL){
             d->rehashindex++;
+            if(--empty_visits == 0){
+                return 1;
+            }
         }
 
-        dictEntry *entry, *nextEntry;
+        dictNode *node, *nextNode;
         //取得要迁移的entry
-        entry = d->ht[0].table[d->rehashindex];
+        node = d->ht[0].table[d->rehashindex];
 
-        while(entry){   //开始遍历桶中的节点
-            nextEntry = entry->next;
-            //算出hash值，以及再算出1号表的桶索引值
-            size_t h = dictHashKey(d, entry->key) & d->ht[1].sizemask;
+        while(node){   //开始遍历桶中的节点
+            nextNode = node->next;
+            //用节点里缓存的hash值算出1号表的桶索引值，不用再访问key
+            size_t h = node->hash & d->ht[1].sizemask;
             //先将要迁移的entry后驱，指向原来桶里的头元素
-            entry->next = d->ht[1].table[h];
+            node->next = d->ht[1].table[h];
             //最后再将迁移的entry放到新桶的头部
-            d->ht[1].table[h] = entry;
+            d->ht[1].table[h] = node;
 
             //更新计数器
             d->ht[0].used--;
             d->ht[1].used++;
 
-            //处理桶里的下一个节点，直到nextEntry为NULL
-            entry = nextEntry;
+            //处理桶里的下一个节点，直到nextNode为NULL
+            node = nextNode;
         }
 
         //桶中的都迁移走了，要把这个桶也清空，只需要赋值NULL，因为桶里的entry被1号表指向了，不能free
         d->ht[0].table[d->rehashindex] = NULL;
         d->rehashindex++;
     }
-    return 0;
+
+    //0号表已经全部移动完毕，交换hash表本身
+    if(d->ht[0].used == 0){
+        //直接释放0号表的节点数组
+        zfree(d->ht[0].table);
+        //1号表直接给0号表
+        d->ht[0] = d->ht[1];
+        //1号表直接重置
+        _dictReset(&d->ht[1]);
+        //关闭dict的rehash标识
+        d->rehashindex = -1;
+        return 0;
+    }
+
+    //还有节点没有迁移
+    return 1;
 }
 
 /**
  *  返回一个给定字典的不安全迭代器 
  */
 dictIterator *dictGetIterator(dict *d){
-    dictIterator *iter = malloc(sizeof(*iter));
+    dictIterator *iter = zmalloc(sizeof(*iter));
     iter->d = d;
     iter->table = 0;
     iter->index = -1;   //注意是-1，而不是0
+    iter->safe = 0;
     iter->entry = NULL;
     iter->nextEntry = NULL;
+    iter->fingerprint = 0;
     return iter;
 }
 
@@ -602,10 +1326,10 @@ long long dictFingerprint(dict *d) {
     long long integers[6], hash = 0;
     int j;
 
-    integers[0] = (long) d->ht[0].table;
+    integers[0] = d->engine == DICT_ENGINE_SWISS ? (long) d->ht[0].ctrl : (long) d->ht[0].table;
     integers[1] = d->ht[0].size;
     integers[2] = d->ht[0].used;
-    integers[3] = (long) d->ht[1].table;
+    integers[3] = d->engine == DICT_ENGINE_SWISS ? (long) d->ht[1].ctrl : (long) d->ht[1].table;
     integers[4] = d->ht[1].size;
     integers[5] = d->ht[1].used;
 
@@ -639,13 +1363,16 @@ void dictReleaseIterator(dictIterator *iter){
             assert(iter->fingerprint == dictFingerprint(iter->d));
         }
     }
-    free(iter);
+    zfree(iter);
 }
 
 /**
  * 返回迭代器当前指向的节点，迭代完成后会返回NULL
  */ 
 dictEntry *dictNext(dictIterator *iter){
+    if(iter->d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissNext(iter);
+    }
     while(1){   //无限循环，里面用break退出
         if(iter->entry==NULL){  //2种可能进入这里，迭代器首次运行，或者已全部迭代完
             dictht *ht = &(iter->d->ht[iter->table]);
@@ -678,44 +1405,232 @@ dictEntry *dictNext(dictIterator *iter){
 
         if(iter->entry){
             iter->nextEntry = iter->entry->next;
-            return iter->entry;
+            return &iter->entry->entry;
         }
     }
     return NULL;
 }
 
-//剩余dictScan函数未完成
+/**
+ * 随机返回字典中的一个节点，字典为空时返回NULL
+ * 先随机选一个非空的桶，再在桶的链表里随机选一个节点，链表长度不同所以不是严格均匀的
+ * rehash时0号表中rehashindex之前的桶已经空了，只在剩下的桶和1号表里选
+ */
+dictEntry *dictGetRandomKey(dict *d){
+    dictNode *he, *orighe;
+    size_t h;
+    int listlen, listele;
+
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissGetRandomKey(d);
+    }
+    if(dictSize(d) == 0){
+        return NULL;
+    }
+    if(dictIsRehashing(d)){
+        _dictRehashStep(d);
+    }
+    if(dictIsRehashing(d)){
+        do{
+            h = d->rehashindex + (random() % (d->ht[0].size + d->ht[1].size - d->rehashindex));
+            he = (h >= d->ht[0].size) ? d->ht[1].table[h - d->ht[0].size] : d->ht[0].table[h];
+        }while(he == NULL);
+    }else{
+        do{
+            h = random() & d->ht[0].sizemask;
+            he = d->ht[0].table[h];
+        }while(he == NULL);
+    }
+
+    //统计链表长度，再随机取其中一个
+    listlen = 0;
+    orighe = he;
+    while(he){
+        he = he->next;
+        listlen++;
+    }
+    listele = random() % listlen;
+    he = orighe;
+    while(listele--){
+        he = he->next;
+    }
+    return &he->entry;
+}
+
+/**
+ * 随机采样最多count个节点放进des，返回实际采样到的数量，节点可能少于count
+ * 不是每个节点都单独随机选桶：从一个随机位置开始连续地扫描桶，把桶里的节点全部收下，
+ * 对cache更友好，一次随机的代价由多个节点分摊；适合淘汰这种只要近似随机的场合，不保证均匀分布
+ * rehash时同一个下标在两个表里都看一遍，0号表中rehashindex之前的桶已经空了，直接跳过
+ * 连续遇到的空桶太多时换一个随机位置继续，总的步数不超过count的10倍
+ */
+unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count){
+    unsigned long j;    //正在看的hash表，0或者1
+    unsigned long tables;   //要看几个hash表
+    unsigned long stored = 0, maxsizemask;
+    unsigned long maxsteps;
+
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissGetSomeKeys(d, des, count);
+    }
+    if(dictSize(d) < count){
+        count = dictSize(d);
+    }
+    maxsteps = count * 10;
+
+    //按采样的数量顺便做一些rehash
+    for(j = 0; j < count; j++){
+        if(dictIsRehashing(d)){
+            _dictRehashStep(d);
+        }else{
+            break;
+        }
+    }
+
+    tables = dictIsRehashing(d) ? 2 : 1;
+    maxsizemask = d->ht[0].sizemask;
+    if(tables > 1 && maxsizemask < d->ht[1].sizemask){
+        maxsizemask = d->ht[1].sizemask;
+    }
 
+    //在较大的那个表的范围内随机选一个起点
+    unsigned long i = random() & maxsizemask;
+    unsigned long emptylen = 0; //连续的空桶数量
+    while(stored < count && maxsteps--){
+        for(j = 0; j < tables; j++){
+            if(tables == 2 && j == 0 && i < (unsigned long)d->rehashindex){
+                //0号表这一段已经迁移完了；如果也超出了1号表的范围，两个表在rehashindex之前都没有节点，直接跳过去
+                if(i >= d->ht[1].size){
+                    i = d->rehashindex;
+                }else{
+                    continue;
+                }
+            }
+            if(i >= d->ht[j].size){
+                continue;
+            }
+            dictNode *he = d->ht[j].table[i];
+
+            if(he == NULL){
+                //连续的空桶超过count个（至少5个）就换个位置
+                emptylen++;
+                if(emptylen >= 5 && emptylen > count){
+                    i = random() & maxsizemask;
+                    emptylen = 0;
+                }
+            }else{
+                emptylen = 0;
+                while(he){
+                    *des = &he->entry;
+                    des++;
+                    he = he->next;
+                    stored++;
+                    if(stored == count){
+                        return stored;
+                    }
+                }
+            }
+        }
+        i = (i+1) & maxsizemask;
+    }
+    return stored;
+}
 
 /**
- * 类似Java的System.currentTimeMillis()方法，返回当前时间戳
- * 注意返回的是long long类型，对应8字节64位，而不是long
- * long只有4字节32位，int在现在的编译器中基本也都是32位的了（早期是16位）
- * gettimeofday函数是由sys/time.h提供的
- */ 
-long long timeInMilliseconds(void){
-    struct timeval tv;
-    gettimeofday(&tv, NULL);
-    return (((long long)tv.tv_sec)*1000) + (tv.tv_usec/1000);
+ * 无状态的增量遍历，每次调用访问游标v指向的一个桶（rehash时是小表的一个桶和大表中对应的所有桶），
+ * 对其中每个节点调用fn，返回下一次调用使用的游标，返回0说明遍历完成；第一次调用时v传0
+ *
+ * 游标不是普通地加1，而是把低sizemask位反转之后加1再反转回来，也就是从高位开始进位：
+ * 表的大小都是2的幂，扩容后原来的一个桶i分裂成i和i+size，缩容时合并回i & sizemask，
+ * 按这个顺序访问时，扩容和缩容都不会漏掉已经存在的节点，代价是缩容时可能会重复返回一些节点
+ *
+ * 不持有任何状态，也不阻止rehash，两次调用之间字典可以随意修改；
+ * 但是在遍历开始之前就存在、一直没被删除的节点保证至少返回一次，fn中不能修改字典
+ */
+unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata){
+    dictht *t0, *t1;
+    const dictNode *de;
+    unsigned long m0, m1;
+
+    if(dictSize(d) == 0){
+        return 0;
+    }
+    if(d->engine == DICT_ENGINE_SWISS){
+        return _dictSwissScan(d, v, fn, privdata);
+    }
+
+    if(!dictIsRehashing(d)){
+        t0 = &(d->ht[0]);
+        m0 = t0->sizemask;
+
+        de = t0->table[v & m0];
+        while(de){
+            fn(privdata, &de->entry);
+            de = de->next;
+        }
+
+        //把掩码以外的位都置1，反转后加1再反转，相当于在掩码内从高位加1
+        v |= ~m0;
+        v = rev(v);
+        v++;
+        v = rev(v);
+    }else{
+        //t0是较小的表，t1是较大的表
+        t0 = &d->ht[0];
+        t1 = &d->ht[1];
+        if(t0->size > t1->size){
+            t0 = &d->ht[1];
+            t1 = &d->ht[0];
+        }
+        m0 = t0->sizemask;
+        m1 = t1->sizemask;
+
+        de = t0->table[v & m0];
+        while(de){
+            fn(privdata, &de->entry);
+            de = de->next;
+        }
+
+        //小表的桶v在大表中对应所有低位和v相同的桶，依次访问
+        do{
+            de = t1->table[v & m1];
+            while(de){
+                fn(privdata, &de->entry);
+                de = de->next;
+            }
+            /**
+             * 在大表的掩码内按反转的顺序加1，先变化的是小表掩码以外的高位，和游标本身的顺序一致；
+             * 游标在大表阶段带上的高位不是0时，从这些高位接着往后走，不会漏掉桶。
+             * 高位全部回到0时进位到了小表掩码内，v正好就是下一次调用的游标
+             */
+            v |= ~m1;
+            v = rev(v);
+            v++;
+            v = rev(v);
+        }while(v & (m0 ^ m1));
+    }
+    return v;
 }
 
+
 /**
- * 在规定的时间内，不停执行包含100步rehash操作
- * 操作完成至少一次，并且到时间，都直接返回已执行完的步数
+ * 在给定的时间（微秒）内不停地rehash，每100步检查一次时间，返回执行的步数
+ * 计时用的是单调时钟，x86上只是读一次TSC，比gettimeofday便宜得多
+ * 有安全迭代器时不能rehash，直接返回0
  */ 
-int dictRehashMilliseconds(dict *d, int ms){
-    //获取当天时间戳
-    long long start = timeInMilliseconds();
-    //记录已完成的桶迁移
+int dictRehashMicroseconds(dict *d, uint64_t us){
+    if(d->iterators > 0){
+        return 0;
+    }
+    monotime start = getMonotonicTicks();
+    uint64_t limit_ns = us * 1000;
     int rehashes = 0;
     while(dictRehash(d, 100)){
-        rehashes = rehashes + 100;
-        if((timeInMilliseconds() - start) > ms){
+        rehashes += 100;
+        if(monotonicTicksToNs(getMonotonicTicks() - start) >= limit_ns){
             break;
         }
     }
-
-    //注意这个返回值，要么为0，要么总为100的倍数，需要后续观察调用方式如何处理这个值的
     return rehashes;
 }
 
@@ -735,9 +1650,211 @@ void dictDisableResize(void){
 
 
 
-int main(){
-    //long long time = timeInMilliseconds();
-    printf("%lu", _dictNextPower(14));
-    getchar();
+#ifdef DICT_TEST_MAIN
+/**
+ * 字典的自测，两种引擎都跑一遍，每种都分别用正常的hash和只有少数几个值的弱hash（制造很长的探测序列）
+ * gcc -DDICT_TEST_MAIN -I. dict.c siphash.c slab.c zmalloc.c monotonic.c -o dict-test
+ * key是1到DICT_TEST_KEYS的整数，值是key的3倍
+ */
+#define DICT_TEST_KEYS 20000
+
+static int dict_test_weak;
+static char dict_test_present[DICT_TEST_KEYS+1];
+static int dict_test_seen[DICT_TEST_KEYS+1];
+static long dict_test_count;
+
+static uint64_t dictTestHash(const void *key){
+    unsigned long k = (unsigned long)key;
+    if(dict_test_weak){
+        //只有64个不同的hash值，同一个值的key会沿着探测序列排成很长的链
+        return (k % 64) * 0x9e3779b97f4a7c15ULL;
+    }
+    return dictGenHashFunction(&k, sizeof(k));
+}
+
+static dictType dictTestType = {dictTestHash, NULL, NULL, NULL, NULL, NULL};
+
+/**
+ * 开放寻址引擎rehash时，1号表按迁移完成前最多的插入次数留了余量，没有安全迭代器时不应该到达负载上限
+ */
+static void dictTestCheckReserve(dict *d){
+    if(d->engine == DICT_ENGINE_SWISS && dictIsRehashing(d) && d->iterators == 0){
+        assert(d->ht[1].used + d->ht[1].deleted < DICT_SWISS_MAX_LOAD(d->ht[1].size));
+    }
+}
+
+static void dictTestAdd(dict *d, unsigned long k){
+    dictTestCheckReserve(d);
+    dictEntry *de = dictAddRaw(d, (void*)k);
+    if(dict_test_present[k]){
+        assert(de == NULL);
+        return;
+    }
+    assert(de != NULL);
+    dictSetUnSignedIntegerVal(de, k * 3);
+    dict_test_present[k] = 1;
+    dict_test_count++;
+}
+
+static void dictTestDelete(dict *d, unsigned long k){
+    int retval = dictDelete(d, (void*)k);
+    assert((retval == DICT_OK) == dict_test_present[k]);
+    if(dict_test_present[k]){
+        dict_test_present[k] = 0;
+        dict_test_count--;
+    }
+}
+
+static void dictTestCheckFind(dict *d, unsigned long k){
+    dictEntry *de = dictFind(d, (void*)k);
+    assert((de != NULL) == dict_test_present[k]);
+    if(de){
+        assert(dictGetKey(de) == (void*)k && dictGetUnsignedIntegerVal(de) == k * 3);
+    }
+    assert((long)dictSize(d) == dict_test_count);
+}
+
+static dict *dictTestCreate(int engine){
+    memset(dict_test_present, 0, sizeof(dict_test_present));
+    dict_test_count = 0;
+    return dictCreateWithEngine(&dictTestType, NULL, engine);
+}
+
+/**
+ * 增删交替：增多删少时表扩大，删多增少时由dictResize缩小（模拟serverCron），墓碑多了会原样大小重建
+ * 每一步之后检查刚操作过的key和一个随机key的查找结果，以及dictSize
+ */
+static void dictTestChurn(int engine){
+    dict *d = dictTestCreate(engine);
+    size_t last_slots = dictSlots(d);
+    int resizes = 0;
+
+    for(int round = 0; round < 40; round++){
+        int addbias = (round % 4 < 2) ? 7 : 3;
+        //按当前的节点数重建表，紧接着大量插入，1号表靠预留的余量撑到迁移完成
+        if(round % 4 == 0 && !dictIsRehashing(d)){
+            dictExpand(d, dictSize(d));
+        }
+        for(int i = 0; i < 20000; i++){
+            unsigned long k = 1 + rand() % DICT_TEST_KEYS;
+            if(rand() % 10 < addbias){
+                dictTestAdd(d, k);
+            }else{
+                dictTestDelete(d, k);
+            }
+            dictTestCheckFind(d, k);
+            dictTestCheckFind(d, 1 + rand() % DICT_TEST_KEYS);
+            if(dict_test_count * 8 < (long)d->ht[0].size){
+                dictResize(d);
+            }
+            if(dictSlots(d) != last_slots){
+                last_slots = dictSlots(d);
+                resizes++;
+            }
+        }
+        //偶尔一次把rehash做完，下一轮从不在rehash的状态开始
+        if(round % 5 == 0){
+            while(dictRehash(d, 100));
+        }
+    }
+    for(unsigned long k = 1; k <= DICT_TEST_KEYS; k++){
+        dictTestCheckFind(d, k);
+    }
+    assert(resizes >= 4);
+    dictRelease(d);
+}
+
+static void dictTestScanCallback(void *privdata, const dictEntry *de){
+    unsigned long k = (unsigned long)dictGetKey(de);
+    (void)privdata;
+    assert(k >= 1 && k <= DICT_TEST_KEYS && dict_test_present[k]);
+    assert(dictGetUnsignedIntegerVal(de) == k * 3);
+    dict_test_seen[k]++;
+}
+
+/**
+ * 扫描期间表先扩大再缩小：前1/20的key在扫描开始前插入并且一直保留，必须全部被扫描到；
+ * 其余的key在扫描中途插入，之后再删除并缩小表
+ */
+static void dictTestScan(int engine){
+    dict *d = dictTestCreate(engine);
+    const unsigned long stable = DICT_TEST_KEYS / 20;
+    unsigned long cursor = 0, next = stable + 1;
+    int calls = 0, shrinking = 0;
+
+    memset(dict_test_seen, 0, sizeof(dict_test_seen));
+    for(unsigned long k = 1; k <= stable; k++){
+        dictTestAdd(d, k);
+    }
+    do{
+        cursor = dictScan(d, cursor, dictTestScanCallback, NULL);
+        calls++;
+        if(!shrinking){
+            for(int j = 0; j < 50 && next <= DICT_TEST_KEYS; j++){
+                dictTestAdd(d, next++);
+            }
+            shrinking = next > DICT_TEST_KEYS;
+        }else{
+            for(int j = 0; j < 50 && next > stable + 1; j++){
+                dictTestDelete(d, --next);
+            }
+            if(dict_test_count * 8 < (long)d->ht[0].size){
+                dictResize(d);
+            }
+        }
+    }while(cursor != 0);
+
+    for(unsigned long k = 1; k <= stable; k++){
+        assert(dict_test_seen[k] >= 1);
+    }
+    assert(calls > 1);
+    dictRelease(d);
+}
+
+/**
+ * rehash进行中用dictGetSomeKeys和dictGetRandomKey取键，取到的必须是存在的key
+ */
+static void dictTestRandomDuringRehash(int engine){
+    dict *d = dictTestCreate(engine);
+    dictEntry *des[32];
+    int checks = 0;
+    unsigned long sampled = 0;
+
+    for(unsigned long k = 1; k <= DICT_TEST_KEYS / 2; k++){
+        dictTestAdd(d, k);
+    }
+    while(dictRehash(d, 100));
+    assert(dictExpand(d, dictSize(d) * 4) == DICT_OK && dictIsRehashing(d));
+    while(dictIsRehashing(d)){
+        //空桶太多时可能一个也取不到，只要求总体上取到过
+        unsigned int got = dictGetSomeKeys(d, des, 32);
+        assert(got <= 32);
+        sampled += got;
+        for(unsigned int j = 0; j < got; j++){
+            unsigned long k = (unsigned long)dictGetKey(des[j]);
+            assert(k >= 1 && k <= DICT_TEST_KEYS && dict_test_present[k]);
+        }
+        dictEntry *de = dictGetRandomKey(d);
+        assert(de && dict_test_present[(unsigned long)dictGetKey(de)]);
+        checks++;
+        //增删同时推进rehash
+        dictTestDelete(d, 1 + rand() % DICT_TEST_KEYS);
+        dictTestAdd(d, 1 + rand() % DICT_TEST_KEYS);
+    }
+    assert(checks > 1 && sampled > 0);
+    dictRelease(d);
+}
+
+int main(void){
+    srand(1);
+    for(int engine = DICT_ENGINE_CHAINED; engine <= DICT_ENGINE_SWISS; engine++){
+        for(dict_test_weak = 0; dict_test_weak <= 1; dict_test_weak++){
+            dictTestChurn(engine);
+            dictTestScan(engine);
+            dictTestRandomDuringRehash(engine);
+            printf("engine %d, weak hash %d: ok\n", engine, dict_test_weak);
+        }
+    }
     return 0;
-}
\ No newline at end of file
+}
+#endif
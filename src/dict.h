@@ -2,6 +2,7 @@
 #define __DICT_H__
 
 #include <stdint.h>
+#include "slab.h"
 
 /*
  * 字典操作状态
@@ -11,6 +12,19 @@
 //初始hash表总量
 #define DICT_HT_INITIAL_SIZE 4
 
+/*
+ * 字典的存储引擎，在dictCreateWithEngine时选定，之后不能改变
+ * CHAINED : 拉链法，每个节点单独分配，节点地址在整个生命周期内不变
+ * SWISS   : 开放寻址法，16个槽为一组，每个槽有一个控制字节保存hash的低7位，
+ *           查找时用SSE2一次比较一组的16个控制字节，节点直接存在槽数组里，
+ *           dictFind等返回的节点指针在下一次修改同一个字典（增、删、rehash）之前有效
+ */
+#define DICT_ENGINE_CHAINED 0
+#define DICT_ENGINE_SWISS 1
+//开放寻址引擎每组的槽数，也是表的最小槽数
+#define DICT_SWISS_GROUP_SIZE 16
+//dictFindBatch每一轮同时处理的key数量，也是dictPrefetchHashes一次最多处理的数量
+#define DICT_BATCH_SIZE 16
 
 
 typedef struct dictEntry{
@@ -20,12 +34,19 @@ typedef struct dictEntry{
         uint64_t u64;
         int64_t s64;
     } v;
-    struct dictEntry *next;
 } dictEntry;
 
+//拉链法引擎的节点，entry必须是第一个成员，返回给调用方的是&node->entry
+typedef struct dictNode{
+    dictEntry entry;
+    struct dictNode *next;
+    //缓存的完整hash值，rehash时不用重新计算，查找时先比较hash再比较key
+    uint64_t hash;
+} dictNode;
+
 typedef struct dictType{
     //计算hash的函数
-    unsigned int (*hashFunction)(const void *key);
+    uint64_t (*hashFunction)(const void *key);
     //复制key的函数
     void *(*keyDup)(void *privdata, const void *key);
     //复制val的函数
@@ -39,37 +60,53 @@ typedef struct dictType{
 } dictType;
 
 typedef struct dictht{
-    dictEntry **table;
-    //hash表大小
+    //拉链法的桶数组
+    dictNode **table;
+    //开放寻址法的控制字节数组和槽数组，一个控制字节对应一个槽
+    int8_t *ctrl;
+    dictEntry *slots;
+    //hash表大小，开放寻址法是槽的数量
     size_t size;
-    //hash掩码，总是size-1
+    //hash掩码，拉链法总是size-1，开放寻址法是组数-1
     size_t sizemask;
     //已有节点总数
     size_t used;
+    //开放寻址法中被删除后留下的墓碑数量，墓碑也占着负载
+    size_t deleted;
 } dictht;
 
 typedef struct dict{
+    //存储引擎，DICT_ENGINE_*
+    int engine;
     dictType *type;
     void *privdata;
     dictht ht[2];
     /*
      *  rehash值，-1为不处于rehash状态中，当rehash时，这个值会递增，当整个完成会置回-1
      *  rehash并不是一次就能完成的操作，而是可中断的操作（避免Java的大GC暂停问题），因此需要这个字段来记录状态和进度
+     *  开放寻址法按组迁移，这里记录的是槽下标，总是组大小的整数倍
      */
-    int rehashindex;
+    long rehashindex;
     //正在运行的安全迭代器数量
     int iterators;
+    //拉链法节点的slab池，字典释放时一次归还
+    slabPool nodepool;
 } dict;
 
+//dictScan对每个节点调用的回调函数
+typedef void (dictScanFunction)(void *privdata, const dictEntry *de);
+
 typedef struct dictIterator{
     dict *d;
     /*
      *  table : 正在被迭代的ht表，要么0要么1
      *  index : 迭代器目前正指向的hash表索引位置
      *  safe : 如果为1，程序可以对字典进行修改，如果为0，则只能读取
+     *  开放寻址法中index是槽下标，不使用entry和nextEntry
      */
-    int table, index, safe;
-    dictEntry *entry, *nextEntry;
+    int table, safe;
+    long index;
+    dictNode *entry, *nextEntry;
     //不明确干啥的
     long long fingerprint;
 } dictIterator;
@@ -82,7 +119,7 @@ typedef struct dictIterator{
     do {entry->v.u64 = (val);} while(0)
 //对比2个key
 #define dictCompareKeys(d, key1, key2) \
-    ((d)->type->keyCompare) ? (d)->type->keyCompare((d)->privdata, key1, key2) : (key1 == key2)
+    (((d)->type->keyCompare) ? (d)->type->keyCompare((d)->privdata, key1, key2) : (key1 == key2))
 //释放指定字典中entry的key
 #define dictFreeKey(d, entry) do{ \
     if((d)->type->keyDestructor){  \
@@ -130,6 +167,7 @@ typedef struct dictIterator{
 #define dictIsRehashing(d) ((d)->rehashindex != -1)
 
 dict *dictCreate(dictType *type, void *privdata);
+dict *dictCreateWithEngine(dictType *type, void *privdata, int engine);
 void dictRelease(dict *d);
 int dictResize(dict *d);
 int dictExpand(dict *d, size_t size);
@@ -138,21 +176,31 @@ int dictReplace(dict *d, void *key, void *val);
 dictEntry *dictAddRaw(dict *d, void *key);
 dictEntry *dictFind(dict *d, void *key);
 void *dictFetchValue(dict *d, void *key);
+void dictFindBatch(dict *d, void **keys, unsigned int count, dictEntry **des);
+void dictPrefetchHashes(dict *d, const uint64_t *hashes, unsigned int count);
 int dictDelete(dict *d, const void *key);
 int dictNoFreeDelete(dict *d, const void *key);
 
 int dictRehash(dict *d, int n);
-int dictRehashMilliseconds(dict *d, int ms);
+int dictRehashMicroseconds(dict *d, uint64_t us);
 
 dictIterator *dictGetIterator(dict *d);
 dictIterator *dictGetSafeIterator(dict *d);
 void dictReleaseIterator(dictIterator *iter);
 dictEntry *dictNext(dictIterator *iter);
-
-void dictSetHashFunctionSeed(unsigned int initval);
-unsigned int dictGetHashFunctionSeed(void);
-unsigned int dictGenHashFunction(const void *key, int len);
-unsigned int dictGenCaseHashFunction(const unsigned char *buf, int len);
+dictEntry *dictGetRandomKey(dict *d);
+unsigned int dictGetSomeKeys(dict *d, dictEntry **des, unsigned int count);
+unsigned long dictScan(dict *d, unsigned long v, dictScanFunction *fn, void *privdata);
+
+void dictSetHashFunctionSeed(uint8_t *seed);
+uint8_t *dictGetHashFunctionSeed(void);
+uint64_t dictGenHashFunction(const void *key, int len);
+uint64_t dictGenCaseHashFunction(const unsigned char *buf, int len);
+uint64_t dictGenFastHashFunction(const void *key, int len);
+
+//siphash.c
+uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k);
+uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k);
 
 void dictEnableResize(void);
 void dictDisableResize(void);
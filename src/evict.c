@@ -0,0 +1,340 @@
+#include <limits.h>
+#include "redis.h"
+
+/**
+ * maxmemory的键淘汰
+ * 已使用内存超过maxmemory时，在执行带有m标志（REDIS_CMD_DENYOOM）的命令之前，按照淘汰策略删除键，
+ * 直到内存回到限制以内，删不动时拒绝执行命令
+ *
+ * LRU、LFU和TTL不是精确的：每次只从每个数据库随机采样maxmemory_samples个键，代价和键的总数无关
+ * 采样到的键按分数放进一个有序的淘汰池，淘汰池在多次淘汰之间保留，所以之前采样到的好候选不会丢掉，
+ * 每次淘汰的都是到目前为止见过的分数最高的键，效果很接近精确的实现
+ *
+ * 多个分片时内存是全局统计的，每个分片只淘汰自己数据库里的键，淘汰池也是每个分片一个
+ * 超出的内存由还有可淘汰键的分片平均分摊，每个分片只负责自己那一份，空闲的分片在serverCron中淘汰；
+ * 释放了多少内存用本线程的计数器计算，不受其他分片同时分配和释放的影响
+ */
+
+/**
+ * LFU：把robj的24位lru字段拆成16位的分钟时间戳和8位的访问计数器，不需要额外的内存
+ * 计数器是对数的（Morris计数器），值越大增长的概率越小，8位就能表示上百万次的访问
+ * 计数器每过lfu_decay_time分钟减1，过去很热但是现在不再访问的键会慢慢变冷
+ * 扫描式的一次性读取只能把计数器从初始值加1，不会把一直被访问的热点键挤出去
+ */
+
+//LFU计数器增长时用的随机数种子，每个线程一份，rand_r不需要加锁
+static __thread unsigned int lfu_rand_seed = 0;
+
+/**
+ * 当前时间的分钟数，只保留低16位，大约45天回绕一次
+ */
+unsigned int LFUGetTimeInMinutes(void){
+    return (server.unixtime / 60) & 65535;
+}
+
+/**
+ * 距离ldt过去了多少分钟，考虑了回绕，但是超过一个周期的只能当成不到一个周期
+ */
+static unsigned long LFUTimeElapsed(unsigned long ldt){
+    unsigned long now = LFUGetTimeInMinutes();
+    if(now >= ldt){
+        return now - ldt;
+    }
+    return 65535 - ldt + now;
+}
+
+/**
+ * 按对数的概率给计数器加1，计数器超过初始值越多，加1的概率越小
+ */
+static uint8_t LFULogIncr(uint8_t counter){
+    if(counter == 255){
+        return 255;
+    }
+    double r = (double)rand_r(&lfu_rand_seed) / RAND_MAX;
+    double baseval = counter - REDIS_LFU_INIT_VAL;
+    if(baseval < 0){
+        baseval = 0;
+    }
+    double p = 1.0 / (baseval * server.lfu_log_factor + 1);
+    if(r < p){
+        counter++;
+    }
+    return counter;
+}
+
+/**
+ * 返回按经过的时间衰减之后的计数器，不修改对象，采样的时候用
+ */
+unsigned long LFUDecrAndReturn(robj *o){
+    unsigned long ldt = o->lru >> 8;
+    unsigned long counter = o->lru & 255;
+    unsigned long num_periods = server.lfu_decay_time ? LFUTimeElapsed(ldt) / server.lfu_decay_time : 0;
+    if(num_periods){
+        counter = (num_periods > counter) ? 0 : counter - num_periods;
+    }
+    return counter;
+}
+
+/**
+ * 访问对象时更新LFU信息：先衰减，再按概率加1，时间戳更新成现在
+ */
+void updateLFU(robj *o){
+    unsigned long counter = LFUDecrAndReturn(o);
+    counter = LFULogIncr(counter);
+    o->lru = (LFUGetTimeInMinutes() << 8) | counter;
+}
+
+/**
+ * 淘汰池中的一项，按score从小到大排列，最右边的是最应该被淘汰的
+ * LRU的score是空闲时间，LFU的score是255减去访问计数器，TTL的score是ULLONG_MAX减去过期时间，越早过期分数越高
+ * 池子在启动时就为每一项分配好了一个sds，比它短的键直接复制进去，淘汰过程中不需要分配内存
+ */
+#define EVPOOL_CACHED_SDS_SIZE 255
+
+struct evictionPoolEntry{
+    unsigned long long score;   //淘汰分数，越大越应该被淘汰
+    sds key;    //键名，为NULL说明这一项是空的
+    sds cached; //预先分配的sds，key足够短时key就指向它
+    int dbid;   //键所在的数据库
+};
+
+//随机淘汰时下一次从哪个数据库开始，每个分片各自轮换
+static __thread int evict_next_db = 0;
+
+/**
+ * 创建一个空的淘汰池
+ */
+struct evictionPoolEntry *evictionPoolAlloc(void){
+    struct evictionPoolEntry *ep = zmalloc(sizeof(*ep) * REDIS_EVICTION_POOL_SIZE);
+    for(int j = 0; j < REDIS_EVICTION_POOL_SIZE; j++){
+        ep[j].score = 0;
+        ep[j].key = NULL;
+        ep[j].cached = sdsnewlen(NULL, EVPOOL_CACHED_SDS_SIZE);
+        ep[j].dbid = 0;
+    }
+    return ep;
+}
+
+/**
+ * 清空淘汰池中的一项，key是单独分配的才释放
+ */
+static void evictionPoolClearEntry(struct evictionPoolEntry *e){
+    if(e->key != e->cached){
+        sdsfree(e->key);
+    }
+    e->key = NULL;
+}
+
+/**
+ * 从sampledict中采样，把分数足够高的键插入淘汰池
+ * sampledict是键空间或者过期字典，keydict总是键空间，用来在采样过期字典时找到值对象
+ * 用dictGetSomeKeys一次取出一批连续的桶里的键，而不是每个键都单独随机选一个桶
+ */
+#define EVICTION_SAMPLES_ARRAY_SIZE 16
+static void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evictionPoolEntry *pool){
+    dictEntry *_samples[EVICTION_SAMPLES_ARRAY_SIZE];
+    dictEntry **samples;
+    int count;
+
+    //采样数量不多时直接用栈上的数组
+    if(server.maxmemory_samples <= EVICTION_SAMPLES_ARRAY_SIZE){
+        samples = _samples;
+    }else{
+        samples = zmalloc(sizeof(samples[0]) * server.maxmemory_samples);
+    }
+
+    count = dictGetSomeKeys(sampledict, samples, server.maxmemory_samples);
+    for(int j = 0; j < count; j++){
+        dictEntry *de = samples[j];
+        sds key = dictGetKey(de);
+        unsigned long long score;
+        int k;
+
+        if(server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_TTL){
+            //过期字典里保存的就是过期时间
+            score = ULLONG_MAX - (unsigned long long)dictGetSignedIntegerVal(de);
+        }else{
+            robj *o = (sampledict == keydict) ? dictGetVal(de) : dictFetchValue(keydict, key);
+            if(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LRU){
+                score = estimateObjectIdleTime(o);
+            }else{
+                score = 255 - LFUDecrAndReturn(o);
+            }
+        }
+
+        //找到第一个分数不小于它的位置
+        k = 0;
+        while(k < REDIS_EVICTION_POOL_SIZE && pool[k].key && pool[k].score < score){
+            k++;
+        }
+        if(k == 0 && pool[REDIS_EVICTION_POOL_SIZE-1].key != NULL){
+            //池子满了，并且比池子里所有的都差，不插入
+            continue;
+        }else if(k < REDIS_EVICTION_POOL_SIZE && pool[k].key == NULL){
+            //插在空位上，不需要移动
+        }else{
+            if(pool[REDIS_EVICTION_POOL_SIZE-1].key == NULL){
+                //右边还有空位，把k之后的都右移一位，空出k，最右边那项的cached跟着挪过来
+                sds cached = pool[REDIS_EVICTION_POOL_SIZE-1].cached;
+                memmove(pool+k+1, pool+k, sizeof(pool[0]) * (REDIS_EVICTION_POOL_SIZE-k-1));
+                pool[k].cached = cached;
+            }else{
+                //右边没有空位，丢掉分数最低的第0项，把k之前的都左移一位，插在k-1
+                k--;
+                sds cached = pool[0].cached;
+                evictionPoolClearEntry(&pool[0]);
+                memmove(pool, pool+1, sizeof(pool[0]) * k);
+                pool[k].cached = cached;
+            }
+        }
+
+        size_t klen = sdslen(key);
+        if(klen > EVPOOL_CACHED_SDS_SIZE){
+            pool[k].key = sdsdup(key);
+        }else{
+            memcpy(pool[k].cached, key, klen+1);
+            sdssetlen(pool[k].cached, klen);
+            pool[k].key = pool[k].cached;
+        }
+        pool[k].score = score;
+        pool[k].dbid = dbid;
+    }
+    if(samples != _samples){
+        zfree(samples);
+    }
+}
+
+/**
+ * 按LRU、LFU或者TTL策略选出要淘汰的键，返回的是键空间中的sds，没有可以淘汰的键时返回NULL
+ * 池子里的键可能在放进去之后已经被删除了，这样的项直接丢掉，继续看下一个
+ */
+static sds evictionPoolPick(int allkeys, int *dbid){
+    struct evictionPoolEntry *pool = shard->eviction_pool;
+
+    while(1){
+        unsigned long long total_keys = 0;
+        for(int j = 0; j < server.dbnum; j++){
+            redisDb *db = &shard->db[j];
+            dict *d = allkeys ? db->dict : db->expires;
+            if(dictSize(d) != 0){
+                evictionPoolPopulate(j, d, db->dict, pool);
+                total_keys += dictSize(d);
+            }
+        }
+        if(total_keys == 0){
+            return NULL;
+        }
+
+        //从分数最高的一端开始找还存在的键
+        for(int k = REDIS_EVICTION_POOL_SIZE-1; k >= 0; k--){
+            if(pool[k].key == NULL){
+                continue;
+            }
+            redisDb *db = &shard->db[pool[k].dbid];
+            dictEntry *de = dictFind(allkeys ? db->dict : db->expires, pool[k].key);
+            *dbid = pool[k].dbid;
+            evictionPoolClearEntry(&pool[k]);
+            if(de){
+                return dictGetKey(de);
+            }
+        }
+        //池子里的都失效了，重新采样
+    }
+}
+
+/**
+ * 按随机策略选出要淘汰的键，数据库之间轮流淘汰
+ */
+static sds evictionRandomPick(int allkeys, int *dbid){
+    for(int j = 0; j < server.dbnum; j++){
+        int id = (evict_next_db++) % server.dbnum;
+        redisDb *db = &shard->db[id];
+        dictEntry *de = dictGetRandomKey(allkeys ? db->dict : db->expires);
+        if(de){
+            *dbid = id;
+            return dictGetKey(de);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * 其他分片中还有可淘汰键的分片数量，用的是它们在serverCron中发布的键数量
+ */
+static int otherEvictableShards(int allkeys){
+    int num = 0;
+    for(int j = 0; j < server.shards_num; j++){
+        redisShard *s = server.shards[j];
+        if(s == shard){
+            continue;
+        }
+        size_t n = allkeys ? __atomic_load_n(&s->keys_num, __ATOMIC_RELAXED) :
+            __atomic_load_n(&s->volatile_keys_num, __ATOMIC_RELAXED);
+        if(n > 0){
+            num++;
+        }
+    }
+    return num;
+}
+
+/**
+ * 已使用内存超过maxmemory时按策略淘汰键，直到回到限制以内
+ * 内存没有超过限制或者淘汰成功返回REDIS_OK，策略是noeviction或者没有键可以淘汰时返回REDIS_ERR
+ */
+int freeMemoryIfNeeded(void){
+    size_t mem_used = zmalloc_used_memory();
+    long long mem_tofree, mem_freed;
+
+    if(mem_used <= server.maxmemory){
+        return REDIS_OK;
+    }
+    if(server.maxmemory_policy == REDIS_MAXMEMORY_NO_EVICTION){
+        return REDIS_ERR;
+    }
+
+    int allkeys = server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_ALLKEYS;
+    int use_random = server.maxmemory_policy == REDIS_MAXMEMORY_ALLKEYS_RANDOM ||
+        server.maxmemory_policy == REDIS_MAXMEMORY_VOLATILE_RANDOM;
+
+    //超出的部分由还有可淘汰键的分片平均分摊，本分片算一份
+    int others = otherEvictableShards(allkeys);
+    mem_tofree = mem_used - server.maxmemory;
+    mem_tofree = (mem_tofree + others) / (others + 1);
+    mem_freed = 0;
+    while(mem_freed < mem_tofree){
+        int dbid = 0;
+        sds bestkey = use_random ? evictionRandomPick(allkeys, &dbid) : evictionPoolPick(allkeys, &dbid);
+        if(bestkey == NULL){
+            //本分片没有可淘汰的键了，马上发布出去，不用等serverCron；其他分片还有的话由它们淘汰，不因此拒绝命令
+            __atomic_store_n(allkeys ? &shard->keys_num : &shard->volatile_keys_num, 0, __ATOMIC_RELAXED);
+            return others ? REDIS_OK : REDIS_ERR;
+        }
+
+        //bestkey属于键空间，删除之前先复制一份
+        robj *keyobj = createStringObject(bestkey, sdslen(bestkey));
+        long long delta = zmalloc_thread_used_memory();
+        dbDelete(&shard->db[dbid], keyobj);
+        delta -= zmalloc_thread_used_memory();
+        mem_freed += delta;
+        decrRefCount(keyobj);
+        __atomic_add_fetch(&server.stat_evictedkeys, 1, __ATOMIC_RELAXED);
+    }
+    return REDIS_OK;
+}
+
+/**
+ * 淘汰策略的名字，用于INFO
+ */
+char *maxmemoryToString(void){
+    switch(server.maxmemory_policy){
+        case REDIS_MAXMEMORY_VOLATILE_LRU: return "volatile-lru";
+        case REDIS_MAXMEMORY_VOLATILE_LFU: return "volatile-lfu";
+        case REDIS_MAXMEMORY_VOLATILE_TTL: return "volatile-ttl";
+        case REDIS_MAXMEMORY_VOLATILE_RANDOM: return "volatile-random";
+        case REDIS_MAXMEMORY_ALLKEYS_LRU: return "allkeys-lru";
+        case REDIS_MAXMEMORY_ALLKEYS_LFU: return "allkeys-lfu";
+        case REDIS_MAXMEMORY_ALLKEYS_RANDOM: return "allkeys-random";
+        case REDIS_MAXMEMORY_NO_EVICTION: return "noeviction";
+        default: return "unknown";
+    }
+}
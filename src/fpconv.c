@@ -0,0 +1,337 @@
+#include <stdint.h>
+#include <string.h>
+#include "fpconv.h"
+
+/**
+ * Grisu2算法，参考Florian Loitsch的论文《Printing Floating-Point Numbers Quickly and Accurately with Integers》
+ * 用64位整数表示的浮点数(frac * 2^exp)乘以预先算好的10的幂，得到落在固定区间内的值，
+ * 再在上下边界之间逐位生成数字，生成的位数只要能区分出边界就停止，所以结果是最短的
+ */
+
+typedef struct Fp{
+    uint64_t frac;
+    int exp;
+}Fp;
+
+#define FP_NPOWERS 87
+#define FP_STEPPOWERS 8
+#define FP_FIRSTPOWER -348  //第一个10的幂
+#define FP_EXPMAX -32
+#define FP_EXPMIN -60
+
+#define FP_FRACMASK  0x000FFFFFFFFFFFFFULL
+#define FP_EXPMASK   0x7FF0000000000000ULL
+#define FP_HIDDENBIT 0x0010000000000000ULL
+#define FP_SIGNMASK  0x8000000000000000ULL
+#define FP_EXPBIAS   (1023 + 52)
+
+/**
+ * 10^-348到10^340，每隔8个取一个，10^k约等于frac * 2^exp，frac的最高位是1
+ */
+static const Fp powers_ten[FP_NPOWERS] = {
+    {0xfa8fd5a0081c0288ULL, -1220}, {0xbaaee17fa23ebf76ULL, -1193},
+    {0x8b16fb203055ac76ULL, -1166}, {0xcf42894a5dce35eaULL, -1140},
+    {0x9a6bb0aa55653b2dULL, -1113}, {0xe61acf033d1a45dfULL, -1087},
+    {0xab70fe17c79ac6caULL, -1060}, {0xff77b1fcbebcdc4fULL, -1034},
+    {0xbe5691ef416bd60cULL, -1007}, {0x8dd01fad907ffc3cULL, -980},
+    {0xd3515c2831559a83ULL, -954}, {0x9d71ac8fada6c9b5ULL, -927},
+    {0xea9c227723ee8bcbULL, -901}, {0xaecc49914078536dULL, -874},
+    {0x823c12795db6ce57ULL, -847}, {0xc21094364dfb5637ULL, -821},
+    {0x9096ea6f3848984fULL, -794}, {0xd77485cb25823ac7ULL, -768},
+    {0xa086cfcd97bf97f4ULL, -741}, {0xef340a98172aace5ULL, -715},
+    {0xb23867fb2a35b28eULL, -688}, {0x84c8d4dfd2c63f3bULL, -661},
+    {0xc5dd44271ad3cdbaULL, -635}, {0x936b9fcebb25c996ULL, -608},
+    {0xdbac6c247d62a584ULL, -582}, {0xa3ab66580d5fdaf6ULL, -555},
+    {0xf3e2f893dec3f126ULL, -529}, {0xb5b5ada8aaff80b8ULL, -502},
+    {0x87625f056c7c4a8bULL, -475}, {0xc9bcff6034c13053ULL, -449},
+    {0x964e858c91ba2655ULL, -422}, {0xdff9772470297ebdULL, -396},
+    {0xa6dfbd9fb8e5b88fULL, -369}, {0xf8a95fcf88747d94ULL, -343},
+    {0xb94470938fa89bcfULL, -316}, {0x8a08f0f8bf0f156bULL, -289},
+    {0xcdb02555653131b6ULL, -263}, {0x993fe2c6d07b7facULL, -236},
+    {0xe45c10c42a2b3b06ULL, -210}, {0xaa242499697392d3ULL, -183},
+    {0xfd87b5f28300ca0eULL, -157}, {0xbce5086492111aebULL, -130},
+    {0x8cbccc096f5088ccULL, -103}, {0xd1b71758e219652cULL, -77},
+    {0x9c40000000000000ULL, -50}, {0xe8d4a51000000000ULL, -24},
+    {0xad78ebc5ac620000ULL, 3}, {0x813f3978f8940984ULL, 30},
+    {0xc097ce7bc90715b3ULL, 56}, {0x8f7e32ce7bea5c70ULL, 83},
+    {0xd5d238a4abe98068ULL, 109}, {0x9f4f2726179a2245ULL, 136},
+    {0xed63a231d4c4fb27ULL, 162}, {0xb0de65388cc8ada8ULL, 189},
+    {0x83c7088e1aab65dbULL, 216}, {0xc45d1df942711d9aULL, 242},
+    {0x924d692ca61be758ULL, 269}, {0xda01ee641a708deaULL, 295},
+    {0xa26da3999aef774aULL, 322}, {0xf209787bb47d6b85ULL, 348},
+    {0xb454e4a179dd1877ULL, 375}, {0x865b86925b9bc5c2ULL, 402},
+    {0xc83553c5c8965d3dULL, 428}, {0x952ab45cfa97a0b3ULL, 455},
+    {0xde469fbd99a05fe3ULL, 481}, {0xa59bc234db398c25ULL, 508},
+    {0xf6c69a72a3989f5cULL, 534}, {0xb7dcbf5354e9beceULL, 561},
+    {0x88fcf317f22241e2ULL, 588}, {0xcc20ce9bd35c78a5ULL, 614},
+    {0x98165af37b2153dfULL, 641}, {0xe2a0b5dc971f303aULL, 667},
+    {0xa8d9d1535ce3b396ULL, 694}, {0xfb9b7cd9a4a7443cULL, 720},
+    {0xbb764c4ca7a44410ULL, 747}, {0x8bab8eefb6409c1aULL, 774},
+    {0xd01fef10a657842cULL, 800}, {0x9b10a4e5e9913129ULL, 827},
+    {0xe7109bfba19c0c9dULL, 853}, {0xac2820d9623bf429ULL, 880},
+    {0x80444b5e7aa7cf85ULL, 907}, {0xbf21e44003acdd2dULL, 933},
+    {0x8e679c2f5e44ff8fULL, 960}, {0xd433179d9c8cb841ULL, 986},
+    {0x9e19db92b4e31ba9ULL, 1013}, {0xeb96bf6ebadf77d9ULL, 1039},
+    {0xaf87023b9bf0ee6bULL, 1066},
+};
+
+static const uint64_t tens[] = {
+    10000000000000000000ULL, 1000000000000000000ULL, 100000000000000000ULL,
+    10000000000000000ULL, 1000000000000000ULL, 100000000000000ULL,
+    10000000000000ULL, 1000000000000ULL, 100000000000ULL,
+    10000000000ULL, 1000000000ULL, 100000000ULL,
+    10000000ULL, 1000000ULL, 100000ULL,
+    10000ULL, 1000ULL, 100ULL,
+    10ULL, 1ULL
+};
+
+/**
+ * 找到一个10^k，使乘积的二进制指数落在[FP_EXPMIN, FP_EXPMAX]之间，k的相反数就是结果的十进制指数
+ */
+static Fp findCachedPow10(int exp, int *k){
+    const double one_log_ten = 0.30102999566398114;
+    //10^k的二进制指数约等于k*log2(10) - 63，让exp + 它 + 64落在区间中间，估计出k再向两边调整
+    int approx = (int)((-47 - exp) * one_log_ten);
+    int idx = (approx - FP_FIRSTPOWER) / FP_STEPPOWERS;
+    if(idx < 0){
+        idx = 0;
+    }else if(idx >= FP_NPOWERS){
+        idx = FP_NPOWERS - 1;
+    }
+    while(1){
+        int current = exp + powers_ten[idx].exp + 64;
+        if(current < FP_EXPMIN){
+            idx++;
+            continue;
+        }
+        if(current > FP_EXPMAX){
+            idx--;
+            continue;
+        }
+        *k = FP_FIRSTPOWER + idx * FP_STEPPOWERS;
+        return powers_ten[idx];
+    }
+}
+
+static Fp buildFp(double d){
+    uint64_t bits;
+    Fp fp;
+    memcpy(&bits, &d, sizeof(bits));
+    fp.frac = bits & FP_FRACMASK;
+    fp.exp = (bits & FP_EXPMASK) >> 52;
+    if(fp.exp){
+        fp.frac += FP_HIDDENBIT;
+        fp.exp -= FP_EXPBIAS;
+    }else{
+        //非规格化数
+        fp.exp = -FP_EXPBIAS + 1;
+    }
+    return fp;
+}
+
+static void normalize(Fp *fp){
+    while((fp->frac & FP_HIDDENBIT) == 0){
+        fp->frac <<= 1;
+        fp->exp--;
+    }
+    int shift = 64 - 52 - 1;
+    fp->frac <<= shift;
+    fp->exp -= shift;
+}
+
+/**
+ * 计算fp和相邻的两个double的中点，落在这两个中点之间的十进制数都会被还原成fp
+ */
+static void getNormalizedBoundaries(Fp *fp, Fp *lower, Fp *upper){
+    upper->frac = (fp->frac << 1) + 1;
+    upper->exp = fp->exp - 1;
+    while((upper->frac & (FP_HIDDENBIT << 1)) == 0){
+        upper->frac <<= 1;
+        upper->exp--;
+    }
+    int u_shift = 64 - 52 - 2;
+    upper->frac <<= u_shift;
+    upper->exp = upper->exp - u_shift;
+
+    //frac正好是2的幂时，下面相邻的double距离只有一半
+    int l_shift = fp->frac == FP_HIDDENBIT ? 2 : 1;
+    lower->frac = (fp->frac << l_shift) - 1;
+    lower->exp = fp->exp - l_shift;
+    lower->frac <<= lower->exp - upper->exp;
+    lower->exp = upper->exp;
+}
+
+/**
+ * 两个64位的尾数相乘，只保留四舍五入后的高64位
+ */
+static Fp multiply(Fp *a, Fp *b){
+    unsigned __int128 p = (unsigned __int128)a->frac * b->frac;
+    Fp fp;
+    fp.frac = (uint64_t)(p >> 64) + (uint64_t)(((uint64_t)p >> 63) & 1);
+    fp.exp = a->exp + b->exp + 64;
+    return fp;
+}
+
+/**
+ * 最后一位往下调整，让结果尽量接近真实值，同时不越过边界
+ */
+static void roundDigit(char *digits, int ndigits, uint64_t delta, uint64_t rem, uint64_t kappa, uint64_t frac){
+    while(rem < frac && delta - rem >= kappa &&
+        (rem + kappa < frac || frac - rem > rem + kappa - frac)){
+        digits[ndigits - 1]--;
+        rem += kappa;
+    }
+}
+
+/**
+ * 从upper开始逐位生成数字，剩下的部分小于delta（上下边界的距离）时就可以停止了
+ * K是十进制指数，返回生成的位数
+ */
+static int generateDigits(Fp *fp, Fp *upper, Fp *lower, char *digits, int *K){
+    uint64_t wfrac = upper->frac - fp->frac;
+    uint64_t delta = upper->frac - lower->frac;
+    Fp one;
+    one.frac = 1ULL << -upper->exp;
+    one.exp = upper->exp;
+
+    uint64_t part1 = upper->frac >> -one.exp;    //整数部分
+    uint64_t part2 = upper->frac & (one.frac - 1);  //小数部分
+
+    int idx = 0, kappa = 10;
+    const uint64_t *divp;
+    //整数部分最多10位，从10^9开始
+    for(divp = tens + 10; kappa > 0; divp++){
+        uint64_t div = *divp;
+        unsigned digit = part1 / div;
+        if(digit || idx){
+            digits[idx++] = digit + '0';
+        }
+        part1 -= digit * div;
+        kappa--;
+
+        uint64_t tmp = (part1 << -one.exp) + part2;
+        if(tmp <= delta){
+            *K += kappa;
+            roundDigit(digits, idx, delta, tmp, div << -one.exp, wfrac);
+            return idx;
+        }
+    }
+
+    //小数部分，每次乘10取出一位
+    const uint64_t *unit = tens + 18;
+    while(1){
+        part2 *= 10;
+        delta *= 10;
+        kappa--;
+
+        unsigned digit = part2 >> -one.exp;
+        if(digit || idx){
+            digits[idx++] = digit + '0';
+        }
+        part2 &= one.frac - 1;
+        if(part2 < delta){
+            *K += kappa;
+            roundDigit(digits, idx, delta, part2, one.frac, wfrac * *unit);
+            return idx;
+        }
+        unit--;
+    }
+}
+
+static int grisu2(double d, char *digits, int *K){
+    Fp w = buildFp(d);
+    Fp lower, upper;
+    int k;
+
+    getNormalizedBoundaries(&w, &lower, &upper);
+    normalize(&w);
+
+    Fp cp = findCachedPow10(upper.exp, &k);
+    w = multiply(&w, &cp);
+    upper = multiply(&upper, &cp);
+    lower = multiply(&lower, &cp);
+    //乘法有误差，边界各往里收一点，保证生成的数字一定能还原
+    lower.frac++;
+    upper.frac--;
+
+    *K = -k;
+    return generateDigits(&w, &upper, &lower, digits, K);
+}
+
+/**
+ * 把digits * 10^K格式化输出，规则和printf的%.17g相同：
+ * 十进制指数在[-4, 17)之间用普通的小数形式，否则用科学计数法
+ */
+static int emitDigits(char *digits, int ndigits, char *dest, int K){
+    int exp10 = ndigits + K - 1;    //科学计数法中的指数
+    int idx = 0;
+
+    if(exp10 >= -4 && exp10 < 17){
+        if(K >= 0){
+            //整数，后面补0
+            memcpy(dest, digits, ndigits);
+            memset(dest + ndigits, '0', K);
+            return ndigits + K;
+        }
+        int point = ndigits + K;    //小数点前面的位数
+        if(point > 0){
+            memcpy(dest, digits, point);
+            dest[point] = '.';
+            memcpy(dest + point + 1, digits + point, ndigits - point);
+            return ndigits + 1;
+        }
+        //0.000ddd
+        dest[idx++] = '0';
+        dest[idx++] = '.';
+        memset(dest + idx, '0', -point);
+        idx += -point;
+        memcpy(dest + idx, digits, ndigits);
+        return idx + ndigits;
+    }
+
+    //d.ddde+XX
+    dest[idx++] = digits[0];
+    if(ndigits > 1){
+        dest[idx++] = '.';
+        memcpy(dest + idx, digits + 1, ndigits - 1);
+        idx += ndigits - 1;
+    }
+    dest[idx++] = 'e';
+    if(exp10 < 0){
+        dest[idx++] = '-';
+        exp10 = -exp10;
+    }else{
+        dest[idx++] = '+';
+    }
+    if(exp10 >= 100){
+        dest[idx++] = '0' + exp10 / 100;
+        exp10 %= 100;
+        dest[idx++] = '0' + exp10 / 10;
+    }else{
+        dest[idx++] = '0' + exp10 / 10;
+    }
+    dest[idx++] = '0' + exp10 % 10;
+    return idx;
+}
+
+int fpconv_dtoa(double d, char dest[FPCONV_MAX_LEN]){
+    char digits[18];
+    int str_len = 0;
+    uint64_t bits;
+
+    memcpy(&bits, &d, sizeof(bits));
+    if(bits & FP_SIGNMASK){
+        dest[0] = '-';
+        str_len++;
+    }
+    //正负0
+    if((bits & ~FP_SIGNMASK) == 0){
+        dest[str_len] = '0';
+        return str_len + 1;
+    }
+
+    int K = 0;
+    int ndigits = grisu2(d, digits, &K);
+    str_len += emitDigits(digits, ndigits, dest + str_len, K);
+    return str_len;
+}
@@ -0,0 +1,19 @@
+#ifndef __FPCONV_H__
+#define __FPCONV_H__
+
+/**
+ * double转字符串，输出能精确还原成同一个double的最短十进制表示（Grisu2算法）
+ * 绝大多数值得到的就是最短的表示，极少数情况会多一位，但一定能还原
+ * 比snprintf("%.17g")快很多，并且不会输出0.30000000000000004这样多余的位数
+ */
+
+//输出的最大长度：17位有效数字 + 符号 + 小数点 + "e+308"，不包括结束符
+#define FPCONV_MAX_LEN 24
+
+/**
+ * 把fp转成字符串写到dest，不写结束符，返回写入的长度
+ * dest至少要有FPCONV_MAX_LEN字节，fp不能是nan和inf，由调用方处理
+ */
+int fpconv_dtoa(double fp, char dest[FPCONV_MAX_LEN]);
+
+#endif // !__FPCONV_H__
@@ -1,7 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <strings.h>
+#include <string.h>
 #include "intset.h"
+#include "zmalloc.h"
 /**
  * 暂时去掉了所有大小端的转换函数调用，假定系统只支持小端系统（linux或windows）
  */ 
@@ -13,7 +14,7 @@
 static intset *intsetResize(intset *is, uint32_t len){
     //重新计算intset结构所需要的contents数组内存大小
     size_t size = len * (is->encoding);
-    is = realloc(is, sizeof(intset) + size);
+    is = zrealloc(is, sizeof(intset) + size);
     return is;
 }
 
@@ -78,18 +79,19 @@ static uint8_t intsetSearch(intset *is, int64_t value, uint32_t *pos){
         if(pos){
             *pos = 0;
         }
-        return 1;
+        return 0;
     }else{
+        //比最大值大或者比最小值小，一定不存在，直接插到尾部或者首部
         if(value > _intsetGet(is, is->length-1)){
             if(pos){
                 *pos = is->length;
             }
-            return 1;
+            return 0;
         }else if(value < _intsetGet(is, 0)){
             if(pos){
                 *pos = 0;
             }
-            return 1;
+            return 0;
         }
     }
 
@@ -187,7 +189,7 @@ static void intsetMoveTail(intset *is, uint32_t from, uint32_t to){
  * 注意数组没有初始化
  */ 
 intset *intsetNew(void){
-    intset *is = malloc(sizeof(intset));
+    intset *is = zmalloc(sizeof(intset));
     is->encoding = INTSET_ENC_INT16;
     is->length = 0;
     return is;
@@ -253,7 +255,7 @@ intset *intsetRemove(intset *is, int64_t value, int8_t *success){
             intsetMoveTail(is, pos+1, pos);
         }
         //重新调整空间
-        intsetResize(is, is->length-1);
+        is = intsetResize(is, is->length-1);
         is->length--;
 
         if(success){ 
@@ -281,6 +283,17 @@ int64_t intsetRandom(intset *is){
     return _intsetGet(is, rand() % is->length);
 }
 
+/**
+ * 取得pos位置的值，pos越界返回0
+ */
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value){
+    if(pos < is->length){
+        *value = _intsetGet(is, pos);
+        return 1;
+    }
+    return 0;
+}
+
 uint32_t intsetLen(intset *is){
     return is->length;
 }
@@ -292,6 +305,7 @@ size_t intsetBlobLen(intset *is){
     return (sizeof(intset)) + is->length * is->encoding;
 }
 
+#ifdef INTSET_TEST_MAIN
 int main(void){
     int a[5] = {1,2,3,4,5};
     int *ptr = a;
@@ -301,4 +315,5 @@ int main(void){
     }
     getchar();
     return 0;   
-}
\ No newline at end of file
+}
+#endif
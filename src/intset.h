@@ -14,6 +14,7 @@ intset *intsetAdd(intset *is, int64_t value, int8_t *success);
 intset *intsetRemove(intset *is, int64_t value, int8_t *success);
 uint8_t intsetFind(intset *is, int64_t value);
 int64_t intsetRandom(intset *is);
+uint8_t intsetGet(intset *is, uint32_t pos, int64_t *value);
 uint32_t intsetLen(intset *is);
 size_t intsetBlobLen(intset *is);
 
@@ -0,0 +1,219 @@
+#include "redis.h"
+
+/**
+ * 命令的执行统计和延迟直方图
+ * 统计数据在call()中记录到当前分片的cmdstats，读取时把所有分片的加起来
+ * 读其他分片的数据时不加锁，得到的是一个近似的快照，对统计来说足够了
+ */
+
+extern struct redisCommand redisCommandTable[];
+
+/**
+ * 直方图桶的下界（纳秒），是latencyBucketIndex的逆运算
+ */
+static uint64_t latencyBucketLowerBound(int idx){
+    if(idx < REDIS_LATENCY_SUB_BUCKETS){
+        return idx;
+    }
+    int shift = (idx >> REDIS_LATENCY_SUB_BITS) - 1;
+    uint64_t sub = idx & (REDIS_LATENCY_SUB_BUCKETS-1);
+    return (REDIS_LATENCY_SUB_BUCKETS + sub) << shift;
+}
+
+/**
+ * 直方图桶的上界（纳秒），桶内的值都不大于它
+ */
+static uint64_t latencyBucketUpperBound(int idx){
+    if(idx == REDIS_LATENCY_BUCKETS-1){
+        return UINT64_MAX;
+    }
+    return latencyBucketLowerBound(idx+1) - 1;
+}
+
+/**
+ * 计算百分位数（纳秒），percentile取值0到100
+ * 返回第一个累计数量达到要求的桶的上界，但不超过记录到的最大值
+ */
+uint64_t latencyPercentile(redisCommandStats *st, double percentile){
+    uint64_t total = 0, target;
+    for(int j = 0; j < REDIS_LATENCY_BUCKETS; j++){
+        total += st->histogram[j];
+    }
+    if(total == 0){
+        return 0;
+    }
+    target = (uint64_t)(total * percentile / 100.0 + 0.5);
+    if(target == 0){
+        target = 1;
+    }
+    uint64_t count = 0;
+    for(int j = 0; j < REDIS_LATENCY_BUCKETS; j++){
+        count += st->histogram[j];
+        if(count >= target){
+            uint64_t upper = latencyBucketUpperBound(j);
+            return upper < st->max_ns ? upper : st->max_ns;
+        }
+    }
+    return st->max_ns;
+}
+
+/**
+ * 把所有分片中命令id的统计加到dst中
+ */
+void latencyMergeStats(redisCommandStats *dst, int id){
+    memset(dst, 0, sizeof(*dst));
+    for(int i = 0; i < server.shards_num; i++){
+        redisCommandStats *st = &server.shards[i]->cmdstats[id];
+        dst->calls += st->calls;
+        dst->nanoseconds += st->nanoseconds;
+        if(st->max_ns > dst->max_ns){
+            dst->max_ns = st->max_ns;
+        }
+        for(int j = 0; j < REDIS_LATENCY_BUCKETS; j++){
+            dst->histogram[j] += st->histogram[j];
+        }
+    }
+}
+
+/**
+ * INFO commandstats，每个执行过的命令一行
+ */
+sds genCommandStatsString(sds info){
+    redisCommandStats st;
+    for(int j = 0; j < server.numcommands; j++){
+        struct redisCommand *c = redisCommandTable + j;
+        latencyMergeStats(&st, j);
+        if(st.calls == 0){
+            continue;
+        }
+        info = sdscatprintf(info, "cmdstat_%s:calls=%llu,usec=%llu,usec_per_call=%.2f\r\n",
+            c->name, (unsigned long long)st.calls, (unsigned long long)(st.nanoseconds / 1000),
+            (double)st.nanoseconds / 1000 / st.calls);
+    }
+    return info;
+}
+
+/**
+ * INFO latencystats，每个执行过的命令的p50、p99、p99.9和最大延迟，单位微秒
+ */
+sds genLatencyStatsString(sds info){
+    redisCommandStats st;
+    if(!server.latency_tracking){
+        return info;
+    }
+    for(int j = 0; j < server.numcommands; j++){
+        struct redisCommand *c = redisCommandTable + j;
+        latencyMergeStats(&st, j);
+        if(st.calls == 0){
+            continue;
+        }
+        info = sdscatprintf(info, "latency_percentiles_usec_%s:p50=%.3f,p99=%.3f,p99.9=%.3f,max=%.3f\r\n",
+            c->name,
+            latencyPercentile(&st, 50) / 1000.0,
+            latencyPercentile(&st, 99) / 1000.0,
+            latencyPercentile(&st, 99.9) / 1000.0,
+            st.max_ns / 1000.0);
+    }
+    return info;
+}
+
+static void addReplyDoubleUs(redisClient *c, uint64_t ns){
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "%.3f", ns / 1000.0);
+    addReplyBulkCBuffer(c, buf, len);
+}
+
+/**
+ * 回复一个命令的延迟统计
+ * histogram_usec按2的幂微秒分桶，输出的是累计数量，空的桶不输出
+ */
+static void addReplyCommandLatency(redisClient *c, struct redisCommand *cmd, redisCommandStats *st){
+    uint64_t cumulative[64];  //每个2的幂微秒桶的数量
+    int buckets = 0, last = -1;
+
+    memset(cumulative, 0, sizeof(cumulative));
+    for(int j = 0; j < REDIS_LATENCY_BUCKETS; j++){
+        if(st->histogram[j] == 0){
+            continue;
+        }
+        //细分桶的上界落在哪个2的幂微秒桶里
+        int b = 63;
+        if(j != REDIS_LATENCY_BUCKETS-1){
+            uint64_t upper_us = (latencyBucketUpperBound(j) + 999) / 1000;
+            b = upper_us <= 1 ? 0 : 64 - __builtin_clzll(upper_us - 1);
+        }
+        cumulative[b] += st->histogram[j];
+    }
+    for(int b = 0; b < 64; b++){
+        if(cumulative[b]){
+            buckets++;
+            last = b;
+        }
+    }
+
+    addReplyBulkCBuffer(c, cmd->name, cmd->namelen);
+    addReplyMultiBulkLen(c, 12);
+    addReplyBulkCBuffer(c, "calls", 5);
+    addReplyLongLong(c, st->calls);
+    addReplyBulkCBuffer(c, "p50", 3);
+    addReplyDoubleUs(c, latencyPercentile(st, 50));
+    addReplyBulkCBuffer(c, "p99", 3);
+    addReplyDoubleUs(c, latencyPercentile(st, 99));
+    addReplyBulkCBuffer(c, "p99.9", 5);
+    addReplyDoubleUs(c, latencyPercentile(st, 99.9));
+    addReplyBulkCBuffer(c, "max", 3);
+    addReplyDoubleUs(c, st->max_ns);
+    addReplyBulkCBuffer(c, "histogram_usec", 14);
+    addReplyMultiBulkLen(c, buckets * 2);
+    uint64_t total = 0;
+    for(int b = 0; b <= last; b++){
+        total += cumulative[b];
+        if(cumulative[b]){
+            addReplyLongLong(c, 1LL << b);
+            addReplyLongLong(c, total);
+        }
+    }
+}
+
+/**
+ * LATENCY HISTOGRAM [command ...]
+ * 不指定命令时回复所有执行过的命令
+ */
+void latencyCommand(redisClient *c){
+    redisCommandStats st;
+
+    if(strcasecmp(c->argv[1]->ptr, "histogram")){
+        addReplyErrorFormat(c, "Unknown subcommand '%s'. Try LATENCY HISTOGRAM.", (char*)c->argv[1]->ptr);
+        return;
+    }
+    if(!server.latency_tracking){
+        addReplyError(c, "latency-tracking is disabled");
+        return;
+    }
+
+    //先统计要回复的命令数量，数组的长度要在最前面写出
+    int count = 0;
+    struct redisCommand **cmds = zmalloc(sizeof(*cmds) * (c->argc > 2 ? c->argc-2 : server.numcommands));
+    if(c->argc == 2){
+        for(int j = 0; j < server.numcommands; j++){
+            latencyMergeStats(&st, j);
+            if(st.calls){
+                cmds[count++] = redisCommandTable + j;
+            }
+        }
+    }else{
+        for(int j = 2; j < c->argc; j++){
+            struct redisCommand *cmd = lookupCommand(c->argv[j]->ptr);
+            if(cmd){
+                cmds[count++] = cmd;
+            }
+        }
+    }
+
+    addReplyMultiBulkLen(c, count * 2);
+    for(int j = 0; j < count; j++){
+        latencyMergeStats(&st, cmds[j]->id);
+        addReplyCommandLatency(c, cmds[j], &st);
+    }
+    zfree(cmds);
+}
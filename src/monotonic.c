@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+#include "monotonic.h"
+
+int monotonic_use_tsc = 0;
+uint64_t monotonic_tsc_mult = 0;
+
+static char monotonic_info[64];
+
+static uint64_t clockMonotonicNs(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) && defined(__linux__)
+/**
+ * 检查/proc/cpuinfo中是否同时有constant_tsc和nonstop_tsc
+ * 前者保证TSC频率不随CPU频率变化，后者保证深度休眠时TSC不停止
+ */
+static int tscIsReliable(void){
+    FILE *fp = fopen("/proc/cpuinfo", "r");
+    char line[4096];
+    int constant = 0, nonstop = 0;
+    if(fp == NULL){
+        return 0;
+    }
+    while(fgets(line, sizeof(line), fp) != NULL){
+        if(strncmp(line, "flags", 5) == 0){
+            constant = strstr(line, " constant_tsc") != NULL;
+            nonstop = strstr(line, " nonstop_tsc") != NULL;
+            break;
+        }
+    }
+    fclose(fp);
+    return constant && nonstop;
+}
+
+/**
+ * 用CLOCK_MONOTONIC校准TSC的频率，忙等大约10毫秒
+ */
+static void calibrateTsc(void){
+    uint64_t ns0 = clockMonotonicNs(), tsc0 = __builtin_ia32_rdtsc();
+    uint64_t ns1, tsc1;
+    do{
+        ns1 = clockMonotonicNs();
+    }while(ns1 - ns0 < 10000000);
+    tsc1 = __builtin_ia32_rdtsc();
+    monotonic_tsc_mult = ((ns1 - ns0) << 32) / (tsc1 - tsc0);
+}
+#endif
+
+const char *monotonicInit(void){
+#if defined(__x86_64__) && defined(__linux__)
+    if(tscIsReliable()){
+        calibrateTsc();
+        if(monotonic_tsc_mult != 0){
+            monotonic_use_tsc = 1;
+            snprintf(monotonic_info, sizeof(monotonic_info), "X86 TSC @ %.0f ticks/us",
+                1000.0 * 4294967296.0 / monotonic_tsc_mult);
+            return monotonic_info;
+        }
+    }
+#endif
+    snprintf(monotonic_info, sizeof(monotonic_info), "POSIX clock_gettime");
+    return monotonic_info;
+}
+
+const char *monotonicInfoString(void){
+    return monotonic_info;
+}
@@ -0,0 +1,69 @@
+#ifndef __MONOTONIC_H__
+#define __MONOTONIC_H__
+
+#include <stdint.h>
+#include <time.h>
+
+/**
+ * 单调时钟，用于测量耗时，不受系统时间调整的影响
+ * x86_64上CPU的TSC是恒定频率并且不会在休眠时停止时，直接读取TSC，只需要几纳秒
+ * 其他情况使用clock_gettime(CLOCK_MONOTONIC)，在linux上通过vDSO调用，不会陷入内核
+ * 取时间返回的是原始的tick，只有在计算差值之后才转成纳秒，热路径上不做乘除法
+ */
+typedef uint64_t monotime;
+
+extern int monotonic_use_tsc;   //是否使用TSC
+extern uint64_t monotonic_tsc_mult; //tick转纳秒的定点数乘数，低32位是小数部分
+
+/**
+ * 初始化单调时钟，必须在第一次取时间之前调用，返回描述所选时钟的字符串
+ */
+const char *monotonicInit(void);
+const char *monotonicInfoString(void);
+
+static inline monotime getMonotonicTicks(void){
+#if defined(__x86_64__)
+    if(monotonic_use_tsc){
+        return __builtin_ia32_rdtsc();
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * 把两次getMonotonicTicks的差值转成纳秒
+ */
+static inline uint64_t monotonicTicksToNs(monotime ticks){
+#if defined(__x86_64__)
+    if(monotonic_use_tsc){
+        return (uint64_t)(((unsigned __int128)ticks * monotonic_tsc_mult) >> 32);
+    }
+#endif
+    return ticks;
+}
+
+static inline uint64_t getMonotonicNs(void){
+    return monotonicTicksToNs(getMonotonicTicks());
+}
+
+static inline uint64_t getMonotonicUs(void){
+    return getMonotonicNs() / 1000;
+}
+
+/**
+ * 低精度的单调时钟（毫秒），精度是内核的一个tick（通常1到4毫秒）
+ * 只读取vDSO中内核在tick时更新的时间，比CLOCK_MONOTONIC还要便宜，适合秒级的LRU时钟
+ */
+static inline uint64_t getMonotonicCoarseMs(void){
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#endif // !__MONOTONIC_H__
@@ -0,0 +1,1268 @@
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include "redis.h"
+#include "util.h"
+
+static void setProtocolError(redisClient *c);
+
+/**
+ * IO线程的共享状态
+ * 每个线程有自己的客户端列表和待处理计数，主线程写好列表后设置计数，线程处理完后把计数清0
+ */
+static pthread_t io_threads[REDIS_IO_THREADS_MAX_NUM];
+static pthread_mutex_t io_threads_mutex[REDIS_IO_THREADS_MAX_NUM];
+static unsigned long io_threads_pending[REDIS_IO_THREADS_MAX_NUM];
+static list *io_threads_list[REDIS_IO_THREADS_MAX_NUM];
+static int io_threads_op;
+//保护异步关闭队列，IO线程里出错的客户端也会放进这个队列
+static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * 回复链表节点的释放函数
+ */
+static void freeClientReplyValue(void *o){
+    zfree(o);
+}
+
+/**
+ * 为给定的套接字创建一个新的客户端，并注册读事件
+ */
+redisClient *createClient(int fd){
+    redisClient *c = zmalloc(sizeof(redisClient));
+
+    //设置非阻塞和关闭Nagle算法，还要按配置开启keepalive
+    anetNonBlock(NULL, fd);
+    anetEnableTcpNoDelay(NULL, fd);
+    if(server.tcpkeepalive){
+        anetKeepAlive(NULL, fd, server.tcpkeepalive);
+    }
+    /**
+     * 读事件使用边缘触发，每次通知后都要把套接字里的数据全部读进querybuf，
+     * 这样一个连接只在有新数据到达时才会被唤醒一次
+     * 使用io_uring时读写都交给内核完成（AE_COMPLETION），IO线程会在其他线程里读写套接字，这时不能使用
+     */
+    int mask = AE_READABLE|AE_EDGE;
+    if(server.io_threads_num == 1){
+        mask |= AE_COMPLETION;
+    }
+    if(aeCreateFileEvent(shard->el, fd, mask, readQueryFromClient, c) == AE_ERR){
+        close(fd);
+        zfree(c);
+        return NULL;
+    }
+
+    c->fd = fd;
+    c->shard = shard;
+    //默认使用0号数据库
+    c->db = &shard->db[0];
+    c->dictid = 0;
+    c->name = NULL;
+    c->querybuf = sdsempty();
+    c->qb_pos = 0;
+    c->flags = 0;
+    c->argc = 0;
+    c->argv = NULL;
+    c->argv_len = 0;
+    c->cmd = NULL;
+    c->broadcast_hops = 0;
+    c->broadcast_acc = 0;
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->bulklen = -1;
+    c->bufpos = 0;
+    c->reply = listCreate();
+    listSetFreeMethod(c->reply, freeClientReplyValue);
+    c->reply_bytes = 0;
+    c->sentlen = 0;
+    c->ctime = c->lastinteraction = server.unixtime;
+    listAddNodeTail(shard->clients, c);
+    c->client_list_node = listLast(shard->clients);
+    __atomic_add_fetch(&server.connected_clients, 1, __ATOMIC_RELAXED);
+    return c;
+}
+
+/**
+ * 释放当前命令的所有参数，argv数组本身保留，留给下一条命令复用
+ */
+static void freeClientArgv(redisClient *c){
+    for(int j = 0; j < c->argc; j++){
+        decrRefCount(c->argv[j]);
+    }
+    c->argc = 0;
+    c->cmd = NULL;
+}
+
+/**
+ * 命令执行完成后重置客户端，准备接收下一条命令
+ */
+void resetClient(redisClient *c){
+    freeClientArgv(c);
+    c->reqtype = 0;
+    c->multibulklen = 0;
+    c->bulklen = -1;
+}
+
+/**
+ * 释放客户端，关闭连接并清理所有相关资源
+ */
+void freeClient(redisClient *c){
+    //命令还在其他分片执行，等它回来之后再释放
+    if(c->flags & REDIS_FORWARDED){
+        freeClientAsync(c);
+        return;
+    }
+    //注销事件并关闭套接字
+    aeDeleteFileEvent(shard->el, c->fd, AE_READABLE|AE_WRITABLE|AE_EDGE);
+    close(c->fd);
+
+    sdsfree(c->querybuf);
+    freeClientArgv(c);
+    zfree(c->argv);
+    listRelease(c->reply);
+    if(c->name){
+        decrRefCount(c->name);
+    }
+
+    //从客户端链表中删除
+    listDeleteNode(shard->clients, c->client_list_node);
+    //如果在等待IO线程读取的队列里，也要一并删除
+    if(c->flags & REDIS_PENDING_READ){
+        listNode *ln = listSearchKey(server.clients_pending_read, c);
+        redisAssert(ln != NULL);
+        listDeleteNode(server.clients_pending_read, ln);
+    }
+    //如果在等待发送回复的队列里，也要一并删除
+    if(c->flags & REDIS_PENDING_WRITE){
+        listNode *ln = listSearchKey(shard->clients_pending_write, c);
+        redisAssert(ln != NULL);
+        listDeleteNode(shard->clients_pending_write, ln);
+    }
+    //如果在异步关闭队列里，也要一并删除
+    if(c->flags & REDIS_CLOSE_ASAP){
+        listNode *ln = listSearchKey(shard->clients_to_close, c);
+        redisAssert(ln != NULL);
+        listDeleteNode(shard->clients_to_close, ln);
+    }
+    __atomic_sub_fetch(&server.connected_clients, 1, __ATOMIC_RELAXED);
+    zfree(c);
+}
+
+/**
+ * 将客户端放入异步关闭队列，在beforeSleep或serverCron中才真正释放
+ * 用于不能立即释放客户端的上下文中（例如正在遍历客户端，或者在IO线程中）
+ */
+void freeClientAsync(redisClient *c){
+    if(server.io_threads_num > 1){
+        pthread_mutex_lock(&async_free_queue_mutex);
+    }
+    if(!(c->flags & REDIS_CLOSE_ASAP)){
+        c->flags |= REDIS_CLOSE_ASAP;
+        listAddNodeTail(shard->clients_to_close, c);
+    }
+    if(server.io_threads_num > 1){
+        pthread_mutex_unlock(&async_free_queue_mutex);
+    }
+}
+
+/**
+ * 释放异步关闭队列里的所有客户端
+ */
+void freeClientsInAsyncFreeQueue(void){
+    listIterator li;
+    listNode *ln;
+    listRewindHead(shard->clients_to_close, &li);
+    while((ln = listNext(&li))){
+        redisClient *c = listNodeValue(ln);
+        //命令转发到其他分片的客户端，留到下一次再释放
+        if(c->flags & REDIS_FORWARDED){
+            continue;
+        }
+        //先去掉标志再删除节点，这样freeClient就不会再查找一次队列
+        c->flags &= ~REDIS_CLOSE_ASAP;
+        listDeleteNode(shard->clients_to_close, ln);
+        freeClient(c);
+    }
+}
+
+/**
+ * 客户端是否还有没发送完的回复
+ */
+int clientHasPendingReplies(redisClient *c){
+    return c->bufpos || listLength(c->reply);
+}
+
+/**
+ * 在往客户端写入回复之前调用
+ * 这里并不注册写事件，只是把客户端放进shard->clients_pending_write，
+ * 等到beforeSleep中再统一发送，大部分情况下一次writev就能全部写完，不需要再等一次写事件
+ */
+static int prepareClientToWrite(redisClient *c){
+    /**
+     * 在其他分片执行的转发命令，只写入回复缓冲区，由客户端所在的分片发送
+     * 这时客户端的flags属于原来的分片，这里不能读写
+     */
+    if(c->shard != shard){
+        return REDIS_OK;
+    }
+    if(c->fd <= 0){
+        return REDIS_ERR;
+    }
+    if(c->flags & (REDIS_CLOSE_AFTER_REPLY|REDIS_CLOSE_ASAP)){
+        return REDIS_ERR;
+    }
+    /**
+     * 已经在等待队列里，或者已经注册了写事件，都不需要再处理
+     * IO线程中产生的回复（例如协议错误）不能操作全局队列，由主线程在读取阶段结束后再放进队列
+     */
+    if(!(c->flags & (REDIS_PENDING_WRITE|REDIS_PENDING_READ)) && !clientHasPendingReplies(c)){
+        c->flags |= REDIS_PENDING_WRITE;
+        listAddNodeHead(shard->clients_pending_write, c);
+    }
+    return REDIS_OK;
+}
+
+/**
+ * 把已经有回复的客户端放进shard->clients_pending_write，
+ * 用于回复不是在本分片主线程中产生的情况（IO线程或者其他分片）
+ */
+void putClientInPendingWriteQueue(redisClient *c){
+    if(!(c->flags & (REDIS_PENDING_WRITE|REDIS_CLOSE_ASAP))){
+        c->flags |= REDIS_PENDING_WRITE;
+        listAddNodeHead(shard->clients_pending_write, c);
+    }
+}
+
+/**
+ * 尝试把回复写入客户端的静态缓冲区
+ * 如果回复链表里已经有内容，或者缓冲区放不下，则返回REDIS_ERR
+ */
+static int _addReplyToBuffer(redisClient *c, const char *s, size_t len){
+    size_t available = sizeof(c->buf) - c->bufpos;
+    //回复链表里已经有内容了，只能继续追加到链表里，否则顺序会乱
+    if(listLength(c->reply) > 0){
+        return REDIS_ERR;
+    }
+    if(len > available){
+        return REDIS_ERR;
+    }
+    memcpy(c->buf + c->bufpos, s, len);
+    c->bufpos += len;
+    return REDIS_OK;
+}
+
+/**
+ * 将回复追加到回复链表中，先填满尾部的块，剩下的部分再新建一个块
+ * 新块至少为REDIS_REPLY_CHUNK_BYTES，这样连续的小回复会被合并在一起
+ */
+static void _addReplyProtoToList(redisClient *c, const char *s, size_t len){
+    listNode *ln = listLast(c->reply);
+    clientReplyBlock *tail = ln ? listNodeValue(ln) : NULL;
+
+    if(tail){
+        //先尽量填满尾部块
+        size_t avail = tail->size - tail->used;
+        size_t copy = avail >= len ? len : avail;
+        memcpy(tail->buf + tail->used, s, copy);
+        tail->used += copy;
+        s += copy;
+        len -= copy;
+    }
+    if(len){
+        size_t size = len < REDIS_REPLY_CHUNK_BYTES ? REDIS_REPLY_CHUNK_BYTES : len;
+        tail = zmalloc(size + sizeof(clientReplyBlock));
+        tail->size = size;
+        tail->used = len;
+        memcpy(tail->buf, s, len);
+        listAddNodeTail(c->reply, tail);
+        c->reply_bytes += tail->size;
+    }
+}
+
+/**
+ * 先尝试写入静态缓冲区，放不下再写入回复链表
+ */
+static void _addReplyString(redisClient *c, const char *s, size_t len){
+    if(_addReplyToBuffer(c, s, len) != REDIS_OK){
+        _addReplyProtoToList(c, s, len);
+    }
+}
+
+/**
+ * 将字符串对象作为回复内容发给客户端
+ */
+void addReply(redisClient *c, robj *obj){
+    if(prepareClientToWrite(c) != REDIS_OK){
+        return;
+    }
+    if(obj->encoding == REDIS_ENCODING_INT){
+        //INT编码的对象先转成字符串，不用创建临时的对象
+        char buf[32];
+        int len = ll2string(buf, sizeof(buf), (long)obj->ptr);
+        _addReplyString(c, buf, len);
+    }else{
+        _addReplyString(c, obj->ptr, sdslen(obj->ptr));
+    }
+}
+
+/**
+ * 将sds作为回复内容发给客户端，s会被释放
+ */
+void addReplySds(redisClient *c, sds s){
+    if(prepareClientToWrite(c) != REDIS_OK){
+        sdsfree(s);
+        return;
+    }
+    _addReplyString(c, s, sdslen(s));
+    sdsfree(s);
+}
+
+void addReplyString(redisClient *c, char *s, size_t len){
+    if(prepareClientToWrite(c) != REDIS_OK){
+        return;
+    }
+    _addReplyString(c, s, len);
+}
+
+static void addReplyErrorLength(redisClient *c, char *s, size_t len){
+    addReplyString(c, "-ERR ", 5);
+    addReplyString(c, s, len);
+    addReplyString(c, "\r\n", 2);
+}
+
+void addReplyError(redisClient *c, char *err){
+    addReplyErrorLength(c, err, strlen(err));
+}
+
+void addReplyErrorFormat(redisClient *c, const char *fmt, ...){
+    va_list ap;
+    va_start(ap, fmt);
+    sds s = sdsempty();
+    char buf[REDIS_MAX_LOGMSG_LEN];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    s = sdscat(s, buf);
+    //错误信息里不能有换行，否则会破坏协议
+    for(size_t j = 0; j < sdslen(s); j++){
+        if(s[j] == '\r' || s[j] == '\n'){
+            s[j] = ' ';
+        }
+    }
+    addReplyErrorLength(c, s, sdslen(s));
+    sdsfree(s);
+}
+
+void addReplyStatus(redisClient *c, char *status){
+    addReplyString(c, "+", 1);
+    addReplyString(c, status, strlen(status));
+    addReplyString(c, "\r\n", 2);
+}
+
+/**
+ * 以prefix开头的长度或整数回复，例如":1\r\n"或者"$5\r\n"
+ */
+static void _addReplyLongLongWithPrefix(redisClient *c, long long ll, char prefix){
+    char buf[128];
+    int len;
+    buf[0] = prefix;
+    len = ll2string(buf+1, sizeof(buf)-1, ll);
+    buf[len+1] = '\r';
+    buf[len+2] = '\n';
+    addReplyString(c, buf, len+3);
+}
+
+void addReplyLongLong(redisClient *c, long long ll){
+    _addReplyLongLongWithPrefix(c, ll, ':');
+}
+
+void addReplyMultiBulkLen(redisClient *c, long length){
+    _addReplyLongLongWithPrefix(c, length, '*');
+}
+
+/**
+ * 回复一个bulk字符串，格式为$<len>\r\n<data>\r\n
+ */
+void addReplyBulk(redisClient *c, robj *obj){
+    _addReplyLongLongWithPrefix(c, stringObjectLen(obj), '$');
+    addReply(c, obj);
+    addReply(c, shared.crlf);
+}
+
+/**
+ * 以bulk回复一个double，使用能还原成同一个值的最短表示
+ */
+void addReplyDouble(redisClient *c, double d){
+    char dbuf[MAX_D2STRING_CHARS];
+    int dlen = d2string(dbuf, sizeof(dbuf), d);
+    addReplyBulkCBuffer(c, dbuf, dlen);
+}
+
+void addReplyBulkCBuffer(redisClient *c, void *p, size_t len){
+    _addReplyLongLongWithPrefix(c, len, '$');
+    addReplyString(c, p, len);
+    addReply(c, shared.crlf);
+}
+
+/**
+ * 将客户端所有待发送的回复（静态缓冲区+回复链表）用writev一次写出
+ * sentlen是第一段待发送数据中已经发送的字节数，第一段是静态缓冲区或者链表的头块
+ * 返回REDIS_ERR说明客户端已经被释放了
+ */
+int writeToClient(redisClient *c, int handler_installed){
+    struct iovec iov[REDIS_IOV_MAX];
+    ssize_t nwritten = 0, totwritten = 0;
+
+    while(clientHasPendingReplies(c)){
+        int iovcnt = 0;
+        size_t offset = c->sentlen;
+        size_t iovbytes = 0;
+
+        //先放静态缓冲区，然后依次放链表中的块
+        if(c->bufpos){
+            iov[iovcnt].iov_base = c->buf + offset;
+            iov[iovcnt].iov_len = c->bufpos - offset;
+            iovbytes += iov[iovcnt].iov_len;
+            iovcnt++;
+            offset = 0;
+        }
+        listNode *ln = listFirst(c->reply);
+        while(ln && iovcnt < REDIS_IOV_MAX && iovbytes < REDIS_MAX_WRITE_PER_CALL){
+            clientReplyBlock *o = listNodeValue(ln);
+            if(o->used > offset){
+                iov[iovcnt].iov_base = o->buf + offset;
+                iov[iovcnt].iov_len = o->used - offset;
+                iovbytes += iov[iovcnt].iov_len;
+                iovcnt++;
+            }
+            offset = 0;
+            ln = listNextNode(ln);
+        }
+        if(iovcnt == 0){
+            break;
+        }
+
+        nwritten = aeWritev(c->shard->el, c->fd, iov, iovcnt);
+        if(nwritten <= 0){
+            break;
+        }
+        totwritten += nwritten;
+
+        //根据写出的字节数，依次消耗静态缓冲区和链表中的块
+        size_t remaining = nwritten;
+        if(c->bufpos){
+            size_t left = c->bufpos - c->sentlen;
+            if(remaining >= left){
+                remaining -= left;
+                c->bufpos = 0;
+                c->sentlen = 0;
+            }else{
+                c->sentlen += remaining;
+                remaining = 0;
+            }
+        }
+        while(remaining){
+            ln = listFirst(c->reply);
+            clientReplyBlock *o = listNodeValue(ln);
+            size_t left = o->used - c->sentlen;
+            if(remaining >= left){
+                remaining -= left;
+                c->reply_bytes -= o->size;
+                listDeleteNode(c->reply, ln);
+                c->sentlen = 0;
+            }else{
+                c->sentlen += remaining;
+                remaining = 0;
+            }
+        }
+        //没有全部写出，说明内核缓冲区已满，等写事件再继续
+        if((size_t)nwritten < iovbytes){
+            break;
+        }
+        /**
+         * 一个客户端写得太多会让其他客户端等太久，超过REDIS_MAX_WRITE_PER_CALL就停下，剩下的交给写事件；
+         * 超过maxmemory时继续写，让回复缓冲区占用的内存尽快释放
+         */
+        if(totwritten > REDIS_MAX_WRITE_PER_CALL &&
+            !(server.maxmemory && zmalloc_used_memory() > server.maxmemory)){
+            break;
+        }
+    }
+    //释放掉头部的空块
+    while(c->bufpos == 0 && listLength(c->reply)){
+        clientReplyBlock *o = listNodeValue(listFirst(c->reply));
+        if(o->used){
+            break;
+        }
+        c->reply_bytes -= o->size;
+        listDeleteNode(c->reply, listFirst(c->reply));
+    }
+
+    if(nwritten == -1){
+        if(errno != EAGAIN){
+            redisLog("Error writing to client: %s", strerror(errno));
+            freeClientAsync(c);
+            return REDIS_ERR;
+        }
+    }
+    if(totwritten > 0){
+        c->lastinteraction = server.unixtime;
+    }
+    if(!clientHasPendingReplies(c)){
+        c->sentlen = 0;
+        if(handler_installed){
+            aeDeleteFileEvent(shard->el, c->fd, AE_WRITABLE);
+        }
+        //回复已发送完毕，关闭需要关闭的客户端，这里可能在IO线程中，所以只能异步关闭
+        if(c->flags & REDIS_CLOSE_AFTER_REPLY){
+            freeClientAsync(c);
+            return REDIS_ERR;
+        }
+    }
+    return REDIS_OK;
+}
+
+/**
+ * 客户端套接字的写事件处理器，只有在beforeSleep没能一次写完时才会注册
+ */
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask){
+    redisClient *c = privdata;
+    AE_NOTUSED(el);
+    AE_NOTUSED(mask);
+    /**
+     * 回复缓冲区正在被其他分片写入，先注销写事件，
+     * 命令回来之后客户端会重新进入shard->clients_pending_write
+     */
+    if(c->flags & REDIS_FORWARDED){
+        aeDeleteFileEvent(shard->el, fd, AE_WRITABLE);
+        return;
+    }
+    writeToClient(c, 1);
+}
+
+/**
+ * 在进入下一次epoll_wait之前调用，直接发送所有客户端在这一轮中产生的回复
+ * 这样就省掉了注册写事件再等一次通知的往返，只有写不完的客户端才注册写事件
+ */
+int handleClientsWithPendingWrites(void){
+    int processed = listLength(shard->clients_pending_write);
+
+    while(listLength(shard->clients_pending_write)){
+        listNode *ln = listFirst(shard->clients_pending_write);
+        redisClient *c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        listDeleteNode(shard->clients_pending_write, ln);
+
+        //转发出去的客户端等命令回来后会重新进入队列
+        if(c->flags & (REDIS_CLOSE_ASAP|REDIS_FORWARDED)){
+            continue;
+        }
+        if(writeToClient(c, 0) == REDIS_ERR){
+            continue;
+        }
+        //还有数据没写完，注册写事件，等套接字可写时继续发送
+        if(clientHasPendingReplies(c) &&
+            aeCreateFileEvent(shard->el, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR){
+            freeClientAsync(c);
+        }
+    }
+    return processed;
+}
+
+/**
+ * 解析inline命令，例如telnet直接输入的"set foo bar"
+ * 直接在querybuf原地切分，不再复制出一行
+ * 命令完整则返回REDIS_OK，还需要更多数据则返回REDIS_ERR
+ */
+static int processInlineBuffer(redisClient *c){
+    char *start = c->querybuf + c->qb_pos;
+    size_t len = sdslen(c->querybuf) - c->qb_pos;
+    char *newline = memchr(start, '\n', len);
+    int linefeed_chars = 1;
+    int argc;
+    sds *argv;
+
+    //还没有读到一整行
+    if(newline == NULL){
+        if(len > REDIS_INLINE_MAX_SIZE){
+            addReplyError(c, "Protocol error: too big inline request");
+            setProtocolError(c);
+        }
+        return REDIS_ERR;
+    }
+    //兼容\r\n结尾
+    if(newline != start && *(newline-1) == '\r'){
+        newline--;
+        linefeed_chars++;
+    }
+
+    //临时把行尾改成结束符，sdssplitargs就可以直接在querybuf上切分
+    char saved = *newline;
+    *newline = '\0';
+    argv = sdssplitargs(start, &argc);
+    *newline = saved;
+    if(argv == NULL){
+        addReplyError(c, "Protocol error: unbalanced quotes in request");
+        setProtocolError(c);
+        return REDIS_ERR;
+    }
+    c->qb_pos += (newline - start) + linefeed_chars;
+
+    //创建参数对象，sdssplitargs分出来的sds直接给对象使用
+    if(argc > c->argv_len){
+        zfree(c->argv);
+        c->argv = zmalloc(sizeof(robj*) * argc);
+        c->argv_len = argc;
+    }
+    c->argc = 0;
+    for(int j = 0; j < argc; j++){
+        if(sdslen(argv[j])){
+            c->argv[c->argc++] = createObject(REDIS_STRING, argv[j]);
+        }else{
+            sdsfree(argv[j]);
+        }
+    }
+    zfree(argv);
+    return REDIS_OK;
+}
+
+/**
+ * 协议错误时，回复错误信息后关闭客户端，并丢弃剩余的数据
+ */
+static void setProtocolError(redisClient *c){
+    c->flags |= REDIS_CLOSE_AFTER_REPLY;
+    c->qb_pos = sdslen(c->querybuf);
+}
+
+/**
+ * 解析RESP协议的multibulk命令，可以跨多次read继续解析
+ * 解析的状态保存在multibulklen和bulklen中，qb_pos指向下一个要解析的字节
+ * 命令完整则返回REDIS_OK，还需要更多数据则返回REDIS_ERR
+ */
+static int processMultibulkBuffer(redisClient *c){
+    char *newline = NULL;
+    long long ll;
+
+    if(c->multibulklen == 0){
+        //还没有读到参数个数，解析*<argc>\r\n
+        redisAssert(c->argc == 0);
+        newline = memchr(c->querybuf + c->qb_pos, '\r', sdslen(c->querybuf) - c->qb_pos);
+        if(newline == NULL){
+            if(sdslen(c->querybuf) - c->qb_pos > REDIS_INLINE_MAX_SIZE){
+                addReplyError(c, "Protocol error: too big mbulk count string");
+                setProtocolError(c);
+            }
+            return REDIS_ERR;
+        }
+        //\r后面的\n还没有到
+        if(newline + 1 >= c->querybuf + sdslen(c->querybuf)){
+            return REDIS_ERR;
+        }
+        char *p = c->querybuf + c->qb_pos + 1;
+        if(!string2ll(p, newline - p, &ll) || ll > 1024*1024){
+            addReplyError(c, "Protocol error: invalid multibulk length");
+            setProtocolError(c);
+            return REDIS_ERR;
+        }
+        c->qb_pos = (newline - c->querybuf) + 2;
+        //*0或者*-1都当做空命令
+        if(ll <= 0){
+            return REDIS_OK;
+        }
+        c->multibulklen = ll;
+        if(ll > c->argv_len){
+            zfree(c->argv);
+            c->argv = zmalloc(sizeof(robj*) * ll);
+            c->argv_len = ll;
+        }
+    }
+
+    redisAssert(c->multibulklen > 0);
+    while(c->multibulklen){
+        //读取参数长度$<len>\r\n
+        if(c->bulklen == -1){
+            newline = memchr(c->querybuf + c->qb_pos, '\r', sdslen(c->querybuf) - c->qb_pos);
+            if(newline == NULL){
+                if(sdslen(c->querybuf) - c->qb_pos > REDIS_INLINE_MAX_SIZE){
+                    addReplyError(c, "Protocol error: too big bulk count string");
+                    setProtocolError(c);
+                    return REDIS_ERR;
+                }
+                break;
+            }
+            if(newline + 1 >= c->querybuf + sdslen(c->querybuf)){
+                break;
+            }
+            if(c->querybuf[c->qb_pos] != '$'){
+                addReplyErrorFormat(c, "Protocol error: expected '$', got '%c'", c->querybuf[c->qb_pos]);
+                setProtocolError(c);
+                return REDIS_ERR;
+            }
+            char *p = c->querybuf + c->qb_pos + 1;
+            if(!string2ll(p, newline - p, &ll) || ll < 0 || ll > 512*1024*1024){
+                addReplyError(c, "Protocol error: invalid bulk length");
+                setProtocolError(c);
+                return REDIS_ERR;
+            }
+            c->qb_pos = (newline - c->querybuf) + 2;
+            if(ll >= REDIS_MBULK_BIG_ARG){
+                /**
+                 * 大参数：把已解析的部分截掉，让querybuf从这个参数开始，
+                 * 并且一次性预留好整个参数的空间，之后read直接读进这块空间，
+                 * 读完后querybuf本身就成为参数对象，不再复制一次
+                 */
+                if(sdslen(c->querybuf) - c->qb_pos <= (size_t)ll + 2){
+                    sdsrange(c->querybuf, c->qb_pos, -1);
+                    c->qb_pos = 0;
+                    c->querybuf = sdsMakeRoomNonGreedy(c->querybuf, ll + 2 - sdslen(c->querybuf));
+                }
+            }
+            c->bulklen = ll;
+        }
+
+        //参数数据还没有读全
+        if(sdslen(c->querybuf) - c->qb_pos < (size_t)(c->bulklen + 2)){
+            break;
+        }
+        if(c->qb_pos == 0 && c->bulklen >= REDIS_MBULK_BIG_ARG &&
+            sdslen(c->querybuf) == (size_t)(c->bulklen + 2)){
+            //querybuf正好就是这个参数，直接拿来做对象，去掉结尾的\r\n
+            c->argv[c->argc++] = createObject(REDIS_STRING, c->querybuf);
+            sdsIncrLen(c->querybuf, -2);
+            //为下一个参数重新分配querybuf，大参数后面往往还是大参数，所以预留同样的大小，不再额外翻倍
+            c->querybuf = sdsMakeRoomNonGreedy(sdsempty(), c->bulklen + 2);
+        }else{
+            c->argv[c->argc++] = createStringObject(c->querybuf + c->qb_pos, c->bulklen);
+            c->qb_pos += c->bulklen + 2;
+        }
+        c->bulklen = -1;
+        c->multibulklen--;
+    }
+
+    //所有参数都已读入
+    if(c->multibulklen == 0){
+        return REDIS_OK;
+    }
+    return REDIS_ERR;
+}
+
+/**
+ * 解析querybuf中所有完整的命令并执行，不完整的部分留到下次read之后继续解析
+ */
+/**
+ * 流水线预取：从pos开始扫描querybuf中后面最多DICT_BATCH_SIZE条完整的multibulk命令，
+ * 取出第一个键，一起预取它们在键空间中的位置，这样执行这些命令时访存已经和前面命令的执行重叠了
+ * 只扫描RESP格式，不创建任何对象；遇到不完整的命令或者inline命令就停下
+ * 返回扫描结束的位置，qb_pos越过这个位置之前不需要再次扫描
+ */
+static size_t prefetchPipelineKeys(redisClient *c, size_t pos){
+    char *buf = c->querybuf;
+    size_t len = sdslen(buf);
+    const char *keys[DICT_BATCH_SIZE];
+    size_t lens[DICT_BATCH_SIZE];
+    int numkeys = 0;
+
+    for(int n = 0; n < DICT_BATCH_SIZE && pos < len && buf[pos] == '*'; n++){
+        const char *argp[2] = {NULL, NULL};
+        size_t argl[2] = {0, 0};
+        long long argc, ll, j;
+        char *newline = memchr(buf + pos, '\r', len - pos);
+        if(newline == NULL || !string2ll(buf + pos + 1, newline - (buf + pos + 1), &argc) || argc > 1024*1024){
+            break;
+        }
+        size_t cur = newline - buf + 2;
+        for(j = 0; j < argc; j++){
+            if(cur >= len || buf[cur] != '$'){
+                break;
+            }
+            newline = memchr(buf + cur, '\r', len - cur);
+            if(newline == NULL || !string2ll(buf + cur + 1, newline - (buf + cur + 1), &ll) || ll < 0){
+                break;
+            }
+            cur = newline - buf + 2;
+            if(cur + ll + 2 > len){
+                break;
+            }
+            if(j < 2){
+                argp[j] = buf + cur;
+                argl[j] = ll;
+            }
+            cur += ll + 2;
+        }
+        //命令还不完整
+        if(j < argc){
+            break;
+        }
+        pos = cur;
+
+        if(argc < 2){
+            continue;
+        }
+        struct redisCommand *cmd = lookupCommandBuffer(argp[0], argl[0]);
+        //只预取属于当前分片的键，其他分片的键会被转发过去
+        if(cmd && cmd->firstkey == 1 && (server.shards_num == 1 || getKeyShard(argp[1], argl[1]) == shard->id)){
+            keys[numkeys] = argp[1];
+            lens[numkeys] = argl[1];
+            numkeys++;
+        }
+    }
+    if(numkeys){
+        dbPrefetchKeys(c->db, keys, lens, numkeys);
+    }
+    return pos;
+}
+
+void processInputBuffer(redisClient *c){
+    //已经预取过的命令的结束位置
+    size_t prefetched = 0;
+    while(c->qb_pos < sdslen(c->querybuf)){
+        //回复之后就要关闭的客户端，不再处理后面的命令
+        if(c->flags & (REDIS_CLOSE_AFTER_REPLY|REDIS_CLOSE_ASAP)){
+            break;
+        }
+        //已经解析好的命令还没执行完（等待主线程或者其他分片），argv还被占用着
+        if(c->flags & (REDIS_PENDING_COMMAND|REDIS_FORWARDED)){
+            break;
+        }
+        //根据第一个字节判断协议类型
+        if(!c->reqtype){
+            if(c->querybuf[c->qb_pos] == '*'){
+                c->reqtype = REDIS_REQ_MULTIBULK;
+            }else{
+                c->reqtype = REDIS_REQ_INLINE;
+            }
+        }
+        if(c->reqtype == REDIS_REQ_INLINE){
+            if(processInlineBuffer(c) != REDIS_OK){
+                break;
+            }
+        }else if(c->reqtype == REDIS_REQ_MULTIBULK){
+            if(processMultibulkBuffer(c) != REDIS_OK){
+                break;
+            }
+        }else{
+            redisPanic("Unknown request type");
+        }
+
+        //当前命令后面还有数据说明是流水线，执行当前命令之前先预取后面命令的键
+        if(c->argc && c->qb_pos >= prefetched && c->qb_pos < sdslen(c->querybuf) &&
+            !(c->flags & REDIS_PENDING_READ) && dictSlots(c->db->dict) >= REDIS_PREFETCH_MIN_SLOTS){
+            prefetched = prefetchPipelineKeys(c, c->qb_pos);
+        }
+
+        if(c->argc == 0){
+            //空命令，直接重置
+            resetClient(c);
+        }else if(c->flags & REDIS_PENDING_READ){
+            //在IO线程中只负责解析，命令交给主线程执行
+            c->flags |= REDIS_PENDING_COMMAND;
+            break;
+        }else{
+            if(processCommand(c) == REDIS_OK){
+                resetClient(c);
+            }
+        }
+    }
+    //把已经解析完的部分一次性截掉，而不是每条命令都移动一次剩余的数据
+    if(c->qb_pos){
+        sdsrange(c->querybuf, c->qb_pos, -1);
+        c->qb_pos = 0;
+    }
+}
+
+/**
+ * 为新接受的连接创建客户端，超过maxclients则直接拒绝
+ */
+static void acceptCommonHandler(int fd){
+    redisClient *c = createClient(fd);
+    if(c == NULL){
+        redisLog("Error registering fd event for the new client: %s (fd=%d)", strerror(errno), fd);
+        return;
+    }
+    /**
+     * 先创建客户端再检查连接数，因为此时套接字已经是非阻塞的了，
+     * 错误信息可以直接尝试写出去，写不出去也无所谓
+     */
+    if(__atomic_load_n(&server.connected_clients, __ATOMIC_RELAXED) > server.maxclients){
+        char *err = "-ERR max number of clients reached\r\n";
+        if(write(c->fd, err, strlen(err)) == -1){
+            //不需要处理
+        }
+        __atomic_add_fetch(&server.stat_rejected_conn, 1, __ATOMIC_RELAXED);
+        freeClient(c);
+        return;
+    }
+    __atomic_add_fetch(&server.stat_numconnections, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * 监听套接字的读事件处理器，接受新的TCP连接
+ * 监听套接字是水平触发的，每次最多接受REDIS_MAX_ACCEPTS_PER_CALL个连接，避免饿死其他客户端
+ * 使用io_uring时连接已经由内核接受好，aeAccept只是取出来
+ */
+void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask){
+    int cfd;
+    int max = REDIS_MAX_ACCEPTS_PER_CALL;
+    AE_NOTUSED(mask);
+    AE_NOTUSED(privdata);
+
+    while(max--){
+        cfd = aeAccept(el, fd);
+        if(cfd == -1){
+            if(errno != EWOULDBLOCK){
+                redisLog("Accepting client connection: %s", strerror(errno));
+            }
+            return;
+        }
+        acceptCommonHandler(cfd);
+    }
+}
+
+/**
+ * 如果IO线程正在运行，就把客户端放进server.clients_pending_read，返回1
+ * 客户端会在beforeSleep中被分配给IO线程读取和解析
+ */
+static int postponeClientRead(redisClient *c){
+    if(server.io_threads_active &&
+        !(c->flags & (REDIS_PENDING_READ|REDIS_CLOSE_ASAP))){
+        c->flags |= REDIS_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read, c);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 客户端套接字的读事件处理器，将数据读入querybuf
+ * 因为是边缘触发，所以要循环读取直到套接字里没有数据为止
+ */
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask){
+    redisClient *c = (redisClient*)privdata;
+    int readlen = REDIS_IOBUF_LEN;
+    AE_NOTUSED(el);
+    AE_NOTUSED(mask);
+
+    //开启了IO线程时，先把客户端放进队列，由IO线程去读
+    if(postponeClientRead(c)){
+        return;
+    }
+
+    while(1){
+        int big_arg = 0;
+        readlen = REDIS_IOBUF_LEN;
+        /**
+         * 如果正在读一个大参数，只读这个参数剩余的部分，
+         * 这样querybuf里正好就是这个参数，可以直接拿来做参数对象
+         */
+        if(c->reqtype == REDIS_REQ_MULTIBULK && c->multibulklen && c->bulklen != -1 &&
+            c->bulklen >= REDIS_MBULK_BIG_ARG){
+            ssize_t remaining = (size_t)(c->bulklen + 2) - (sdslen(c->querybuf) - c->qb_pos);
+            big_arg = 1;
+            if(remaining > 0 && remaining < readlen){
+                readlen = remaining;
+            }
+        }
+        size_t qblen = sdslen(c->querybuf);
+        c->querybuf = sdsMakeRoom(c->querybuf, readlen);
+        //普通情况下把扩容得到的剩余空间（包括分配器多给的）全部用上，减少read的次数
+        if(!big_arg && sdsavail(c->querybuf) > (size_t)readlen){
+            readlen = sdsavail(c->querybuf);
+        }
+        ssize_t nread = aeRead(c->shard->el, fd, c->querybuf + qblen, readlen);
+        if(nread == -1){
+            if(errno == EAGAIN){
+                //数据已经读完了
+                break;
+            }else if(errno == EINTR){
+                continue;
+            }else{
+                redisLog("Reading from client: %s", strerror(errno));
+                freeClientAsync(c);
+                return;
+            }
+        }else if(nread == 0){
+            //对端关闭了连接
+            freeClientAsync(c);
+            return;
+        }
+        sdsIncrLen(c->querybuf, nread);
+        c->lastinteraction = server.unixtime;
+        if(sdslen(c->querybuf) > REDIS_MAX_QUERYBUF_LEN){
+            redisLog("Closing client that reached max query buffer length (qbuf=%zu)", sdslen(c->querybuf));
+            freeClientAsync(c);
+            return;
+        }
+        processInputBuffer(c);
+        /**
+         * 没有读满说明内核缓冲区已经空了，不需要再用一次read去确认EAGAIN，
+         * 之后再有数据到达，epoll仍然会再通知一次
+         */
+        if(nread < readlen){
+            break;
+        }
+    }
+}
+
+/**
+ * ==================== 多线程IO ====================
+ * 只有读取套接字、解析协议和写回复会交给IO线程，命令执行始终在主线程，所以键空间不需要加锁
+ * 主线程在beforeSleep中把待处理的客户端平均分配给各个线程（主线程自己负责0号列表），
+ * 然后忙等所有线程的计数变为0，线程之间不会同时操作同一个客户端
+ */
+
+static inline unsigned long getIOPendingCount(int i){
+    return __atomic_load_n(&io_threads_pending[i], __ATOMIC_SEQ_CST);
+}
+
+static inline void setIOPendingCount(int i, unsigned long count){
+    __atomic_store_n(&io_threads_pending[i], count, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * IO线程的主循环，先自旋等待任务，长时间没有任务则尝试获取自己的互斥锁，
+ * 主线程在负载低时会持有这把锁，线程就会停在这里不再占用CPU
+ */
+static void *IOThreadMain(void *myid){
+    long id = (unsigned long)myid;
+    //IO线程只和0号分片一起使用，异步关闭的客户端放进它的队列
+    shard = server.shards[0];
+
+    while(1){
+        for(int j = 0; j < 1000000; j++){
+            if(getIOPendingCount(id) != 0){
+                break;
+            }
+        }
+        //给主线程一个机会把线程停下来
+        if(getIOPendingCount(id) == 0){
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        listIterator li;
+        listNode *ln;
+        listRewindHead(io_threads_list[id], &li);
+        while((ln = listNext(&li))){
+            redisClient *c = listNodeValue(ln);
+            if(io_threads_op == REDIS_IO_THREADS_OP_WRITE){
+                writeToClient(c, 0);
+            }else if(io_threads_op == REDIS_IO_THREADS_OP_READ){
+                readQueryFromClient(NULL, c->fd, c, 0);
+            }else{
+                redisPanic("io_threads_op value is unknown");
+            }
+        }
+        listEmpty(io_threads_list[id]);
+        setIOPendingCount(id, 0);
+    }
+    return NULL;
+}
+
+/**
+ * 创建IO线程，io-threads为1时不创建任何线程，所有IO都在主线程完成
+ * 线程创建后处于停止状态，直到有足够多的客户端需要写回复
+ */
+void initThreadedIO(void){
+    server.io_threads_active = 0;
+    if(server.io_threads_num == 1){
+        return;
+    }
+    if(server.io_threads_num > REDIS_IO_THREADS_MAX_NUM){
+        redisLog("Fatal: too many I/O threads configured. The maximum number is %d.", REDIS_IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+    for(int i = 0; i < server.io_threads_num; i++){
+        io_threads_list[i] = listCreate();
+        //0号是主线程自己
+        if(i == 0){
+            continue;
+        }
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i], NULL);
+        setIOPendingCount(i, 0);
+        pthread_mutex_lock(&io_threads_mutex[i]);
+        if(pthread_create(&tid, NULL, IOThreadMain, (void*)(long)i) != 0){
+            redisLog("Fatal: Can't initialize IO thread.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+}
+
+static void startThreadedIO(void){
+    for(int j = 1; j < server.io_threads_num; j++){
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    }
+    server.io_threads_active = 1;
+}
+
+static void stopThreadedIO(void){
+    //停止之前先把已经排队的读请求在主线程处理掉
+    handleClientsWithPendingReadsUsingThreads();
+    for(int j = 1; j < server.io_threads_num; j++){
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    }
+    server.io_threads_active = 0;
+}
+
+/**
+ * 等待写回复的客户端太少时，线程间同步的开销比收益还大，这时停止IO线程
+ * 返回1说明IO线程已经（或本来就）处于停止状态
+ */
+static int stopThreadedIOIfNeeded(void){
+    int pending = listLength(shard->clients_pending_write);
+
+    if(server.io_threads_num == 1){
+        return 1;
+    }
+    if(pending < (server.io_threads_num * 2)){
+        if(server.io_threads_active){
+            stopThreadedIO();
+        }
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 把clients_pending_write里的客户端分配给IO线程写出，没写完的客户端由主线程注册写事件
+ * IO线程没有启用时退化为handleClientsWithPendingWrites
+ */
+int handleClientsWithPendingWritesUsingThreads(void){
+    int processed = listLength(shard->clients_pending_write);
+    if(processed == 0){
+        return 0;
+    }
+    if(server.io_threads_num == 1 || stopThreadedIOIfNeeded()){
+        return handleClientsWithPendingWrites();
+    }
+    if(!server.io_threads_active){
+        startThreadedIO();
+    }
+
+    //按轮询的方式分配给各个线程
+    listIterator li;
+    listNode *ln;
+    int item_id = 0;
+    listRewindHead(shard->clients_pending_write, &li);
+    while((ln = listNext(&li))){
+        redisClient *c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_WRITE;
+        if(c->flags & REDIS_CLOSE_ASAP){
+            listDeleteNode(shard->clients_pending_write, ln);
+            continue;
+        }
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id], c);
+        item_id++;
+    }
+
+    //设置计数之后线程就会开始工作，主线程同时处理自己的那一份
+    io_threads_op = REDIS_IO_THREADS_OP_WRITE;
+    for(int j = 1; j < server.io_threads_num; j++){
+        setIOPendingCount(j, listLength(io_threads_list[j]));
+    }
+    listRewindHead(io_threads_list[0], &li);
+    while((ln = listNext(&li))){
+        writeToClient(listNodeValue(ln), 0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    //等待所有线程完成
+    while(1){
+        unsigned long pending = 0;
+        for(int j = 1; j < server.io_threads_num; j++){
+            pending += getIOPendingCount(j);
+        }
+        if(pending == 0){
+            break;
+        }
+    }
+
+    //还有数据没写完的客户端，注册写事件，之后由主线程继续发送
+    listRewindHead(shard->clients_pending_write, &li);
+    while((ln = listNext(&li))){
+        redisClient *c = listNodeValue(ln);
+        if(c->flags & REDIS_CLOSE_ASAP){
+            continue;
+        }
+        if(clientHasPendingReplies(c) &&
+            aeCreateFileEvent(shard->el, c->fd, AE_WRITABLE, sendReplyToClient, c) == AE_ERR){
+            freeClientAsync(c);
+        }
+    }
+    listEmpty(shard->clients_pending_write);
+    return processed;
+}
+
+/**
+ * 把clients_pending_read里的客户端分配给IO线程读取并解析出第一条命令，
+ * 全部完成后由主线程依次执行这些命令，再在主线程中处理querybuf里剩余的命令
+ */
+int handleClientsWithPendingReadsUsingThreads(void){
+    if(!server.io_threads_active){
+        return 0;
+    }
+    int processed = listLength(server.clients_pending_read);
+    if(processed == 0){
+        return 0;
+    }
+
+    listIterator li;
+    listNode *ln;
+    int item_id = 0;
+    listRewindHead(server.clients_pending_read, &li);
+    while((ln = listNext(&li))){
+        redisClient *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id], c);
+        item_id++;
+    }
+
+    io_threads_op = REDIS_IO_THREADS_OP_READ;
+    for(int j = 1; j < server.io_threads_num; j++){
+        setIOPendingCount(j, listLength(io_threads_list[j]));
+    }
+    listRewindHead(io_threads_list[0], &li);
+    while((ln = listNext(&li))){
+        redisClient *c = listNodeValue(ln);
+        readQueryFromClient(NULL, c->fd, c, 0);
+    }
+    listEmpty(io_threads_list[0]);
+
+    while(1){
+        unsigned long pending = 0;
+        for(int j = 1; j < server.io_threads_num; j++){
+            pending += getIOPendingCount(j);
+        }
+        if(pending == 0){
+            break;
+        }
+    }
+
+    //回到单线程，执行已经解析好的命令
+    while(listLength(server.clients_pending_read)){
+        ln = listFirst(server.clients_pending_read);
+        redisClient *c = listNodeValue(ln);
+        c->flags &= ~REDIS_PENDING_READ;
+        listDeleteNode(server.clients_pending_read, ln);
+
+        if(c->flags & REDIS_CLOSE_ASAP){
+            continue;
+        }
+        if(c->flags & REDIS_PENDING_COMMAND){
+            c->flags &= ~REDIS_PENDING_COMMAND;
+            if(processCommand(c) == REDIS_OK){
+                resetClient(c);
+            }
+        }
+        processInputBuffer(c);
+
+        //IO线程中产生的回复（例如协议错误）没有进入写队列，这里补上
+        if(clientHasPendingReplies(c)){
+            putClientInPendingWriteQueue(c);
+        }
+    }
+    return processed;
+}
@@ -1,13 +1,26 @@
+#include <limits.h>
 #include "redis.h"
+#include "util.h"
+
+/**
+ * 新对象lru字段的初始值，LFU模式下是当前的分钟数和计数器的初始值
+ */
+static inline unsigned int objectInitialLRU(void){
+    if(server.maxmemory_policy & REDIS_MAXMEMORY_FLAG_LFU){
+        return (LFUGetTimeInMinutes() << 8) | REDIS_LFU_INIT_VAL;
+    }
+    return LRU_CLOCK();
+}
+
 /**
  * 创建一个新的redisObject对象
  */ 
 robj *createObject(int type, void *ptr){
-    robj *obj = malloc(sizeof(*obj));
+    robj *obj = zmalloc(sizeof(*obj));
     obj->type = type;
     obj->encoding = REDIS_ENCODING_RAW; //默认为普通字符串
     obj->ptr = ptr;
-    obj->lru = LRU_CLOCK();
+    obj->lru = objectInitialLRU();
     obj->refcount = 1;  //引用数+1
     return obj;
 }
@@ -20,41 +33,74 @@ robj *createRawStringObject(char *ptr, size_t len){
     return createObject(REDIS_STRING, sdsnewlen(ptr, len));
 }
 
+/**
+ * 创建一个REDIS_ENCODING_EMBSTR编码的字符对象
+ * redisObject和sdshdr只分配一次内存，sds紧跟在robj后面，这个sds是只读的，不能修改和单独释放
+ * ptr为NULL时内容不初始化，由调用方填写
+ */
+robj *createEmbeddedStringObject(char *ptr, size_t len){
+    robj *o = zmalloc(sizeof(robj) + sizeof(struct sdshdr8) + len + 1);
+    struct sdshdr8 *sh = (void*)(o+1);
+
+    o->type = REDIS_STRING;
+    o->encoding = REDIS_ENCODING_EMBSTR;
+    o->ptr = sh->buf;
+    o->refcount = 1;
+    o->lru = objectInitialLRU();
+
+    sh->len = len;
+    sh->alloc = len;
+    sh->flags = SDS_TYPE_8;
+    if(ptr){
+        memcpy(sh->buf, ptr, len);
+    }
+    sh->buf[len] = '\0';
+    return o;
+}
+
 /**
  * 根据len不同，选择不同的String封装实现
- * 目前去掉了Embed紧缩类型的实现，只有raw一种类型
+ * 短字符串使用EMBSTR编码，只需要一次内存分配，读取时也只有一次缓存不命中
  */ 
 robj *createStringObject(char *ptr, size_t len){
+    if(len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT){
+        return createEmbeddedStringObject(ptr, len);
+    }
     return createRawStringObject(ptr, len);
 }
 
 /**
- * 将long long类型的值，转换成字符串，生成redisObject对象
- * 不考虑共享缓存小值，也不使用原版自定义的转换函数
+ * 将long long类型的值生成字符串对象
+ * 0到9999直接返回共享的整数对象，不分配内存；能放进long的使用INT编码，值直接保存在ptr里
+ * 设置了maxmemory时每个值都需要自己的LRU时间，不使用共享对象
  */ 
 robj *createStringObjectFromLongLong(long long value){
-    return createObject(REDIS_STRING, sdsfromlonglong(value));
+    robj *o;
+    if(server.maxmemory == 0 && value >= 0 && value < REDIS_SHARED_INTEGERS){
+        o = shared.integers[value];
+        incrRefCount(o);
+    }else if(value >= LONG_MIN && value <= LONG_MAX){
+        o = createObject(REDIS_STRING, NULL);
+        o->encoding = REDIS_ENCODING_INT;
+        o->ptr = (void*)((long)value);
+    }else{
+        o = createObject(REDIS_STRING, sdsfromlonglong(value));
+    }
+    return o;
 }
 
 /**
  * 将long double类型的值，转换成字符串，生成redisObject对象
- * 原版使用了特殊技巧
+ * 能无损转成double的值输出能还原成同一个double的最短字符串，例如0.1加0.2得到"0.3"
+ * 否则（超出double的范围或者精度）用%.17Lg输出，不丢掉long double的精度
  */ 
 robj *createStringObjectFromLongDouble(long double value){
-    char buf[256];
-    //转成17位精度的小数，这种精度可以在大部分机器上被rouning而不改变每一位数值
-    int len = snprintf(buf, sizeof(buf), "%.17Lf", value);
-    //开始倒着遍历，去掉最后一位的0
-    if(strchr(buf, '.') != NULL){
-        //将指针指向buf的最后一位
-        char *p = buf + len - 1;
-        while(*p == '0'){   //如果是0，就将len减1，直到不是0
-            p--;
-            len--;
-        }
-        if(*p=='.'){    //如果是小数点，则len再减一
-            len--;
-        }
+    char buf[MAX_LONG_DOUBLE_CHARS];
+    int len;
+    if((long double)(double)value == value){
+        len = d2string(buf, sizeof(buf), (double)value);
+    }else{
+        len = snprintf(buf, sizeof(buf), "%.17Lg", value);
     }
     return createStringObject(buf, len);
 }
@@ -71,6 +117,9 @@ robj *dupStringObject(robj *o){
         case REDIS_ENCODING_RAW:{
             return createRawStringObject(o->ptr, sdslen(o->ptr));
         }
+        case REDIS_ENCODING_EMBSTR:{
+            return createEmbeddedStringObject(o->ptr, sdslen(o->ptr));
+        }
         case REDIS_ENCODING_INT:{
             d = createObject(REDIS_STRING, NULL);
             d->encoding = REDIS_ENCODING_INT;
@@ -78,10 +127,11 @@ robj *dupStringObject(robj *o){
             return d;
         }
         default:{
+            redisPanic("Wrong encoding.");
             break;
         }
     }
-    //有可能不返回任何值，所以会有警告
+    return NULL;
 }
 
 /**
@@ -116,11 +166,22 @@ robj *createHashObject(void){
     return o;
 }
 
+/**
+ * 把对象变成共享对象，之后它的引用计数不再变化，可以在多个线程之间只读地使用
+ */
+robj *makeObjectShared(robj *o){
+    redisAssert(o->refcount == 1);
+    o->refcount = REDIS_SHARED_REFCOUNT;
+    return o;
+}
+
 /**
  * 给对象的计数器加1
  */ 
 void incrRefCount(robj *o){
-    o->refcount++;
+    if(o->refcount != REDIS_SHARED_REFCOUNT){
+        o->refcount++;
+    }
 }
 
 /**
@@ -128,6 +189,9 @@ void incrRefCount(robj *o){
  * 当refcount变成0时，释放对象
  */ 
 void decrRefCount(robj *o){
+    if(o->refcount == REDIS_SHARED_REFCOUNT){
+        return;
+    }
     if(o->refcount == 1){
         switch(o->type){
             case REDIS_STRING:{
@@ -153,7 +217,7 @@ void decrRefCount(robj *o){
             default: break;
         }
         //别忘了清理自己
-        free(o);
+        zfree(o);
     }else{
         o->refcount--;
     }
@@ -176,6 +240,7 @@ robj *resetRefCount(robj *obj){
 
 /**
  * 对于String类型的type，如果是RAW类型，则释放sdshdr结构体空间
+ * EMBSTR类型的sds和对象在同一块内存里，随对象一起释放
  */ 
 void freeStringObject(robj *o){
     if(o->encoding == REDIS_ENCODING_RAW){
@@ -189,7 +254,7 @@ void freeListObject(robj *o){
             break;
         }
         case REDIS_ENCODING_ZIPLIST:{
-            free(o->ptr);
+            zfree(o->ptr);
             break;
         }
         default:{
@@ -204,7 +269,7 @@ void freeSetObject(robj *o){
             break;
         }
         case REDIS_ENCODING_INTSET:{
-            free(o->ptr);
+            zfree(o->ptr);
             break;
         }
     }
@@ -219,14 +284,265 @@ void freeHashObject(robj *o){
             break;
         }
         case REDIS_ENCODING_ZIPLIST:{
-            free(o->ptr);
+            zfree(o->ptr);
             break;
         }
     }
 }
 
+/**
+ * 尝试把字符串对象转成更省内存的编码，返回新的对象，原对象可能已经被释放
+ * 能表示成long的字符串转成INT编码，0到9999直接换成共享对象；
+ * 其他短字符串转成EMBSTR，长字符串去掉sds末尾多余的空间
+ * 被共享的对象不能修改，原样返回
+ */
+robj *tryObjectEncoding(robj *o){
+    sds s = o->ptr;
+    size_t len;
+    long value;
+
+    redisAssert(o->type == REDIS_STRING);
+    if(!sdsEncodedObject(o) || o->refcount > 1){
+        return o;
+    }
+    len = sdslen(s);
+
+    //超过20个字符不可能是long，先用长度排除
+    if(len <= 20 && string2l(s, len, &value)){
+        //设置了maxmemory时每个值都需要自己的LRU时间，不使用共享对象
+        if(server.maxmemory == 0 && value >= 0 && value < REDIS_SHARED_INTEGERS){
+            decrRefCount(o);
+            return shared.integers[value];
+        }
+        if(o->encoding == REDIS_ENCODING_RAW){
+            sdsfree(o->ptr);
+            o->encoding = REDIS_ENCODING_INT;
+            o->ptr = (void*)value;
+            return o;
+        }
+        //EMBSTR的sds和对象在一起，不能单独释放，换成新的INT对象
+        decrRefCount(o);
+        o = createObject(REDIS_STRING, (void*)value);
+        o->encoding = REDIS_ENCODING_INT;
+        return o;
+    }
+
+    if(len <= REDIS_ENCODING_EMBSTR_SIZE_LIMIT){
+        if(o->encoding == REDIS_ENCODING_EMBSTR){
+            return o;
+        }
+        robj *emb = createEmbeddedStringObject(s, len);
+        decrRefCount(o);
+        return emb;
+    }
+    //大参数直接复用了查询缓冲区，末尾可能有很多空闲空间，超过10%就去掉
+    if(o->encoding == REDIS_ENCODING_RAW && sdsavail(s) > len/10){
+        o->ptr = sdsRemoveFreeSpace(o->ptr);
+    }
+    return o;
+}
+
+/**
+ * 检查对象的类型，不是type则回复WRONGTYPE错误并返回1
+ */
+int checkType(redisClient *c, robj *o, int type){
+    if(o->type != type){
+        addReply(c, shared.wrongtypeerr);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 字符串对象能否表示为long long，可以则返回REDIS_OK并写入llval（可以为NULL）
+ */
+int isObjectRepresentableAsLongLong(robj *o, long long *llval){
+    redisAssert(o->type == REDIS_STRING);
+    if(o->encoding == REDIS_ENCODING_INT){
+        if(llval){
+            *llval = (long)o->ptr;
+        }
+        return REDIS_OK;
+    }
+    return string2ll(o->ptr, sdslen(o->ptr), llval) ? REDIS_OK : REDIS_ERR;
+}
+
+/**
+ * 返回字符串对象的sds形式，INT编码的会转成新的RAW对象，否则只增加引用计数
+ * 用完之后要调用decrRefCount
+ */
+robj *getDecodedObject(robj *o){
+    if(sdsEncodedObject(o)){
+        incrRefCount(o);
+        return o;
+    }
+    if(o->type == REDIS_STRING && o->encoding == REDIS_ENCODING_INT){
+        char buf[32];
+        int len = ll2string(buf, sizeof(buf), (long)o->ptr);
+        return createStringObject(buf, len);
+    }
+    redisPanic("Unknown encoding type");
+    return NULL;
+}
+
+/**
+ * 比较两个字符串对象，返回值和memcmp相同
+ */
+int compareStringObjects(robj *a, robj *b){
+    redisAssert(a->type == REDIS_STRING && b->type == REDIS_STRING);
+    if(a == b){
+        return 0;
+    }
+    a = getDecodedObject(a);
+    b = getDecodedObject(b);
+    int cmp = sdscmp(a->ptr, b->ptr);
+    decrRefCount(a);
+    decrRefCount(b);
+    return cmp;
+}
+
+int equalStringObjects(robj *a, robj *b){
+    //两个都是INT编码时直接比较整数
+    if(a->encoding == REDIS_ENCODING_INT && b->encoding == REDIS_ENCODING_INT){
+        return a->ptr == b->ptr;
+    }
+    return compareStringObjects(a, b) == 0;
+}
+
+/**
+ * 字符串对象的长度，INT编码的要算出转成字符串后的长度
+ */
+size_t stringObjectLen(robj *o){
+    redisAssert(o->type == REDIS_STRING);
+    if(sdsEncodedObject(o)){
+        return sdslen(o->ptr);
+    }
+    char buf[32];
+    return ll2string(buf, sizeof(buf), (long)o->ptr);
+}
+
+/**
+ * 从字符串对象中取出long long，o为NULL时当做0
+ * 不是合法的整数则返回REDIS_ERR
+ */
+int getLongLongFromObject(robj *o, long long *target){
+    long long value;
+    if(o == NULL){
+        value = 0;
+    }else{
+        redisAssert(o->type == REDIS_STRING);
+        if(sdsEncodedObject(o)){
+            if(!string2ll(o->ptr, sdslen(o->ptr), &value)){
+                return REDIS_ERR;
+            }
+        }else if(o->encoding == REDIS_ENCODING_INT){
+            value = (long)o->ptr;
+        }else{
+            redisPanic("Unknown string encoding");
+        }
+    }
+    if(target){
+        *target = value;
+    }
+    return REDIS_OK;
+}
+
+int getLongDoubleFromObject(robj *o, long double *target){
+    long double value;
+    if(o == NULL){
+        value = 0;
+    }else{
+        redisAssert(o->type == REDIS_STRING);
+        if(sdsEncodedObject(o)){
+            if(!string2ld(o->ptr, sdslen(o->ptr), &value)){
+                return REDIS_ERR;
+            }
+        }else if(o->encoding == REDIS_ENCODING_INT){
+            value = (long)o->ptr;
+        }else{
+            redisPanic("Unknown string encoding");
+        }
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+int getLongDoubleFromObjectOrReply(redisClient *c, robj *o, long double *target, const char *msg){
+    long double value;
+    if(getLongDoubleFromObject(o, &value) != REDIS_OK){
+        if(msg != NULL){
+            addReplyError(c, (char*)msg);
+        }else{
+            addReplyError(c, "value is not a valid float");
+        }
+        return REDIS_ERR;
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg){
+    long long value;
+    if(getLongLongFromObject(o, &value) != REDIS_OK){
+        if(msg != NULL){
+            addReplyError(c, (char*)msg);
+        }else{
+            addReplyError(c, "value is not an integer or out of range");
+        }
+        return REDIS_ERR;
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *msg){
+    long long value;
+    if(getLongLongFromObjectOrReply(c, o, &value, msg) != REDIS_OK){
+        return REDIS_ERR;
+    }
+    if(value < LONG_MIN || value > LONG_MAX){
+        if(msg != NULL){
+            addReplyError(c, (char*)msg);
+        }else{
+            addReplyError(c, "value is out of range");
+        }
+        return REDIS_ERR;
+    }
+    *target = value;
+    return REDIS_OK;
+}
+
+/**
+ * 返回对象类型的名字，用于TYPE命令
+ */
+char *strObjectType(int type){
+    switch(type){
+        case REDIS_STRING: return "string";
+        case REDIS_LIST: return "list";
+        case REDIS_SET: return "set";
+        case REDIS_ZSET: return "zset";
+        case REDIS_HASH: return "hash";
+        default: return "unknown";
+    }
+}
+
+/**
+ * 估算对象多久没有被访问过（毫秒），精度是REDIS_LRU_CLOCK_RESOLUTION，只在LRU模式下有意义
+ * LRU时钟只有24位，溢出回绕之后当前时钟会比对象的时间小，这时按绕了一圈计算
+ */
+unsigned long long estimateObjectIdleTime(robj *o){
+    unsigned long long lruclock = LRU_CLOCK();
+    if(lruclock >= o->lru){
+        return (lruclock - o->lru) * REDIS_LRU_CLOCK_RESOLUTION;
+    }else{
+        return (lruclock + (REDIS_LRU_CLOCK_MAX - o->lru)) * REDIS_LRU_CLOCK_RESOLUTION;
+    }
+}
+
+#ifdef OBJECT_TEST_MAIN
 int main(){
     printf("abc");
     getchar();
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/time.h>
+#include "ae.h"
+#include "anet.h"
+#include "sds.h"
+
+/**
+ * 流水线吞吐量测试工具
+ * 每个连接一次发送pipeline条ECHO命令，收齐所有回复后再发送下一批，统计每秒完成的请求数
+ * 编译时需要和ae.c、anet.c、sds.c、util.c、fpconv.c、zmalloc.c一起链接
+ */
+
+static struct config{
+    aeEventLoop *el;
+    char *hostip;
+    int hostport;
+    int numclients; //并发连接数
+    long long requests; //总请求数
+    long long requests_issued;  //已发出的请求数
+    long long requests_finished;    //已收到回复的请求数
+    int pipeline;   //每批发送的命令数
+    int datasize;   //ECHO参数的长度
+    long long start;    //开始时间（微秒）
+    sds cmd;    //一条ECHO命令的协议数据
+    size_t replylen;    //一条ECHO回复的长度，回复内容固定，所以只需要按字节计数
+    int liveclients;
+} config;
+
+typedef struct benchClient{
+    int fd;
+    sds obuf;   //待发送的命令
+    size_t written; //obuf中已发送的字节数
+    size_t pending; //这一批还没收到的回复字节数
+    int batch;  //这一批的命令数
+} benchClient;
+
+static long long ustime(void){
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec)*1000000 + tv.tv_usec;
+}
+
+static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+
+static void freeBenchClient(benchClient *c){
+    aeDeleteFileEvent(config.el, c->fd, AE_READABLE|AE_WRITABLE);
+    close(c->fd);
+    sdsfree(c->obuf);
+    free(c);
+    if(--config.liveclients == 0){
+        aeStop(config.el);
+    }
+}
+
+/**
+ * 准备下一批命令，没有剩余请求则关闭连接
+ */
+static void prepareBatch(benchClient *c){
+    long long left = config.requests - config.requests_issued;
+    if(left <= 0){
+        freeBenchClient(c);
+        return;
+    }
+    c->batch = left < config.pipeline ? (int)left : config.pipeline;
+    config.requests_issued += c->batch;
+    sdsclear(c->obuf);
+    for(int j = 0; j < c->batch; j++){
+        c->obuf = sdscatlen(c->obuf, config.cmd, sdslen(config.cmd));
+    }
+    c->written = 0;
+    c->pending = config.replylen * c->batch;
+    aeCreateFileEvent(config.el, c->fd, AE_WRITABLE, writeHandler, c);
+}
+
+static void readHandler(aeEventLoop *el, int fd, void *privdata, int mask){
+    benchClient *c = privdata;
+    char buf[16*1024];
+    (void)el;
+    (void)mask;
+
+    ssize_t nread = read(fd, buf, sizeof(buf));
+    if(nread <= 0){
+        if(nread == -1 && errno == EAGAIN){
+            return;
+        }
+        fprintf(stderr, "Error reading from server: %s\n", nread ? strerror(errno) : "connection closed");
+        exit(1);
+    }
+    c->pending -= nread;
+    if(c->pending == 0){
+        config.requests_finished += c->batch;
+        prepareBatch(c);
+    }
+}
+
+static void writeHandler(aeEventLoop *el, int fd, void *privdata, int mask){
+    benchClient *c = privdata;
+    (void)el;
+    (void)mask;
+
+    ssize_t nwritten = write(fd, c->obuf + c->written, sdslen(c->obuf) - c->written);
+    if(nwritten == -1){
+        if(errno == EAGAIN){
+            return;
+        }
+        fprintf(stderr, "Error writing to server: %s\n", strerror(errno));
+        exit(1);
+    }
+    c->written += nwritten;
+    if(c->written == sdslen(c->obuf)){
+        aeDeleteFileEvent(config.el, c->fd, AE_WRITABLE);
+    }
+}
+
+static void createBenchClient(void){
+    char err[ANET_ERR_LEN];
+    benchClient *c = malloc(sizeof(*c));
+    c->fd = anetTcpConnect(err, config.hostip, config.hostport);
+    if(c->fd == ANET_ERR){
+        fprintf(stderr, "Could not connect to server at %s:%d: %s\n", config.hostip, config.hostport, err);
+        exit(1);
+    }
+    anetNonBlock(NULL, c->fd);
+    anetEnableTcpNoDelay(NULL, c->fd);
+    c->obuf = sdsempty();
+    aeCreateFileEvent(config.el, c->fd, AE_READABLE, readHandler, c);
+    config.liveclients++;
+    prepareBatch(c);
+}
+
+static void usage(void){
+    printf("Usage: redis-benchmark [-h <host>] [-p <port>] [-c <clients>] [-n <requests>] [-P <numreq>] [-d <size>]\n\n");
+    printf(" -h <hostname>      Server hostname (default 127.0.0.1)\n");
+    printf(" -p <port>          Server port (default 6379)\n");
+    printf(" -c <clients>       Number of parallel connections (default 50)\n");
+    printf(" -n <requests>      Total number of requests (default 100000)\n");
+    printf(" -P <numreq>        Pipeline <numreq> ECHO requests per round trip (default 1)\n");
+    printf(" -d <size>          Data size of ECHO payload in bytes (default 3)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv){
+    config.hostip = "127.0.0.1";
+    config.hostport = 6379;
+    config.numclients = 50;
+    config.requests = 100000;
+    config.pipeline = 1;
+    config.datasize = 3;
+
+    for(int i = 1; i < argc; i++){
+        int lastarg = (i == argc-1);
+        if(!strcmp(argv[i], "-h") && !lastarg){
+            config.hostip = argv[++i];
+        }else if(!strcmp(argv[i], "-p") && !lastarg){
+            config.hostport = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-c") && !lastarg){
+            config.numclients = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-n") && !lastarg){
+            config.requests = atoll(argv[++i]);
+        }else if(!strcmp(argv[i], "-P") && !lastarg){
+            config.pipeline = atoi(argv[++i]);
+        }else if(!strcmp(argv[i], "-d") && !lastarg){
+            config.datasize = atoi(argv[++i]);
+        }else{
+            usage();
+        }
+    }
+    if(config.numclients < 1 || config.pipeline < 1 || config.datasize < 1 || config.requests < 1){
+        usage();
+    }
+
+    //生成ECHO命令和预期的回复长度
+    sds data = sdsempty();
+    for(int j = 0; j < config.datasize; j++){
+        data = sdscatlen(data, "x", 1);
+    }
+    config.cmd = sdsempty();
+    config.cmd = sdscat(config.cmd, "*2\r\n$4\r\nECHO\r\n");
+    char lenbuf[32];
+    int lenlen = snprintf(lenbuf, sizeof(lenbuf), "$%d\r\n", config.datasize);
+    config.cmd = sdscatlen(config.cmd, lenbuf, lenlen);
+    config.cmd = sdscatsds(config.cmd, data);
+    config.cmd = sdscat(config.cmd, "\r\n");
+    config.replylen = lenlen + config.datasize + 2;
+    sdsfree(data);
+
+    config.el = aeCreateEventLoop(config.numclients + 128);
+    config.start = ustime();
+    for(int j = 0; j < config.numclients; j++){
+        createBenchClient();
+    }
+    aeMain(config.el);
+
+    double secs = (double)(ustime() - config.start) / 1000000;
+    printf("====== ECHO (pipeline %d) ======\n", config.pipeline);
+    printf("  %lld requests completed in %.2f seconds\n", config.requests_finished, secs);
+    printf("  %d parallel clients\n", config.numclients);
+    printf("  %d bytes payload\n\n", config.datasize);
+    printf("%.2f requests per second\n", config.requests_finished / secs);
+    return 0;
+}
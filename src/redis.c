@@ -2,6 +2,9 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdint.h>
 #include "redis.h"
 #include "util.h"
 
@@ -9,19 +12,106 @@
  * 全局变量
  */
 struct redisServer server;
+struct sharedObjectsStruct shared;
 
 /**
  * 实现所有的命令结构参数，注意redisCommand并没有使用typedef起别名，所以这里不是定义而是实现
  */
 struct redisCommand redisCommandTable[] = {
-    {"echo", echoCommand, 2, "r", 0, 0, 0, 0}
+    {"echo", echoCommand, 2, "r", 0, 0, 0, 0},
+    {"ping", pingCommand, -1, "r", 0, 0, 0, 0},
+    {"quit", quitCommand, -1, "r", 0, 0, 0, 0},
+    {"info", infoCommand, -1, "r", 0, 0, 0, 0},
+    {"latency", latencyCommand, -2, "r", 0, 0, 0, 0},
+    /* 键相关 */
+    {"del", delCommand, -2, "w", 0, 1, -1, 1},
+    {"exists", existsCommand, -2, "r", 0, 1, -1, 1},
+    {"select", selectCommand, 2, "r", 0, 0, 0, 0},
+    {"keys", keysCommand, 2, "r", 0, 0, 0, 0},
+    {"randomkey", randomkeyCommand, 1, "rR", 0, 0, 0, 0},
+    {"scan", scanCommand, -2, "rR", 0, 0, 0, 0},
+    {"dbsize", dbsizeCommand, 1, "rA", 0, 0, 0, 0},
+    {"flushdb", flushdbCommand, 1, "wA", 0, 0, 0, 0},
+    {"flushall", flushallCommand, 1, "wA", 0, 0, 0, 0},
+    {"type", typeCommand, 2, "r", 0, 1, 1, 1},
+    {"rename", renameCommand, 3, "w", 0, 1, 2, 1},
+    {"renamenx", renamenxCommand, 3, "w", 0, 1, 2, 1},
+    {"expire", expireCommand, 3, "w", 0, 1, 1, 1},
+    {"pexpire", pexpireCommand, 3, "w", 0, 1, 1, 1},
+    {"expireat", expireatCommand, 3, "w", 0, 1, 1, 1},
+    {"pexpireat", pexpireatCommand, 3, "w", 0, 1, 1, 1},
+    {"ttl", ttlCommand, 2, "r", 0, 1, 1, 1},
+    {"pttl", pttlCommand, 2, "r", 0, 1, 1, 1},
+    {"persist", persistCommand, 2, "w", 0, 1, 1, 1},
+    /* 字符串 */
+    {"set", setCommand, -3, "wm", 0, 1, 1, 1},
+    {"setnx", setnxCommand, 3, "wm", 0, 1, 1, 1},
+    {"setex", setexCommand, 4, "wm", 0, 1, 1, 1},
+    {"psetex", psetexCommand, 4, "wm", 0, 1, 1, 1},
+    {"get", getCommand, 2, "r", 0, 1, 1, 1},
+    {"getset", getsetCommand, 3, "wm", 0, 1, 1, 1},
+    {"mget", mgetCommand, -2, "r", 0, 1, -1, 1},
+    {"mset", msetCommand, -3, "wm", 0, 1, -1, 2},
+    {"msetnx", msetnxCommand, -3, "wm", 0, 1, -1, 2},
+    {"incr", incrCommand, 2, "wm", 0, 1, 1, 1},
+    {"decr", decrCommand, 2, "wm", 0, 1, 1, 1},
+    {"incrby", incrbyCommand, 3, "wm", 0, 1, 1, 1},
+    {"decrby", decrbyCommand, 3, "wm", 0, 1, 1, 1},
+    {"incrbyfloat", incrbyfloatCommand, 3, "wm", 0, 1, 1, 1},
+    {"append", appendCommand, 3, "wm", 0, 1, 1, 1},
+    {"strlen", strlenCommand, 2, "r", 0, 1, 1, 1},
+    /* 列表 */
+    {"lpush", lpushCommand, -3, "wm", 0, 1, 1, 1},
+    {"rpush", rpushCommand, -3, "wm", 0, 1, 1, 1},
+    {"lpop", lpopCommand, 2, "w", 0, 1, 1, 1},
+    {"rpop", rpopCommand, 2, "w", 0, 1, 1, 1},
+    {"llen", llenCommand, 2, "r", 0, 1, 1, 1},
+    {"lindex", lindexCommand, 3, "r", 0, 1, 1, 1},
+    {"lset", lsetCommand, 4, "wm", 0, 1, 1, 1},
+    {"lrange", lrangeCommand, 4, "r", 0, 1, 1, 1},
+    {"ltrim", ltrimCommand, 4, "w", 0, 1, 1, 1},
+    {"lrem", lremCommand, 4, "w", 0, 1, 1, 1},
+    /* 集合 */
+    {"sadd", saddCommand, -3, "wm", 0, 1, 1, 1},
+    {"srem", sremCommand, -3, "w", 0, 1, 1, 1},
+    {"sismember", sismemberCommand, 3, "r", 0, 1, 1, 1},
+    {"scard", scardCommand, 2, "r", 0, 1, 1, 1},
+    {"smembers", smembersCommand, 2, "r", 0, 1, 1, 1},
+    {"spop", spopCommand, 2, "wR", 0, 1, 1, 1},
+    {"srandmember", srandmemberCommand, -2, "rR", 0, 1, 1, 1},
+    {"sscan", sscanCommand, -3, "rR", 0, 1, 1, 1},
+    /* 哈希 */
+    {"hset", hsetCommand, 4, "wm", 0, 1, 1, 1},
+    {"hsetnx", hsetnxCommand, 4, "wm", 0, 1, 1, 1},
+    {"hget", hgetCommand, 3, "r", 0, 1, 1, 1},
+    {"hmset", hmsetCommand, -4, "wm", 0, 1, 1, 1},
+    {"hmget", hmgetCommand, -3, "r", 0, 1, 1, 1},
+    {"hdel", hdelCommand, -3, "w", 0, 1, 1, 1},
+    {"hlen", hlenCommand, 2, "r", 0, 1, 1, 1},
+    {"hexists", hexistsCommand, 3, "r", 0, 1, 1, 1},
+    {"hincrby", hincrbyCommand, 4, "wm", 0, 1, 1, 1},
+    {"hkeys", hkeysCommand, 2, "r", 0, 1, 1, 1},
+    {"hvals", hvalsCommand, 2, "r", 0, 1, 1, 1},
+    {"hgetall", hgetallCommand, 2, "r", 0, 1, 1, 1},
+    {"hscan", hscanCommand, -3, "rR", 0, 1, 1, 1}
 };
 
 /**
- * 返回当前系统秒数，但只返回后24位
+ * 命令名的完美哈希表，在populateCommandTable中生成，之后只读
+ * 每个命令名按长度和几个固定位置的字节（忽略大小写）映射到唯一的槽位，
+ * 查找时只需要计算一次哈希、比较一次名字，不需要遍历冲突链
+ */
+static struct redisCommand **commandPerfectTable;
+static uint64_t commandPerfectSeed;
+static int commandPerfectBits;
+static size_t commandMinNameLen, commandMaxNameLen;
+
+/**
+ * 返回LRU时钟，以REDIS_LRU_CLOCK_RESOLUTION毫秒为单位，只保留后24位
+ * LRU时钟只用来比较对象的空闲时间，所以使用低精度的单调时钟，不受系统时间调整的影响
  */ 
 unsigned int getLRUClock(void){
-   return (mstime() / REDIS_LRU_CLOCK_RESOLUTION) & REDIS_LRU_CLOCK_MAX;
+   return (getMonotonicCoarseMs() / REDIS_LRU_CLOCK_RESOLUTION) & REDIS_LRU_CLOCK_MAX;
 }
 
 /**
@@ -31,11 +121,12 @@ unsigned int getLRUClock(void){
  * 返回当前微秒级时间
  */ 
 long long ustime(void){
-    struct timeval tv;
+    struct timespec ts;
     long long result;
-    gettimeofday(&tv, NULL);
-    result = ((long long)tv.tv_sec) * 1000 * 1000;
-	return result += tv.tv_usec;
+    //linux上通过vDSO读取，不会陷入内核
+    clock_gettime(CLOCK_REALTIME, &ts);
+    result = ((long long)ts.tv_sec) * 1000 * 1000;
+    return result + ts.tv_nsec / 1000;
 }
 
 /**
@@ -56,7 +147,7 @@ void redisLogRaw(const char *msg){
     if(!fp){    //文件指针不存在直接返回
         return;
     }
-    fprintf(fp, "%s", msg);
+    fprintf(fp, "%s\n", msg);
     fflush(fp);
     if(!log_to_stdout){ //不是输出stdout还得关闭文件
         fclose(fp);
@@ -79,14 +170,10 @@ void redisLog(const char *fmt, ...){
 /**
  * hash table type实现
  */ 
-unsigned int dictSdsHash(const void *key){
+uint64_t dictSdsHash(const void *key){
     return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
 }
 
-unsigned int dictSdsCaseHash(const void *key){
-    return dictGenCaseHashFunction((unsigned char*)key, sdslen((char*)key));
-}
-
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2){
     int len1 = sdslen((sds)key1);
     int len2 = sdslen((sds)key2);
@@ -96,7 +183,7 @@ int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2){
     return memcmp(key1, key2, len1) == 0;
 }
 
-unsigned int dictObjHash(const void *key){
+uint64_t dictObjHash(const void *key){
     const robj *o = key;
     return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
 }
@@ -107,8 +194,37 @@ int dictObjKeyCompare(void *privdata, const void *key1, const void *key2){
     return dictSdsKeyCompare(privdata, o1->ptr, o2->ptr);
 }
 
-int dictSdsKeyCaseCompare(void *privdata, const void *key1, const void *key2){
-    return strcasecmp(key1, key2) == 0;
+/**
+ * 集合和哈希中的对象可能是INT编码，INT编码的对象先转成字符串再计算hash
+ */
+uint64_t dictEncObjHash(const void *key){
+    robj *o = (robj*)key;
+    if(sdsEncodedObject(o)){
+        return dictGenHashFunction(o->ptr, sdslen((sds)o->ptr));
+    }else{
+        char buf[32];
+        int len = ll2string(buf, sizeof(buf), (long)o->ptr);
+        return dictGenHashFunction((unsigned char*)buf, len);
+    }
+}
+
+/**
+ * 两个都是INT编码时直接比较整数，否则转成字符串比较
+ * 字符串形式的数字一定会被tryObjectEncoding转成INT，但这里不依赖这一点
+ */
+int dictEncObjKeyCompare(void *privdata, const void *key1, const void *key2){
+    robj *o1 = (robj*)key1, *o2 = (robj*)key2;
+    int cmp;
+
+    if(o1->encoding == REDIS_ENCODING_INT && o2->encoding == REDIS_ENCODING_INT){
+        return o1->ptr == o2->ptr;
+    }
+    o1 = getDecodedObject(o1);
+    o2 = getDecodedObject(o2);
+    cmp = dictSdsKeyCompare(privdata, o1->ptr, o2->ptr);
+    decrRefCount(o1);
+    decrRefCount(o2);
+    return cmp;
 }
 
 void dictSdsDestructor(void *privdata, void *key){
@@ -116,16 +232,66 @@ void dictSdsDestructor(void *privdata, void *key){
     sdsfree(key);
 }
 
+void dictRedisObjectDestructor(void *privdata, void *val){
+    (void)privdata;
+    if(val == NULL){
+        return;
+    }
+    decrRefCount(val);
+}
+
+/**
+ * 数据库键空间的type实现
+ * key为sds对象，value为redisObject对象
+ */
+dictType dbDictType = {
+    dictSdsHash,        //hash生成函数
+    NULL,               //key复制函数
+    NULL,               //value复制函数
+    dictSdsKeyCompare,  //key比较函数
+    dictSdsDestructor,  //key销毁函数
+    dictRedisObjectDestructor   //value销毁函数
+};
+
+/**
+ * 集合对象的type实现
+ * key为redisObject对象，可能是INT编码，没有value
+ */
+dictType setDictType = {
+    dictEncObjHash,     //hash生成函数
+    NULL,               //key复制函数
+    NULL,               //value复制函数
+    dictEncObjKeyCompare,   //key比较函数
+    dictRedisObjectDestructor,  //key销毁函数
+    NULL                //value销毁函数
+};
+
+/**
+ * 哈希对象的type实现
+ * key和value都是redisObject对象，可能是INT编码
+ */
+dictType hashDictType = {
+    dictEncObjHash,     //hash生成函数
+    NULL,               //key复制函数
+    NULL,               //value复制函数
+    dictEncObjKeyCompare,   //key比较函数
+    dictRedisObjectDestructor,  //key销毁函数
+    dictRedisObjectDestructor   //value销毁函数
+};
+
 /**
  * 定义command命令hash表的type实现
  * key为sds对象， value为command结构体的指针
  */
-dictType commandTableDictType = {
-    dictSdsCaseHash,    //hash生成函数
+/**
+ * 只比较指针的键，用于expires，key直接引用数据库dict中的sds，不需要释放
+ */
+dictType keyptrDictType = {
+    dictSdsHash,        //hash生成函数
     NULL,               //key复制函数
-    NULL,                //value复制函数
-    dictSdsKeyCaseCompare,   //key比较函数
-    dictSdsDestructor,  //key销毁函数
+    NULL,               //value复制函数
+    dictSdsKeyCompare,  //key比较函数
+    NULL,               //key销毁函数
     NULL                //value销毁函数
 };
 
@@ -134,6 +300,10 @@ dictType commandTableDictType = {
  */ 
 void initServerConfig(){
 
+    //dict的hash密钥每次启动随机生成，必须在创建任何字典之前设置
+    char hashseed[16];
+    getRandomHexChars(hashseed, sizeof(hashseed));
+    dictSetHashFunctionSeed((uint8_t*)hashseed);
     //设置服务器运行的ID
     getRandomHexChars(server.runid, REDIS_RUN_ID_SIZE);
     //给运行ID加入结尾字符
@@ -147,29 +317,371 @@ void initServerConfig(){
     //设置服务端口号
     server.port = REDIS_SERVERPORT;
     server.tcp_backlog = REDIS_TCP_BACKLOG;
+    server.bindaddr = NULL;
+    server.maxclients = REDIS_MAX_CLIENTS;
+    server.io_threads_num = 1;
+    server.shards_num = 1;
+    server.event_backend = AE_API_EPOLL;
     server.dbnum = REDIS_DEFAULT_DBNUM;
+    server.set_max_intset_entries = REDIS_SET_MAX_INTSET_ENTRIES;
     server.maxidletime = REDIS_MAXIDLETIME;
     server.tcpkeepalive = REDIS_DEFAULT_TCP_KEEPALIVE;
+    server.latency_tracking = REDIS_DEFAULT_LATENCY_TRACKING;
+    server.activerehashing = REDIS_DEFAULT_ACTIVE_REHASHING;
 
-    server.logfile = strdup(REDIS_DEFAULT_LOGFILE);
+    server.logfile = zstrdup(REDIS_DEFAULT_LOGFILE);
 
     server.daemonize = REDIS_DEFAULT_DAEMONIZE;
      //将默认值复制了一份，注意strdup并不会free空间，但是这里只调用一次
-    server.pidfile = strdup(REDIS_DEFAULT_PID_FILE);
+    server.pidfile = zstrdup(REDIS_DEFAULT_PID_FILE);
     server.maxmemory = REDIS_DEFAULT_MAXMEMORY;
+    server.maxmemory_policy = REDIS_DEFAULT_MAXMEMORY_POLICY;
+    server.maxmemory_samples = REDIS_DEFAULT_MAXMEMORY_SAMPLES;
+    server.lfu_log_factor = REDIS_DEFAULT_LFU_LOG_FACTOR;
+    server.lfu_decay_time = REDIS_DEFAULT_LFU_DECAY_TIME;
     server.shutdown_asap = 0;
 
     //初始化LRU时间
     server.lruclock = getLRUClock();
 
-    server.commands = dictCreate(&commandTableDictType, NULL);
-
     //加载所有命令列表
     populateCommandTable();
 
     //还要加载5个命令
 }
 
+/**
+ * 更新服务器的时间缓存，由0号分片在serverCron中调用，其他分片只读
+ */
+void updateCachedTime(void){
+    server.mstime = mstime();
+    server.unixtime = server.mstime / 1000;
+    __atomic_store_n(&server.lruclock, getLRUClock(), __ATOMIC_RELAXED);
+}
+
+/**
+ * 检查客户端是否已经空闲超时，如果超时则释放客户端
+ * 返回1说明客户端已被释放
+ */
+int clientsCronHandleTimeout(redisClient *c){
+    time_t now = server.unixtime;
+    if(server.maxidletime && (now - c->lastinteraction > server.maxidletime)){
+        redisLog("Closing idle client");
+        freeClient(c);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * 空闲了一段时间的客户端，querybuf中多余的空间还给分配器
+ * 读取大参数时预留的空间不会自动缩小，不处理的话每个发过大参数的空闲连接都会一直占着这块内存
+ * IO线程正在读取的客户端不能动它的querybuf
+ */
+int clientsCronResizeQueryBuffer(redisClient *c){
+    time_t idletime = server.unixtime - c->lastinteraction;
+    if(c->flags & REDIS_PENDING_READ){
+        return 0;
+    }
+    if(idletime > 2 && sdsAllocSize(c->querybuf) > 1024 && sdsavail(c->querybuf) > 1024){
+        c->querybuf = sdsRemoveFreeSpace(c->querybuf);
+    }
+    return 0;
+}
+
+/**
+ * 对客户端进行周期检查，每次只检查一部分客户端，保证每秒大约能把所有客户端都检查一遍
+ * 这样即使有大量的连接，每次serverCron的耗时也不会太长
+ */
+void clientsCron(void){
+    int numclients = listLength(shard->clients);
+    int iterations = numclients/server.hz;
+
+    if(iterations < REDIS_CLIENTS_CRON_MIN_ITERATIONS){
+        iterations = (numclients < REDIS_CLIENTS_CRON_MIN_ITERATIONS) ?
+                     numclients : REDIS_CLIENTS_CRON_MIN_ITERATIONS;
+    }
+    while(listLength(shard->clients) && iterations--){
+        //每次把尾部的客户端轮转到头部，然后检查这个客户端
+        listRotate(shard->clients);
+        listNode *head = listFirst(shard->clients);
+        redisClient *c = listNodeValue(head);
+        if(clientsCronHandleTimeout(c)){
+            continue;
+        }
+        if(clientsCronResizeQueryBuffer(c)){
+            continue;
+        }
+    }
+}
+
+/**
+ * 关闭服务器前的清理工作
+ */
+int prepareForShutdown(void){
+    redisLog("User requested shutdown...");
+    for(int j = 0; j < server.shards_num; j++){
+        if(server.shards[j]->ipfd != -1){
+            close(server.shards[j]->ipfd);
+        }
+    }
+    redisLog("Redis is now ready to exit, bye bye...");
+    return REDIS_OK;
+}
+
+/**
+ * 数据库的后台工作，每个分片只处理自己的数据库
+ * 只靠查找时的单步rehash，不再被访问的大字典会一直停在rehash中间，两个表的内存都不能释放，
+ * 所以开启activerehashing时每次最多花REDIS_ACTIVE_REHASH_BUDGET_US微秒主动rehash，
+ * 从上次用完时间的数据库接着做，一个数据库的两个字典都完成了才换下一个
+ */
+static void databasesCron(void){
+    static __thread int rehash_db = 0;  //下一次从哪个数据库开始
+    if(!server.activerehashing){
+        return;
+    }
+
+    monotime start = getMonotonicTicks();
+    for(int j = 0; j < server.dbnum; j++){
+        redisDb *db = &shard->db[rehash_db];
+        dict *dicts[2] = {db->dict, db->expires};
+        for(int k = 0; k < 2; k++){
+            if(!dictIsRehashing(dicts[k])){
+                continue;
+            }
+            uint64_t elapsed_us = monotonicTicksToNs(getMonotonicTicks() - start) / 1000;
+            if(elapsed_us >= REDIS_ACTIVE_REHASH_BUDGET_US){
+                return;
+            }
+            dictRehashMicroseconds(dicts[k], REDIS_ACTIVE_REHASH_BUDGET_US - elapsed_us);
+            if(dictIsRehashing(dicts[k])){
+                //时间用完了，下次还从这个数据库开始
+                return;
+            }
+        }
+        rehash_db = (rehash_db + 1) % server.dbnum;
+    }
+}
+
+/**
+ * 服务器的时间事件处理函数，每个分片都会执行，每秒执行server.hz次
+ * 全局的工作（时间缓存、关闭服务器）只由0号分片负责
+ */
+int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData){
+    AE_NOTUSED(eventLoop);
+    AE_NOTUSED(id);
+    AE_NOTUSED(clientData);
+
+    if(shard->id == 0){
+        updateCachedTime();
+
+        //已使用内存的峰值，各线程的计数器在这里合并一次
+        size_t used = zmalloc_used_memory();
+        if(used > server.stat_peak_memory){
+            server.stat_peak_memory = used;
+        }
+        //读/proc需要一次系统调用，100毫秒读一次就足够了
+        run_with_period(100){
+            server.resident_set_size = zmalloc_get_rss();
+        }
+
+        //收到SIGTERM后，在这里安全地关闭服务器
+        if(server.shutdown_asap){
+            if(prepareForShutdown() == REDIS_OK){
+                exit(0);
+            }
+            redisLog("SIGTERM received but errors trying to shut down the server");
+            server.shutdown_asap = 0;
+        }
+        server.cronloops++;
+    }
+
+    clientsCron();
+
+    databasesCron();
+
+    //发布本分片的键数量，其他分片淘汰时用来判断这里还有没有可淘汰的键
+    if(server.shards_num > 1){
+        size_t keys = 0, volatile_keys = 0;
+        for(int j = 0; j < server.dbnum; j++){
+            keys += dictSize(shard->db[j].dict);
+            volatile_keys += dictSize(shard->db[j].expires);
+        }
+        __atomic_store_n(&shard->keys_num, keys, __ATOMIC_RELAXED);
+        __atomic_store_n(&shard->volatile_keys_num, volatile_keys, __ATOMIC_RELAXED);
+    }
+    //每个分片只淘汰自己那一份，没有写命令的分片也要在这里淘汰
+    if(server.maxmemory){
+        freeMemoryIfNeeded();
+    }
+
+    //释放需要异步关闭的客户端
+    freeClientsInAsyncFreeQueue();
+
+    //返回下一次执行的间隔毫秒数
+    return 1000/server.hz;
+}
+
+/**
+ * 每次事件循环进入epoll_wait之前调用
+ */
+void beforeSleep(struct aeEventLoop *eventLoop){
+    AE_NOTUSED(eventLoop);
+    //先处理交给IO线程读取的客户端，并在主线程执行解析出来的命令
+    handleClientsWithPendingReadsUsingThreads();
+    //直接发送这一轮产生的所有回复
+    handleClientsWithPendingWritesUsingThreads();
+    //释放读写过程中出错或者需要关闭的客户端
+    freeClientsInAsyncFreeQueue();
+    //唤醒这一轮收到了消息的分片
+    flushShardMessages();
+}
+
+static void sigtermHandler(int sig){
+    (void)sig;
+    //只设置标志位，真正的关闭在serverCron中进行
+    server.shutdown_asap = 1;
+}
+
+void setupSignalHandlers(void){
+    struct sigaction act;
+    sigemptyset(&act.sa_mask);
+    act.sa_flags = 0;
+    act.sa_handler = sigtermHandler;
+    sigaction(SIGTERM, &act, NULL);
+    sigaction(SIGINT, &act, NULL);
+}
+
+/**
+ * 创建共享对象
+ */
+void createSharedObjects(void){
+    shared.crlf = createObject(REDIS_STRING, sdsnew("\r\n"));
+    shared.ok = createObject(REDIS_STRING, sdsnew("+OK\r\n"));
+    shared.err = createObject(REDIS_STRING, sdsnew("-ERR\r\n"));
+    shared.nullbulk = createObject(REDIS_STRING, sdsnew("$-1\r\n"));
+    shared.nullmultibulk = createObject(REDIS_STRING, sdsnew("*-1\r\n"));
+    shared.emptymultibulk = createObject(REDIS_STRING, sdsnew("*0\r\n"));
+    shared.emptybulk = createObject(REDIS_STRING, sdsnew("$0\r\n\r\n"));
+    shared.czero = createObject(REDIS_STRING, sdsnew(":0\r\n"));
+    shared.cone = createObject(REDIS_STRING, sdsnew(":1\r\n"));
+    shared.cnegone = createObject(REDIS_STRING, sdsnew(":-1\r\n"));
+    shared.pong = createObject(REDIS_STRING, sdsnew("+PONG\r\n"));
+    shared.wrongtypeerr = createObject(REDIS_STRING, sdsnew(
+        "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n"));
+    shared.nokeyerr = createObject(REDIS_STRING, sdsnew("-ERR no such key\r\n"));
+    shared.syntaxerr = createObject(REDIS_STRING, sdsnew("-ERR syntax error\r\n"));
+    shared.sameobjecterr = createObject(REDIS_STRING, sdsnew(
+        "-ERR source and destination objects are the same\r\n"));
+    shared.outofrangeerr = createObject(REDIS_STRING, sdsnew("-ERR index out of range\r\n"));
+    shared.emptyscan = createObject(REDIS_STRING, sdsnew("*2\r\n$1\r\n0\r\n*0\r\n"));
+    shared.oomerr = createObject(REDIS_STRING, sdsnew(
+        "-OOM command not allowed when used memory > 'maxmemory'.\r\n"));
+    //0到9999的整数对象，所有分片共用，引用计数固定不变
+    for(long j = 0; j < REDIS_SHARED_INTEGERS; j++){
+        shared.integers[j] = makeObjectShared(createObject(REDIS_STRING, (void*)j));
+        shared.integers[j]->encoding = REDIS_ENCODING_INT;
+    }
+}
+
+/**
+ * 初始化服务器的运行时状态：事件处理器、数据库、监听套接字和时间事件
+ */
+void initServer(void){
+    signal(SIGHUP, SIG_IGN);
+    //对端关闭后继续write会收到SIGPIPE，忽略掉，让write返回EPIPE
+    signal(SIGPIPE, SIG_IGN);
+    setupSignalHandlers();
+
+    if(server.shards_num > 1 && server.io_threads_num > 1){
+        redisLog("Fatal: io-threads and shards can't be used together.");
+        exit(1);
+    }
+    server.clients_pending_read = listCreate();
+    server.connected_clients = 0;
+    server.io_threads_active = 0;
+    server.cronloops = 0;
+    server.stat_numconnections = 0;
+    server.stat_rejected_conn = 0;
+    server.stat_starttime = time(NULL);
+    server.stat_peak_memory = 0;
+    server.stat_evictedkeys = 0;
+    server.resident_set_size = zmalloc_get_rss();
+    updateCachedTime();
+    createSharedObjects();
+
+    //创建所有分片的事件处理器、数据库和监听套接字，0号分片属于主线程
+    initShards();
+}
+
+/**
+ * 命令名的特征值：长度和第0、1、中间、倒数第2、最后一个字节，字节都转成小写
+ * 调用方保证len不小于3
+ */
+static inline uint64_t commandNameKey(const char *name, size_t len){
+    const unsigned char *p = (const unsigned char*)name;
+    uint64_t k = len;
+    k = (k << 8) | (p[0] | 0x20);
+    k = (k << 8) | (p[1] | 0x20);
+    k = (k << 8) | (p[len/2] | 0x20);
+    k = (k << 8) | (p[len-2] | 0x20);
+    k = (k << 8) | (p[len-1] | 0x20);
+    return k;
+}
+
+static inline unsigned int commandNameSlot(uint64_t key, uint64_t seed, int bits){
+    return (unsigned int)((key * seed) >> (64 - bits));
+}
+
+/**
+ * 为命令表生成完美哈希：用乘法哈希取高bits位作为槽位，寻找一个让所有命令都不冲突的seed
+ * 表的大小从命令数的2倍开始，找不到就扩大一倍，命令表是固定的，所以结果每次启动都一样
+ */
+static void buildCommandPerfectTable(int numcommands){
+    int bits = 1;
+    while((1 << bits) < numcommands * 2){
+        bits++;
+    }
+    commandMinNameLen = SIZE_MAX;
+    commandMaxNameLen = 0;
+    for(int i = 0; i < numcommands; i++){
+        size_t len = redisCommandTable[i].namelen;
+        redisAssert(len >= 3);
+        if(len < commandMinNameLen) commandMinNameLen = len;
+        if(len > commandMaxNameLen) commandMaxNameLen = len;
+    }
+
+    for(; bits <= 16; bits++){
+        size_t slots = (size_t)1 << bits;
+        struct redisCommand **table = zcalloc(slots * sizeof(*table));
+        uint64_t seed = 0x9E3779B97F4A7C15ULL;
+        for(int attempt = 0; attempt < 4096; attempt++){
+            int i;
+            //每次换一个奇数seed，保证乘法是可逆的
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            seed |= 1;
+            memset(table, 0, slots * sizeof(*table));
+            for(i = 0; i < numcommands; i++){
+                struct redisCommand *c = redisCommandTable + i;
+                unsigned int slot = commandNameSlot(commandNameKey(c->name, c->namelen), seed, bits);
+                if(table[slot] != NULL){
+                    break;
+                }
+                table[slot] = c;
+            }
+            if(i == numcommands){
+                commandPerfectTable = table;
+                commandPerfectSeed = seed;
+                commandPerfectBits = bits;
+                return;
+            }
+        }
+        zfree(table);
+    }
+    //两个命令名的特征值完全相同时才会走到这里，需要在commandNameKey中加入更多的字节
+    redisPanic("Can't build the perfect hash table for commands");
+}
+
 /**
  * 根据redis.c顶部定义的命令列表，创建命令表
  */ 
@@ -193,14 +705,319 @@ void populateCommandTable(void){
                 case 't': c->flags |= REDIS_CMD_STALE; break;
                 case 'M': c->flags |= REDIS_CMD_SKIP_MONITOR; break;
                 case 'k': c->flags |= REDIS_CMD_ASKING; break;
+                case 'A': c->flags |= REDIS_CMD_ALL_SHARDS; break;
                 default: redisPanic("Unsupported command flag"); break;
             }
             f++;
         }
-        //最后将命令加到服务器命令字典
-        int result = dictAdd(server.commands, sdsnew(c->name), c);
-        redisAssert(result == DICT_OK);
+        c->namelen = strlen(c->name);
+        c->id = i;
+    }
+    server.numcommands = numcount;
+    buildCommandPerfectTable(numcount);
+}
+
+/**
+ * 根据命令名查找命令，找不到返回NULL
+ * 使用完美哈希表，只探测一个槽位，长度相同时才比较名字
+ */
+struct redisCommand *lookupCommand(sds name){
+    return lookupCommandBuffer(name, sdslen(name));
+}
+
+/**
+ * 同lookupCommand，名字不需要是sds，供还没有解析成对象的命令使用
+ */
+struct redisCommand *lookupCommandBuffer(const char *name, size_t len){
+    if(len < commandMinNameLen || len > commandMaxNameLen){
+        return NULL;
+    }
+    unsigned int slot = commandNameSlot(commandNameKey(name, len), commandPerfectSeed, commandPerfectBits);
+    struct redisCommand *c = commandPerfectTable[slot];
+    if(c == NULL || (size_t)c->namelen != len || strncasecmp(c->name, name, len) != 0){
+        return NULL;
+    }
+    return c;
+}
+
+/**
+ * 执行命令的实现函数，并把耗时记录到当前分片的命令统计中
+ */
+void call(redisClient *c){
+    struct redisCommand *cmd = c->cmd;
+    monotime start = getMonotonicTicks();
+    cmd->proc(c);
+    uint64_t ns = monotonicTicksToNs(getMonotonicTicks() - start);
+    latencyAddSample(&shard->cmdstats[cmd->id], ns, server.latency_tracking);
+}
+
+/**
+ * 查找并检查命令，然后执行
+ * 返回REDIS_OK说明客户端可以继续处理下一条命令，
+ * 返回REDIS_ERR说明命令已经转发给其他分片，参数还不能释放
+ */
+int processCommand(redisClient *c){
+    c->cmd = lookupCommand(c->argv[0]->ptr);
+    if(!c->cmd){
+        addReplyErrorFormat(c, "unknown command '%s'", (char*)c->argv[0]->ptr);
+        return REDIS_OK;
+    }else if((c->cmd->arity > 0 && c->cmd->arity != c->argc) ||
+            (c->argc < -c->cmd->arity)){
+        //arity为正数要求参数个数正好相等，为负数表示参数个数至少为-arity
+        addReplyErrorFormat(c, "wrong number of arguments for '%s' command", c->cmd->name);
+        return REDIS_OK;
+    }
+
+    //带A标志的命令在所有分片上依次执行，最后一个分片回复，见shard.c开头的说明
+    if(c->cmd->flags & REDIS_CMD_ALL_SHARDS){
+        c->broadcast_acc = 0;
+        c->broadcast_hops = server.shards_num - 1;
+        if(c->broadcast_hops > 0){
+            call(c);
+            forwardCommandToShard(c, (shard->id + 1) % server.shards_num);
+            return REDIS_ERR;
+        }
+    }
+
+    //键不属于当前分片时，把命令交给键所在的分片执行，完成之前客户端暂停处理后面的命令
+    if(server.shards_num > 1){
+        int target = getCommandShard(c);
+        if(target == -1){
+            addReplyError(c, "Keys in request don't hash to the same shard");
+            return REDIS_OK;
+        }
+        if(target != shard->id){
+            forwardCommandToShard(c, target);
+            return REDIS_ERR;
+        }
+    }
+
+    //内存超过限制时先淘汰键，淘汰不了就拒绝可能增加内存的命令
+    if(server.maxmemory && (c->cmd->flags & REDIS_CMD_DENYOOM) && freeMemoryIfNeeded() == REDIS_ERR){
+        addReply(c, shared.oomerr);
+        return REDIS_OK;
     }
+
+    call(c);
+    return REDIS_OK;
+}
+
+/**
+ * 命令的实现
+ */
+void echoCommand(redisClient *c){
+    addReplyBulk(c, c->argv[1]);
+}
+
+/**
+ * 回复OK之后关闭连接，processInputBuffer看到REDIS_CLOSE_AFTER_REPLY就不再处理后面的命令
+ */
+void quitCommand(redisClient *c){
+    addReply(c, shared.ok);
+    c->flags |= REDIS_CLOSE_AFTER_REPLY;
+}
+
+void pingCommand(redisClient *c){
+    if(c->argc > 2){
+        addReplyErrorFormat(c, "wrong number of arguments for '%s' command", c->cmd->name);
+        return;
+    }
+    if(c->argc == 1){
+        addReply(c, shared.pong);
+    }else{
+        addReplyBulk(c, c->argv[1]);
+    }
+}
+
+/**
+ * 把字节数转成便于阅读的形式，例如1.50M
+ */
+void bytesToHuman(char *s, unsigned long long n){
+    double d;
+
+    if(n < 1024){
+        sprintf(s, "%lluB", n);
+    }else if(n < (1024*1024)){
+        d = (double)n/(1024);
+        sprintf(s, "%.2fK", d);
+    }else if(n < (1024LL*1024*1024)){
+        d = (double)n/(1024*1024);
+        sprintf(s, "%.2fM", d);
+    }else if(n < (1024LL*1024*1024*1024)){
+        d = (double)n/(1024LL*1024*1024);
+        sprintf(s, "%.2fG", d);
+    }else{
+        d = (double)n/(1024LL*1024*1024*1024);
+        sprintf(s, "%.2fT", d);
+    }
+}
+
+/**
+ * 生成INFO命令的内容，section为NULL或者"default"时输出默认的几个部分
+ */
+sds genRedisInfoString(char *section){
+    sds info = sdsempty();
+    int allsections = 0, defsections = 0, sections = 0;
+
+    if(section == NULL){
+        section = "default";
+    }
+    allsections = strcasecmp(section, "all") == 0 || strcasecmp(section, "everything") == 0;
+    defsections = strcasecmp(section, "default") == 0;
+
+    if(allsections || defsections || !strcasecmp(section, "server")){
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscatprintf(info,
+            "# Server\r\n"
+            "redis_version:%s\r\n"
+            "arch_bits:%d\r\n"
+            "multiplexing_api:%s\r\n"
+            "monotonic_clock:%s\r\n"
+            "process_id:%ld\r\n"
+            "run_id:%s\r\n"
+            "tcp_port:%d\r\n"
+            "uptime_in_seconds:%ld\r\n"
+            "hz:%d\r\n"
+            "shards:%d\r\n"
+            "io_threads:%d\r\n",
+            REDIS_VERSION,
+            server.arch_bits,
+            aeGetApiName(shard->el),
+            monotonicInfoString(),
+            (long)getpid(),
+            server.runid,
+            server.port,
+            (long)(time(NULL) - server.stat_starttime),
+            server.hz,
+            server.shards_num,
+            server.io_threads_num);
+    }
+
+    if(allsections || defsections || !strcasecmp(section, "clients")){
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscatprintf(info,
+            "# Clients\r\n"
+            "connected_clients:%ld\r\n",
+            __atomic_load_n(&server.connected_clients, __ATOMIC_RELAXED));
+    }
+
+    if(allsections || defsections || !strcasecmp(section, "memory")){
+        char hmem[64], peak_hmem[64], maxmemory_hmem[64];
+        size_t used = zmalloc_used_memory();
+        //峰值只在serverCron中更新，这里先用当前值修正一下
+        if(used > server.stat_peak_memory){
+            server.stat_peak_memory = used;
+        }
+        bytesToHuman(hmem, used);
+        bytesToHuman(peak_hmem, server.stat_peak_memory);
+        bytesToHuman(maxmemory_hmem, server.maxmemory);
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscatprintf(info,
+            "# Memory\r\n"
+            "used_memory:%zu\r\n"
+            "used_memory_human:%s\r\n"
+            "used_memory_rss:%zu\r\n"
+            "used_memory_peak:%zu\r\n"
+            "used_memory_peak_human:%s\r\n"
+            "used_memory_slabs:%zu\r\n"
+            "maxmemory:%llu\r\n"
+            "maxmemory_human:%s\r\n"
+            "maxmemory_policy:%s\r\n"
+            "mem_fragmentation_ratio:%.2f\r\n"
+            "mem_allocator:%s\r\n",
+            used,
+            hmem,
+            server.resident_set_size,
+            server.stat_peak_memory,
+            peak_hmem,
+            slabUsedMemory(),
+            server.maxmemory,
+            maxmemory_hmem,
+            maxmemoryToString(),
+            zmalloc_get_fragmentation_ratio(server.resident_set_size),
+            ZMALLOC_LIB);
+    }
+
+    if(allsections || defsections || !strcasecmp(section, "stats")){
+        unsigned long long processed = 0;
+        for(int i = 0; i < server.shards_num; i++){
+            for(int j = 0; j < server.numcommands; j++){
+                processed += server.shards[i]->cmdstats[j].calls;
+            }
+        }
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscatprintf(info,
+            "# Stats\r\n"
+            "total_connections_received:%lld\r\n"
+            "total_commands_processed:%llu\r\n"
+            "rejected_connections:%lld\r\n"
+            "evicted_keys:%lld\r\n",
+            __atomic_load_n(&server.stat_numconnections, __ATOMIC_RELAXED),
+            processed,
+            __atomic_load_n(&server.stat_rejected_conn, __ATOMIC_RELAXED),
+            __atomic_load_n(&server.stat_evictedkeys, __ATOMIC_RELAXED));
+    }
+
+    //多个分片时只统计当前分片（DBSIZE会汇总所有分片），正在rehash的字典显示迁移进度
+    if(allsections || defsections || !strcasecmp(section, "keyspace")){
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscat(info, "# Keyspace\r\n");
+        for(int j = 0; j < server.dbnum; j++){
+            dict *d = shard->db[j].dict;
+            long long keys = dictSize(d);
+            long long vkeys = dictSize(shard->db[j].expires);
+            if(keys == 0 && vkeys == 0){
+                continue;
+            }
+            info = sdscatprintf(info, "db%d:keys=%lld,expires=%lld", j, keys, vkeys);
+            if(dictIsRehashing(d)){
+                //rehashindex之前的桶都已经迁移了
+                info = sdscatprintf(info, ",rehashing=%.1f%%",
+                    (double)d->rehashindex * 100 / d->ht[0].size);
+            }
+            info = sdscat(info, "\r\n");
+        }
+    }
+
+    //命令统计需要遍历所有命令和分片，只有明确指定时才输出
+    if(allsections || !strcasecmp(section, "commandstats")){
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscat(info, "# Commandstats\r\n");
+        info = genCommandStatsString(info);
+    }
+
+    if(allsections || !strcasecmp(section, "latencystats")){
+        if(sections++){
+            info = sdscat(info, "\r\n");
+        }
+        info = sdscat(info, "# Latencystats\r\n");
+        info = genLatencyStatsString(info);
+    }
+    return info;
+}
+
+void infoCommand(redisClient *c){
+    char *section = c->argc == 2 ? c->argv[1]->ptr : NULL;
+
+    if(c->argc > 2){
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+    sds info = genRedisInfoString(section);
+    addReplyBulkCBuffer(c, info, sdslen(info));
+    sdsfree(info);
 }
 
 void version(){
@@ -220,14 +1037,24 @@ void usage(){
     exit(1);
 }
 
+/**
+ * 内存分配失败时记录日志并退出，继续运行只会在更难排查的地方崩溃
+ */
+void redisOutOfMemoryHandler(size_t allocation_size){
+    redisLog("Out Of Memory allocating %zu bytes!", allocation_size);
+    redisPanic("Redis aborting for OUT OF MEMORY");
+}
+
 int main(int argc, char *argv[]){
 
+    zmalloc_set_oom_handler(redisOutOfMemoryHandler);
+
     //初始化服务器
     initServerConfig();
 
     //检查输入参数
     if(argc >= 2){
-        int i = 0;
+        int i = 1;  //跳过程序名
         sds options = sdsempty();
         char *configfile = NULL;
 
@@ -240,7 +1067,7 @@ int main(int argc, char *argv[]){
             usage();
         }
 
-        //猜测第一个参数是否为配置文件路径
+        //猜测第一个参数是否为配置文件路径（"-"表示从标准输入读取）
         if(argv[i][0] != '-' || argv[i][1] != '-'){
             configfile = argv[i];
             i++;
@@ -252,9 +1079,9 @@ int main(int argc, char *argv[]){
                 //参数名,例如--port
                 if(sdslen(options)){
                     options = sdscat(options, "\n");    //在上次的最后追加换行符
-                    options = sdscat(options, argv[i] + 2);
-                    options = sdscat(options, " ");
                 }
+                options = sdscat(options, argv[i] + 2);
+                options = sdscat(options, " ");
             }else{
                 //参数值，要前后加上双引号，最终形式例如port "1234"\n
                 options = sdscatrepr(options, argv[i], strlen(argv[i]));
@@ -269,8 +1096,22 @@ int main(int argc, char *argv[]){
         }
 
         //开始载入配置文件
-
+        loadServerConfig(configfile, options);
+        sdsfree(options);
     }else{
         redisLog("Warning: no config file specified, using the default config.");
     }
+
+    redisLog("Monotonic clock: %s", monotonicInit());
+    initServer();
+    initThreadedIO();
+    startShards();
+    redisLog("Server started, Redis version %s", REDIS_VERSION);
+    redisLog("The server is now ready to accept connections on port %d (%s, %d shards)",
+        server.port, aeGetApiName(shard->el), server.shards_num);
+
+    //进入0号分片的事件循环，直到服务器关闭
+    aeMain(shard->el);
+    aeDeleteEventLoop(shard->el);
+    return 0;
 }
\ No newline at end of file
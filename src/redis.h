@@ -3,10 +3,21 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <limits.h>
+#include "config.h"
+#include "ae.h"
+#include "anet.h"
 #include "sds.h"
 #include "adlist.h"
 #include "dict.h"
 #include "intset.h"
+#include "monotonic.h"
+#include "zmalloc.h"
 
 /**
  * 定义当前软件版本
@@ -38,6 +49,105 @@
 #define REDIS_MAX_LOGMSG_LEN 1024   //最长的log字节数为1k
 #define REDIS_DEFAULT_MAXMEMORY 0
 #define REDIS_DEFAULT_PID_FILE "/var/run/redis.pid" //默认进程pid文件
+#define REDIS_MIN_RESERVED_FDS 32   //除了客户端连接以外，为日志、监听等保留的描述符数量
+#define REDIS_EVENTLOOP_FDSET_INCR (REDIS_MIN_RESERVED_FDS+96)  //事件处理器比maxclients多追踪的描述符数量
+#define REDIS_MAX_ACCEPTS_PER_CALL 1000 //每次accept事件最多接受的连接数
+#define REDIS_CLIENTS_CRON_MIN_ITERATIONS 5 //clientsCron每次至少检查的客户端数量
+#define REDIS_SET_MAX_INTSET_ENTRIES 512    //整数集合超过这个元素数量就转成哈希表
+#define REDIS_SHARED_INTEGERS 10000 //共享的整数对象，0到9999
+#define REDIS_DEFAULT_ACTIVE_REHASHING 1    //默认在serverCron中主动rehash
+#define REDIS_ACTIVE_REHASH_BUDGET_US 1000  //每个分片每次serverCron主动rehash的时间上限（微秒）
+
+/**
+ * 过期命令的时间单位
+ */
+#define UNIT_SECONDS 0
+#define UNIT_MILLISECONDS 1
+
+/**
+ * 列表操作的方向
+ */
+#define REDIS_HEAD 0
+#define REDIS_TAIL 1
+
+/**
+ * 网络IO相关
+ */
+#define REDIS_IOBUF_LEN (1024*16)   //每次read的最大字节数
+#define REDIS_MAX_QUERYBUF_LEN (1024*1024*1024) //查询缓冲区的最大长度，超过则关闭客户端
+#define REDIS_INLINE_MAX_SIZE (1024*64) //inline命令和multibulk长度行的最大长度
+#define REDIS_MBULK_BIG_ARG (1024*32)   //超过这个长度的bulk参数，直接读进预分配好的对象里
+#define REDIS_REPLY_CHUNK_BYTES (16*1024)   //客户端静态回复缓冲区的大小，也是回复块的最小大小
+#define REDIS_IOV_MAX 1024  //每次writev最多的iovec数量
+#define REDIS_MAX_WRITE_PER_CALL (1024*1024*64) //每次writev最多组织的字节数，也是一次writeToClient最多写出的字节数
+#define REDIS_PREFETCH_MIN_SLOTS (1024*64)  //键空间的槽数少于这个值时基本都在cache里，流水线不做预取
+
+/**
+ * 请求协议类型
+ */
+#define REDIS_REQ_INLINE 1  //空格分隔的inline命令，例如telnet输入
+#define REDIS_REQ_MULTIBULK 2   //RESP协议的*<argc>\r\n$<len>\r\n<arg>\r\n...
+
+/**
+ * 客户端flags
+ */
+#define REDIS_CLOSE_AFTER_REPLY (1<<0)  //回复发送完毕后关闭客户端
+#define REDIS_CLOSE_ASAP (1<<1) //在serverCron中异步关闭客户端
+#define REDIS_PENDING_WRITE (1<<2)  //客户端在shard->clients_pending_write中，等待beforeSleep发送回复
+#define REDIS_PENDING_READ (1<<3)   //客户端在server.clients_pending_read中，等待IO线程读取和解析
+#define REDIS_PENDING_COMMAND (1<<4)    //IO线程已经解析出一条完整的命令，等待主线程执行
+#define REDIS_FORWARDED (1<<5)  //当前命令已经转发给键所在的分片执行，完成之前客户端不能被本分片读写
+
+/**
+ * IO线程相关
+ */
+#define REDIS_IO_THREADS_MAX_NUM 128    //io-threads的上限
+#define REDIS_IO_THREADS_OP_READ 0  //IO线程当前的任务是读取并解析
+#define REDIS_IO_THREADS_OP_WRITE 1 //IO线程当前的任务是发送回复
+
+/**
+ * 分片相关
+ */
+#define REDIS_SHARDS_MAX_NUM 64 //shards的上限
+#define REDIS_SHARD_QUEUE_SIZE 4096 //分片之间每个单向队列的容量，必须是2的幂
+
+/**
+ * 命令延迟直方图，按纳秒记录，对数分桶：每个2的幂区间再线性分成16个子桶，相对误差不超过1/16
+ * 小于16纳秒的值每个值一个桶，超过2^40纳秒（约18分钟）的都记在最后一个桶里
+ */
+#define REDIS_LATENCY_SUB_BITS 4
+#define REDIS_LATENCY_SUB_BUCKETS (1<<REDIS_LATENCY_SUB_BITS)
+#define REDIS_LATENCY_MAX_BITS 40
+#define REDIS_LATENCY_BUCKETS ((REDIS_LATENCY_MAX_BITS-REDIS_LATENCY_SUB_BITS+1)*REDIS_LATENCY_SUB_BUCKETS)
+#define REDIS_DEFAULT_LATENCY_TRACKING 1
+
+/**
+ * maxmemory淘汰策略
+ * volatile开头的只淘汰设置了过期时间的键，allkeys开头的在所有键中淘汰
+ * 高位是策略的编号，低位是策略的特性，判断用的是LRU还是LFU、是否在所有键中淘汰时只需要检查标志位
+ */
+#define REDIS_MAXMEMORY_FLAG_LRU (1<<0)
+#define REDIS_MAXMEMORY_FLAG_LFU (1<<1)
+#define REDIS_MAXMEMORY_FLAG_ALLKEYS (1<<2)
+#define REDIS_MAXMEMORY_VOLATILE_LRU ((0<<8)|REDIS_MAXMEMORY_FLAG_LRU)
+#define REDIS_MAXMEMORY_VOLATILE_LFU ((1<<8)|REDIS_MAXMEMORY_FLAG_LFU)
+#define REDIS_MAXMEMORY_VOLATILE_TTL (2<<8)
+#define REDIS_MAXMEMORY_VOLATILE_RANDOM (3<<8)
+#define REDIS_MAXMEMORY_ALLKEYS_LRU ((4<<8)|REDIS_MAXMEMORY_FLAG_LRU|REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_ALLKEYS_LFU ((5<<8)|REDIS_MAXMEMORY_FLAG_LFU|REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|REDIS_MAXMEMORY_FLAG_ALLKEYS)
+#define REDIS_MAXMEMORY_NO_EVICTION (7<<8)
+#define REDIS_DEFAULT_MAXMEMORY_POLICY REDIS_MAXMEMORY_NO_EVICTION
+#define REDIS_DEFAULT_MAXMEMORY_SAMPLES 5   //每次淘汰在每个数据库中采样的键数量
+#define REDIS_EVICTION_POOL_SIZE 16 //淘汰池的大小
+
+/**
+ * LFU模式下robj的lru字段分成两部分：
+ * 高16位是计数器上一次衰减的时间（分钟），低8位是对数的访问计数器
+ */
+#define REDIS_LFU_INIT_VAL 5    //新对象的计数器初始值，避免刚写入的键马上被淘汰
+#define REDIS_DEFAULT_LFU_LOG_FACTOR 10 //越大计数器增长越慢
+#define REDIS_DEFAULT_LFU_DECAY_TIME 1  //计数器每隔多少分钟减1，为0则不衰减
 
 // 命令标志
 #define REDIS_CMD_WRITE 1                   /* "w" flag */
@@ -53,6 +163,7 @@
 #define REDIS_CMD_STALE 1024                /* "t" flag */
 #define REDIS_CMD_SKIP_MONITOR 2048         /* "M" flag */
 #define REDIS_CMD_ASKING 4096               /* "k" flag */
+#define REDIS_CMD_ALL_SHARDS 8192           /* "A" flag */
 
 /**
  *  对象类型
@@ -76,6 +187,15 @@
 #define REDIS_ENCODING_SKIPLIST 7
 #define REDIS_ENCODING_EMBSTR 8
 
+/**
+ * 不超过这个长度的字符串使用EMBSTR编码，redisObject和sds在同一块内存里
+ * 16字节的robj + 3字节的sdshdr8 + 44字节的内容 + 1字节的\0正好是64字节，占一个缓存行
+ */
+#define REDIS_ENCODING_EMBSTR_SIZE_LIMIT 44
+
+//对象的ptr是否是sds
+#define sdsEncodedObject(objptr) (objptr->encoding == REDIS_ENCODING_RAW || objptr->encoding == REDIS_ENCODING_EMBSTR)
+
 /**
  * redis对象相关
  */ 
@@ -83,6 +203,17 @@
 #define REDIS_LRU_CLOCK_MAX ((1<<REDIS_LRU_BITS)-1) //24位全为1，即最大的24位数
 #define REDIS_LRU_CLOCK_RESOLUTION 1000
 
+/**
+ * 共享对象的引用计数，incrRefCount和decrRefCount对它不做任何操作
+ * 共享对象在启动时创建，之后所有线程都只读，不会被释放，也不需要原子地修改引用计数
+ */
+#define REDIS_SHARED_REFCOUNT INT_MAX
+
+/**
+ * 在serverCron中每隔_ms_毫秒执行一次，间隔小于serverCron的周期时每次都执行
+ */
+#define run_with_period(_ms_) if((_ms_ <= 1000/server.hz) || !(server.cronloops%((_ms_)/(1000/server.hz))))
+
 /**
  * debug相关宏函数
  */ 
@@ -106,17 +237,128 @@ typedef struct redisObject{
 
 typedef struct redisDb{
     dict *dict; //保存库里所有的键值对
+    dict *expires;  //设置了过期时间的键，值是毫秒级的过期时间戳
     int id; //数据库号码
 } redisDb;
 
+/**
+ * 回复块，回复链表的每个节点都是一个回复块，多条小回复会被依次写进同一个块
+ */
+typedef struct clientReplyBlock{
+    size_t size;    //buf的总大小
+    size_t used;    //buf已经使用的大小
+    char buf[];
+} clientReplyBlock;
+
+/**
+ * 每个命令的执行统计，每个分片各有一份，只由分片自己的线程修改，INFO时把所有分片的加起来
+ */
+typedef struct redisCommandStats{
+    uint64_t calls; //执行次数
+    uint64_t nanoseconds;   //总耗时
+    uint64_t max_ns;    //最大耗时
+    uint64_t histogram[REDIS_LATENCY_BUCKETS];  //耗时的分布
+} redisCommandStats;
+
+/**
+ * 耗时对应的直方图桶下标
+ * 最高位在第msb位的值，用最高位之后的REDIS_LATENCY_SUB_BITS位作为子桶编号
+ */
+static inline int latencyBucketIndex(uint64_t ns){
+    if(ns < REDIS_LATENCY_SUB_BUCKETS){
+        return (int)ns;
+    }
+    int msb = 63 - __builtin_clzll(ns);
+    if(msb >= REDIS_LATENCY_MAX_BITS){
+        return REDIS_LATENCY_BUCKETS-1;
+    }
+    int shift = msb - REDIS_LATENCY_SUB_BITS;
+    return ((shift+1) << REDIS_LATENCY_SUB_BITS) + (int)((ns >> shift) - REDIS_LATENCY_SUB_BUCKETS);
+}
+
+/**
+ * 记录一次命令执行的耗时，在call()中调用，只有几条整数指令
+ */
+static inline void latencyAddSample(redisCommandStats *st, uint64_t ns, int tracking){
+    st->calls++;
+    st->nanoseconds += ns;
+    if(ns > st->max_ns){
+        st->max_ns = ns;
+    }
+    if(tracking){
+        st->histogram[latencyBucketIndex(ns)]++;
+    }
+}
+
+struct redisShard;
+
 typedef struct redisClient{
     int fd; //  套接字描述符
+    struct redisShard *shard;   //接受这个连接的分片，客户端的读写只在这个分片的线程中进行
     redisDb *db;    //客户端当前正在使用的数据库
     int dictid; //正在使用的数据库id
     robj *name; //客户端的名字
     sds querybuf;   //查询字符的缓冲区
+    int flags;  //客户端状态，值为REDIS_CLOSE_AFTER_REPLY等的或
+    time_t ctime;   //客户端的创建时间
+    time_t lastinteraction; //最后一次和服务器交互的时间，用于空闲超时
+    listNode *client_list_node; //在shard->clients中的节点，删除时不用再遍历链表
+    size_t qb_pos;  //querybuf中已经解析到的位置，解析完一批命令后才统一截掉前面的部分
+    int argc;   //当前命令的参数个数
+    robj **argv;    //当前命令的参数数组
+    int argv_len;   //argv数组的容量，下一条命令参数不多于它时直接复用
+    struct redisCommand *cmd;   //当前正在执行的命令
+    int broadcast_hops; //带A标志的命令在当前分片执行之后还要经过的分片数量，为0时由当前分片回复
+    long long broadcast_acc;    //带A标志的命令在各个分片中累加的结果，例如DBSIZE的键数量
+    int reqtype;    //请求的协议类型
+    int multibulklen;   //当前命令还剩多少个参数没有读入
+    long bulklen;   //当前参数的长度，-1表示还没有读到长度行
+    list *reply;    //回复链表，每个节点是一个clientReplyBlock，静态缓冲区满了才使用
+    unsigned long long reply_bytes; //回复链表中所有块的总大小
+    size_t sentlen; //第一段待发送数据（静态缓冲区或者链表头块）中已经发送的字节数
+    int bufpos; //静态缓冲区已使用的字节数
+    char buf[REDIS_REPLY_CHUNK_BYTES];  //静态回复缓冲区，小回复直接写在这里，不需要分配内存
 } redisClient;
 
+/**
+ * 共享对象，在服务器启动时创建，所有回复直接引用，不再重复分配
+ */
+struct sharedObjectsStruct{
+    robj *crlf, *ok, *err, *nullbulk, *nullmultibulk, *emptymultibulk, *emptybulk,
+    *czero, *cone, *cnegone, *pong, *wrongtypeerr, *nokeyerr, *syntaxerr,
+    *sameobjecterr, *outofrangeerr, *oomerr, *emptyscan,
+    *integers[REDIS_SHARED_INTEGERS];
+};
+
+/**
+ * 分片之间传递消息的单生产者单消费者无锁队列，在shard.c中实现
+ */
+typedef struct shardQueue shardQueue;
+
+/**
+ * 分片，每个分片是一个线程，拥有自己的事件处理器、监听套接字、客户端和数据库
+ * shards为1时只有0号分片，运行在主线程中
+ * 分片之间不共享任何可写的状态，访问其他分片的键时把客户端通过队列交给那个分片执行
+ */
+typedef struct redisShard{
+    int id; //分片编号，也是绑定的CPU编号
+    pthread_t thread;   //分片的线程，0号分片是主线程
+    aeEventLoop *el;    //事件处理器
+    int ipfd;   //TCP监听套接字描述符，多个分片时使用SO_REUSEPORT绑定同一个端口
+    char neterr[ANET_ERR_LEN];  //anet的错误信息
+    redisDb *db;    //这个分片拥有的数据库
+    list *clients;  //这个分片接受的所有客户端
+    list *clients_to_close; //等待异步关闭的客户端
+    list *clients_pending_write;    //有回复等待发送的客户端，在beforeSleep中统一发送
+    int notifyfd;   //eventfd，其他分片往队列里放了消息后用它唤醒这个分片
+    list **backlog; //发往每个分片的消息，队列满的时候暂存在这里
+    int *notify_pending;    //这一轮往哪些分片发送了消息，在beforeSleep中统一唤醒
+    redisCommandStats *cmdstats;    //按命令id索引的执行统计
+    struct evictionPoolEntry *eviction_pool;    //淘汰池，在这个分片的所有数据库间共用
+    size_t keys_num;    //所有数据库的键数量，serverCron中更新，其他分片判断还有没有可淘汰的键时读取
+    size_t volatile_keys_num;   //所有数据库中设置了过期时间的键数量，同上
+} redisShard;
+
 /**
  * 定义函数指针类型，里面封装具体命令的实现
  */ 
@@ -135,6 +377,8 @@ struct redisCommand{
     int firstkey;
     int lastkey;
     int keystep;
+    int namelen;    //命令名字的长度，查找命令时先比较长度
+    int id; //命令在redisCommandTable中的下标，用于索引分片的cmdstats
 };
 
 struct redisServer{
@@ -146,17 +390,43 @@ struct redisServer{
     char *pidfile;  //进程pid文件路径
     int arch_bits;  //架构类型，是32位还是64位的
     char runid[REDIS_RUN_ID_SIZE + 1];  //服务器的RUN ID，每次运行的值都不一样
-    unsigned lruclock:REDIS_LRU_BITS;   //当前系统时间的缓存，目前不使用缓存
+    unsigned int lruclock;  //LRU时钟的缓存，在serverCron中每秒更新server.hz次
     int shutdown_asap;  //关闭服务器的标志位
 
-    dict *commands; //命令表（不考虑rename配置项）
+    int numcommands;    //redisCommandTable中的命令数量
 
     /* 网络相关 */
     int port;   //监听端口
     int tcp_backlog;    //backlog监听端口
+    char *bindaddr; //绑定的地址，为NULL则绑定所有地址
+    int event_backend;  //配置的多路复用库，AE_API_EPOLL或AE_API_IO_URING
+    int shards_num; //分片数量，为1则只有主线程
+    redisShard **shards;    //所有分片
+    shardQueue **shard_queues;  //分片之间的消息队列，shard_queues[from*shards_num+to]
+    long connected_clients; //所有分片的客户端总数，多个线程原子地修改
+    list *clients_pending_read; //等待IO线程读取的客户端
+    int io_threads_num; //IO线程数量（包括主线程），为1则不开启IO线程
+    int io_threads_active;  //IO线程是否正在运行，没有足够的客户端时会暂停
+    unsigned int maxclients;    //最大客户端连接数
+    int cronloops;  //serverCron已执行的次数
+
+    /* 时间缓存，在serverCron中更新，精度要求不高的地方直接使用 */
+    time_t unixtime;    //秒级时间
+    long long mstime;   //毫秒级时间
+
+    /* 统计相关，多个分片时原子地修改 */
+    long long stat_numconnections;  //已接受的连接总数
+    long long stat_rejected_conn;   //因为超过maxclients而被拒绝的连接数
+    time_t stat_starttime;  //服务器启动的时间
+    size_t stat_peak_memory;    //used_memory的最大值，由serverCron更新
+    size_t resident_set_size;   //常驻内存，由serverCron定期从/proc读取
+    long long stat_evictedkeys; //因为maxmemory被淘汰的键数量
+    int latency_tracking;   //是否记录每个命令的延迟直方图
+    int activerehashing;    //是否在serverCron中主动rehash数据库的字典
 
     /* 数据库相关 */
     int dbnum;
+    size_t set_max_intset_entries;  //整数集合的最大元素数量
     int maxidletime;    //客户端最大空转时间
     int tcpkeepalive;   //如果不是0，则开启SO_KEEPALIVE
     int daemonize;  //是否为守护进程
@@ -165,14 +435,20 @@ struct redisServer{
     char *logfile;  //log文件路径
 
     unsigned long long maxmemory;   //最大可用内存
+    int maxmemory_policy;   //淘汰策略，值为REDIS_MAXMEMORY_*
+    int maxmemory_samples;  //淘汰时的采样数量
+    int lfu_log_factor; //LFU计数器增长的对数因子
+    int lfu_decay_time; //LFU计数器衰减的周期（分钟）
 };
  
 
 
 /**
- * 返回LRU时钟时间，此为简化版本，每次都要进行系统调用，取精确的时间
+ * 返回LRU时钟时间
+ * serverCron的执行间隔不大于LRU时钟的精度时，直接使用serverCron更新的缓存，否则现取
  */ 
-#define LRU_CLOCK() (getLRUClock())
+#define LRU_CLOCK() ((1000/server.hz <= REDIS_LRU_CLOCK_RESOLUTION) ? \
+    __atomic_load_n(&server.lruclock, __ATOMIC_RELAXED) : getLRUClock())
 
 /**
  * 系统核心函数
@@ -188,10 +464,172 @@ void redisLog(const char *fmt, ...);
 #endif
 void redisLogRaw(const char *msg);
 
+/**
+ * 网络相关函数
+ */
+redisClient *createClient(int fd);
+void freeClient(redisClient *c);
+void freeClientAsync(redisClient *c);
+void freeClientsInAsyncFreeQueue(void);
+void acceptTcpHandler(aeEventLoop *el, int fd, void *privdata, int mask);
+void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask);
+void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask);
+int writeToClient(redisClient *c, int handler_installed);
+int clientHasPendingReplies(redisClient *c);
+int handleClientsWithPendingWrites(void);
+void initThreadedIO(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+void putClientInPendingWriteQueue(redisClient *c);
+void processInputBuffer(redisClient *c);
+void resetClient(redisClient *c);
+void addReply(redisClient *c, robj *obj);
+void addReplySds(redisClient *c, sds s);
+void addReplyString(redisClient *c, char *s, size_t len);
+void addReplyBulk(redisClient *c, robj *obj);
+void addReplyBulkCBuffer(redisClient *c, void *p, size_t len);
+void addReplyLongLong(redisClient *c, long long ll);
+void addReplyDouble(redisClient *c, double d);
+void addReplyMultiBulkLen(redisClient *c, long length);
+void addReplyStatus(redisClient *c, char *status);
+void addReplyError(redisClient *c, char *err);
+#ifdef __GNUC__
+void addReplyErrorFormat(redisClient *c, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+#else
+void addReplyErrorFormat(redisClient *c, const char *fmt, ...);
+#endif
+
+/**
+ * 命令执行相关函数
+ */
+struct redisCommand *lookupCommand(sds name);
+struct redisCommand *lookupCommandBuffer(const char *name, size_t len);
+int processCommand(redisClient *c);
+int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData);
+void beforeSleep(struct aeEventLoop *eventLoop);
+void call(redisClient *c);
+
 /**
  * 所有命令函数原型
  */
 void echoCommand(redisClient *c);
+void infoCommand(redisClient *c);
+void latencyCommand(redisClient *c);
+void pingCommand(redisClient *c);
+void quitCommand(redisClient *c);
+void delCommand(redisClient *c);
+void existsCommand(redisClient *c);
+void selectCommand(redisClient *c);
+void keysCommand(redisClient *c);
+void randomkeyCommand(redisClient *c);
+void scanCommand(redisClient *c);
+void dbsizeCommand(redisClient *c);
+void flushdbCommand(redisClient *c);
+void flushallCommand(redisClient *c);
+void typeCommand(redisClient *c);
+void renameCommand(redisClient *c);
+void renamenxCommand(redisClient *c);
+void expireCommand(redisClient *c);
+void pexpireCommand(redisClient *c);
+void expireatCommand(redisClient *c);
+void pexpireatCommand(redisClient *c);
+void ttlCommand(redisClient *c);
+void pttlCommand(redisClient *c);
+void persistCommand(redisClient *c);
+void setCommand(redisClient *c);
+void setnxCommand(redisClient *c);
+void setexCommand(redisClient *c);
+void psetexCommand(redisClient *c);
+void getCommand(redisClient *c);
+void getsetCommand(redisClient *c);
+void mgetCommand(redisClient *c);
+void msetCommand(redisClient *c);
+void msetnxCommand(redisClient *c);
+void incrCommand(redisClient *c);
+void decrCommand(redisClient *c);
+void incrbyCommand(redisClient *c);
+void decrbyCommand(redisClient *c);
+void incrbyfloatCommand(redisClient *c);
+void appendCommand(redisClient *c);
+void strlenCommand(redisClient *c);
+void lpushCommand(redisClient *c);
+void rpushCommand(redisClient *c);
+void lpopCommand(redisClient *c);
+void rpopCommand(redisClient *c);
+void llenCommand(redisClient *c);
+void lindexCommand(redisClient *c);
+void lsetCommand(redisClient *c);
+void lrangeCommand(redisClient *c);
+void ltrimCommand(redisClient *c);
+void lremCommand(redisClient *c);
+void saddCommand(redisClient *c);
+void sremCommand(redisClient *c);
+void sismemberCommand(redisClient *c);
+void scardCommand(redisClient *c);
+void smembersCommand(redisClient *c);
+void spopCommand(redisClient *c);
+void srandmemberCommand(redisClient *c);
+void sscanCommand(redisClient *c);
+void hsetCommand(redisClient *c);
+void hsetnxCommand(redisClient *c);
+void hgetCommand(redisClient *c);
+void hmsetCommand(redisClient *c);
+void hmgetCommand(redisClient *c);
+void hdelCommand(redisClient *c);
+void hlenCommand(redisClient *c);
+void hexistsCommand(redisClient *c);
+void hincrbyCommand(redisClient *c);
+void hkeysCommand(redisClient *c);
+void hvalsCommand(redisClient *c);
+void hgetallCommand(redisClient *c);
+void hscanCommand(redisClient *c);
+
+/**
+ * 数据库相关函数，在db.c中实现
+ */
+robj *lookupKey(redisDb *db, robj *key);
+robj *lookupKeyRead(redisDb *db, robj *key);
+robj *lookupKeyWrite(redisDb *db, robj *key);
+robj *lookupKeyReadOrReply(redisClient *c, robj *key, robj *reply);
+robj *lookupKeyWriteOrReply(redisClient *c, robj *key, robj *reply);
+void dbAdd(redisDb *db, robj *key, robj *val);
+void dbOverwrite(redisDb *db, robj *key, robj *val);
+void setKey(redisDb *db, robj *key, robj *val);
+int dbExists(redisDb *db, robj *key);
+int dbDelete(redisDb *db, robj *key);
+void lookupKeysBatch(redisDb *db, robj **keys, int count, int step, robj **vals);
+void dbPrefetchKeys(redisDb *db, const char **keys, const size_t *lens, int count);
+long long emptyDb(void);
+int selectDb(redisClient *c, int id);
+int removeExpire(redisDb *db, robj *key);
+void setExpire(redisDb *db, robj *key, long long when);
+long long getExpire(redisDb *db, robj *key);
+int expireIfNeeded(redisDb *db, robj *key);
+robj *dbRandomKey(redisDb *db);
+int parseScanCursorOrReply(redisClient *c, robj *o, unsigned long *cursor);
+void scanGenericCommand(redisClient *c, robj *o, unsigned long cursor);
+
+/**
+ * 集合类型相关函数，在t_set.c中实现
+ */
+typedef struct setTypeIterator{
+    robj *subject;
+    int encoding;
+    int ii; //intset的迭代位置
+    dictIterator *di;
+} setTypeIterator;
+
+robj *setTypeCreate(robj *value);
+int setTypeAdd(robj *subject, robj *value);
+int setTypeRemove(robj *subject, robj *value);
+int setTypeIsMember(robj *subject, robj *value);
+unsigned long setTypeSize(robj *subject);
+void setTypeConvert(robj *subject, int enc);
+setTypeIterator *setTypeInitIterator(robj *subject);
+void setTypeReleaseIterator(setTypeIterator *si);
+robj *setTypeNextObject(setTypeIterator *si);
+int setTypeRandomElement(robj *setobj, robj **objele, int64_t *llele);
 
 /**
  * redisObject相关函数
@@ -199,6 +637,7 @@ void echoCommand(redisClient *c);
 robj *createObject(int type, void *ptr);
 robj *createStringObject(char *ptr, size_t len);
 robj *createRawStringObject(char *ptr, size_t len);
+robj *createEmbeddedStringObject(char *ptr, size_t len);
 robj *createStringObjectFromLongLong(long long value);
 robj *createStringObjectFromLongDouble(long double value);
 robj *dupStringObject(robj *o);
@@ -208,6 +647,7 @@ robj *createSetObject(void);
 robj *createIntsetObject(void);
 robj *createHashObject(void);
 
+robj *makeObjectShared(robj *o);
 void incrRefCount(robj *o);
 void decrRefCount(robj *o);
 void decrRefCountVoid(void *o);
@@ -217,19 +657,66 @@ void freeListObject(robj *o);
 void freeSetObject(robj *o);
 void freeZsetObject(robj *o);
 void freeHashObject(robj *o);
+int checkType(redisClient *c, robj *o, int type);
+int isObjectRepresentableAsLongLong(robj *o, long long *llval);
+robj *getDecodedObject(robj *o);
+robj *tryObjectEncoding(robj *o);
+int compareStringObjects(robj *a, robj *b);
+int equalStringObjects(robj *a, robj *b);
+size_t stringObjectLen(robj *o);
+int getLongLongFromObject(robj *o, long long *target);
+int getLongDoubleFromObject(robj *o, long double *target);
+int getLongDoubleFromObjectOrReply(redisClient *c, robj *o, long double *target, const char *msg);
+int getLongLongFromObjectOrReply(redisClient *c, robj *o, long long *target, const char *msg);
+int getLongFromObjectOrReply(redisClient *c, robj *o, long *target, const char *msg);
+char *strObjectType(int type);
+unsigned long long estimateObjectIdleTime(robj *o);
+
+/**
+ * 命令延迟统计相关函数，在latency.c中实现
+ */
+uint64_t latencyPercentile(redisCommandStats *st, double percentile);
+void latencyMergeStats(redisCommandStats *dst, int id);
+sds genCommandStatsString(sds info);
+sds genLatencyStatsString(sds info);
+
+/**
+ * maxmemory淘汰相关函数，在evict.c中实现
+ */
+struct evictionPoolEntry *evictionPoolAlloc(void);
+int freeMemoryIfNeeded(void);
+unsigned int LFUGetTimeInMinutes(void);
+unsigned long LFUDecrAndReturn(robj *o);
+void updateLFU(robj *o);
+char *maxmemoryToString(void);
 
 /**
  * 配置相关函数
  */
 
 void loadServerConfig(char *filename, char *option);
+void loadServerConfigFromString(char *config);
 
 /**
  * 对外公开的数据
  */
+/**
+ * 分片相关
+ */
+void initShards(void);
+void startShards(void);
+int getKeyShard(const char *key, size_t len);
+int getCommandShard(redisClient *c);
+void forwardCommandToShard(redisClient *c, int target);
+void flushShardMessages(void);
+
 extern struct redisServer server;
+extern __thread redisShard *shard;
+extern struct sharedObjectsStruct shared;
 extern dictType setDictType;
 extern dictType hashDictType;
+extern dictType dbDictType;
+extern dictType keyptrDictType;
 /**
  * 工具函数
  */
@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sds.h"
+
+/**
+ * sds分词函数的微基准测试，对比逐字节的实现和SIMD实现
+ * 测试数据：很长的inline命令（大量普通参数和少量带引号的参数）和一个很大的配置文件
+ * 编译时需要和sds.c、util.c、fpconv.c、zmalloc.c一起链接，用法：sds-benchmark [轮数]
+ */
+
+static double nowSec(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * 一条inline命令：MSET加上args个键值对，每10个值有一个带引号和转义的
+ */
+static sds makeInlineCommand(int args){
+    sds cmd = sdsnew("MSET");
+    for(int j = 0; j < args; j++){
+        if(j % 10 == 9){
+            cmd = sdscatprintf(cmd, " key:%08d \"quoted value with spaces\\t%d\"", j, j);
+        }else{
+            cmd = sdscatprintf(cmd, " key:%08d value-%d-abcdefghijklmnopqrstuvwxyz", j, j);
+        }
+    }
+    return cmd;
+}
+
+/**
+ * 一个lines行的配置文件，带注释和缩进
+ */
+static sds makeConfigFile(int lines){
+    sds conf = sdsempty();
+    for(int j = 0; j < lines; j++){
+        if(j % 8 == 0){
+            conf = sdscatprintf(conf, "# comment line %d describing the next option\n", j);
+        }else{
+            conf = sdscatprintf(conf, "  Some-Option-%d   \"/var/lib/ledis/data-%d\"  yes\t\r\n", j, j);
+        }
+    }
+    return conf;
+}
+
+static double benchSplitargs(sds line, int rounds, long *tokens){
+    double start = nowSec();
+    *tokens = 0;
+    for(int r = 0; r < rounds; r++){
+        int argc;
+        sds *argv = sdssplitargs(line, &argc);
+        *tokens += argc;
+        sdsfreesplitres(argv, argc);
+    }
+    return nowSec() - start;
+}
+
+/**
+ * 模拟loadServerConfigFromString：按行切分，去掉首尾空白，再逐行分词并把配置名转成小写
+ */
+static double benchConfig(sds conf, int rounds, long *tokens){
+    double start = nowSec();
+    *tokens = 0;
+    for(int r = 0; r < rounds; r++){
+        int lines;
+        sds *line = sdssplitlen(conf, sdslen(conf), "\n", 1, &lines);
+        for(int j = 0; j < lines; j++){
+            line[j] = sdstrim(line[j], " \t\r\n");
+            if(line[j][0] == '#' || line[j][0] == '\0'){
+                continue;
+            }
+            int argc;
+            sds *argv = sdssplitargs(line[j], &argc);
+            if(argc){
+                sdstolower(argv[0]);
+            }
+            *tokens += argc;
+            sdsfreesplitres(argv, argc);
+        }
+        sdsfreesplitres(line, lines);
+    }
+    return nowSec() - start;
+}
+
+static void report(const char *name, const char *impl, double secs, size_t bytes, int rounds, long tokens){
+    printf("%-16s %-7s %8.2f ms  %8.1f MB/s  %ld tokens\n", name, impl,
+        secs * 1000, (double)bytes * rounds / secs / (1024*1024), tokens);
+}
+
+#define BENCH_REPEAT 5
+
+int main(int argc, char **argv){
+    int rounds = argc > 1 ? atoi(argv[1]) : 200;
+    int conf_rounds = rounds / 10 + 1;
+    sds inl = makeInlineCommand(2000);
+    sds conf = makeConfigFile(20000);
+    double best[2][2] = {{1e9, 1e9}, {1e9, 1e9}};   //[实现][测试]，取多次中最快的一次
+    long tokens[2][2];
+    const char *impl;
+
+    sdsSimdInit(0);
+    impl = sdsSimdName();
+
+    //两种实现交替运行多次，减少机器负载波动和第一次分配内存的影响
+    for(int k = 0; k < BENCH_REPEAT; k++){
+        for(int scalar = 0; scalar < 2; scalar++){
+            sdsSimdInit(scalar);
+            double t = benchSplitargs(inl, rounds, &tokens[scalar][0]);
+            if(t < best[scalar][0]){
+                best[scalar][0] = t;
+            }
+            t = benchConfig(conf, conf_rounds, &tokens[scalar][1]);
+            if(t < best[scalar][1]){
+                best[scalar][1] = t;
+            }
+        }
+    }
+
+    printf("inline command: %zu bytes, config file: %zu bytes, best of %d\n",
+        sdslen(inl), sdslen(conf), BENCH_REPEAT);
+    report("sdssplitargs", "scalar", best[1][0], sdslen(inl), rounds, tokens[1][0]);
+    report("sdssplitargs", impl, best[0][0], sdslen(inl), rounds, tokens[0][0]);
+    report("config load", "scalar", best[1][1], sdslen(conf), conf_rounds, tokens[1][1]);
+    report("config load", impl, best[0][1], sdslen(conf), conf_rounds, tokens[0][1]);
+    if(tokens[0][0] != tokens[1][0] || tokens[0][1] != tokens[1][1]){
+        printf("token count mismatch between implementations!\n");
+        return 1;
+    }
+    printf("speedup: sdssplitargs %.2fx, config load %.2fx\n",
+        best[1][0] / best[0][0], best[1][1] / best[0][1]);
+
+    sdsfree(inl);
+    sdsfree(conf);
+    return 0;
+}
@@ -2,7 +2,16 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <assert.h>
+#include <stdarg.h>
+#include <limits.h>
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define SDS_USE_X86_SIMD 1
+#endif
 #include "sds.h"
+#include "zmalloc.h"
+#include "util.h"
 
 /*
  *  返回新的buf值（并不返回sdshdr整个对象）
@@ -15,39 +24,153 @@ sds sdsnew(const char *init){
     }
 }
 
-sds sdsnewlen(const void *init, size_t initlen){
+/**
+ * 每种头部类型的大小
+ */
+int sdsHdrSize(char type){
+    switch(type & SDS_TYPE_MASK){
+        case SDS_TYPE_5: return sizeof(struct sdshdr5);
+        case SDS_TYPE_8: return sizeof(struct sdshdr8);
+        case SDS_TYPE_16: return sizeof(struct sdshdr16);
+        case SDS_TYPE_32: return sizeof(struct sdshdr32);
+        case SDS_TYPE_64: return sizeof(struct sdshdr64);
+    }
+    return 0;
+}
 
-    struct sdshdr *sh;
+/**
+ * 每种头部的len和alloc能表示的最大长度
+ */
+static inline size_t sdsTypeMaxSize(char type){
+    if(type == SDS_TYPE_5){
+        return (1<<5) - 1;
+    }
+    if(type == SDS_TYPE_8){
+        return (1<<8) - 1;
+    }
+    if(type == SDS_TYPE_16){
+        return (1<<16) - 1;
+    }
+#if (LONG_MAX == LLONG_MAX)
+    if(type == SDS_TYPE_32){
+        return (1ll<<32) - 1;
+    }
+#endif
+    return -1; //SDS_TYPE_64，等于SIZE_MAX
+}
 
-    if(init){
-        //初始化有值就用malloc
-        //结构体大小+存储的字符串大小+空白结尾
-        //printf("init is not null");
-        sh = malloc((sizeof(struct sdshdr)) + initlen + 1);
-    }else{
-        //printf("init is null");
-        //初始化没值就用calloc
-        sh = calloc(1, (sizeof(struct sdshdr)) + initlen + 1);
+/**
+ * 分配器实际给出的buf容量（不包括头部和结束符），usable是zmalloc_usable返回的大小
+ * malloc会按大小等级向上取整，多出来的空间直接算作sds的剩余空间，
+ * 之后追加的时候可以少realloc几次，结果不会超过头部类型能表示的最大值
+ */
+static size_t sdsUsableAlloc(size_t usable, int hdrlen, char type){
+    usable -= hdrlen + 1;
+    if(usable > sdsTypeMaxSize(type)){
+        usable = sdsTypeMaxSize(type);
     }
+    return usable;
+}
 
-    //分配失败就直接返回
-    if(sh == NULL){
-        return NULL;
+/**
+ * 扩容时最多预分配的长度，默认SDS_MAX_PREALLOC，可以通过sds-max-prealloc配置
+ */
+static size_t sds_max_prealloc = SDS_MAX_PREALLOC;
+
+void sdsSetMaxPrealloc(size_t size){
+    sds_max_prealloc = size;
+}
+
+/**
+ * 能放下string_size长度的最小头部类型
+ */
+char sdsReqType(size_t string_size){
+    if(string_size < 1<<5){
+        return SDS_TYPE_5;
+    }
+    if(string_size < 1<<8){
+        return SDS_TYPE_8;
+    }
+    if(string_size < 1<<16){
+        return SDS_TYPE_16;
     }
+#if (LONG_MAX == LLONG_MAX)
+    if(string_size < 1ll<<32){
+        return SDS_TYPE_32;
+    }
+    return SDS_TYPE_64;
+#else
+    return SDS_TYPE_32;
+#endif
+}
 
-    //设置初始长度和剩余空间（不留）
-    sh->len = initlen;
-    sh->free = 0;
+sds sdsnewlen(const void *init, size_t initlen){
+    void *sh;
+    sds s;
+    char type = sdsReqType(initlen);
+    //空字符串创建出来一般是为了往后追加，sdshdr5不能保存剩余空间，直接用sdshdr8
+    if(type == SDS_TYPE_5 && initlen == 0){
+        type = SDS_TYPE_8;
+    }
+    int hdrlen = sdsHdrSize(type);
+    unsigned char *fp; //指向flags
+
+    //头部大小+存储的字符串大小+空白结尾
+    size_t usable;
+    sh = zmalloc_usable(hdrlen + initlen + 1, &usable);
+    if(!init){
+        //初始化没值就清零
+        memset(sh, 0, hdrlen + initlen + 1);
+    }
+
+    s = (char*)sh + hdrlen;
+    fp = ((unsigned char*)s) - 1;
+    //设置初始长度和容量，容量是分配器实际给出的大小
+    usable = sdsUsableAlloc(usable, hdrlen, type);
+    switch(type){
+        case SDS_TYPE_5: {
+            *fp = type | (initlen << SDS_TYPE_BITS);
+            break;
+        }
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            sh->len = initlen;
+            sh->alloc = usable;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            sh->len = initlen;
+            sh->alloc = usable;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            sh->len = initlen;
+            sh->alloc = usable;
+            *fp = type;
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            sh->len = initlen;
+            sh->alloc = usable;
+            *fp = type;
+            break;
+        }
+    }
 
     //如果init有内容，则复制到buf字段里
     if(init && initlen){
-        memcpy(sh->buf, init, initlen);
+        memcpy(s, init, initlen);
     }
 
     //统一追加结束符，不管init有没有
-    sh->buf[initlen] = '\0';
+    s[initlen] = '\0';
 
-    return (char*)sh->buf;
+    return s;
 }
 
 /*
@@ -61,31 +184,17 @@ void sdsfree(sds s){
     if(s == NULL){
         return;
     }
-    free(s - sizeof(struct sdshdr));
-}
-
-size_t sdslen(const sds s){
-    //传入的是里面字符串的指针，可以通过减去结构体本身长度，返回字符串所属结构体的指针
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    return sh->len;
-}
-
-size_t sdsavail(const sds s){
-    //传入的是里面字符串的指针，可以通过减去结构体本身长度，返回字符串所属结构体的指针
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    return sh->free;
+    zfree((char*)s - sdsHdrSize(s[-1]));
 }
 
 sds sdsdup(const sds s){
-    return sdsnewlen(s, strlen(s));
+    return sdsnewlen(s, sdslen(s));
 }
 
 void sdsclear(sds s){
-    //惰性清空，只是修改free和len的值，然后第一位增加结束符即可，不清空每个字节
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    sh->free = (sh->free - sh->len);
-    sh->len = 0;
-    sh->buf[0] = '\0';
+    //惰性清空，只是修改len的值，然后第一位增加结束符即可，不清空每个字节
+    sdssetlen(s, 0);
+    s[0] = '\0';
 }
 
 sds sdscat(sds s, const char *t){
@@ -93,8 +202,6 @@ sds sdscat(sds s, const char *t){
 }
 
 sds sdscatlen(sds s, const void *t, size_t len){
-    struct sdshdr *sh;
-
     //暂存旧的len值
     size_t oldlen = sdslen(s);
 
@@ -104,14 +211,10 @@ sds sdscatlen(sds s, const void *t, size_t len){
         return NULL;
     }
 
-    //这里sh已经是新的了，free值也是扩展后的
-    sh = (void*)(s - (sizeof(struct sdshdr)));
-
     //复制新字符串到最后
     memcpy(s + oldlen, t, len);
-    sh->len = oldlen + len;
-    sh->free = sh->free - len;
-    sh->buf[oldlen + len] = '\0';
+    sdssetlen(s, oldlen + len);
+    s[oldlen + len] = '\0';
 
     return s;
 }
@@ -128,29 +231,20 @@ sds sdscpy(sds s, const char *t){
 }
 
 sds sdscpylen(sds s, const char *t, size_t len){
-   struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-
-   //获取原来的总长度
-   size_t totallen = (sh->free + sh->len);
-
-   //总长度都没有新内容大，则需要扩展
-   if(totallen < len){
-       s = sdsMakeRoom(s, (len-sh->len));
+   //容量都没有新内容大，则需要扩展
+   if(sdsalloc(s) < len){
+       s = sdsMakeRoom(s, len - sdslen(s));
        if(s == NULL){
            return NULL;
        }
-       //用新的sds获取新的sh，算出新的总长度
-       sh = (void*)(s - (sizeof(struct sdshdr)));
-       totallen = (sh->free + sh->len);
    }
 
    //复制内容，直接覆盖
    memcpy(s, t, len);
 
-   //sdsMakeRoom只是返回了buf，并没有重设len和free字段，最后还要单独设置
+   //sdsMakeRoom只是返回了buf，并没有重设len字段，最后还要单独设置
    s[len] = '\0';
-   sh->len = len;
-   sh->free = totallen - len;
+   sdssetlen(s, len);
    return s;
 }
 
@@ -165,52 +259,243 @@ int sdscmp(const sds s1, const sds s2){
     len1 = sdslen(s1);
     len2 = sdslen(s2);
     minlen = (len1 < len2) ? len1 : len2;
-    return memcmp(s1, s2, minlen);
+    int cmp = memcmp(s1, s2, minlen);
+    //前缀相同时，长的那个更大
+    if(cmp == 0){
+        return (len1 > len2) ? 1 : (len1 < len2 ? -1 : 0);
+    }
+    return cmp;
+}
+
+/**
+ * 分词用的扫描内核：返回p[0..len)中第一个属于set的字节的下标，没有找到返回len
+ * set最多SDS_SCAN_MAX_SET个字节
+ * x86_64上按CPU支持的指令集在启动时选择AVX2（每次32字节）或者SSE2（每次16字节），
+ * 其他平台和不足一个向量的尾部使用逐字节的实现
+ */
+#define SDS_SCAN_MAX_SET 8
+
+typedef size_t sdsScanFunc(const char *p, size_t len, const char *set, int setlen);
+typedef void sdsCaseFunc(char *p, size_t len, int upper);
+
+static size_t sdsScanScalar(const char *p, size_t len, const char *set, int setlen){
+    for(size_t i = 0; i < len; i++){
+        for(int j = 0; j < setlen; j++){
+            if(p[i] == set[j]){
+                return i;
+            }
+        }
+    }
+    return len;
+}
+
+/**
+ * 只转换ASCII的字母，和C locale下的tolower/toupper相同
+ */
+static void sdsCaseScalar(char *p, size_t len, int upper){
+    char lo = upper ? 'a' : 'A', hi = upper ? 'z' : 'Z';
+    for(size_t i = 0; i < len; i++){
+        if(p[i] >= lo && p[i] <= hi){
+            p[i] ^= 0x20;
+        }
+    }
+}
+
+#ifdef SDS_USE_X86_SIMD
+/**
+ * 从p开始读n字节是否不会跨过4K页的边界，不跨页的越界读不会触发缺页错误
+ * 越界读到的字节在比较结果中会被去掉
+ */
+#define SDS_SIMD_SAFE_OVERREAD(p, n) ((((uintptr_t)(p)) & 4095) <= 4096 - (n))
+//这种越界读是有意的，不让AddressSanitizer报错
+#define SDS_NO_SANITIZE __attribute__((no_sanitize_address))
+
+SDS_NO_SANITIZE
+static size_t sdsScanSse2(const char *p, size_t len, const char *set, int setlen){
+    __m128i needles[SDS_SCAN_MAX_SET];
+    size_t i = 0;
+
+    for(int j = 0; j < setlen; j++){
+        needles[j] = _mm_set1_epi8(set[j]);
+    }
+    for(; i + 16 <= len; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i eq = _mm_cmpeq_epi8(chunk, needles[0]);
+        for(int j = 1; j < setlen; j++){
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, needles[j]));
+        }
+        int mask = _mm_movemask_epi8(eq);
+        if(mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+    //参数一般都很短，尾部不足16字节时只要不跨页就直接读一个向量，把超出len的位去掉
+    if(i < len && SDS_SIMD_SAFE_OVERREAD(p + i, 16)){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i eq = _mm_cmpeq_epi8(chunk, needles[0]);
+        for(int j = 1; j < setlen; j++){
+            eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, needles[j]));
+        }
+        int mask = _mm_movemask_epi8(eq) & ((1 << (len - i)) - 1);
+        return mask ? i + __builtin_ctz(mask) : len;
+    }
+    return i + sdsScanScalar(p + i, len - i, set, setlen);
+}
+
+/**
+ * 字节是有符号比较，大于等于0x80的字节是负数，不会落在字母的范围里
+ */
+static void sdsCaseSse2(char *p, size_t len, int upper){
+    __m128i lo = _mm_set1_epi8(upper ? 'a'-1 : 'A'-1);
+    __m128i hi = _mm_set1_epi8(upper ? 'z'+1 : 'Z'+1);
+    __m128i flip = _mm_set1_epi8(0x20);
+    size_t i = 0;
+
+    for(; i + 16 <= len; i += 16){
+        __m128i chunk = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i in = _mm_and_si128(_mm_cmpgt_epi8(chunk, lo), _mm_cmpgt_epi8(hi, chunk));
+        _mm_storeu_si128((__m128i*)(p + i), _mm_xor_si128(chunk, _mm_and_si128(in, flip)));
+    }
+    sdsCaseScalar(p + i, len - i, upper);
+}
+
+__attribute__((target("avx2"))) SDS_NO_SANITIZE
+static size_t sdsScanAvx2(const char *p, size_t len, const char *set, int setlen){
+    __m256i needles[SDS_SCAN_MAX_SET];
+    size_t i = 0;
+
+    for(int j = 0; j < setlen; j++){
+        needles[j] = _mm256_set1_epi8(set[j]);
+    }
+    for(; i + 32 <= len; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i eq = _mm256_cmpeq_epi8(chunk, needles[0]);
+        for(int j = 1; j < setlen; j++){
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(chunk, needles[j]));
+        }
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq);
+        if(mask){
+            return i + __builtin_ctz(mask);
+        }
+    }
+    if(i < len && SDS_SIMD_SAFE_OVERREAD(p + i, 32)){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i eq = _mm256_cmpeq_epi8(chunk, needles[0]);
+        for(int j = 1; j < setlen; j++){
+            eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(chunk, needles[j]));
+        }
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(eq) & ((1u << (len - i)) - 1);
+        return mask ? i + __builtin_ctz(mask) : len;
+    }
+    return i + sdsScanScalar(p + i, len - i, set, setlen);
+}
+
+__attribute__((target("avx2")))
+static void sdsCaseAvx2(char *p, size_t len, int upper){
+    __m256i lo = _mm256_set1_epi8(upper ? 'a'-1 : 'A'-1);
+    __m256i hi = _mm256_set1_epi8(upper ? 'z'+1 : 'Z'+1);
+    __m256i flip = _mm256_set1_epi8(0x20);
+    size_t i = 0;
+
+    for(; i + 32 <= len; i += 32){
+        __m256i chunk = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i in = _mm256_and_si256(_mm256_cmpgt_epi8(chunk, lo), _mm256_cmpgt_epi8(hi, chunk));
+        _mm256_storeu_si256((__m256i*)(p + i), _mm256_xor_si256(chunk, _mm256_and_si256(in, flip)));
+    }
+    sdsCaseSse2(p + i, len - i, upper);
+}
+#endif
+
+static sdsScanFunc *sdsScan = sdsScanScalar;
+static sdsCaseFunc *sdsCase = sdsCaseScalar;
+static const char *sdsSimdImpl = "scalar";
+
+/**
+ * 选择扫描内核，force_scalar为1时使用逐字节的实现，用于对比测试
+ * 进程启动时会自动调用一次，选择CPU支持的最快实现
+ */
+void sdsSimdInit(int force_scalar){
+    sdsScan = sdsScanScalar;
+    sdsCase = sdsCaseScalar;
+    sdsSimdImpl = "scalar";
+#ifdef SDS_USE_X86_SIMD
+    if(force_scalar){
+        return;
+    }
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2")){
+        sdsScan = sdsScanAvx2;
+        sdsCase = sdsCaseAvx2;
+        sdsSimdImpl = "avx2";
+    }else{
+        //x86_64一定支持SSE2
+        sdsScan = sdsScanSse2;
+        sdsCase = sdsCaseSse2;
+        sdsSimdImpl = "sse2";
+    }
+#else
+    (void)force_scalar;
+#endif
+}
+
+const char *sdsSimdName(void){
+    return sdsSimdImpl;
+}
+
+/**
+ * 在main之前选择内核，之后各个线程只读这两个函数指针
+ */
+__attribute__((constructor))
+static void sdsSimdAutoInit(void){
+    sdsSimdInit(0);
 }
 
 /*
  * 去掉前后cset出现过的字符
+ * 先把cset做成256位的位图，每个字符只需要查一次表，不用每次strchr
  */
 sds sdstrim(sds s, const char *cset){
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    char *start, *end, *sp, *ep;    //前两个不变，后两个会变
-    
+    uint32_t map[8] = {0};
+    char *end, *sp, *ep;    //end不变，后两个会变
+
+    for(const unsigned char *c = (const unsigned char*)cset; *c; c++){
+        map[*c >> 5] |= 1u << (*c & 31);
+    }
+#define SDS_IN_CSET(ch) (map[(unsigned char)(ch) >> 5] & (1u << ((unsigned char)(ch) & 31)))
+
     sp = s;
-    start = s;
     ep = s + sdslen(s) - 1; //不要最后那个\0
     end = s + sdslen(s) - 1;
 
     //修剪完只有sp和ep的指向发生了变化
-    while(sp <= end && strchr(cset, *sp)){
+    while(sp <= end && SDS_IN_CSET(*sp)){
         sp++;
     }
-    while(ep > start && strchr(cset, *ep)){
+    while(ep > sp && SDS_IN_CSET(*ep)){
         ep--;
     }
+#undef SDS_IN_CSET
 
     size_t len = (sp > ep) ? 0 : ((ep - sp) + 1);
 
     //如果sp变了，则将剩余的字符串整体前移
-    if(sh->buf != sp){
-        memmove(sh->buf, sp, len);
+    if(s != sp){
+        memmove(s, sp, len);
     }
 
-    //更新属性
-    sh->len = len;
-    sh->free = sh->free + (sh->len - len);
-    sh->buf[len] = '\0';
+    s[len] = '\0';
+    sdssetlen(s, len);
 
-    return sh->buf;
+    return s;
 }
 
 /*
  * 截取字符串其中的一段
  * start和end都是索引从0开始，并且包含自身
- * 索引可以为负数
+ * 索引可以为负数，用ssize_t，querybuf这样超过2GB的字符串也能截取
  * 直接修改buf自身
  */
-void sdsrange(sds s, int start, int end){
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
+void sdsrange(sds s, ssize_t start, ssize_t end){
     size_t len = sdslen(s);
     if(len == 0){
         return;
@@ -218,14 +503,14 @@ void sdsrange(sds s, int start, int end){
 
     if(start < 0){
         //如果是负数就倒着计算
-        start = len + start;
+        start = (ssize_t)len + start;
         if(start < 0){
             start = 0;
         }
     }
 
     if(end < 0){
-        end = len + end;
+        end = (ssize_t)len + end;
         if(end < 0){
             end = 0;
         }
@@ -233,9 +518,9 @@ void sdsrange(sds s, int start, int end){
 
     size_t newlen = (start > end) ? 0 : (end - start + 1);
     if(newlen != 0){
-        if(start >= len){   //start超出原始长度，newlen自然为0
+        if(start >= (ssize_t)len){   //start超出原始长度，newlen自然为0
             newlen = 0;
-        }else if(end >= len){   //end超出原始长度，当做最后一个字符，再重新计算newlen
+        }else if(end >= (ssize_t)len){   //end超出原始长度，当做最后一个字符，再重新计算newlen
             end = len-1;
             newlen = (start > end) ? 0 : (end-start)+1;
         }
@@ -244,12 +529,11 @@ void sdsrange(sds s, int start, int end){
     }
 
     if(start && newlen){    //2个参数都不为0，开始移动字符串，用start和newlan来移动，不需要end了
-        memmove(sh->buf, sh->buf+start, newlen);
+        memmove(s, s+start, newlen);
     }
 
-    sh->buf[newlen] = '\0';    //源代码写的是0，这里暂时改写成\0
-    sh->free = sh->free + (sh->len - newlen);
-    sh->len = newlen;
+    s[newlen] = '\0';    //源代码写的是0，这里暂时改写成\0
+    sdssetlen(s, newlen);
     //不用再返回了
 }
 
@@ -257,24 +541,19 @@ void sdsrange(sds s, int start, int end){
  * 将buf里面的字符串全部变成小写
  */
 void sdstolower(sds s){
-    int len = sdslen(s);
-    for (int i=0; i < len; i++){
-        s[i] = tolower(s[i]);
-    }
+    sdsCase(s, sdslen(s), 0);
 }
 
 /*
  * 将buf里面的字符串全部变成大写
  */
 void sdstoupper(sds s){
-    int len = sdslen(s);
-    for (int i=0; i < len; i++){
-        s[i] = toupper(s[i]);
-    }
+    sdsCase(s, sdslen(s), 1);
 }
 
 /**
  * 就是split函数，分隔字符可以是1个，也支持多字符，注意返回的sds数组需要调用者自己清理
+ * 用memchr找分隔符的第一个字符，glibc的memchr本身就是向量化的，再用memcmp确认剩下的字符
  */ 
 sds *sdssplitlen(const char *s, int len, const char *sep, int seplen, int *count){
     int elements = 0; //token的下标
@@ -286,19 +565,31 @@ sds *sdssplitlen(const char *s, int len, const char *sep, int seplen, int *count
         return NULL;
     }
 
-    tokens = malloc(sizeof(sds) * slots);
+    tokens = zmalloc(sizeof(sds) * slots);
 
     if(len == 0){
         *count = 0;
         return tokens;
     }
 
-    //如果分隔字符为1个，就尝试判断每个字符，如果是2个，最后1个字符就不需要判断了，因为肯定不是，以此类推
-    for (int i = 0; i < (len - (seplen - 1)); i++){
+    //分隔符只可能出现在[0, last]的位置上
+    int last = len - seplen;
+    int i = 0;
+    while(i <= last){
+        const char *hit = memchr(s + i, sep[0], last - i + 1);
+        if(hit == NULL){
+            break;
+        }
+        i = hit - s;
+        if(seplen > 1 && memcmp(hit + 1, sep + 1, seplen - 1) != 0){
+            i++;
+            continue;
+        }
+
         //每次都要先尝试扩展空间
         if(slots < elements + 2){
             slots *= 2; //位置翻倍
-            sds *newTokens = realloc(tokens, sizeof(sds) * slots);
+            sds *newTokens = zrealloc(tokens, sizeof(sds) * slots);
             if(newTokens == NULL){
                 goto cleanup;
             }
@@ -306,46 +597,79 @@ sds *sdssplitlen(const char *s, int len, const char *sep, int seplen, int *count
             tokens = newTokens;
         }
 
-        //开始查找是否为分隔字符，也是2种情况，有可能是单字符或者多字符，要分别判断2次
-        if((seplen == 1 && *(s+i) == sep[0]) || memcmp(s+i, sep, seplen) == 0){
-            //如果找到，则从start开始截取，总截取i-start个字符
-            tokens[elements] = sdsnewlen(s+start, i-start);
-            if(tokens[elements] == NULL){
-                goto cleanup;
-            }
-            elements++; //token下标+1
-            start = i + seplen; //start位置放到找到的分隔字符后面的第一个字符
-            i = i + seplen - 1; //对于多字符分隔符，则直接跳过后面分隔符。
-        }
-        //扫描一轮后，还要把最后一段字符也算作新的分组
+        //从start开始截取，总截取i-start个字符
         tokens[elements] = sdsnewlen(s+start, i-start);
         if(tokens[elements] == NULL){
             goto cleanup;
         }
-        *count = (++elements);  //最终count为索引数+1
-        return tokens;
+        elements++; //token下标+1
+        start = i + seplen; //start位置放到找到的分隔字符后面的第一个字符
+        i = start;  //对于多字符分隔符，则直接跳过后面分隔符
     }
+    //扫描完成后，还要把最后一段字符也算作新的分组
+    tokens[elements] = sdsnewlen(s+start, len-start);
+    if(tokens[elements] == NULL){
+        goto cleanup;
+    }
+    *count = (++elements);  //最终count为索引数+1
+    return tokens;
 
     //如果操作失败，统一在这里释放字符串数组资源
     cleanup : {
-        for (int i = 0; i < elements; i++){
+        for (int j = 0; j < elements; j++){
             //逐一清理每个字符串
-            free(tokens[i]);
+            sdsfree(tokens[j]);
         }
         //最后清理数组本身
-        free(tokens);
+        zfree(tokens);
         *count = 0;
         return NULL;
     }
 }
 
+/**
+ * 判断字符是否为16进制数字
+ */
+static int is_hex_digit(char c){
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+           (c >= 'A' && c <= 'F');
+}
+
+/**
+ * 将16进制数字字符转成对应的整数值
+ */
+static int hex_digit_to_int(char c){
+    switch(c){
+        case '0': return 0;
+        case '1': return 1;
+        case '2': return 2;
+        case '3': return 3;
+        case '4': return 4;
+        case '5': return 5;
+        case '6': return 6;
+        case '7': return 7;
+        case '8': return 8;
+        case '9': return 9;
+        case 'a': case 'A': return 10;
+        case 'b': case 'B': return 11;
+        case 'c': case 'C': return 12;
+        case 'd': case 'D': return 13;
+        case 'e': case 'E': return 14;
+        case 'f': case 'F': return 15;
+        default: return 0;
+    }
+}
+
 /**
  * 将一行配置，解析成字符串数组
  * 可以处理值被单引号或者双引号包围的情况
  * argc为最终数组的长度
+ * 用扫描内核一次跳过一整段普通字符，只在空白、引号和转义字符处停下来，
+ * 没有引号和转义的参数只分配一次内存
  */ 
 sds *sdssplitargs(const char *line, int *argc) {
     const char *p = line;
+    const char *end = line + strlen(line);  //结束符等同于到达end
     char *current = NULL;
     char **vector = NULL;
 
@@ -354,21 +678,30 @@ sds *sdssplitargs(const char *line, int *argc) {
 
         /* skip blanks */
         // 跳过空白
-        // T = O(N)
-        while(*p && isspace(*p)) p++;
+        while(p < end && isspace(*p)) p++;
 
-        if (*p) {
+        if (p < end) {
             /* get a token */
             int inq=0;  /* set to 1 if we are in "quotes" */
             int insq=0; /* set to 1 if we are in 'single quotes' */
             int done=0;
 
-            if (current == NULL) current = sdsempty();
-
-            // T = O(N)
             while(!done) {
+                /* copy the run of ordinary characters at once */
+                const char *run = p;
+                size_t n;
+                if (inq) n = sdsScan(p, end-p, "\\\"", 2);
+                else if (insq) n = sdsScan(p, end-p, "\\'", 2);
+                else n = sdsScan(p, end-p, " \n\r\t\"'", 6);
+                p += n;
+                if (current == NULL) current = sdsnewlen(run, n);
+                else if (n) current = sdscatlen(current, run, n);
+
                 if (inq) {
-                    if (*p == '\\' && *(p+1) == 'x' &&
+                    if (p == end) {
+                        /* unterminated quotes */
+                        goto err;
+                    } else if (*p == '\\' && *(p+1) == 'x' &&
                                              is_hex_digit(*(p+2)) &&
                                              is_hex_digit(*(p+3)))
                     {
@@ -377,7 +710,7 @@ sds *sdssplitargs(const char *line, int *argc) {
                         byte = (hex_digit_to_int(*(p+2))*16)+
                                 hex_digit_to_int(*(p+3));
                         current = sdscatlen(current,(char*)&byte,1);
-                        p += 3;
+                        p += 4;
                     } else if (*p == '\\' && *(p+1)) {
                         char c;
 
@@ -391,56 +724,52 @@ sds *sdssplitargs(const char *line, int *argc) {
                         default: c = *p; break;
                         }
                         current = sdscatlen(current,&c,1);
+                        p++;
                     } else if (*p == '"') {
                         /* closing quote must be followed by a space or
                          * nothing at all. */
                         if (*(p+1) && !isspace(*(p+1))) goto err;
                         done=1;
-                    } else if (!*p) {
-                        /* unterminated quotes */
-                        goto err;
+                        p++;
                     } else {
+                        /* a lone backslash at the end of the line */
                         current = sdscatlen(current,p,1);
+                        p++;
                     }
                 } else if (insq) {
-                    if (*p == '\\' && *(p+1) == '\'') {
-                        p++;
+                    if (p == end) {
+                        /* unterminated quotes */
+                        goto err;
+                    } else if (*p == '\\' && *(p+1) == '\'') {
                         current = sdscatlen(current,"'",1);
+                        p += 2;
                     } else if (*p == '\'') {
                         /* closing quote must be followed by a space or
                          * nothing at all. */
                         if (*(p+1) && !isspace(*(p+1))) goto err;
                         done=1;
-                    } else if (!*p) {
-                        /* unterminated quotes */
-                        goto err;
+                        p++;
                     } else {
                         current = sdscatlen(current,p,1);
+                        p++;
                     }
                 } else {
-                    switch(*p) {
-                    case ' ':
-                    case '\n':
-                    case '\r':
-                    case '\t':
-                    case '\0':
+                    if (p == end) {
                         done=1;
-                        break;
-                    case '"':
+                    } else if (*p == '"') {
                         inq=1;
-                        break;
-                    case '\'':
+                        p++;
+                    } else if (*p == '\'') {
                         insq=1;
-                        break;
-                    default:
-                        current = sdscatlen(current,p,1);
-                        break;
+                        p++;
+                    } else {
+                        /* ' ', '\n', '\r' or '\t' */
+                        done=1;
+                        p++;
                     }
                 }
-                if (*p) p++;
             }
             /* add the token to the vector */
-            // T = O(N)
             vector = zrealloc(vector,((*argc)+1)*sizeof(char*));
             vector[*argc] = current;
             (*argc)++;
@@ -468,68 +797,247 @@ void sdsfreesplitres(sds *token, int count){
     while(count--){ //先倒着释放每一个元素
         sdsfree(token[count]);
     }
-    free(token);    //最后释放数组本身
+    zfree(token);    //最后释放数组本身
 }
 
 /*
  * 返回sds全部已分配的内存字节数
- * 1.指针本身的长度
- * 2.字符串本身长度（len）
- * 3.剩余的长度（free）
- * 4.结束符长度（1）
+ * 1.头部的长度
+ * 2.buf的容量（alloc）
+ * 3.结束符长度（1）
+ * alloc已经包括了分配器多给的空间，所以这就是分配器实际给出的大小，
+ * 不直接查询分配器，因为EMBSTR对象里的sds不是单独分配的
  */
 size_t sdsAllocSize(sds s){
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    return (sizeof(*sh)) + sh->len + sh->free + 1;
+    return sdsHdrSize(s[-1]) + sdsalloc(s) + 1;
 }
 
-char *sdsMakeRoom(sds s, size_t addlen){
-    
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    struct sdshdr *newsh;
-    size_t free = sdsavail(s);
-    size_t len = sdslen(s);
-    size_t newlen = (len + addlen); //合并后正好的长度
+/**
+ * 返回sds实际分配的内存块的起始地址，也就是头部的地址
+ */
+void *sdsAllocPtr(const sds s){
+    return (void*)(s - sdsHdrSize(s[-1]));
+}
+
+/**
+ * 保证s后面至少有addlen字节的剩余空间，len不变
+ * greedy为1时额外预分配，不超过新长度，也不超过sds_max_prealloc；为0时只要求正好够用
+ * 两种情况都会把分配器多给的空间算进剩余空间
+ * 扩容后长度需要更大的头部时，换成新类型的头部重新分配
+ */
+static sds _sdsMakeRoom(sds s, size_t addlen, int greedy){
+    void *sh, *newsh;
+    size_t avail = sdsavail(s);
+    size_t len, newlen, reqlen;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen;
 
     //如果剩余空间大于新的长度，则直接返回不扩展
-    if(free >= addlen){
+    if(avail >= addlen){
         return s;
     }
 
-    //最终长度如果小于1M，直接翻倍扩容，否则最多只增加1M空间
-    if(newlen < SDS_MAX_PREALLOC){
-        newlen = newlen * 2;
+    len = sdslen(s);
+    sh = (char*)s - sdsHdrSize(oldtype);
+    reqlen = newlen = (len + addlen); //合并后正好的长度
+    assert(newlen > len);   //溢出
+
+    //预分配：最终长度小于sds_max_prealloc时直接翻倍，否则最多只增加sds_max_prealloc
+    if(greedy){
+        newlen += newlen < sds_max_prealloc ? newlen : sds_max_prealloc;
+    }
+
+    //sdshdr5不能记录剩余空间，扩容时至少使用sdshdr8
+    type = sdsReqType(newlen);
+    if(type == SDS_TYPE_5){
+        type = SDS_TYPE_8;
+    }
+
+    hdrlen = sdsHdrSize(type);
+    assert(hdrlen + newlen + 1 > reqlen);   //溢出
+    size_t usable;
+    if(oldtype == type){
+        newsh = zrealloc_usable(sh, hdrlen + newlen + 1, &usable);
+        if(newsh == NULL){
+            return NULL;
+        }
+        s = (char*)newsh + hdrlen;
     }else{
-        newlen = newlen + SDS_MAX_PREALLOC;
+        //头部大小变了，buf的位置也要变，不能直接realloc
+        newsh = zmalloc_usable(hdrlen + newlen + 1, &usable);
+        if(newsh == NULL){
+            return NULL;
+        }
+        memcpy((char*)newsh + hdrlen, s, len + 1);
+        zfree(sh);
+        s = (char*)newsh + hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
     }
+    sdssetalloc(s, sdsUsableAlloc(usable, hdrlen, type));
+    return s;
+}
 
-    newsh = realloc(sh, sizeof(struct sdshdr) + newlen + 1);
-    if(newsh == NULL){
-        return NULL;
+sds sdsMakeRoom(sds s, size_t addlen){
+    return _sdsMakeRoom(s, addlen, 1);
+}
+
+/**
+ * 不做预分配的版本，用于已经知道最终长度的场景，例如读取一个大参数
+ */
+sds sdsMakeRoomNonGreedy(sds s, size_t addlen){
+    return _sdsMakeRoom(s, addlen, 0);
+}
+
+/**
+ * 去掉末尾的剩余空间，长度变短后可能换成更小的头部
+ */
+sds sdsRemoveFreeSpace(sds s){
+    void *sh, *newsh;
+    char type, oldtype = s[-1] & SDS_TYPE_MASK;
+    int hdrlen, oldhdrlen = sdsHdrSize(oldtype);
+    size_t len = sdslen(s);
+    size_t avail = sdsavail(s);
+
+    sh = (char*)s - oldhdrlen;
+    if(avail == 0){
+        return s;
     }
 
-    //更新空余长度
-    newsh->free = newlen - len;
-    return newsh->buf;
+    type = sdsReqType(len);
+    hdrlen = sdsHdrSize(type);
+
+    //类型不变，或者仍然需要较大的头部时，直接realloc；否则换成更小的头部重新分配
+    if(oldtype == type || type > SDS_TYPE_8){
+        newsh = zrealloc(sh, oldhdrlen + len + 1);
+        if(newsh == NULL){
+            return NULL;
+        }
+        s = (char*)newsh + oldhdrlen;
+    }else{
+        newsh = zmalloc(hdrlen + len + 1);
+        if(newsh == NULL){
+            return NULL;
+        }
+        memcpy((char*)newsh + hdrlen, s, len + 1);
+        zfree(sh);
+        s = (char*)newsh + hdrlen;
+        s[-1] = type;
+        sdssetlen(s, len);
+    }
+    //这里故意不把分配器多给的空间算进去，调用方要的就是没有剩余空间
+    sdssetalloc(s, len);
+    return s;
 }
 
-char *sdsRemoveFreeSpace(sds s){
-    struct sdshdr *sh = (void*)(s - (sizeof(struct sdshdr)));
-    sh = realloc(sh, sizeof(struct sdshdr) + sh->len + 1);
-    sh->free = 0;
+/**
+ * 在调用者直接往sds末尾写入数据之后（例如read到sdsMakeRoom扩展出来的空间里），
+ * 用这个函数修正len，incr可以为负数，表示从右边截掉
+ */
+void sdsIncrLen(sds s, ssize_t incr){
+    unsigned char flags = s[-1];
+    size_t len;
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5: {
+            unsigned char *fp = ((unsigned char*)s) - 1;
+            unsigned char oldlen = SDS_TYPE_5_LEN(flags);
+            assert((incr > 0 && oldlen + incr < 32) || (incr < 0 && oldlen >= (unsigned int)(-incr)));
+            *fp = SDS_TYPE_5 | ((oldlen + incr) << SDS_TYPE_BITS);
+            len = oldlen + incr;
+            break;
+        }
+        case SDS_TYPE_8: {
+            SDS_HDR_VAR(8,s);
+            assert((incr >= 0 && sh->alloc - sh->len >= incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_16: {
+            SDS_HDR_VAR(16,s);
+            assert((incr >= 0 && sh->alloc - sh->len >= incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_32: {
+            SDS_HDR_VAR(32,s);
+            assert((incr >= 0 && sh->alloc - sh->len >= (unsigned int)incr) || (incr < 0 && sh->len >= (unsigned int)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        case SDS_TYPE_64: {
+            SDS_HDR_VAR(64,s);
+            assert((incr >= 0 && sh->alloc - sh->len >= (uint64_t)incr) || (incr < 0 && sh->len >= (uint64_t)(-incr)));
+            len = (sh->len += incr);
+            break;
+        }
+        default: len = 0; //不会到这里
+    }
+    s[len] = '\0';
 }
 
-#define SDS_LLSTR_SIZE 21
 /**
- *  根据一个long long的值，转换成字符串，再封装成sdshdr对象 
- *  没有使用原版复杂的转换方法
+ *  根据一个long long的值，转换成字符串，再封装成sds对象
  */
 sds sdsfromlonglong(long long value){
-    char buf[SDS_LLSTR_SIZE];
-    int len = sprintf(buf, "%lld", value);
+    char buf[LONG_STR_SIZE];
+    int len = ll2string(buf, sizeof(buf), value);
     return sdsnewlen(buf, len);
 }
 
+/**
+ * 按printf的格式把内容追加到s后面
+ * 先用栈上的缓冲区尝试，放不下时按两倍大小重新分配，直到能放下为止
+ */
+sds sdscatvprintf(sds s, const char *fmt, va_list ap){
+    va_list cpy;
+    char staticbuf[1024], *buf = staticbuf, *t;
+    size_t buflen = strlen(fmt)*2;
+
+    if(buflen > sizeof(staticbuf)){
+        buf = zmalloc(buflen);
+        if(buf == NULL){
+            return NULL;
+        }
+    }else{
+        buflen = sizeof(staticbuf);
+    }
+
+    while(1){
+        //用倒数第二个字节判断是否被截断
+        buf[buflen-2] = '\0';
+        va_copy(cpy, ap);
+        vsnprintf(buf, buflen, fmt, cpy);
+        va_end(cpy);
+        if(buf[buflen-2] != '\0'){
+            if(buf != staticbuf){
+                zfree(buf);
+            }
+            buflen *= 2;
+            buf = zmalloc(buflen);
+            if(buf == NULL){
+                return NULL;
+            }
+            continue;
+        }
+        break;
+    }
+
+    t = sdscat(s, buf);
+    if(buf != staticbuf){
+        zfree(buf);
+    }
+    return t;
+}
+
+sds sdscatprintf(sds s, const char *fmt, ...){
+    va_list ap;
+    char *t;
+    va_start(ap, fmt);
+    t = sdscatvprintf(s, fmt, ap);
+    va_end(ap);
+    return t;
+}
+
 /**
  * 将p字符串前后加入双引号，然后追加到s后面
  * 暂时不处理原版的各种特殊字符
@@ -542,6 +1050,7 @@ sds sdscatrepr(sds s, const char *p, size_t len){
     return s;
 }
 
+#ifdef SDS_TEST_MAIN
 int main(){
     //long long v = 123;
     //sds s = sdsfromlonglong(v);
@@ -550,4 +1059,5 @@ int main(){
     printf("%d", result);
     getchar();
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,30 +1,139 @@
 #ifndef __SDS_H__
 #define __SDS_H__
 
-#define SDS_MAX_PREALLOC (1024*1024)    //最大预分配长度为1M
+#define SDS_MAX_PREALLOC (1024*1024)    //默认的最大预分配长度为1M
 
 #include <sys/types.h>
+#include <stdarg.h>
+#include <stdint.h>
 
 /**
  * 给自定义字符串对象起个类型别名
  */ 
 typedef char *sds;
 
-struct sdshdr{
-    //记录buf数组中已经使用的字节数量
-    int len;
-    //记录buf数组中未使用字节的数量
-    int free;
-    //用于保存字符串
+/**
+ * sds的头部按字符串长度选择不同的类型，len和alloc字段使用能放下长度的最小整数
+ * 头部的最后一个字节都是flags，低3位是类型，所以总能通过s[-1]找到头部的类型
+ * alloc是buf的容量，不包括头部和结尾的\0，剩余空间是alloc - len
+ * 结构体要按1字节对齐，否则buf前面会有空隙，s[-1]就不是flags了
+ */
+
+//sdshdr5没有len和alloc字段，长度保存在flags的高5位，只用于创建后不再修改的短字符串
+struct __attribute__ ((__packed__)) sdshdr5{
+    unsigned char flags;    //低3位是类型，高5位是长度
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr8{
+    uint8_t len;            //已经使用的字节数量
+    uint8_t alloc;          //buf的容量，不包括头部和结束符
+    unsigned char flags;    //低3位是类型，高5位没有使用
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr16{
+    uint16_t len;
+    uint16_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr32{
+    uint32_t len;
+    uint32_t alloc;
+    unsigned char flags;
+    char buf[];
+};
+struct __attribute__ ((__packed__)) sdshdr64{
+    uint64_t len;
+    uint64_t alloc;
+    unsigned char flags;
     char buf[];
 };
 
+#define SDS_TYPE_5  0
+#define SDS_TYPE_8  1
+#define SDS_TYPE_16 2
+#define SDS_TYPE_32 3
+#define SDS_TYPE_64 4
+#define SDS_TYPE_MASK 7
+#define SDS_TYPE_BITS 3
+#define SDS_HDR_VAR(T,s) struct sdshdr##T *sh = (void*)((s)-(sizeof(struct sdshdr##T)));
+#define SDS_HDR(T,s) ((struct sdshdr##T *)((s)-(sizeof(struct sdshdr##T))))
+#define SDS_TYPE_5_LEN(f) ((f)>>SDS_TYPE_BITS)
+
+/**
+ * 下面这些函数在dict比较、回复和命令解析中频繁调用，放在头文件中内联
+ */
+static inline size_t sdslen(const sds s){
+    unsigned char flags = s[-1];
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5: return SDS_TYPE_5_LEN(flags);
+        case SDS_TYPE_8: return SDS_HDR(8,s)->len;
+        case SDS_TYPE_16: return SDS_HDR(16,s)->len;
+        case SDS_TYPE_32: return SDS_HDR(32,s)->len;
+        case SDS_TYPE_64: return SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
+
+static inline size_t sdsavail(const sds s){
+    unsigned char flags = s[-1];
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5: return 0;
+        case SDS_TYPE_8: return SDS_HDR(8,s)->alloc - SDS_HDR(8,s)->len;
+        case SDS_TYPE_16: return SDS_HDR(16,s)->alloc - SDS_HDR(16,s)->len;
+        case SDS_TYPE_32: return SDS_HDR(32,s)->alloc - SDS_HDR(32,s)->len;
+        case SDS_TYPE_64: return SDS_HDR(64,s)->alloc - SDS_HDR(64,s)->len;
+    }
+    return 0;
+}
+
+static inline void sdssetlen(sds s, size_t newlen){
+    unsigned char flags = s[-1];
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5:
+            s[-1] = SDS_TYPE_5 | (newlen << SDS_TYPE_BITS);
+            break;
+        case SDS_TYPE_8: SDS_HDR(8,s)->len = newlen; break;
+        case SDS_TYPE_16: SDS_HDR(16,s)->len = newlen; break;
+        case SDS_TYPE_32: SDS_HDR(32,s)->len = newlen; break;
+        case SDS_TYPE_64: SDS_HDR(64,s)->len = newlen; break;
+    }
+}
+
+static inline void sdsinclen(sds s, size_t inc){
+    sdssetlen(s, sdslen(s) + inc);
+}
+
+/**
+ * buf的容量，等于sdsavail() + sdslen()
+ */
+static inline size_t sdsalloc(const sds s){
+    unsigned char flags = s[-1];
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5: return SDS_TYPE_5_LEN(flags);
+        case SDS_TYPE_8: return SDS_HDR(8,s)->alloc;
+        case SDS_TYPE_16: return SDS_HDR(16,s)->alloc;
+        case SDS_TYPE_32: return SDS_HDR(32,s)->alloc;
+        case SDS_TYPE_64: return SDS_HDR(64,s)->alloc;
+    }
+    return 0;
+}
+
+static inline void sdssetalloc(sds s, size_t newlen){
+    unsigned char flags = s[-1];
+    switch(flags & SDS_TYPE_MASK){
+        case SDS_TYPE_5: break; //sdshdr5没有alloc字段
+        case SDS_TYPE_8: SDS_HDR(8,s)->alloc = newlen; break;
+        case SDS_TYPE_16: SDS_HDR(16,s)->alloc = newlen; break;
+        case SDS_TYPE_32: SDS_HDR(32,s)->alloc = newlen; break;
+        case SDS_TYPE_64: SDS_HDR(64,s)->alloc = newlen; break;
+    }
+}
+
 sds sdsnew(const char *init);
 sds sdsnewlen(const void *init, size_t initlen);
 void sdsfree(sds s);
 sds sdsempty(void);
-size_t sdslen(const sds s);
-size_t sdsavail(const sds s);
 sds sdsdup(const sds s);
 void sdsclear(sds s);
 sds sdscat(sds s, const char *t);
@@ -34,20 +143,35 @@ sds sdscpy(sds s, const char *t);
 sds sdscpylen(sds s, const char *t, size_t len);
 int sdscmp(const sds s1, const sds s2);
 sds sdstrim(sds s, const char *cset);
-void sdsrange(sds s, int start, int end);
+void sdsrange(sds s, ssize_t start, ssize_t end);
 void sdstolower(sds s);
 void sdstoupper(sds s);
 sds *sdssplitlen(const char *s, int len, const char *sep, int seplen, int *count);
 sds *sdssplitargs(const char *line, int *argc);
 void sdsfreesplitres(sds *token, int count);
 size_t sdsAllocSize(sds s);
+void sdsSimdInit(int force_scalar);
+const char *sdsSimdName(void);
 
 sds sdscatrepr(sds s, const char *p, size_t len);
+sds sdscatvprintf(sds s, const char *fmt, va_list ap);
+#ifdef __GNUC__
+sds sdscatprintf(sds s, const char *fmt, ...)
+    __attribute__((format(printf, 2, 3)));
+#else
+sds sdscatprintf(sds s, const char *fmt, ...);
+#endif
 
 sds sdsfromlonglong(long long value);
 
 //**************底层API***************************//
 sds sdsMakeRoom(sds s, size_t addlen);
+sds sdsMakeRoomNonGreedy(sds s, size_t addlen);
+void sdsSetMaxPrealloc(size_t size);
+void sdsIncrLen(sds s, ssize_t incr);
 sds sdsRemoveFreeSpace(sds s);
+void *sdsAllocPtr(const sds s);
+int sdsHdrSize(char type);
+char sdsReqType(size_t string_size);
 
 #endif // !__SDS_H___
\ No newline at end of file
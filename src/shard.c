@@ -0,0 +1,355 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include "redis.h"
+
+/**
+ * 多分片模式（shared-nothing）
+ * 每个分片是一个绑定到CPU上的线程，拥有自己的事件处理器、SO_REUSEPORT监听套接字、客户端和数据库，
+ * 每个键按哈希值属于唯一的分片，分片之间不共享任何可写的状态，所以键空间不需要加锁
+ * 客户端访问其他分片的键时，把整个客户端通过单生产者单消费者的无锁队列交给键所在的分片执行命令，
+ * 执行完后再通过反方向的队列还回来，在这期间原来的分片不会读写这个客户端
+ * FLUSHALL、DBSIZE这类作用于整个键空间的命令（带A标志）从客户端所在的分片开始，沿着分片编号转一圈，
+ * 每个分片执行自己的部分并把结果累加到broadcast_acc，最后一个分片回复，然后还给客户端所在的分片
+ */
+
+//当前线程所在的分片，IO线程使用0号分片
+__thread redisShard *shard = NULL;
+
+/**
+ * 单生产者单消费者的环形队列，只保存客户端指针
+ * head只由消费者修改，tail只由生产者修改，放在不同的缓存行里避免伪共享
+ */
+struct shardQueue{
+    unsigned long head __attribute__((aligned(64)));
+    unsigned long tail __attribute__((aligned(64)));
+    redisClient *items[REDIS_SHARD_QUEUE_SIZE] __attribute__((aligned(64)));
+};
+
+static shardQueue *shardQueueCreate(void){
+    shardQueue *q = zmalloc(sizeof(*q));
+    q->head = 0;
+    q->tail = 0;
+    return q;
+}
+
+/**
+ * 放入一个元素，队列已满返回0
+ */
+static int shardQueuePush(shardQueue *q, redisClient *c){
+    unsigned long tail = q->tail;
+    if(tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == REDIS_SHARD_QUEUE_SIZE){
+        return 0;
+    }
+    q->items[tail & (REDIS_SHARD_QUEUE_SIZE-1)] = c;
+    //release保证消费者看到新的tail时，元素和客户端的所有修改都已经可见
+    __atomic_store_n(&q->tail, tail+1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/**
+ * 取出一个元素，队列为空返回NULL
+ */
+static redisClient *shardQueuePop(shardQueue *q){
+    unsigned long head = q->head;
+    if(head == __atomic_load_n(&q->tail, __ATOMIC_ACQUIRE)){
+        return NULL;
+    }
+    redisClient *c = q->items[head & (REDIS_SHARD_QUEUE_SIZE-1)];
+    __atomic_store_n(&q->head, head+1, __ATOMIC_RELEASE);
+    return c;
+}
+
+static inline shardQueue *getShardQueue(int from, int to){
+    return server.shard_queues[from * server.shards_num + to];
+}
+
+/**
+ * 把客户端发给target分片，队列满了先放进backlog，在beforeSleep中重试
+ */
+static void shardSend(int target, redisClient *c){
+    if(listLength(shard->backlog[target]) == 0 && shardQueuePush(getShardQueue(shard->id, target), c)){
+        shard->notify_pending[target] = 1;
+    }else{
+        listAddNodeTail(shard->backlog[target], c);
+    }
+}
+
+/**
+ * 在键所在的分片中执行转发过来的命令，回复直接写进客户端的回复缓冲区，然后把客户端还回去
+ * 带A标志的命令还没有经过所有分片时，交给下一个分片继续执行
+ */
+static void executeForwardedCommand(redisClient *c){
+    redisDb *origdb = c->db;
+    c->db = &shard->db[c->dictid];
+    if(c->cmd->flags & REDIS_CMD_ALL_SHARDS){
+        c->broadcast_hops--;
+    }
+    //和processCommand一样，在键所在的分片淘汰
+    if(server.maxmemory && (c->cmd->flags & REDIS_CMD_DENYOOM) && freeMemoryIfNeeded() == REDIS_ERR){
+        addReply(c, shared.oomerr);
+    }else{
+        call(c);
+    }
+    c->db = origdb;
+    if(c->broadcast_hops > 0){
+        shardSend((shard->id + 1) % server.shards_num, c);
+    }else{
+        shardSend(c->shard->id, c);
+    }
+}
+
+/**
+ * 转发的命令执行完毕回到了客户端所在的分片，继续处理querybuf中剩余的命令
+ */
+static void finishForwardedCommand(redisClient *c){
+    c->flags &= ~REDIS_FORWARDED;
+    resetClient(c);
+    //等待期间连接出错或者超时的客户端，交给异步关闭队列去释放
+    if(c->flags & REDIS_CLOSE_ASAP){
+        return;
+    }
+    if(clientHasPendingReplies(c)){
+        putClientInPendingWriteQueue(c);
+    }
+    processInputBuffer(c);
+}
+
+/**
+ * notifyfd的读事件处理器，处理其他分片发来的所有消息
+ * 客户端属于本分片说明是执行完毕还回来的，否则是需要在本分片执行的命令
+ */
+static void shardNotifyHandler(aeEventLoop *el, int fd, void *privdata, int mask){
+    uint64_t count;
+    AE_NOTUSED(el);
+    AE_NOTUSED(privdata);
+    AE_NOTUSED(mask);
+
+    //先清空计数再读队列，之后到达的消息一定会再唤醒一次
+    if(read(fd, &count, sizeof(count)) == -1){
+        //EAGAIN，不需要处理
+    }
+    for(int j = 0; j < server.shards_num; j++){
+        if(j == shard->id){
+            continue;
+        }
+        shardQueue *q = getShardQueue(j, shard->id);
+        redisClient *c;
+        while((c = shardQueuePop(q)) != NULL){
+            if(c->shard == shard){
+                finishForwardedCommand(c);
+            }else{
+                executeForwardedCommand(c);
+            }
+        }
+    }
+}
+
+/**
+ * 计算键属于哪个分片
+ * 只用来把键分到几个分片上，不存在hash flooding的问题，用快速hash
+ */
+int getKeyShard(const char *key, size_t len){
+    return dictGenFastHashFunction((const unsigned char*)key, len) % server.shards_num;
+}
+
+/**
+ * 计算命令中的键属于哪个分片
+ * 没有键的命令在当前分片执行，多个键不属于同一个分片时返回-1
+ */
+int getCommandShard(redisClient *c){
+    struct redisCommand *cmd = c->cmd;
+    int target = shard->id;
+    int first = 1;
+
+    if(cmd->firstkey == 0){
+        return target;
+    }
+    int last = cmd->lastkey;
+    if(last < 0){
+        last = c->argc + last;
+    }
+    for(int j = cmd->firstkey; j <= last && j < c->argc; j += cmd->keystep){
+        sds key = c->argv[j]->ptr;
+        int owner = getKeyShard(key, sdslen(key));
+        if(first){
+            target = owner;
+            first = 0;
+        }else if(owner != target){
+            return -1;
+        }
+    }
+    return target;
+}
+
+/**
+ * 把当前命令交给target分片执行，客户端在命令回来之前不再处理任何读写
+ */
+void forwardCommandToShard(redisClient *c, int target){
+    c->flags |= REDIS_FORWARDED;
+    shardSend(target, c);
+}
+
+/**
+ * 在beforeSleep中调用，重试backlog中的消息，并唤醒这一轮收到消息的分片
+ * 同一个分片在一轮中只写一次eventfd
+ */
+void flushShardMessages(void){
+    if(server.shards_num == 1){
+        return;
+    }
+    for(int j = 0; j < server.shards_num; j++){
+        list *backlog = shard->backlog[j];
+        while(listLength(backlog)){
+            listNode *ln = listFirst(backlog);
+            if(!shardQueuePush(getShardQueue(shard->id, j), listNodeValue(ln))){
+                break;
+            }
+            listDeleteNode(backlog, ln);
+            shard->notify_pending[j] = 1;
+        }
+        if(shard->notify_pending[j]){
+            uint64_t one = 1;
+            shard->notify_pending[j] = 0;
+            if(write(server.shards[j]->notifyfd, &one, sizeof(one)) == -1){
+                //计数器溢出时write会返回EAGAIN，对方一定还没处理，不需要再唤醒
+            }
+        }
+    }
+}
+
+/**
+ * 创建分片的事件处理器、数据库、监听套接字，并注册serverCron
+ */
+static redisShard *createShard(int id){
+    redisShard *s = zmalloc(sizeof(*s));
+    s->id = id;
+    s->thread = pthread_self();
+    s->clients = listCreate();
+    s->clients_to_close = listCreate();
+    s->clients_pending_write = listCreate();
+    s->backlog = zmalloc(sizeof(list*) * server.shards_num);
+    s->cmdstats = zcalloc(server.numcommands * sizeof(redisCommandStats));
+    s->notify_pending = zcalloc(server.shards_num * sizeof(int));
+    s->eviction_pool = evictionPoolAlloc();
+    s->keys_num = s->volatile_keys_num = 0;
+    for(int j = 0; j < server.shards_num; j++){
+        s->backlog[j] = listCreate();
+    }
+
+    s->el = aeCreateEventLoop(server.maxclients + REDIS_EVENTLOOP_FDSET_INCR);
+    if(s->el == NULL){
+        redisLog("Failed creating the event loop. Error message: '%s'", strerror(errno));
+        exit(1);
+    }
+    if(server.event_backend == AE_API_IO_URING && aeUseIoUring(s->el) == AE_ERR && id == 0){
+        redisLog("io_uring is not supported by this kernel or build, falling back to epoll");
+    }
+    aeSetBeforeSleepProc(s->el, beforeSleep);
+
+    //创建数据库，键空间的两个字典都用开放寻址引擎，查找只需要比较控制字节和少量的key
+    s->db = zmalloc(sizeof(redisDb) * server.dbnum);
+    for(int j = 0; j < server.dbnum; j++){
+        s->db[j].dict = dictCreateWithEngine(&dbDictType, NULL, DICT_ENGINE_SWISS);
+        s->db[j].expires = dictCreateWithEngine(&keyptrDictType, NULL, DICT_ENGINE_SWISS);
+        s->db[j].id = j;
+    }
+
+    //打开TCP监听端口，多个分片时每个分片都有自己的套接字，由内核分配新连接
+    if(server.shards_num > 1){
+        s->ipfd = anetTcpServerReusePort(s->neterr, server.port, server.bindaddr, server.tcp_backlog);
+    }else{
+        s->ipfd = anetTcpServer(s->neterr, server.port, server.bindaddr, server.tcp_backlog);
+    }
+    if(s->ipfd == ANET_ERR){
+        redisLog("Creating Server TCP listening socket %s:%d: %s",
+            server.bindaddr ? server.bindaddr : "*", server.port, s->neterr);
+        exit(1);
+    }
+    anetNonBlock(NULL, s->ipfd);
+
+    //注册serverCron时间事件，1毫秒之后首次执行
+    if(aeCreateTimeEvent(s->el, 1, serverCron, NULL, NULL) == AE_ERR){
+        redisPanic("Can't create the serverCron time event.");
+    }
+    //注册监听套接字的accept事件，使用io_uring时由内核的multishot accept接受连接
+    if(aeCreateFileEvent(s->el, s->ipfd, AE_READABLE|AE_COMPLETION, acceptTcpHandler, NULL) == AE_ERR){
+        redisPanic("Unrecoverable error creating server.ipfd file event.");
+    }
+
+    s->notifyfd = -1;
+    if(server.shards_num > 1){
+        s->notifyfd = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC);
+        if(s->notifyfd == -1 ||
+            aeCreateFileEvent(s->el, s->notifyfd, AE_READABLE, shardNotifyHandler, NULL) == AE_ERR){
+            redisPanic("Can't create the shard notify event.");
+        }
+    }
+    return s;
+}
+
+/**
+ * 创建所有分片和它们之间的队列，0号分片属于主线程
+ * 必须在启动分片线程之前全部创建好，之后分片数组和队列就不再修改了
+ */
+void initShards(void){
+    int n = server.shards_num;
+    server.shards = zmalloc(sizeof(redisShard*) * n);
+    server.shard_queues = zcalloc(n * n * sizeof(shardQueue*));
+    for(int i = 0; i < n; i++){
+        for(int j = 0; j < n; j++){
+            if(i != j){
+                server.shard_queues[i*n+j] = shardQueueCreate();
+            }
+        }
+    }
+    for(int j = 0; j < n; j++){
+        server.shards[j] = createShard(j);
+    }
+    shard = server.shards[0];
+}
+
+/**
+ * 把当前线程绑定到分片编号对应的CPU上，CPU数量不够时循环使用
+ */
+static void bindShardToCPU(int id){
+#ifdef __linux__
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    if(ncpu <= 0){
+        return;
+    }
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(id % ncpu, &cpuset);
+    if(pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset) != 0){
+        redisLog("Warning: can't bind shard %d to CPU %ld", id, id % ncpu);
+    }
+#else
+    AE_NOTUSED(id);
+#endif
+}
+
+static void *shardMain(void *arg){
+    shard = arg;
+    bindShardToCPU(shard->id);
+    aeMain(shard->el);
+    return NULL;
+}
+
+/**
+ * 启动1号及以后的分片线程，0号分片在主线程中运行
+ */
+void startShards(void){
+    if(server.shards_num == 1){
+        return;
+    }
+    bindShardToCPU(0);
+    for(int j = 1; j < server.shards_num; j++){
+        redisShard *s = server.shards[j];
+        if(pthread_create(&s->thread, NULL, shardMain, s) != 0){
+            redisLog("Fatal: Can't initialize shard thread.");
+            exit(1);
+        }
+    }
+}
@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+/**
+ * SipHash-1-2，带128位密钥的64位hash，用于键来自客户端的字典
+ * 密钥在启动时随机生成，客户端无法构造出大量hash相同的键（hash flooding）
+ * 每8字节只做1轮压缩、结束时2轮，比标准的SipHash-2-4快很多，对hash表来说强度足够
+ *
+ * 算法参考 https://github.com/veorq/SipHash
+ */
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/**
+ * 小端机器上直接读8个字节，memcpy会被编译成一条不要求对齐的load
+ */
+static inline uint64_t U8TO64_LE(const uint8_t *p){
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+#else
+static inline uint64_t U8TO64_LE(const uint8_t *p){
+    return (uint64_t)p[0] | ((uint64_t)p[1] << 8) | ((uint64_t)p[2] << 16) | ((uint64_t)p[3] << 24) |
+        ((uint64_t)p[4] << 32) | ((uint64_t)p[5] << 40) | ((uint64_t)p[6] << 48) | ((uint64_t)p[7] << 56);
+}
+#endif
+
+//ASCII转小写，不依赖locale
+static inline uint8_t siptlw(uint8_t c){
+    return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static inline uint64_t U8TO64_LE_NOCASE(const uint8_t *p){
+    return (uint64_t)siptlw(p[0]) | ((uint64_t)siptlw(p[1]) << 8) |
+        ((uint64_t)siptlw(p[2]) << 16) | ((uint64_t)siptlw(p[3]) << 24) |
+        ((uint64_t)siptlw(p[4]) << 32) | ((uint64_t)siptlw(p[5]) << 40) |
+        ((uint64_t)siptlw(p[6]) << 48) | ((uint64_t)siptlw(p[7]) << 56);
+}
+
+#define ROTL(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPROUND do{ \
+    v0 += v1; v1 = ROTL(v1, 13); v1 ^= v0; v0 = ROTL(v0, 32); \
+    v2 += v3; v3 = ROTL(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = ROTL(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = ROTL(v1, 17); v1 ^= v2; v2 = ROTL(v2, 32); \
+} while(0)
+
+/**
+ * 两个版本只有读取8字节块的方式不同，nocase为1时先把每个字节转成小写
+ */
+static inline uint64_t siphashGeneric(const uint8_t *in, const size_t inlen, const uint8_t *k, int nocase){
+    uint64_t v0 = 0x736f6d6570736575ULL;
+    uint64_t v1 = 0x646f72616e646f6dULL;
+    uint64_t v2 = 0x6c7967656e657261ULL;
+    uint64_t v3 = 0x7465646279746573ULL;
+    uint64_t k0 = U8TO64_LE(k);
+    uint64_t k1 = U8TO64_LE(k + 8);
+    uint64_t m;
+    const uint8_t *end = in + inlen - (inlen % 8);
+    const int left = inlen & 7;
+    //最后一个块的最高字节是长度
+    uint64_t b = ((uint64_t)inlen) << 56;
+
+    v3 ^= k1;
+    v2 ^= k0;
+    v1 ^= k1;
+    v0 ^= k0;
+
+    for(; in != end; in += 8){
+        m = nocase ? U8TO64_LE_NOCASE(in) : U8TO64_LE(in);
+        v3 ^= m;
+        SIPROUND;
+        v0 ^= m;
+    }
+
+    //剩下不足8字节的部分
+    switch(left){
+    case 7: b |= ((uint64_t)(nocase ? siptlw(in[6]) : in[6])) << 48; /* fall through */
+    case 6: b |= ((uint64_t)(nocase ? siptlw(in[5]) : in[5])) << 40; /* fall through */
+    case 5: b |= ((uint64_t)(nocase ? siptlw(in[4]) : in[4])) << 32; /* fall through */
+    case 4: b |= ((uint64_t)(nocase ? siptlw(in[3]) : in[3])) << 24; /* fall through */
+    case 3: b |= ((uint64_t)(nocase ? siptlw(in[2]) : in[2])) << 16; /* fall through */
+    case 2: b |= ((uint64_t)(nocase ? siptlw(in[1]) : in[1])) << 8;  /* fall through */
+    case 1: b |= ((uint64_t)(nocase ? siptlw(in[0]) : in[0])); break;
+    case 0: break;
+    }
+
+    v3 ^= b;
+    SIPROUND;
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIPROUND;
+    SIPROUND;
+
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/**
+ * 对in的inlen个字节计算hash，k是16字节的密钥
+ */
+uint64_t siphash(const uint8_t *in, const size_t inlen, const uint8_t *k){
+    return siphashGeneric(in, inlen, k, 0);
+}
+
+/**
+ * 不区分大小写的版本，大小写不同的两个字符串得到相同的hash
+ */
+uint64_t siphash_nocase(const uint8_t *in, const size_t inlen, const uint8_t *k){
+    return siphashGeneric(in, inlen, k, 1);
+}
@@ -0,0 +1,299 @@
+#include <string.h>
+#include "slab.h"
+#include "zmalloc.h"
+
+//所有池中slab的大小总和，只在分配和释放整个slab时修改，这时容器可能在任意线程，用原子操作
+static size_t slab_used_memory = 0;
+
+static inline size_t _slabBytes(slabPool *pool, slab *s){
+    return sizeof(slab) + (size_t)pool->objsize * s->cap;
+}
+
+static void _slabPartialAdd(slabPool *pool, slab *s){
+    s->prev = NULL;
+    s->next = pool->partial;
+    if(pool->partial){
+        pool->partial->prev = s;
+    }
+    pool->partial = s;
+}
+
+static void _slabPartialRemove(slabPool *pool, slab *s){
+    if(s->prev){
+        s->prev->next = s->next;
+    }else{
+        pool->partial = s->next;
+    }
+    if(s->next){
+        s->next->prev = s->prev;
+    }
+}
+
+/**
+ * 返回slabs数组中第一个地址大于p的slab的下标
+ */
+static unsigned int _slabUpperBound(slabPool *pool, const void *p){
+    unsigned int lo = 0, hi = pool->numslabs;
+    while(lo < hi){
+        unsigned int mid = (lo + hi) / 2;
+        if((const void*)pool->slabs[mid] <= p){
+            lo = mid + 1;
+        }else{
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+ * 分配一个新的slab，按地址插入slabs数组并放进partial链表
+ * 对象数量按当前使用中的对象数量翻倍增长
+ */
+static slab *_slabCreate(slabPool *pool){
+    size_t cap = SLAB_MIN_OBJECTS, usable;
+    while(cap < pool->inuse && cap < SLAB_MAX_OBJECTS){
+        cap *= 2;
+    }
+    slab *s = zmalloc_usable(sizeof(slab) + (size_t)pool->objsize * cap, &usable);
+    //分配器按大小等级取整多出来的空间也用来放对象
+    s->cap = (usable - sizeof(slab)) / pool->objsize;
+    s->inuse = s->used = 0;
+    s->freelist = NULL;
+
+    if(pool->numslabs == pool->maxslabs){
+        pool->maxslabs = pool->maxslabs ? pool->maxslabs * 2 : 4;
+        pool->slabs = zrealloc(pool->slabs, sizeof(slab*) * pool->maxslabs);
+    }
+    //新的slab通常在堆的高处，插入的位置基本都在数组末尾
+    unsigned int idx = _slabUpperBound(pool, s);
+    memmove(pool->slabs + idx + 1, pool->slabs + idx, sizeof(slab*) * (pool->numslabs - idx));
+    pool->slabs[idx] = s;
+    pool->numslabs++;
+
+    _slabPartialAdd(pool, s);
+    __atomic_add_fetch(&slab_used_memory, _slabBytes(pool, s), __ATOMIC_RELAXED);
+    return s;
+}
+
+/**
+ * 归还一个已经没有使用中对象的slab
+ */
+static void _slabDestroy(slabPool *pool, slab *s){
+    unsigned int idx = _slabUpperBound(pool, s) - 1;
+    memmove(pool->slabs + idx, pool->slabs + idx + 1, sizeof(slab*) * (pool->numslabs - idx - 1));
+    pool->numslabs--;
+    _slabPartialRemove(pool, s);
+    __atomic_sub_fetch(&slab_used_memory, _slabBytes(pool, s), __ATOMIC_RELAXED);
+    zfree(s);
+}
+
+/**
+ * 初始化一个空的池，不分配任何内存
+ */
+void slabPoolInit(slabPool *pool, size_t objsize){
+    //对象要能放下空闲链表的指针，并保持8字节对齐
+    if(objsize < sizeof(void*)){
+        objsize = sizeof(void*);
+    }
+    pool->objsize = (objsize + 7) & ~(size_t)7;
+    pool->numslabs = pool->maxslabs = 0;
+    pool->slabs = NULL;
+    pool->partial = NULL;
+    memset(pool->loose, 0, sizeof(pool->loose));
+    pool->inuse = 0;
+}
+
+/**
+ * 分配一个对象：优先从还有空闲对象的slab中分配，对象很少时单独分配，都不行时分配新的slab
+ */
+void *slabAlloc(slabPool *pool){
+    void *obj;
+    slab *s = pool->partial;
+
+    if(s == NULL){
+        //使用中的对象少于SLAB_LOOSE_OBJECTS个时，loose中一定有空位
+        if(pool->inuse < SLAB_LOOSE_OBJECTS){
+            for(int j = 0; j < SLAB_LOOSE_OBJECTS; j++){
+                if(pool->loose[j] == NULL){
+                    obj = zmalloc(pool->objsize);
+                    pool->loose[j] = obj;
+                    pool->inuse++;
+                    return obj;
+                }
+            }
+        }
+        s = _slabCreate(pool);
+    }
+
+    if(s->freelist){
+        obj = s->freelist;
+        s->freelist = *(void**)obj;
+    }else{
+        obj = (char*)s->data + (size_t)pool->objsize * s->used++;
+    }
+    s->inuse++;
+    pool->inuse++;
+    if(s->inuse == s->cap){
+        _slabPartialRemove(pool, s);
+    }
+    return obj;
+}
+
+/**
+ * 释放一个对象，单独分配的直接zfree，否则放回所在slab的空闲链表，slab空了就归还
+ */
+void slabFree(slabPool *pool, void *obj){
+    pool->inuse--;
+    for(int j = 0; j < SLAB_LOOSE_OBJECTS; j++){
+        if(pool->loose[j] == obj){
+            pool->loose[j] = NULL;
+            zfree(obj);
+            return;
+        }
+    }
+
+    slab *s = pool->slabs[_slabUpperBound(pool, obj) - 1];
+    *(void**)obj = s->freelist;
+    s->freelist = obj;
+    if(s->inuse-- == s->cap){
+        _slabPartialAdd(pool, s);
+    }
+    if(s->inuse == 0){
+        _slabDestroy(pool, s);
+        //池空了，连slabs数组也还回去
+        if(pool->numslabs == 0){
+            zfree(pool->slabs);
+            pool->slabs = NULL;
+            pool->maxslabs = 0;
+        }
+    }
+}
+
+/**
+ * 一次释放池中所有的对象和slab，之前分配的对象全部失效，池回到初始状态可以继续使用
+ */
+void slabPoolRelease(slabPool *pool){
+    for(int j = 0; j < SLAB_LOOSE_OBJECTS; j++){
+        if(pool->loose[j]){
+            zfree(pool->loose[j]);
+        }
+    }
+    for(unsigned int j = 0; j < pool->numslabs; j++){
+        __atomic_sub_fetch(&slab_used_memory, _slabBytes(pool, pool->slabs[j]), __ATOMIC_RELAXED);
+        zfree(pool->slabs[j]);
+    }
+    zfree(pool->slabs);
+    slabPoolInit(pool, pool->objsize);
+}
+
+/**
+ * 返回所有池中slab占用的内存，这部分也包含在zmalloc_used_memory中
+ */
+size_t slabUsedMemory(void){
+    return __atomic_load_n(&slab_used_memory, __ATOMIC_RELAXED);
+}
+
+#ifdef SLAB_TEST_MAIN
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+/**
+ * slab池的自测：按随机顺序分配和释放，检查存活对象互不覆盖，全部释放后slab都已归还
+ * gcc -DSLAB_TEST_MAIN -I. slab.c zmalloc.c -o slab-test
+ */
+#define SLAB_TEST_OBJECTS 20000
+
+static void *slab_test_objs[SLAB_TEST_OBJECTS];
+
+/**
+ * 每个对象写满自己的编号，对象之间有重叠的话检查时就会发现
+ */
+static void slabTestFill(slabPool *pool, int i){
+    memset(slab_test_objs[i], i & 0xff, pool->objsize);
+    *(int*)slab_test_objs[i] = i;
+}
+
+static void slabTestCheck(slabPool *pool, int i){
+    const unsigned char *p = slab_test_objs[i];
+    assert(*(const int*)p == i);
+    for(size_t j = sizeof(int); j < pool->objsize; j++){
+        assert(p[j] == (i & 0xff));
+    }
+}
+
+static void slabTestShuffle(int *order, int n){
+    for(int i = n - 1; i > 0; i--){
+        int j = rand() % (i + 1), t = order[i];
+        order[i] = order[j];
+        order[j] = t;
+    }
+}
+
+/**
+ * 分配n个对象，按随机顺序释放一半再分配回来，最后按随机顺序全部释放
+ */
+static void slabTestRound(slabPool *pool, int n){
+    static int order[SLAB_TEST_OBJECTS];
+
+    for(int i = 0; i < n; i++){
+        slab_test_objs[i] = slabAlloc(pool);
+        slabTestFill(pool, i);
+        order[i] = i;
+    }
+    assert(pool->inuse == (size_t)n);
+    slabTestShuffle(order, n);
+    for(int i = 0; i < n / 2; i++){
+        slabFree(pool, slab_test_objs[order[i]]);
+    }
+    for(int i = n / 2; i < n; i++){
+        slabTestCheck(pool, order[i]);
+    }
+    for(int i = 0; i < n / 2; i++){
+        slab_test_objs[order[i]] = slabAlloc(pool);
+        slabTestFill(pool, order[i]);
+    }
+    for(int i = 0; i < n; i++){
+        slabTestCheck(pool, i);
+    }
+    slabTestShuffle(order, n);
+    for(int i = 0; i < n; i++){
+        slabFree(pool, slab_test_objs[order[i]]);
+    }
+
+    //最后一个对象释放时所有slab和slabs数组都已经归还
+    assert(pool->inuse == 0 && pool->numslabs == 0);
+    assert(pool->slabs == NULL && pool->maxslabs == 0 && pool->partial == NULL);
+    for(int j = 0; j < SLAB_LOOSE_OBJECTS; j++){
+        assert(pool->loose[j] == NULL);
+    }
+    assert(slabUsedMemory() == 0);
+}
+
+int main(void){
+    size_t sizes[] = {1, 24, 40, 100};
+    //少于SLAB_LOOSE_OBJECTS个时只用单独分配的对象，其余的会用到一个或者很多个slab
+    int counts[] = {3, SLAB_LOOSE_OBJECTS + 1, 200, SLAB_TEST_OBJECTS};
+    size_t base = zmalloc_used_memory();
+
+    srand(1);
+    for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+        slabPool pool;
+        slabPoolInit(&pool, sizes[s]);
+        for(int round = 0; round < 20; round++){
+            slabTestRound(&pool, counts[round % 4]);
+        }
+
+        //还有存活对象时也可以一次释放整个池
+        for(int i = 0; i < SLAB_TEST_OBJECTS / 2; i++){
+            slab_test_objs[i] = slabAlloc(&pool);
+        }
+        assert(pool.numslabs > 0 && slabUsedMemory() > 0);
+        slabPoolRelease(&pool);
+        assert(pool.numslabs == 0 && pool.inuse == 0 && slabUsedMemory() == 0);
+        printf("object size %zu: ok\n", sizes[s]);
+    }
+    assert(zmalloc_used_memory() == base);
+    return 0;
+}
+#endif
@@ -0,0 +1,52 @@
+#ifndef __SLAB_H__
+#define __SLAB_H__
+
+#include <stddef.h>
+
+/**
+ * 定长小对象的slab池，给dict拉链法的节点和adlist的链表节点使用
+ * 每个池属于一个容器（一个dict或者一个list），和容器本身一样不加锁，由持有容器的线程使用
+ * 容器很小时对象单独分配；之后对象从slab中切出，释放的对象放回所在slab的空闲链表，
+ * 一个slab中的对象全部释放后立即归还这个slab，容器销毁时一次释放所有slab，而不是对每个节点调用zfree
+ * 容器缩小后，零散存活的对象会让各自的slab留下来，每个存活对象最多占住一个slab（SLAB_MAX_OBJECTS个对象）
+ */
+
+//前几个对象单独分配，不值得占用一个slab
+#define SLAB_LOOSE_OBJECTS 4
+//slab的对象数量是当前使用中的对象数量向上取2的幂，限制在这个范围内
+#define SLAB_MIN_OBJECTS 8
+#define SLAB_MAX_OBJECTS 256
+
+typedef struct slab{
+    //还有空闲对象的slab组成的双向链表
+    struct slab *prev, *next;
+    //本slab中被释放的对象组成的空闲链表，对象的前8个字节存放下一个空闲对象
+    void *freelist;
+    //正在使用的对象数量、已经切出的对象数量、能容纳的对象数量
+    unsigned int inuse, used, cap;
+    //对象数组，按8字节对齐
+    long long data[];
+} slab;
+
+typedef struct slabPool{
+    //对象大小，至少是一个指针的大小
+    unsigned int objsize;
+    //slab的数量和slabs数组的容量
+    unsigned int numslabs, maxslabs;
+    //所有的slab按地址排序，释放对象时用二分查找找到它所在的slab
+    slab **slabs;
+    //还有空闲对象的slab，新对象从链表头部的slab分配
+    slab *partial;
+    //单独分配的对象
+    void *loose[SLAB_LOOSE_OBJECTS];
+    //正在使用的对象总数
+    size_t inuse;
+} slabPool;
+
+void slabPoolInit(slabPool *pool, size_t objsize);
+void *slabAlloc(slabPool *pool);
+void slabFree(slabPool *pool, void *obj);
+void slabPoolRelease(slabPool *pool);
+size_t slabUsedMemory(void);
+
+#endif // !__SLAB_H__
@@ -0,0 +1,267 @@
+#include <limits.h>
+#include "redis.h"
+
+/**
+ * 哈希类型的命令，目前只实现了哈希表编码，域和值都是字符串对象
+ */
+
+/**
+ * 查找哈希对象，不存在则创建一个新的加入数据库
+ * 键存在但类型不对时回复错误并返回NULL
+ */
+static robj *hashTypeLookupWriteOrCreate(redisClient *c, robj *key){
+    robj *o = lookupKeyWrite(c->db, key);
+    if(o == NULL){
+        o = createHashObject();
+        dbAdd(c->db, key, o);
+    }else if(o->type != REDIS_HASH){
+        addReply(c, shared.wrongtypeerr);
+        return NULL;
+    }
+    return o;
+}
+
+/**
+ * 返回域对应的值，不存在返回NULL
+ */
+static robj *hashTypeGetObject(robj *o, robj *field){
+    redisAssert(o->encoding == REDIS_ENCODING_HT);
+    dictEntry *de = dictFind(o->ptr, field);
+    return de ? dictGetVal(de) : NULL;
+}
+
+static int hashTypeExists(robj *o, robj *field){
+    return hashTypeGetObject(o, field) != NULL;
+}
+
+/**
+ * 设置域的值，域已经存在返回1，新加入返回0
+ * 哈希表持有域和值的引用
+ */
+static int hashTypeSet(robj *o, robj *field, robj *value){
+    redisAssert(o->encoding == REDIS_ENCODING_HT);
+    incrRefCount(value);
+    if(dictReplace(o->ptr, field, value)){
+        incrRefCount(field);
+        return 0;
+    }
+    return 1;
+}
+
+static int hashTypeDelete(robj *o, robj *field){
+    return dictDelete(o->ptr, field) == DICT_OK;
+}
+
+/**
+ * 写入哈希表之前对域和值尝试转换编码，数字字符串变成INT编码或者共享整数
+ */
+static void hashTypeTryObjectEncoding(robj **field, robj **value){
+    *field = tryObjectEncoding(*field);
+    *value = tryObjectEncoding(*value);
+}
+
+static unsigned long hashTypeLength(robj *o){
+    return dictSize((dict*)o->ptr);
+}
+
+void hsetCommand(redisClient *c){
+    robj *o;
+    if((o = hashTypeLookupWriteOrCreate(c, c->argv[1])) == NULL){
+        return;
+    }
+    hashTypeTryObjectEncoding(c->argv+2, c->argv+3);
+    int update = hashTypeSet(o, c->argv[2], c->argv[3]);
+    addReply(c, update ? shared.czero : shared.cone);
+}
+
+void hsetnxCommand(redisClient *c){
+    robj *o;
+    if((o = hashTypeLookupWriteOrCreate(c, c->argv[1])) == NULL){
+        return;
+    }
+    if(hashTypeExists(o, c->argv[2])){
+        addReply(c, shared.czero);
+    }else{
+        hashTypeTryObjectEncoding(c->argv+2, c->argv+3);
+        hashTypeSet(o, c->argv[2], c->argv[3]);
+        addReply(c, shared.cone);
+    }
+}
+
+void hmsetCommand(redisClient *c){
+    robj *o;
+    if((c->argc % 2) == 1){
+        addReplyError(c, "wrong number of arguments for HMSET");
+        return;
+    }
+    if((o = hashTypeLookupWriteOrCreate(c, c->argv[1])) == NULL){
+        return;
+    }
+    for(int j = 2; j < c->argc; j += 2){
+        hashTypeTryObjectEncoding(c->argv+j, c->argv+j+1);
+        hashTypeSet(o, c->argv[j], c->argv[j+1]);
+    }
+    addReply(c, shared.ok);
+}
+
+void hincrbyCommand(redisClient *c){
+    long long value, incr, oldvalue;
+    robj *o, *current, *new;
+
+    if(getLongLongFromObjectOrReply(c, c->argv[3], &incr, NULL) != REDIS_OK){
+        return;
+    }
+    if((o = hashTypeLookupWriteOrCreate(c, c->argv[1])) == NULL){
+        return;
+    }
+    if((current = hashTypeGetObject(o, c->argv[2])) != NULL){
+        if(getLongLongFromObject(current, &value) != REDIS_OK){
+            addReplyError(c, "hash value is not an integer");
+            return;
+        }
+    }else{
+        value = 0;
+    }
+
+    oldvalue = value;
+    if((incr < 0 && oldvalue < 0 && incr < (LLONG_MIN-oldvalue)) ||
+        (incr > 0 && oldvalue > 0 && incr > (LLONG_MAX-oldvalue))){
+        addReplyError(c, "increment or decrement would overflow");
+        return;
+    }
+    value += incr;
+    new = createStringObjectFromLongLong(value);
+    hashTypeSet(o, c->argv[2], new);
+    decrRefCount(new);
+    addReplyLongLong(c, value);
+}
+
+static void addHashFieldToReply(redisClient *c, robj *o, robj *field){
+    robj *value;
+    if(o == NULL || (value = hashTypeGetObject(o, field)) == NULL){
+        addReply(c, shared.nullbulk);
+    }else{
+        addReplyBulk(c, value);
+    }
+}
+
+void hgetCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    addHashFieldToReply(c, o, c->argv[2]);
+}
+
+void hmgetCommand(redisClient *c){
+    //键不存在时当做空的哈希，每个域都回复空
+    robj *o = lookupKeyRead(c->db, c->argv[1]);
+    if(o != NULL && o->type != REDIS_HASH){
+        addReply(c, shared.wrongtypeerr);
+        return;
+    }
+    addReplyMultiBulkLen(c, c->argc-2);
+    for(int j = 2; j < c->argc; j++){
+        addHashFieldToReply(c, o, c->argv[j]);
+    }
+}
+
+void hdelCommand(redisClient *c){
+    robj *o;
+    int deleted = 0;
+
+    if((o = lookupKeyWriteOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    for(int j = 2; j < c->argc; j++){
+        if(hashTypeDelete(o, c->argv[j])){
+            deleted++;
+            if(hashTypeLength(o) == 0){
+                dbDelete(c->db, c->argv[1]);
+                break;
+            }
+        }
+    }
+    addReplyLongLong(c, deleted);
+}
+
+void hlenCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    addReplyLongLong(c, hashTypeLength(o));
+}
+
+void hexistsCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    addReply(c, hashTypeExists(o, c->argv[2]) ? shared.cone : shared.czero);
+}
+
+#define REDIS_HASH_KEY (1<<0)
+#define REDIS_HASH_VALUE (1<<1)
+
+/**
+ * HKEYS、HVALS、HGETALL的通用实现，flags决定回复域、值还是两者都回复
+ */
+static void genericHgetallCommand(redisClient *c, int flags){
+    robj *o;
+    dictIterator *di;
+    dictEntry *de;
+    int multiplier = 0;
+
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptymultibulk)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    if(flags & REDIS_HASH_KEY) multiplier++;
+    if(flags & REDIS_HASH_VALUE) multiplier++;
+
+    addReplyMultiBulkLen(c, hashTypeLength(o) * multiplier);
+    di = dictGetIterator(o->ptr);
+    while((de = dictNext(di)) != NULL){
+        if(flags & REDIS_HASH_KEY){
+            addReplyBulk(c, dictGetKey(de));
+        }
+        if(flags & REDIS_HASH_VALUE){
+            addReplyBulk(c, dictGetVal(de));
+        }
+    }
+    dictReleaseIterator(di);
+}
+
+void hkeysCommand(redisClient *c){
+    genericHgetallCommand(c, REDIS_HASH_KEY);
+}
+
+void hvalsCommand(redisClient *c){
+    genericHgetallCommand(c, REDIS_HASH_VALUE);
+}
+
+void hgetallCommand(redisClient *c){
+    genericHgetallCommand(c, REDIS_HASH_KEY|REDIS_HASH_VALUE);
+}
+
+/**
+ * HSCAN key cursor [MATCH pattern] [COUNT count]
+ */
+void hscanCommand(redisClient *c){
+    robj *o;
+    unsigned long cursor;
+
+    if(parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR){
+        return;
+    }
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan)) == NULL ||
+        checkType(c, o, REDIS_HASH)){
+        return;
+    }
+    scanGenericCommand(c, o, cursor);
+}
@@ -0,0 +1,265 @@
+#include "redis.h"
+
+/**
+ * 列表类型的命令，目前只实现了双端链表编码
+ */
+
+/**
+ * 把元素加入列表的头部或尾部，列表持有元素的一个引用
+ */
+static void listTypePush(robj *subject, robj *value, int where){
+    redisAssert(subject->encoding == REDIS_ENCODING_LINKEDLIST);
+    if(where == REDIS_HEAD){
+        listAddNodeHead(subject->ptr, value);
+    }else{
+        listAddNodeTail(subject->ptr, value);
+    }
+    incrRefCount(value);
+}
+
+/**
+ * 弹出头部或尾部的元素，调用方负责减少返回值的引用计数
+ */
+static robj *listTypePop(robj *subject, int where){
+    list *list = subject->ptr;
+    listNode *ln = (where == REDIS_HEAD) ? listFirst(list) : listLast(list);
+    robj *value = NULL;
+    if(ln != NULL){
+        value = listNodeValue(ln);
+        incrRefCount(value);
+        listDeleteNode(list, ln);
+    }
+    return value;
+}
+
+static unsigned long listTypeLength(robj *subject){
+    return listLength((list*)subject->ptr);
+}
+
+/**
+ * 把负数下标转成正数，超出范围时返回的下标也超出范围
+ */
+static long listTypeNormalizeIndex(robj *subject, long index){
+    if(index < 0){
+        index += listTypeLength(subject);
+    }
+    return index;
+}
+
+static void pushGenericCommand(redisClient *c, int where){
+    robj *lobj = lookupKeyWrite(c->db, c->argv[1]);
+
+    if(lobj && lobj->type != REDIS_LIST){
+        addReply(c, shared.wrongtypeerr);
+        return;
+    }
+    if(lobj == NULL){
+        lobj = createListObject();
+        dbAdd(c->db, c->argv[1], lobj);
+    }
+    for(int j = 2; j < c->argc; j++){
+        c->argv[j] = tryObjectEncoding(c->argv[j]);
+        listTypePush(lobj, c->argv[j], where);
+    }
+    addReplyLongLong(c, listTypeLength(lobj));
+}
+
+void lpushCommand(redisClient *c){
+    pushGenericCommand(c, REDIS_HEAD);
+}
+
+void rpushCommand(redisClient *c){
+    pushGenericCommand(c, REDIS_TAIL);
+}
+
+static void popGenericCommand(redisClient *c, int where){
+    robj *o = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk);
+    if(o == NULL || checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    robj *value = listTypePop(o, where);
+    if(value == NULL){
+        addReply(c, shared.nullbulk);
+        return;
+    }
+    addReplyBulk(c, value);
+    decrRefCount(value);
+    //空列表直接删除键
+    if(listTypeLength(o) == 0){
+        dbDelete(c->db, c->argv[1]);
+    }
+}
+
+void lpopCommand(redisClient *c){
+    popGenericCommand(c, REDIS_HEAD);
+}
+
+void rpopCommand(redisClient *c){
+    popGenericCommand(c, REDIS_TAIL);
+}
+
+void llenCommand(redisClient *c){
+    robj *o = lookupKeyReadOrReply(c, c->argv[1], shared.czero);
+    if(o == NULL || checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    addReplyLongLong(c, listTypeLength(o));
+}
+
+void lindexCommand(redisClient *c){
+    robj *o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk);
+    long index;
+    if(o == NULL || checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    if(getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK){
+        return;
+    }
+    listNode *ln = listIndex(o->ptr, index);
+    if(ln != NULL){
+        addReplyBulk(c, listNodeValue(ln));
+    }else{
+        addReply(c, shared.nullbulk);
+    }
+}
+
+void lsetCommand(redisClient *c){
+    robj *o = lookupKeyWriteOrReply(c, c->argv[1], shared.nokeyerr);
+    long index;
+    robj *value = c->argv[3];
+    if(o == NULL || checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    if(getLongFromObjectOrReply(c, c->argv[2], &index, NULL) != REDIS_OK){
+        return;
+    }
+    listNode *ln = listIndex(o->ptr, index);
+    if(ln == NULL){
+        addReply(c, shared.outofrangeerr);
+        return;
+    }
+    decrRefCount(listNodeValue(ln));
+    listNodeValue(ln) = value;
+    incrRefCount(value);
+    addReply(c, shared.ok);
+}
+
+void lrangeCommand(redisClient *c){
+    robj *o;
+    long start, end, llen, rangelen;
+
+    if(getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK ||
+        getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK){
+        return;
+    }
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.emptymultibulk)) == NULL ||
+        checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    llen = listTypeLength(o);
+
+    //把负数下标转成正数，并限制在列表范围之内
+    start = listTypeNormalizeIndex(o, start);
+    end = listTypeNormalizeIndex(o, end);
+    if(start < 0){
+        start = 0;
+    }
+    if(start > end || start >= llen){
+        addReply(c, shared.emptymultibulk);
+        return;
+    }
+    if(end >= llen){
+        end = llen-1;
+    }
+    rangelen = (end-start)+1;
+
+    addReplyMultiBulkLen(c, rangelen);
+    listNode *ln = listIndex(o->ptr, start);
+    while(rangelen--){
+        addReplyBulk(c, listNodeValue(ln));
+        ln = ln->next;
+    }
+}
+
+void ltrimCommand(redisClient *c){
+    robj *o;
+    long start, end, llen, ltrim, rtrim;
+
+    if(getLongFromObjectOrReply(c, c->argv[2], &start, NULL) != REDIS_OK ||
+        getLongFromObjectOrReply(c, c->argv[3], &end, NULL) != REDIS_OK){
+        return;
+    }
+    if((o = lookupKeyWriteOrReply(c, c->argv[1], shared.ok)) == NULL ||
+        checkType(c, o, REDIS_LIST)){
+        return;
+    }
+    llen = listTypeLength(o);
+
+    start = listTypeNormalizeIndex(o, start);
+    end = listTypeNormalizeIndex(o, end);
+    if(start < 0){
+        start = 0;
+    }
+    if(start > end || start >= llen){
+        //范围为空，删除所有元素
+        ltrim = llen;
+        rtrim = 0;
+    }else{
+        if(end >= llen){
+            end = llen-1;
+        }
+        ltrim = start;
+        rtrim = llen-end-1;
+    }
+
+    list *list = o->ptr;
+    while(ltrim--){
+        listDeleteNode(list, listFirst(list));
+    }
+    while(rtrim--){
+        listDeleteNode(list, listLast(list));
+    }
+    if(listTypeLength(o) == 0){
+        dbDelete(c->db, c->argv[1]);
+    }
+    addReply(c, shared.ok);
+}
+
+/**
+ * LREM key count value
+ * count大于0从头部开始删除，小于0从尾部开始删除，等于0删除所有相等的元素
+ */
+void lremCommand(redisClient *c){
+    robj *subject, *obj = c->argv[3];
+    long toremove, removed = 0;
+    listIterator li;
+    listNode *ln;
+
+    if(getLongFromObjectOrReply(c, c->argv[2], &toremove, NULL) != REDIS_OK){
+        return;
+    }
+    subject = lookupKeyWriteOrReply(c, c->argv[1], shared.czero);
+    if(subject == NULL || checkType(c, subject, REDIS_LIST)){
+        return;
+    }
+
+    if(toremove < 0){
+        toremove = -toremove;
+        listRewindTail(subject->ptr, &li);
+    }else{
+        listRewindHead(subject->ptr, &li);
+    }
+    while((ln = listNext(&li)) != NULL){
+        if(equalStringObjects(listNodeValue(ln), obj)){
+            listDeleteNode(subject->ptr, ln);
+            removed++;
+            if(toremove && removed == toremove){
+                break;
+            }
+        }
+    }
+    if(listTypeLength(subject) == 0){
+        dbDelete(c->db, c->argv[1]);
+    }
+    addReplyLongLong(c, removed);
+}
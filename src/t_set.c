@@ -0,0 +1,426 @@
+#include "redis.h"
+
+/**
+ * 集合类型，元素都是整数并且数量不多时使用整数集合编码，否则使用哈希表编码
+ */
+
+/**
+ * 根据第一个元素选择集合的编码，能表示成整数就使用整数集合
+ */
+robj *setTypeCreate(robj *value){
+    if(isObjectRepresentableAsLongLong(value, NULL) == REDIS_OK){
+        return createIntsetObject();
+    }
+    return createSetObject();
+}
+
+/**
+ * 添加元素，已经存在返回0
+ * 整数集合中加入了非整数元素，或者元素数量超过set-max-intset-entries时转成哈希表
+ */
+int setTypeAdd(robj *subject, robj *value){
+    long long llval;
+    if(subject->encoding == REDIS_ENCODING_HT){
+        if(dictAdd(subject->ptr, value, NULL) == DICT_OK){
+            incrRefCount(value);
+            return 1;
+        }
+    }else if(subject->encoding == REDIS_ENCODING_INTSET){
+        if(isObjectRepresentableAsLongLong(value, &llval) == REDIS_OK){
+            int8_t success = 0;
+            subject->ptr = intsetAdd(subject->ptr, llval, &success);
+            if(success){
+                if(intsetLen(subject->ptr) > server.set_max_intset_entries){
+                    setTypeConvert(subject, REDIS_ENCODING_HT);
+                }
+                return 1;
+            }
+        }else{
+            setTypeConvert(subject, REDIS_ENCODING_HT);
+            //转换后的哈希表中一定没有这个非整数的元素
+            redisAssert(dictAdd(subject->ptr, value, NULL) == DICT_OK);
+            incrRefCount(value);
+            return 1;
+        }
+    }else{
+        redisPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
+/**
+ * 删除元素，不存在返回0
+ */
+int setTypeRemove(robj *setobj, robj *value){
+    long long llval;
+    if(setobj->encoding == REDIS_ENCODING_HT){
+        if(dictDelete(setobj->ptr, value) == DICT_OK){
+            return 1;
+        }
+    }else if(setobj->encoding == REDIS_ENCODING_INTSET){
+        if(isObjectRepresentableAsLongLong(value, &llval) == REDIS_OK){
+            int8_t success;
+            setobj->ptr = intsetRemove(setobj->ptr, llval, &success);
+            if(success){
+                return 1;
+            }
+        }
+    }else{
+        redisPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
+int setTypeIsMember(robj *subject, robj *value){
+    long long llval;
+    if(subject->encoding == REDIS_ENCODING_HT){
+        return dictFind(subject->ptr, value) != NULL;
+    }else if(subject->encoding == REDIS_ENCODING_INTSET){
+        if(isObjectRepresentableAsLongLong(value, &llval) == REDIS_OK){
+            return intsetFind(subject->ptr, llval);
+        }
+    }else{
+        redisPanic("Unknown set encoding");
+    }
+    return 0;
+}
+
+unsigned long setTypeSize(robj *subject){
+    if(subject->encoding == REDIS_ENCODING_HT){
+        return dictSize((dict*)subject->ptr);
+    }else if(subject->encoding == REDIS_ENCODING_INTSET){
+        return intsetLen((intset*)subject->ptr);
+    }
+    redisPanic("Unknown set encoding");
+    return 0;
+}
+
+/**
+ * 把整数集合编码的集合转成哈希表编码，哈希表预先扩展到足够的大小
+ */
+void setTypeConvert(robj *setobj, int enc){
+    redisAssert(setobj->type == REDIS_SET && setobj->encoding == REDIS_ENCODING_INTSET);
+    if(enc != REDIS_ENCODING_HT){
+        redisPanic("Unsupported set conversion");
+    }
+
+    intset *is = setobj->ptr;
+    dict *d = dictCreate(&setDictType, NULL);
+    int64_t intele;
+    dictExpand(d, intsetLen(is));
+    for(uint32_t j = 0; intsetGet(is, j, &intele); j++){
+        robj *element = createStringObjectFromLongLong(intele);
+        redisAssert(dictAdd(d, element, NULL) == DICT_OK);
+    }
+    setobj->encoding = REDIS_ENCODING_HT;
+    zfree(setobj->ptr);
+    setobj->ptr = d;
+}
+
+setTypeIterator *setTypeInitIterator(robj *subject){
+    setTypeIterator *si = zmalloc(sizeof(setTypeIterator));
+    si->subject = subject;
+    si->encoding = subject->encoding;
+    if(si->encoding == REDIS_ENCODING_HT){
+        si->di = dictGetIterator(subject->ptr);
+    }else if(si->encoding == REDIS_ENCODING_INTSET){
+        si->ii = 0;
+    }else{
+        redisPanic("Unknown set encoding");
+    }
+    return si;
+}
+
+void setTypeReleaseIterator(setTypeIterator *si){
+    if(si->encoding == REDIS_ENCODING_HT){
+        dictReleaseIterator(si->di);
+    }
+    zfree(si);
+}
+
+/**
+ * 返回下一个元素，没有更多元素时返回NULL
+ * 返回的对象总是新的引用，调用方用完之后要调用decrRefCount
+ */
+robj *setTypeNextObject(setTypeIterator *si){
+    if(si->encoding == REDIS_ENCODING_HT){
+        dictEntry *de = dictNext(si->di);
+        if(de == NULL){
+            return NULL;
+        }
+        robj *o = dictGetKey(de);
+        incrRefCount(o);
+        return o;
+    }else{
+        int64_t intele;
+        if(!intsetGet(si->subject->ptr, si->ii++, &intele)){
+            return NULL;
+        }
+        return createStringObjectFromLongLong(intele);
+    }
+}
+
+/**
+ * 随机取出一个元素，不删除，集合不能为空
+ * 整数集合编码时元素保存在llele中，*objele为NULL；哈希表编码时元素保存在*objele中，没有增加引用计数
+ * 返回集合的编码，调用方据此决定用哪一个
+ */
+int setTypeRandomElement(robj *setobj, robj **objele, int64_t *llele){
+    if(setobj->encoding == REDIS_ENCODING_HT){
+        dictEntry *de = dictGetRandomKey(setobj->ptr);
+        *objele = dictGetKey(de);
+    }else if(setobj->encoding == REDIS_ENCODING_INTSET){
+        *llele = intsetRandom(setobj->ptr);
+        *objele = NULL;
+    }else{
+        redisPanic("Unknown set encoding");
+    }
+    return setobj->encoding;
+}
+
+void saddCommand(redisClient *c){
+    robj *set;
+    int added = 0;
+
+    set = lookupKeyWrite(c->db, c->argv[1]);
+    if(set == NULL){
+        set = setTypeCreate(c->argv[2]);
+        dbAdd(c->db, c->argv[1], set);
+    }else if(set->type != REDIS_SET){
+        addReply(c, shared.wrongtypeerr);
+        return;
+    }
+    for(int j = 2; j < c->argc; j++){
+        c->argv[j] = tryObjectEncoding(c->argv[j]);
+        if(setTypeAdd(set, c->argv[j])){
+            added++;
+        }
+    }
+    addReplyLongLong(c, added);
+}
+
+void sremCommand(redisClient *c){
+    robj *set;
+    int deleted = 0;
+
+    if((set = lookupKeyWriteOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    for(int j = 2; j < c->argc; j++){
+        if(setTypeRemove(set, c->argv[j])){
+            deleted++;
+            //集合为空时删除键，剩下的元素也不用再处理了
+            if(setTypeSize(set) == 0){
+                dbDelete(c->db, c->argv[1]);
+                break;
+            }
+        }
+    }
+    addReplyLongLong(c, deleted);
+}
+
+void sismemberCommand(redisClient *c){
+    robj *set;
+    if((set = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    addReply(c, setTypeIsMember(set, c->argv[2]) ? shared.cone : shared.czero);
+}
+
+void scardCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, o, REDIS_SET)){
+        return;
+    }
+    addReplyLongLong(c, setTypeSize(o));
+}
+
+void smembersCommand(redisClient *c){
+    robj *set, *ele;
+    setTypeIterator *si;
+
+    if((set = lookupKeyReadOrReply(c, c->argv[1], shared.emptymultibulk)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    addReplyMultiBulkLen(c, setTypeSize(set));
+    si = setTypeInitIterator(set);
+    while((ele = setTypeNextObject(si)) != NULL){
+        addReplyBulk(c, ele);
+        decrRefCount(ele);
+    }
+    setTypeReleaseIterator(si);
+}
+
+/**
+ * SPOP key
+ * 随机删除并返回一个元素
+ */
+void spopCommand(redisClient *c){
+    robj *set, *ele;
+    int64_t llele;
+
+    if((set = lookupKeyWriteOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    if(setTypeRandomElement(set, &ele, &llele) == REDIS_ENCODING_INTSET){
+        ele = createStringObjectFromLongLong(llele);
+        set->ptr = intsetRemove(set->ptr, llele, NULL);
+    }else{
+        //删除时哈希表会释放它，先加一个引用留给回复用
+        incrRefCount(ele);
+        setTypeRemove(set, ele);
+    }
+    addReplyBulk(c, ele);
+    decrRefCount(ele);
+    if(setTypeSize(set) == 0){
+        dbDelete(c->db, c->argv[1]);
+    }
+}
+
+/**
+ * count乘以这个值还大于集合大小时，先复制整个集合再随机删掉多余的，否则随机挑元素直到够数
+ */
+#define SRANDMEMBER_SUB_STRATEGY_MUL 3
+
+/**
+ * SRANDMEMBER key count
+ * count为正数时返回最多count个不重复的元素，为负数时返回-count个可能重复的元素
+ */
+static void srandmemberWithCountCommand(redisClient *c){
+    long l;
+    unsigned long count, size;
+    int uniq = 1;
+    robj *set, *ele;
+    int64_t llele;
+    dict *d;
+
+    if(getLongFromObjectOrReply(c, c->argv[2], &l, NULL) != REDIS_OK){
+        return;
+    }
+    if(l >= 0){
+        count = (unsigned long)l;
+    }else{
+        count = -l;
+        uniq = 0;
+    }
+    if((set = lookupKeyReadOrReply(c, c->argv[1], shared.emptymultibulk)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    size = setTypeSize(set);
+    if(count == 0){
+        addReply(c, shared.emptymultibulk);
+        return;
+    }
+
+    //可以重复：每次都独立地随机取一个
+    if(!uniq){
+        addReplyMultiBulkLen(c, count);
+        while(count--){
+            if(setTypeRandomElement(set, &ele, &llele) == REDIS_ENCODING_INTSET){
+                ele = createStringObjectFromLongLong(llele);
+                addReplyBulk(c, ele);
+                decrRefCount(ele);
+            }else{
+                addReplyBulk(c, ele);
+            }
+        }
+        return;
+    }
+
+    //要的不比集合大小少：整个集合都返回
+    if(count >= size){
+        smembersCommand(c);
+        return;
+    }
+
+    //剩下的两种情况都用一个临时的字典去重
+    d = dictCreate(&setDictType, NULL);
+    if(count * SRANDMEMBER_SUB_STRATEGY_MUL > size){
+        //要的元素接近集合大小，随机挑的话后面重复的概率太高，改成复制之后随机删掉多余的
+        setTypeIterator *si = setTypeInitIterator(set);
+        while((ele = setTypeNextObject(si)) != NULL){
+            redisAssert(dictAdd(d, ele, NULL) == DICT_OK);
+        }
+        setTypeReleaseIterator(si);
+        while(size > count){
+            dictEntry *de = dictGetRandomKey(d);
+            dictDelete(d, dictGetKey(de));
+            size--;
+        }
+    }else{
+        //要的元素远少于集合大小，随机挑，重复的丢掉
+        unsigned long added = 0;
+        while(added < count){
+            if(setTypeRandomElement(set, &ele, &llele) == REDIS_ENCODING_INTSET){
+                ele = createStringObjectFromLongLong(llele);
+            }else{
+                incrRefCount(ele);
+            }
+            if(dictAdd(d, ele, NULL) == DICT_OK){
+                added++;
+            }else{
+                decrRefCount(ele);
+            }
+        }
+    }
+
+    dictIterator *di = dictGetIterator(d);
+    dictEntry *de;
+    addReplyMultiBulkLen(c, count);
+    while((de = dictNext(di)) != NULL){
+        addReplyBulk(c, dictGetKey(de));
+    }
+    dictReleaseIterator(di);
+    dictRelease(d);
+}
+
+/**
+ * SRANDMEMBER key [count]
+ */
+void srandmemberCommand(redisClient *c){
+    robj *set, *ele;
+    int64_t llele;
+
+    if(c->argc == 3){
+        srandmemberWithCountCommand(c);
+        return;
+    }else if(c->argc > 3){
+        addReply(c, shared.syntaxerr);
+        return;
+    }
+
+    if((set = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    if(setTypeRandomElement(set, &ele, &llele) == REDIS_ENCODING_INTSET){
+        ele = createStringObjectFromLongLong(llele);
+        addReplyBulk(c, ele);
+        decrRefCount(ele);
+    }else{
+        addReplyBulk(c, ele);
+    }
+}
+
+/**
+ * SSCAN key cursor [MATCH pattern] [COUNT count]
+ */
+void sscanCommand(redisClient *c){
+    robj *set;
+    unsigned long cursor;
+
+    if(parseScanCursorOrReply(c, c->argv[2], &cursor) == REDIS_ERR){
+        return;
+    }
+    if((set = lookupKeyReadOrReply(c, c->argv[1], shared.emptyscan)) == NULL ||
+        checkType(c, set, REDIS_SET)){
+        return;
+    }
+    scanGenericCommand(c, set, cursor);
+}
@@ -0,0 +1,327 @@
+#include <limits.h>
+#include <math.h>
+#include "redis.h"
+
+/**
+ * 字符串类型的命令
+ */
+
+/**
+ * 检查字符串的长度是否超过了512MB的限制
+ */
+static int checkStringLength(redisClient *c, long long size){
+    if(size > 512*1024*1024){
+        addReplyError(c, "string exceeds maximum allowed size (512MB)");
+        return REDIS_ERR;
+    }
+    return REDIS_OK;
+}
+
+#define REDIS_SET_NO_FLAGS 0
+#define REDIS_SET_NX (1<<0) //键不存在时才设置
+#define REDIS_SET_XX (1<<1) //键存在时才设置
+
+/**
+ * SET、SETNX、SETEX、PSETEX的通用实现
+ * expire为NULL表示不设置过期时间，unit为秒或者毫秒
+ * ok_reply和abort_reply为NULL时分别回复+OK和空回复
+ */
+static void setGenericCommand(redisClient *c, int flags, robj *key, robj *val, robj *expire,
+    int unit, robj *ok_reply, robj *abort_reply){
+    long long milliseconds = 0;
+
+    if(expire){
+        if(getLongLongFromObjectOrReply(c, expire, &milliseconds, NULL) != REDIS_OK){
+            return;
+        }
+        if(milliseconds <= 0){
+            addReplyErrorFormat(c, "invalid expire time in %s", c->cmd->name);
+            return;
+        }
+        if(unit == UNIT_SECONDS){
+            milliseconds *= 1000;
+        }
+    }
+
+    if((flags & REDIS_SET_NX && lookupKeyWrite(c->db, key) != NULL) ||
+        (flags & REDIS_SET_XX && lookupKeyWrite(c->db, key) == NULL)){
+        addReply(c, abort_reply ? abort_reply : shared.nullbulk);
+        return;
+    }
+    setKey(c->db, key, val);
+    if(expire){
+        setExpire(c->db, key, mstime() + milliseconds);
+    }
+    addReply(c, ok_reply ? ok_reply : shared.ok);
+}
+
+/**
+ * SET key value [NX] [XX] [EX <seconds>] [PX <milliseconds>]
+ */
+void setCommand(redisClient *c){
+    robj *expire = NULL;
+    int unit = UNIT_SECONDS;
+    int flags = REDIS_SET_NO_FLAGS;
+
+    for(int j = 3; j < c->argc; j++){
+        char *a = c->argv[j]->ptr;
+        robj *next = (j == c->argc-1) ? NULL : c->argv[j+1];
+
+        if((a[0] == 'n' || a[0] == 'N') && (a[1] == 'x' || a[1] == 'X') && a[2] == '\0'){
+            flags |= REDIS_SET_NX;
+        }else if((a[0] == 'x' || a[0] == 'X') && (a[1] == 'x' || a[1] == 'X') && a[2] == '\0'){
+            flags |= REDIS_SET_XX;
+        }else if((a[0] == 'e' || a[0] == 'E') && (a[1] == 'x' || a[1] == 'X') && a[2] == '\0' && next){
+            unit = UNIT_SECONDS;
+            expire = next;
+            j++;
+        }else if((a[0] == 'p' || a[0] == 'P') && (a[1] == 'x' || a[1] == 'X') && a[2] == '\0' && next){
+            unit = UNIT_MILLISECONDS;
+            expire = next;
+            j++;
+        }else{
+            addReply(c, shared.syntaxerr);
+            return;
+        }
+    }
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
+    setGenericCommand(c, flags, c->argv[1], c->argv[2], expire, unit, NULL, NULL);
+}
+
+void setnxCommand(redisClient *c){
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
+    setGenericCommand(c, REDIS_SET_NX, c->argv[1], c->argv[2], NULL, 0, shared.cone, shared.czero);
+}
+
+void setexCommand(redisClient *c){
+    c->argv[3] = tryObjectEncoding(c->argv[3]);
+    setGenericCommand(c, REDIS_SET_NO_FLAGS, c->argv[1], c->argv[3], c->argv[2], UNIT_SECONDS, NULL, NULL);
+}
+
+void psetexCommand(redisClient *c){
+    c->argv[3] = tryObjectEncoding(c->argv[3]);
+    setGenericCommand(c, REDIS_SET_NO_FLAGS, c->argv[1], c->argv[3], c->argv[2], UNIT_MILLISECONDS, NULL, NULL);
+}
+
+static int getGenericCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.nullbulk)) == NULL){
+        return REDIS_OK;
+    }
+    if(o->type != REDIS_STRING){
+        addReply(c, shared.wrongtypeerr);
+        return REDIS_ERR;
+    }
+    addReplyBulk(c, o);
+    return REDIS_OK;
+}
+
+void getCommand(redisClient *c){
+    getGenericCommand(c);
+}
+
+void getsetCommand(redisClient *c){
+    if(getGenericCommand(c) == REDIS_ERR){
+        return;
+    }
+    c->argv[2] = tryObjectEncoding(c->argv[2]);
+    setKey(c->db, c->argv[1], c->argv[2]);
+}
+
+/**
+ * 按批查找，见lookupKeysBatch
+ */
+void mgetCommand(redisClient *c){
+    robj *vals[DICT_BATCH_SIZE];
+    addReplyMultiBulkLen(c, c->argc-1);
+    for(int base = 1; base < c->argc; base += DICT_BATCH_SIZE){
+        int n = c->argc - base < DICT_BATCH_SIZE ? c->argc - base : DICT_BATCH_SIZE;
+        lookupKeysBatch(c->db, c->argv + base, n, 1, vals);
+        for(int j = 0; j < n; j++){
+            robj *o = vals[j];
+            if(o == NULL || o->type != REDIS_STRING){
+                addReply(c, shared.nullbulk);
+            }else{
+                addReplyBulk(c, o);
+            }
+        }
+    }
+}
+
+/**
+ * MSET和MSETNX的通用实现，nx为1时只要有一个键存在就什么都不做
+ */
+static void msetGenericCommand(redisClient *c, int nx){
+    robj *vals[DICT_BATCH_SIZE];
+    int j, busykeys = 0, pairs = (c->argc - 1) / 2;
+
+    if((c->argc % 2) == 0){
+        addReplyError(c, "wrong number of arguments for MSET");
+        return;
+    }
+    //MSETNX按批检查键是否存在，见lookupKeysBatch；写入仍然逐个setKey
+    if(nx){
+        for(j = 0; j < pairs; j += DICT_BATCH_SIZE){
+            int n = pairs - j < DICT_BATCH_SIZE ? pairs - j : DICT_BATCH_SIZE;
+            lookupKeysBatch(c->db, c->argv + 1 + j*2, n, 2, vals);
+            for(int k = 0; k < n; k++){
+                if(vals[k]){
+                    busykeys++;
+                }
+            }
+        }
+        if(busykeys){
+            addReply(c, shared.czero);
+            return;
+        }
+    }
+    for(j = 1; j < c->argc; j += 2){
+        c->argv[j+1] = tryObjectEncoding(c->argv[j+1]);
+        setKey(c->db, c->argv[j], c->argv[j+1]);
+    }
+    addReply(c, nx ? shared.cone : shared.ok);
+}
+
+void msetCommand(redisClient *c){
+    msetGenericCommand(c, 0);
+}
+
+void msetnxCommand(redisClient *c){
+    msetGenericCommand(c, 1);
+}
+
+/**
+ * INCR、DECR、INCRBY、DECRBY的通用实现
+ */
+static void incrDecrCommand(redisClient *c, long long incr){
+    long long value, oldvalue;
+    robj *o = lookupKeyWrite(c->db, c->argv[1]), *new;
+
+    if(o != NULL && checkType(c, o, REDIS_STRING)){
+        return;
+    }
+    if(getLongLongFromObjectOrReply(c, o, &value, NULL) != REDIS_OK){
+        return;
+    }
+    oldvalue = value;
+    if((incr < 0 && oldvalue < 0 && incr < (LLONG_MIN-oldvalue)) ||
+        (incr > 0 && oldvalue > 0 && incr > (LLONG_MAX-oldvalue))){
+        addReplyError(c, "increment or decrement would overflow");
+        return;
+    }
+    value += incr;
+
+    //只被数据库引用的INT对象直接修改值，不用重新分配，共享整数范围内的值仍然使用共享对象
+    if(o && o->refcount == 1 && o->encoding == REDIS_ENCODING_INT &&
+        (value < 0 || value >= REDIS_SHARED_INTEGERS || server.maxmemory) &&
+        value >= LONG_MIN && value <= LONG_MAX){
+        o->ptr = (void*)((long)value);
+        addReplyLongLong(c, value);
+        return;
+    }
+    new = createStringObjectFromLongLong(value);
+    if(o){
+        dbOverwrite(c->db, c->argv[1], new);
+    }else{
+        dbAdd(c->db, c->argv[1], new);
+    }
+    addReplyLongLong(c, value);
+}
+
+void incrCommand(redisClient *c){
+    incrDecrCommand(c, 1);
+}
+
+void decrCommand(redisClient *c){
+    incrDecrCommand(c, -1);
+}
+
+void incrbyCommand(redisClient *c){
+    long long incr;
+    if(getLongLongFromObjectOrReply(c, c->argv[2], &incr, NULL) != REDIS_OK){
+        return;
+    }
+    incrDecrCommand(c, incr);
+}
+
+void decrbyCommand(redisClient *c){
+    long long incr;
+    if(getLongLongFromObjectOrReply(c, c->argv[2], &incr, NULL) != REDIS_OK){
+        return;
+    }
+    incrDecrCommand(c, -incr);
+}
+
+/**
+ * INCRBYFLOAT key increment
+ * 用long double计算，结果按最短的double表示保存成字符串
+ */
+void incrbyfloatCommand(redisClient *c){
+    long double incr, value;
+    robj *o, *new;
+
+    o = lookupKeyWrite(c->db, c->argv[1]);
+    if(o != NULL && checkType(c, o, REDIS_STRING)){
+        return;
+    }
+    if(getLongDoubleFromObjectOrReply(c, o, &value, NULL) != REDIS_OK ||
+        getLongDoubleFromObjectOrReply(c, c->argv[2], &incr, NULL) != REDIS_OK){
+        return;
+    }
+    value += incr;
+    //超出double范围的结果之后无法再转换，同样拒绝
+    if(isnan(value) || isinf(value) || isinf((double)value)){
+        addReplyError(c, "increment would produce NaN or Infinity");
+        return;
+    }
+    new = createStringObjectFromLongDouble(value);
+    if(o){
+        dbOverwrite(c->db, c->argv[1], new);
+    }else{
+        dbAdd(c->db, c->argv[1], new);
+    }
+    addReplyBulk(c, new);
+}
+
+void appendCommand(redisClient *c){
+    size_t totlen;
+    robj *o, *append;
+
+    o = lookupKeyWrite(c->db, c->argv[1]);
+    if(o == NULL){
+        //键不存在时等同于SET，getDecodedObject返回的引用直接交给键空间，argv[2]不变
+        robj *dec = getDecodedObject(c->argv[2]);
+        dbAdd(c->db, c->argv[1], dec);
+        totlen = stringObjectLen(dec);
+    }else{
+        if(checkType(c, o, REDIS_STRING)){
+            return;
+        }
+        append = c->argv[2];
+        totlen = stringObjectLen(o) + stringObjectLen(append);
+        if(checkStringLength(c, totlen) != REDIS_OK){
+            return;
+        }
+        //值被共享或者不是RAW编码时，先复制一份再原地追加
+        if(o->refcount != 1 || o->encoding != REDIS_ENCODING_RAW){
+            robj *decoded = getDecodedObject(o);
+            o = createRawStringObject(decoded->ptr, sdslen(decoded->ptr));
+            decrRefCount(decoded);
+            dbOverwrite(c->db, c->argv[1], o);
+        }
+        append = getDecodedObject(append);
+        o->ptr = sdscatlen(o->ptr, append->ptr, sdslen(append->ptr));
+        decrRefCount(append);
+        totlen = sdslen(o->ptr);
+    }
+    addReplyLongLong(c, totlen);
+}
+
+void strlenCommand(redisClient *c){
+    robj *o;
+    if((o = lookupKeyReadOrReply(c, c->argv[1], shared.czero)) == NULL ||
+        checkType(c, o, REDIS_STRING)){
+        return;
+    }
+    addReplyLongLong(c, stringObjectLen(o));
+}
@@ -1,8 +1,29 @@
 #ifndef __REDIS_UTIL_H__
 #define __REDIS_UTIL_H__
 
+#include <stdint.h>
 #include "sds.h"
 
+/* The maximum number of characters needed to represent a long double
+ * as a string (long double has a huge range).
+ * This should be the size of the buffer given to ld2string */
+#define MAX_LONG_DOUBLE_CHARS 5*1024
+
+/* Bytes needed for double -> str + '\0', see d2string() */
+#define MAX_D2STRING_CHARS 128
+
+/* Bytes needed for long -> str + '\0' */
+#define LONG_STR_SIZE 21
+
 sds getAbsolutePath(char *filename);
 long long memtoll(const char *p, int *err);
+uint32_t digits10(uint64_t v);
+int ll2string(char *s, size_t len, long long value);
+int ull2string(char *s, size_t len, unsigned long long value);
+int string2ll(const char *s, size_t slen, long long *value);
+int string2l(const char *s, size_t slen, long *value);
+int string2ld(const char *s, size_t slen, long double *dp);
+int d2string(char *buf, size_t len, double value);
+int stringmatchlen(const char *p, int plen, const char *s, int slen, int nocase);
+int stringmatch(const char *p, const char *s, int nocase);
 #endif // !__REDIS_UTIL_H___
@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "zmalloc.h"
+
+#ifdef HAVE_MALLOC_SIZE
+#define PREFIX_SIZE (0)
+#else
+//没有办法查询分配块的大小，在每块内存的前面记录申请的大小
+#define PREFIX_SIZE (sizeof(size_t))
+#endif
+
+#if defined(USE_JEMALLOC)
+#define malloc(size) je_malloc(size)
+#define calloc(count,size) je_calloc(count,size)
+#define realloc(ptr,size) je_realloc(ptr,size)
+#define free(ptr) je_free(ptr)
+#endif
+
+/**
+ * 已使用内存的统计
+ * 每个线程第一次分配内存时领取一个自己的计数器，之后只有这个线程会写它，
+ * 不需要原子的加减，也不会和其他线程争抢同一个缓存行；读取时把所有线程的计数器加起来
+ * 一个线程释放另一个线程分配的内存时，它的计数器会变成负数，加起来的结果仍然是准确的
+ * 超出ZMALLOC_MAX_THREADS的线程共用最后一个计数器，用原子操作修改
+ */
+#define ZMALLOC_MAX_THREADS 128
+
+typedef struct zmallocCounter{
+    long long used;
+    char padding[64 - sizeof(long long)];   //每个计数器独占一个缓存行
+}__attribute__((aligned(64))) zmallocCounter;
+
+static zmallocCounter used_memory_thread[ZMALLOC_MAX_THREADS];
+static int zmalloc_threads_num = 0;
+static __thread int zmalloc_thread_index = -1;
+
+static inline zmallocCounter *zmallocThreadCounter(void){
+    if(zmalloc_thread_index == -1){
+        int idx = __atomic_fetch_add(&zmalloc_threads_num, 1, __ATOMIC_RELAXED);
+        zmalloc_thread_index = idx < ZMALLOC_MAX_THREADS ? idx : ZMALLOC_MAX_THREADS - 1;
+    }
+    return &used_memory_thread[zmalloc_thread_index];
+}
+
+static inline void update_zmalloc_stat(long long delta){
+    zmallocCounter *c = zmallocThreadCounter();
+    if(zmalloc_thread_index == ZMALLOC_MAX_THREADS - 1){
+        __atomic_add_fetch(&c->used, delta, __ATOMIC_RELAXED);
+    }else{
+        //只有本线程写，其他线程读到的是旧值或者新值，不会是半个值
+        __atomic_store_n(&c->used, c->used + delta, __ATOMIC_RELAXED);
+    }
+}
+
+static void zmalloc_default_oom(size_t size){
+    fprintf(stderr, "zmalloc: Out of memory trying to allocate %zu bytes\n", size);
+    fflush(stderr);
+    abort();
+}
+
+static void (*zmalloc_oom_handler)(size_t) = zmalloc_default_oom;
+
+void *zmalloc_usable(size_t size, size_t *usable){
+    void *ptr = malloc(size + PREFIX_SIZE);
+
+    if(!ptr){
+        zmalloc_oom_handler(size);
+    }
+#ifdef HAVE_MALLOC_SIZE
+    size = zmalloc_size(ptr);
+    update_zmalloc_stat(size);
+#else
+    *((size_t*)ptr) = size;
+    update_zmalloc_stat(size + PREFIX_SIZE);
+    ptr = (char*)ptr + PREFIX_SIZE;
+#endif
+    if(usable){
+        *usable = size;
+    }
+    return ptr;
+}
+
+void *zmalloc(size_t size){
+    return zmalloc_usable(size, NULL);
+}
+
+void *zcalloc(size_t size){
+    void *ptr = calloc(1, size + PREFIX_SIZE);
+
+    if(!ptr){
+        zmalloc_oom_handler(size);
+    }
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat(zmalloc_size(ptr));
+    return ptr;
+#else
+    *((size_t*)ptr) = size;
+    update_zmalloc_stat(size + PREFIX_SIZE);
+    return (char*)ptr + PREFIX_SIZE;
+#endif
+}
+
+void *zrealloc_usable(void *ptr, size_t size, size_t *usable){
+#ifndef HAVE_MALLOC_SIZE
+    void *realptr;
+#endif
+    size_t oldsize;
+    void *newptr;
+
+    if(ptr == NULL){
+        return zmalloc_usable(size, usable);
+    }
+#ifdef HAVE_MALLOC_SIZE
+    oldsize = zmalloc_size(ptr);
+    newptr = realloc(ptr, size);
+    if(!newptr){
+        zmalloc_oom_handler(size);
+    }
+    size = zmalloc_size(newptr);
+    update_zmalloc_stat((long long)size - (long long)oldsize);
+#else
+    realptr = (char*)ptr - PREFIX_SIZE;
+    oldsize = *((size_t*)realptr);
+    newptr = realloc(realptr, size + PREFIX_SIZE);
+    if(!newptr){
+        zmalloc_oom_handler(size);
+    }
+    *((size_t*)newptr) = size;
+    update_zmalloc_stat((long long)size - (long long)oldsize);
+    newptr = (char*)newptr + PREFIX_SIZE;
+#endif
+    if(usable){
+        *usable = size;
+    }
+    return newptr;
+}
+
+void *zrealloc(void *ptr, size_t size){
+    return zrealloc_usable(ptr, size, NULL);
+}
+
+#ifndef HAVE_MALLOC_SIZE
+/**
+ * 前缀中记录的是申请的大小，实际分配的内存按字长对齐
+ */
+size_t zmalloc_size(void *ptr){
+    void *realptr = (char*)ptr - PREFIX_SIZE;
+    size_t size = *((size_t*)realptr);
+    if(size & (sizeof(long) - 1)){
+        size += sizeof(long) - (size & (sizeof(long) - 1));
+    }
+    return size + PREFIX_SIZE;
+}
+#endif
+
+void zfree(void *ptr){
+    if(ptr == NULL){
+        return;
+    }
+#ifdef HAVE_MALLOC_SIZE
+    update_zmalloc_stat(-(long long)zmalloc_size(ptr));
+    free(ptr);
+#else
+    void *realptr = (char*)ptr - PREFIX_SIZE;
+    update_zmalloc_stat(-(long long)(*((size_t*)realptr) + PREFIX_SIZE));
+    free(realptr);
+#endif
+}
+
+char *zstrdup(const char *s){
+    size_t l = strlen(s) + 1;
+    char *p = zmalloc(l);
+    memcpy(p, s, l);
+    return p;
+}
+
+/**
+ * 所有线程的计数器之和，不加锁，其他线程正在分配时会差几次分配的大小
+ */
+size_t zmalloc_used_memory(void){
+    long long um = 0;
+    int n = __atomic_load_n(&zmalloc_threads_num, __ATOMIC_RELAXED);
+    if(n > ZMALLOC_MAX_THREADS){
+        n = ZMALLOC_MAX_THREADS;
+    }
+    for(int j = 0; j < n; j++){
+        um += __atomic_load_n(&used_memory_thread[j].used, __ATOMIC_RELAXED);
+    }
+    return um < 0 ? 0 : (size_t)um;
+}
+
+/**
+ * 当前线程的计数器：这个线程分配的减去这个线程释放的，可能是负数
+ * 两次读取之差就是这段时间内这个线程自己分配和释放的内存，不受其他线程影响
+ * （超出ZMALLOC_MAX_THREADS的线程共用一个计数器，这时只是近似值）
+ */
+long long zmalloc_thread_used_memory(void){
+    return __atomic_load_n(&zmallocThreadCounter()->used, __ATOMIC_RELAXED);
+}
+
+void zmalloc_set_oom_handler(void (*oom_handler)(size_t)){
+    zmalloc_oom_handler = oom_handler;
+}
+
+#if defined(__linux__)
+/**
+ * 从/proc/self/statm读取常驻内存，第二个字段是常驻的页数
+ * 只需要一次open和read，可以在serverCron中频繁调用
+ */
+size_t zmalloc_get_rss(void){
+    int page = sysconf(_SC_PAGESIZE);
+    char buf[256];
+    int fd, count;
+    char *p;
+
+    if((fd = open("/proc/self/statm", O_RDONLY)) == -1){
+        return 0;
+    }
+    count = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(count <= 0){
+        return 0;
+    }
+    buf[count] = '\0';
+
+    //跳过第一个字段（总的虚拟内存页数）
+    p = strchr(buf, ' ');
+    if(p == NULL){
+        return 0;
+    }
+    return strtoull(p + 1, NULL, 10) * page;
+}
+#else
+/**
+ * 不支持的平台上用已使用内存代替，碎片率总是1
+ */
+size_t zmalloc_get_rss(void){
+    return zmalloc_used_memory();
+}
+#endif
+
+/**
+ * 碎片率：常驻内存和已使用内存的比值
+ * 大于1说明分配器里有没有还给系统的空闲内存，小于1说明有内存被换出
+ */
+float zmalloc_get_fragmentation_ratio(size_t rss){
+    size_t used = zmalloc_used_memory();
+    return used ? (float)rss / used : 0;
+}
@@ -0,0 +1,61 @@
+#ifndef __ZMALLOC_H__
+#define __ZMALLOC_H__
+
+#include <stddef.h>
+
+/**
+ * 内存分配的封装层，所有模块都通过它分配内存，以便精确统计used_memory
+ * 默认使用libc的malloc，定义USE_JEMALLOC时使用jemalloc（带je_前缀编译，和redis相同）
+ * 能查询分配块实际大小的分配器（jemalloc、glibc、macOS）统计的是实际占用的大小，
+ * 也就是按分配器的大小等级取整之后的大小；其他平台在每块内存前面加一个记录大小的前缀
+ */
+
+#define __xstr(s) __str(s)
+#define __str(s) #s
+
+#if defined(USE_JEMALLOC)
+#include <jemalloc/jemalloc.h>
+#define ZMALLOC_LIB ("jemalloc-" __xstr(JEMALLOC_VERSION_MAJOR) "." __xstr(JEMALLOC_VERSION_MINOR) "." __xstr(JEMALLOC_VERSION_BUGFIX))
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) je_malloc_usable_size(p)
+
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define ZMALLOC_LIB "libc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_size(p)
+
+#elif defined(__linux__)
+#include <malloc.h>
+#define ZMALLOC_LIB "libc"
+#define HAVE_MALLOC_SIZE 1
+#define zmalloc_size(p) malloc_usable_size(p)
+#endif
+
+#ifndef ZMALLOC_LIB
+#define ZMALLOC_LIB "libc"
+#endif
+
+void *zmalloc(size_t size);
+void *zcalloc(size_t size);
+void *zrealloc(void *ptr, size_t size);
+void zfree(void *ptr);
+char *zstrdup(const char *s);
+
+/**
+ * 和上面的函数相同，另外通过usable返回实际可以使用的大小，可能比申请的大
+ */
+void *zmalloc_usable(size_t size, size_t *usable);
+void *zrealloc_usable(void *ptr, size_t size, size_t *usable);
+
+size_t zmalloc_used_memory(void);
+long long zmalloc_thread_used_memory(void);
+void zmalloc_set_oom_handler(void (*oom_handler)(size_t));
+size_t zmalloc_get_rss(void);
+float zmalloc_get_fragmentation_ratio(size_t rss);
+
+#ifndef HAVE_MALLOC_SIZE
+size_t zmalloc_size(void *ptr);
+#endif
+
+#endif // !__ZMALLOC_H__